@@ -0,0 +1,164 @@
+#pragma once
+#include <cppgit2/attribute.hpp>
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/string_view.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <git2.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cppgit2 {
+
+// Compiled gitattributes rules for answering many paths at once
+//
+// repository::lookup_attribute goes through libgit2's attribute stack for
+// every path. An attribute_matcher reads every attributes file once: the
+// .gitattributes files of the working directory (found through the index)
+// or of a tree, $GIT_DIR/info/attributes, core.attributesFile and the
+// system file. Each file becomes a frame of rules indexed by the directory
+// it applies to; within a frame, literal names and "*.ext" patterns are
+// found by hashing the file name, so only wildcard patterns are tried one
+// by one. Precedence and macros ([attr]binary, ...) follow git.
+//
+// Lookups never touch libgit2 and can run on any number of threads. For
+// batches, neighbouring paths share the work of finding their frames, so
+// paths sorted as in the index are cheapest.
+//
+// Untracked .gitattributes files below the top level are not seen, nor
+// are macros added with repository::add_attributes_macro. Patterns ending
+// in '/' only match directories and are dropped, as paths are taken to be
+// files.
+class attribute_matcher : public libgit2_api {
+public:
+  struct value {
+    attribute::attribute_value state;
+    // For attribute_value::string; valid while the matcher lives
+    string_view text;
+  };
+
+  // Read the attributes files of the working directory and the index of
+  // `repo` in the order `flags` gives (file_then_index, index_then_file
+  // or index_only; a bare repository only has the index). Batches are
+  // answered by `num_threads` workers (0 = one per hardware thread)
+  explicit attribute_matcher(
+      const repository &repo,
+      attribute::flag flags = attribute::flag::file_then_index,
+      size_t num_threads = 0);
+
+  // Read the .gitattributes files of the tree (or commit) `treeish`
+  // instead, without checking it out
+  attribute_matcher(const repository &repo, const oid &treeish,
+                    attribute::flag flags = attribute::flag::file_then_index,
+                    size_t num_threads = 0);
+
+  // Number of attributes files read
+  size_t file_count() const { return frames_.size(); }
+
+  // Values of `names` for `path` (relative to the repository root), in
+  // the order of `names`
+  std::vector<value> lookup(string_view path,
+                            const std::vector<std::string> &names) const;
+
+  // Values of `names` for every path: the value of names[j] for paths[i]
+  // is at [i * names.size() + j]. The batch is split across the workers
+  std::vector<value> lookup(const std::vector<std::string> &paths,
+                            const std::vector<std::string> &names);
+
+private:
+  enum class pattern_kind : uint8_t {
+    name,          // literal file name
+    suffix,        // '*' then a literal
+    basename_glob, // wildcards, no '/': matched against the file name
+    path_glob      // matched against the path below the frame's directory
+  };
+
+  struct assignment {
+    uint32_t attr;
+    attribute::attribute_value state;
+    uint32_t text_offset; // in strings_
+    uint32_t text_length;
+  };
+
+  struct rule {
+    uint32_t pattern_offset; // in strings_, folded with core.ignorecase
+    uint32_t pattern_length;
+    pattern_kind kind;
+    uint32_t first; // in assignments_
+    uint32_t count;
+  };
+
+  struct frame {
+    std::string directory; // "" or ending in '/'
+    std::vector<rule> rules;
+    // Rule indexes, ascending
+    std::unordered_map<std::string, std::vector<uint32_t>> by_name;
+    std::unordered_map<std::string, std::vector<uint32_t>> by_extension;
+    std::vector<uint32_t> others;
+  };
+
+  struct macro {
+    bool defined;
+    uint32_t first; // in assignments_
+    uint32_t count;
+  };
+
+  // Attributes a lookup has to follow: those asked for and the macros
+  // that set them
+  struct query {
+    std::vector<int32_t> slot_of; // by attribute id, -1 if not followed
+    std::vector<int32_t> asked;   // slot of each name, -1 if never set
+    size_t slots;
+  };
+
+  // One lookup's state; reused from path to path
+  struct scratch {
+    std::vector<value> values;
+    std::vector<bool> known;
+    std::vector<uint32_t> candidates;
+    std::string directory;              // of the last path
+    std::vector<const frame *> frames; // for it, highest precedence first
+    std::string folded;
+    std::string key;
+    bool has_directory;
+  };
+
+  struct source_file {
+    std::string directory;
+    bool top_level; // may define macros
+    std::string path; // on disk, "" if none
+    oid blob;         // fallback or only source
+    bool has_blob;
+    std::string content;
+  };
+
+  void load(const repository &repo, std::vector<source_file> &files,
+            attribute::flag flags);
+  frame parse(const source_file &file);
+  uint32_t intern(string_view name);
+  query compile(const std::vector<std::string> &names) const;
+  void lookup(string_view path, const query &q, scratch &s,
+              value *out) const;
+  void frames_for(string_view directory, scratch &s) const;
+  bool fill(uint32_t first, uint32_t count, const query &q, scratch &s,
+            size_t &remaining) const;
+  bool matches(const frame &f, const rule &r, string_view path,
+               string_view basename) const;
+
+  thread_pool pool_;
+  bool ignore_case_;
+  std::string strings_; // patterns and values
+  std::vector<assignment> assignments_;
+  std::vector<std::string> attribute_names_;
+  std::unordered_map<std::string, uint32_t> attribute_ids_;
+  std::vector<macro> macros_; // by attribute id
+  std::vector<frame> frames_;
+  std::unordered_map<std::string, size_t> directory_frames_; // .gitattributes
+  std::vector<size_t> first_frames_; // info/attributes
+  std::vector<size_t> last_frames_;  // core.attributesFile, then system
+};
+
+} // namespace cppgit2
@@ -4,7 +4,9 @@
 #include <cppgit2/oid.hpp>
 #include <cppgit2/ownership.hpp>
 #include <cppgit2/signature.hpp>
+#include <deque>
 #include <git2.h>
+#include <string>
 
 namespace cppgit2 {
 
@@ -180,10 +182,80 @@ public:
     // 1 iff the hunk has been tracked to a boundary commit
     char boundary() const { return c_ptr_->boundary; }
 
+    // Access libgit2 C ptr
+    const git_blame_hunk *c_ptr() const { return c_ptr_; }
+
   private:
     const git_blame_hunk *c_ptr_;
   };
 
+  // Owned copy of the hunks of a blamed file
+  //
+  // A hunk list does not reference any libgit2 blame state, so it can outlive
+  // the blame it was copied from, be copied around and be assembled from
+  // several blame runs. Hunks returned by a hunk list point into the list and
+  // are valid until the list is modified or destroyed.
+  class hunk_list : public libgit2_api {
+  public:
+    // Construct an empty hunk list
+    hunk_list() {}
+
+    // Copy all the hunks of a blame
+    hunk_list(const blame &source);
+
+    // Append a hunk, taking its commits, signatures and path from `source`.
+    // The hunk starts right after the last line of the list; lines that
+    // continue the previous hunk are merged into it.
+    void append(const hunk &source, size_t orig_start_line_number,
+                size_t lines_in_hunk);
+
+    // Append a copy of `source`, starting right after the last line
+    void append(const hunk &source);
+
+    // Append a hunk whose final and original commit are both `commit_id`
+    void append(size_t lines_in_hunk, const oid &commit_id,
+                const signature &author, const std::string &orig_path,
+                size_t orig_start_line_number, bool boundary);
+
+    // Gets the hunk at the given index.
+    hunk hunk_by_index(size_t index) const;
+
+    // Gets the hunk that relates to the given (1-based) line number.
+    // Throws git_exception if the line is out of range.
+    hunk hunk_by_line(size_t lineno) const;
+
+    // Number of hunks in the list
+    size_t hunk_count() const { return records_.size(); }
+
+    // Number of lines covered by the hunks
+    size_t line_count() const;
+
+    // Remove all hunks
+    void clear() { records_.clear(); }
+
+  private:
+    // A git_blame_hunk together with the strings it points to
+    struct record {
+      record(const git_blame_hunk &source);
+      record(const record &other);
+      record &operator=(const record &other);
+
+      // Point the C struct at the strings owned by this record
+      void bind();
+
+      git_blame_hunk c_struct;
+      git_signature final_signature, orig_signature;
+      std::string orig_path, final_name, final_email, orig_name, orig_email;
+      bool has_final_signature, has_orig_signature;
+    };
+
+    void push(const record &next);
+
+    // std::deque never relocates its elements on push_back, so the pointers
+    // set up by record::bind() remain valid
+    std::deque<record> records_;
+  };
+
   // Gets the blame hunk at the given index.
   hunk hunk_by_index(uint32_t index) const;
 
@@ -198,6 +270,7 @@ public:
   const git_blame *c_ptr() const;
 
 private:
+  friend class blame_cache;
   friend class repository;
   git_blame *c_ptr_;
   ownership owner_;
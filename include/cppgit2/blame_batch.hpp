@@ -0,0 +1,49 @@
+#pragma once
+#include <cppgit2/blame.hpp>
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/repository.hpp>
+#include <git2.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Blame of many files in a single pass over history
+//
+// repository::blame_file walks history once per file. A blame batch walks
+// the commit graph once for all of its paths: every commit is diffed against
+// its parents a single time, restricted to the paths that still have
+// unattributed lines, and the line-level diffs of the files that changed are
+// spread over a pool of worker threads.
+//
+// Lines are attributed like `git blame` without -M/-C: a file is followed
+// through whole-file renames, but lines are not traced across files. The
+// track_copies_* flags and the min_line/max_line options are ignored.
+// first_parent, use_mailmap, newest_commit and oldest_commit are honored.
+class blame_batch : public libgit2_api {
+public:
+  // Prepare a batch over `repo`, which must outlive the batch
+  blame_batch(const repository &repo,
+              const blame::options &options = blame::options());
+
+  // Add a file to blame (path relative to the repository root)
+  void add_path(const std::string &path);
+
+  // Add several files to blame
+  void add_paths(const std::vector<std::string> &paths);
+
+  // Blame every added file
+  // Line attribution runs on `num_threads` workers, each with its own
+  // repository handle (0 = one per hardware thread). Throws git_exception
+  // if a path does not exist in the newest commit.
+  std::map<std::string, blame::hunk_list> run(size_t num_threads = 0);
+
+private:
+  const repository &repo_;
+  git_blame_options options_;
+  std::vector<std::string> paths_;
+};
+
+} // namespace cppgit2
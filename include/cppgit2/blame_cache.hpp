@@ -0,0 +1,115 @@
+#pragma once
+#include <cppgit2/blame.hpp>
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <git2.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Cache of file blames, keyed by (path, commit)
+//
+// When a file is blamed at a commit that descends from a commit already in
+// the cache, only the commits in between are walked. Lines that libgit2
+// traces back to the cached commit are taken from the cached blame instead of
+// being followed further into history, so blaming a hot file after HEAD moves
+// costs roughly O(new commits). This is only done when no merge lies between
+// the two commits; otherwise the file is blamed from scratch.
+//
+// The cache can be saved to and loaded from disk.
+class blame_cache : public libgit2_api {
+public:
+  // Create an empty cache that blames files in `repo`
+  // `repo` must outlive the cache. The newest/oldest commit and line range
+  // fields of `options` are ignored: the cache always blames whole files.
+  // At most `max_commits_per_path` blames are kept for each path.
+  blame_cache(const repository &repo,
+              const blame::options &options = blame::options(),
+              size_t max_commits_per_path = 8);
+
+  // Counters describing how blames were answered
+  struct statistics {
+    size_t hits;        // Returned straight from the cache
+    size_t incremental; // Only walked commits newer than a cached commit
+    size_t full;        // Blamed from scratch
+  };
+
+  // Blame `path` as of HEAD
+  const blame::hunk_list &blame_file(const std::string &path);
+
+  // Blame `path` as of `commit_id`
+  // The returned list is owned by the cache. It stays valid until the entry
+  // is evicted, either explicitly or because more than
+  // `max_commits_per_path` commits were blamed for the same path.
+  const blame::hunk_list &blame_file(const std::string &path,
+                                     const oid &commit_id);
+
+  // Check if a blame of `path` at `commit_id` is cached
+  bool contains(const std::string &path, const oid &commit_id) const;
+
+  // Drop all cached blames of `path`
+  void evict(const std::string &path);
+
+  // Drop all cached blames
+  void clear();
+
+  // Number of cached (path, commit) blames
+  size_t size() const;
+
+  // Counters since construction (or the last call to clear())
+  statistics stats() const { return stats_; }
+
+  // Write the cache to `path`
+  // The file is written next to its final location and then renamed, so
+  // readers never see a partially written cache.
+  void save(const std::string &path) const;
+
+  // Load blames saved with save(), in addition to the ones already cached
+  void load(const std::string &path);
+
+private:
+  struct path_entry {
+    // Blames by commit hex id
+    std::map<std::string, blame::hunk_list> blames;
+    // Commit hex ids, oldest insertion first
+    std::vector<std::string> order;
+  };
+
+  void insert(const std::string &path, const std::string &commit_hex,
+              blame::hunk_list &&hunks);
+
+  // Cached commit of `entry` that is the closest ancestor of `commit_id`
+  // Returns an empty string if there is none.
+  std::string closest_ancestor(const path_entry &entry,
+                               const oid &commit_id) const;
+
+  // Whether `base_id` is reached from `commit_id` through commits that each
+  // have a single parent
+  // A merge in between may bring in a side branch that forked before the
+  // base, whose lines the cached blame knows nothing about.
+  bool is_linear_extension(const oid &commit_id, const oid &base_id) const;
+
+  // Blame `path` at `commit_id`, reusing the blame of an ancestor commit
+  // Returns false if the cached blame cannot be reused (e.g. the file was
+  // renamed in between, or a merge lies between the two commits), in which
+  // case `result` is left unspecified.
+  bool blame_incremental(const std::string &path, const oid &commit_id,
+                         const std::string &base_hex,
+                         const blame::hunk_list &base,
+                         blame::hunk_list &result) const;
+
+  blame::hunk_list blame_full(const std::string &path,
+                              const oid &commit_id) const;
+
+  git_repository *repo_;
+  git_blame_options options_;
+  size_t max_commits_per_path_;
+  std::map<std::string, path_entry> entries_;
+  statistics stats_;
+};
+
+} // namespace cppgit2
@@ -0,0 +1,69 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/object.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <git2.h>
+#include <memory>
+#include <string>
+
+namespace cppgit2 {
+
+struct bulk_write_backend;
+
+// Routes the object writes of a repository into a single new pack
+//
+// While the session is open, a backend of the highest priority sits in
+// front of the repository's object database: every write through it
+// (odb::write, create_blob_from_buffer, tree builders, commits, ...) is
+// compressed on the calling thread and appended to one pack with
+// pack_writer, instead of becoming a loose object, and objects already in
+// the database are not written again. The same backend serves reads, so
+// the new objects can be looked up before the pack is complete, by full or
+// abbreviated id, as with git fast-import.
+//
+// close() writes the pack index and moves the pack into objects/pack.
+// Other handles on the repository (see repository::reopen) see neither
+// the writes nor the new objects before then. A session destroyed without
+// close() discards everything written through it. libgit2 cannot remove a
+// backend: the first session on a repository handle adds it, later ones
+// reuse it, and between sessions it passes everything on. One session at
+// a time can be open on a handle.
+class bulk_write_session : public libgit2_api {
+public:
+  // Start a session on the object database of `repo`, which must outlive
+  // the session; throws if `repo` already has an open session
+  // `compression_level` is a zlib level, -1 for zlib's default.
+  explicit bulk_write_session(const repository &repo,
+                              int compression_level = -1);
+
+  // Discard the pack unless close() has run
+  ~bulk_write_session();
+
+  bulk_write_session(const bulk_write_session &) = delete;
+  bulk_write_session &operator=(const bulk_write_session &) = delete;
+
+  // Write an object, as odb::write does
+  oid write(const void *data, size_t length,
+            cppgit2::object::object_type type);
+
+  // Number of objects written in this session
+  size_t size() const;
+
+  // Whether the session is still open
+  bool is_open() const;
+
+  // Finish the pack and its index; writes go back to loose objects
+  // Returns the name of the pack (the zero id if nothing was written).
+  oid close();
+
+private:
+  friend struct bulk_write_backend;
+  struct state;
+
+  std::shared_ptr<state> state_;
+  git_odb *odb_;
+};
+
+} // namespace cppgit2
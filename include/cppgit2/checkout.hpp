@@ -83,6 +83,10 @@ public:
     // Normally checkout writes the index upon completion; this prevents that.
     dont_write_index = (1u << 23),
 
+    // Report (through notifications) what would be done, without changing
+    // the working directory or the index
+    dry_run = (1u << 24),
+
     // THE FOLLOWING OPTIONS ARE NOT YET IMPLEMENTED
     // as of date: 2020.01.06
 
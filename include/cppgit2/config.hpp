@@ -1,4 +1,5 @@
 #pragma once
+#include <cppgit2/config_view.hpp>
 #include <cppgit2/data_buffer.hpp>
 #include <cppgit2/git_exception.hpp>
 #include <cppgit2/libgit2_api.hpp>
@@ -173,6 +174,10 @@ public:
   // Create a snapshot of the configuration
   config snapshot();
 
+  // Freeze the configuration into a hashed, read-only view that threads
+  // can share
+  config_view frozen_snapshot() const;
+
   size_t size() const;
 
   // Perform an operation on each config variable
@@ -0,0 +1,136 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/string_view.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <git2.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+class config;
+class repository;
+
+// Frozen, hashed view of a configuration
+//
+// config's getters go through libgit2's backends on every call and return
+// newly allocated strings. A config_view copies every variable once into a
+// single buffer, with booleans and integers parsed up front, and indexes
+// the names in an open-addressing hash table: getters are a hash and a
+// probe, and return string_views into the view. Names are matched as git
+// does, with section and key case-insensitive. For a multivar the getters
+// see the value with the highest priority (the last one read), values()
+// sees all.
+//
+// A view never changes once built, so threads can share one (e.g. through
+// config_view_cache) without locking. A view of a repository's
+// configuration records the size and modification time of the files it
+// was read from; is_current() compares them with the files on disk.
+// Included files (include.path) are read but not watched.
+class config_view {
+public:
+  // Freeze the variables of `cfg`; nothing is watched, so is_current()
+  // is always true
+  explicit config_view(const config &cfg);
+
+  // Read the system, XDG, global and local configuration files of `repo`
+  // (the ones libgit2 loads), watching them
+  explicit config_view(const repository &repo);
+
+  // Number of distinct variable names
+  size_t size() const { return groups_.size(); }
+
+  bool contains(string_view name) const { return find(name) != nullptr; }
+
+  // Getters; throw git_exception if `name` is not set, or does not parse
+  string_view value_as_string(string_view name) const;
+  bool value_as_bool(string_view name) const;
+  int32_t value_as_int32(string_view name) const;
+  int64_t value_as_int64(string_view name) const;
+
+  // Getters returning `fallback` when `name` is not set (but still
+  // throwing if its value does not parse)
+  string_view value_as_string(string_view name, string_view fallback) const;
+  bool value_as_bool(string_view name, bool fallback) const;
+  int32_t value_as_int32(string_view name, int32_t fallback) const;
+  int64_t value_as_int64(string_view name, int64_t fallback) const;
+
+  // Every value of a multivar, lowest priority first
+  std::vector<string_view> values(string_view name) const;
+
+  // Whether the watched files still have the size and modification time
+  // they had when the view was built
+  bool is_current() const;
+
+  // Read the watched files again into a new view
+  config_view reload() const;
+
+private:
+  struct watched_file {
+    std::string path;
+    git_config_level_t level;
+    bool exists;
+    int64_t size;
+    int64_t mtime_seconds;
+    int64_t mtime_nanoseconds;
+  };
+
+  struct value {
+    uint32_t offset; // in buffer_
+    uint32_t length;
+    bool is_set;     // false for "[section] key" without '='
+    bool is_bool;    // parses as a boolean
+    bool bool_value;
+    bool is_int;     // parses as an integer (with k/m/g suffix)
+    int64_t int_value;
+  };
+
+  struct group {
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t first; // in values_
+    uint32_t count;
+  };
+
+  explicit config_view(std::vector<watched_file> files);
+  static std::vector<watched_file> repository_files(const repository &repo);
+  void build(const git_config *cfg);
+  const value *find(string_view name) const;
+  const group *find_group(string_view name) const;
+  static watched_file stat_file(const std::string &path,
+                                git_config_level_t level);
+
+  std::string buffer_; // names and values
+  std::vector<value> values_;
+  std::vector<group> groups_;
+  std::vector<uint32_t> slots_; // group index + 1, 0 when empty
+  std::vector<watched_file> files_;
+};
+
+// Shares the current config_view of a repository between threads
+//
+// get() is lock-free: an atomic load of the current view. At most once per
+// `check_interval` one caller also checks that the files are unchanged,
+// and builds and publishes a new view if not; views handed out earlier
+// stay valid for as long as they are held.
+class config_view_cache {
+public:
+  explicit config_view_cache(
+      const repository &repo,
+      std::chrono::milliseconds check_interval = std::chrono::milliseconds(1000));
+
+  config_view_cache(const config_view_cache &) = delete;
+  config_view_cache &operator=(const config_view_cache &) = delete;
+
+  std::shared_ptr<const config_view> get();
+
+private:
+  std::shared_ptr<const config_view> view_; // through std::atomic_load/store
+  std::chrono::milliseconds interval_;
+  std::atomic<int64_t> next_check_; // steady_clock milliseconds
+};
+
+} // namespace cppgit2
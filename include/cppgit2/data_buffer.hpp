@@ -13,7 +13,7 @@ public:
   // Default construct a data buffer using GIT_BUF_INIT
   data_buffer();
 
-  // Construct buffer from libgit2 C ptr
+  // Construct buffer from libgit2 C ptr (empty if `c_ptr` is null)
   data_buffer(const git_buf *c_ptr);
 
   // Dispose internal buffer
@@ -309,6 +309,7 @@ public:
 
   private:
     friend diff;
+    friend class sparse_checkout;
     git_diff_options *c_ptr_;
     git_diff_options default_options_;
   };
@@ -0,0 +1,102 @@
+#pragma once
+#include <cppgit2/commit.hpp>
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cstdint>
+#include <functional>
+#include <git2.h>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cppgit2 {
+
+// Exporter writing a `git fast-export` stream
+//
+// Each pushed reference is exported in turn: its commits that were not
+// exported before (through an earlier reference or imported marks) and are
+// not hidden are walked with a revwalk, oldest first, and every commit is
+// written as the diff of its tree against that of its first parent
+// (repository::create_diff_tree_to_tree), preceded by the blobs it
+// introduces. Blobs and commits get marks, which also keep any blob from
+// being written twice. A reference whose commits were all written already
+// becomes a `reset`, and an annotated tag under refs/tags a `tag` command.
+//
+// Output goes to the sink through a small buffer, and blob contents are
+// handed over straight from the object database, so memory use does not
+// grow with the size of the history beyond one mark per object.
+//
+// As with git fast-export, commit signatures and extra headers are not
+// exported (so such commits get new ids on import); tags of tags are
+// exported as tags of the object they peel to, and tags of trees and
+// lightweight tags of blobs are skipped.
+class fast_export : public libgit2_api {
+public:
+  // Receives the stream, in pieces
+  typedef std::function<void(const char *data, size_t size)> sink;
+
+  struct statistics {
+    size_t blobs;
+    size_t commits;
+    size_t tags;
+    size_t resets;
+    std::vector<std::string> refs_skipped; // could not be exported
+  };
+
+  // Prepare an export of `repo`, which must outlive the exporter
+  explicit fast_export(const repository &repo);
+
+  ~fast_export();
+
+  // Export the reference `name` (symbolic references are resolved)
+  void push_reference(const std::string &name);
+
+  // Export the references matching `glob`, e.g. "refs/heads/*"
+  void push_glob(const std::string &glob);
+
+  // Leave out `commit` and its ancestors; commits built on them name
+  // them by id
+  void hide(const oid &commit);
+
+  // Write the stream to `out`
+  statistics run(const sink &out);
+  statistics run(std::ostream &out);
+
+  // Load / save marks in the format of --import-marks / --export-marks
+  // Commits with an imported mark count as exported already, so an export
+  // with the marks of the previous one writes only what is new.
+  void import_marks(const std::string &path);
+  void export_marks(const std::string &path) const;
+
+private:
+  void export_reference(const std::string &name);
+  size_t export_commits(const std::string &ref, const git_oid &tip);
+  void export_commit(const std::string &ref, const commit &c);
+  void export_blob(const git_oid &id);
+  void export_tag(const std::string &name, const std::string &raw_tag,
+                  const git_oid &target);
+  void write_reference(const git_oid &id); // ":<mark>" or the hex id
+
+  void write(const char *data, size_t size);
+  void write(const std::string &text) { write(text.data(), text.size()); }
+  void flush();
+
+  static int is_exported(const git_oid *id, void *payload);
+
+  const repository &repo_;
+  git_odb *odb_;
+  std::vector<std::string> refs_;
+  std::vector<git_oid> hidden_;
+
+  std::unordered_map<git_oid, uintmax_t, oid_hash, oid_equal> marks_;
+  uintmax_t last_mark_;
+
+  const sink *sink_;
+  std::string buffer_;
+  statistics stats_;
+};
+
+} // namespace cppgit2
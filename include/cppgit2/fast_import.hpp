@@ -0,0 +1,131 @@
+#pragma once
+#include <cppgit2/bulk_write_session.hpp>
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/string_view.hpp>
+#include <cstdint>
+#include <functional>
+#include <git2.h>
+#include <istream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cppgit2 {
+
+// Importer for `git fast-import` streams
+//
+// Supported commands: blob, commit (M, D, C, R and deleteall file changes,
+// from, merge), tag, reset, checkpoint, progress, done, feature (done,
+// force, date-format=raw, import-marks, import-marks-if-exists,
+// export-marks) and option (ignored). Dates must be in the raw format.
+// Notes, ls, cat-blob and get-mark are not supported.
+//
+// Every branch keeps its current tree in memory, loaded directory by
+// directory as file changes reach into it, so a commit writes only the
+// trees along the paths it changed. Objects go into one pack through a
+// bulk_write_session, and the branches and tags are updated in a single
+// reference transaction at the end of the stream (and at each checkpoint).
+// As with git fast-import, a ref is not moved backwards (to a commit that
+// does not contain its current target) unless forced, and refs are never
+// read as starting points: the first commit on a branch without `from` is a
+// root commit ("from refs/heads/name^0" continues an existing branch).
+class fast_import : public libgit2_api {
+public:
+  struct statistics {
+    size_t blobs;
+    size_t trees;
+    size_t commits;
+    size_t tags;
+    size_t refs_updated;
+    std::vector<std::string> refs_skipped; // not fast-forwards
+  };
+
+  // Prepare an import into `repo`, which must outlive the importer
+  explicit fast_import(const repository &repo);
+
+  ~fast_import();
+
+  // Allow ref updates that are not fast-forwards
+  void set_force(bool force) { force_ = force; }
+
+  // Called with the text of each `progress` command
+  void set_progress_callback(std::function<void(const string_view &)> fn) {
+    progress_ = std::move(fn);
+  }
+
+  // Import the stream read from `in` / from the file descriptor `fd`
+  statistics run(std::istream &in);
+  statistics run(int fd);
+
+  // Object id of mark `:number`; throws if there is no such mark
+  oid mark(uintmax_t number) const;
+
+  // Load / save marks in the format of --import-marks / --export-marks
+  void import_marks(const std::string &path);
+  void export_marks(const std::string &path) const;
+
+private:
+  struct tree_node;
+  struct tree_entry {
+    uint32_t mode;
+    git_oid id; // stale while `subtree` is dirty
+    std::unique_ptr<tree_node> subtree; // loaded directory, or null
+  };
+  struct tree_node {
+    std::map<std::string, tree_entry> entries;
+    bool dirty;
+  };
+  struct branch {
+    bool has_tip;
+    git_oid tip;
+    tree_entry root;
+  };
+  class input;
+
+  statistics import_stream(const std::function<size_t(char *, size_t)> &read);
+  void parse_blob(input &in);
+  void parse_commit(input &in, const std::string &ref);
+  void parse_tag(input &in, const std::string &name);
+  void parse_reset(input &in, const std::string &ref);
+  void parse_file_change(input &in, const std::string &line, branch &b);
+  void parse_feature(const std::string &feature);
+  void read_data(input &in, std::string &out);
+  bool parse_mark(input &in, uintmax_t &mark);
+  git_oid resolve(const std::string &commitish);
+  git_oid commit_tree(const git_oid &commit);
+  branch &lookup_branch(const std::string &ref);
+  void reset_branch(branch &b, const git_oid *tip);
+
+  tree_node &load(tree_entry &dir);
+  tree_entry *find(tree_entry &dir, const std::vector<std::string> &path,
+                   size_t depth);
+  void set_path(tree_entry &dir, const std::vector<std::string> &path,
+                size_t depth, uint32_t mode, const git_oid &id);
+  bool remove_path(tree_entry &dir, const std::vector<std::string> &path,
+                   size_t depth);
+  const git_oid &write_tree(tree_entry &dir);
+  git_oid write_object(const std::string &data, git_object_t type);
+
+  void update_refs();
+
+  const repository &repo_;
+  git_odb *odb_;
+  std::unique_ptr<bulk_write_session> session_;
+  bool force_;
+  std::function<void(const string_view &)> progress_;
+  std::string export_marks_path_; // from `feature export-marks`
+
+  std::unordered_map<uintmax_t, git_oid> marks_;
+  std::map<std::string, branch> branches_;
+  std::map<std::string, git_oid> tags_;
+  std::unordered_map<git_oid, git_oid, oid_hash, oid_equal> commit_trees_;
+  statistics stats_;
+  std::string data_; // reused buffer for object contents
+};
+
+} // namespace cppgit2
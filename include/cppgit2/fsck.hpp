@@ -0,0 +1,100 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <git2.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Parallel integrity verification
+//
+// check() lists every object of the object database (git_odb_foreach, so
+// alternates included) and then, in parallel with one repository handle per
+// worker:
+//
+//  1. reads each object, hashes its content again and compares the result
+//     with its id, and checks the format of commits, trees and tags
+//  2. walks the history from the references, HEAD, the ids recorded in the
+//     reflogs and the index, checking that every object a commit, tree or
+//     tag refers to exists and has the expected type; problems found here
+//     carry the path at which the object was reached ("<commit>:dir/file",
+//     the reference name, or "<ref>@{<time>}" for a reflog entry)
+//
+// Problems are handed to the reporter as they are found, one call at a time,
+// so a caller can print them while the check goes on.
+class fsck : public libgit2_api {
+public:
+  enum class problem_type {
+    unreadable,    // the object could not be read (or inflated)
+    hash_mismatch, // its content does not hash to its id
+    malformed,     // bad commit, tree or tag format
+    missing,       // referred to but not in the object database
+    wrong_type,    // referred to as another type of object
+    broken_link    // referred to, but unreadable or with a bad hash
+  };
+
+  struct problem {
+    problem_type type;
+    oid id;           // the object at fault
+    std::string path; // where it was reached, if known
+    std::string message;
+  };
+
+  struct statistics {
+    size_t objects;
+    size_t commits;
+    size_t trees;
+    size_t blobs;
+    size_t tags;
+    size_t problems;
+  };
+
+  typedef std::function<void(const problem &)> reporter;
+
+  // Prepare `num_threads` workers (0 = one per hardware thread) over `repo`,
+  // which must outlive this object
+  explicit fsck(const repository &repo, size_t num_threads = 0);
+
+  // Verify every object, then (if `connectivity`) the links between the
+  // objects reachable from the references
+  statistics check(const reporter &fn, bool connectivity = true);
+
+private:
+  void verify_objects(const reporter &fn, statistics &stats);
+  void check_connectivity(const reporter &fn);
+  // Index of `id` in ids_, or ids_.size()
+  size_t find(const git_oid &id) const;
+  // 1 if newly visited, 0 if already visited, -1 if not in ids_
+  int visit(const git_oid &id);
+  // Whether `id` exists, is sound and has the `expected` type (reported if
+  // not)
+  bool check_link(const git_oid &id, git_object_t expected,
+                  const std::string &path, const reporter &fn);
+  void walk_tree(const repository &handle, const git_oid &id,
+                 std::string &path, const reporter &fn);
+  void report(const reporter &fn, problem_type type, const git_oid &id,
+              const std::string &path, const std::string &message);
+
+  const repository &repo_;
+  thread_pool pool_;
+  std::vector<repository> handles_;
+
+  // Sorted ids, their types (high bit set if the object is bad), and one
+  // visited bit each for the connectivity walk
+  std::vector<git_oid> ids_;
+  std::vector<uint8_t> types_;
+  std::unique_ptr<std::atomic<uint64_t>[]> visited_;
+  std::mutex report_mutex_;
+  std::atomic<size_t> problems_;
+};
+
+} // namespace cppgit2
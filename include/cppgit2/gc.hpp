@@ -0,0 +1,94 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <git2.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Reachability analysis and garbage collection
+//
+// mark() enumerates the objects of the repository (loose objects and the
+// .idx files of its packs; alternates are not included), gives each one a
+// bit in a bitmap, and marks what is reachable from the references, their
+// reflogs, HEAD and the index, and from the HEAD, reflogs, per-worktree
+// references (refs/bisect/, refs/worktree/, refs/rewritten/) and index of
+// every other worktree. Commits are listed with a revwalk; their
+// trees are then walked in parallel, each worker with its own repository
+// handle, and a tree shared by many commits is entered only once since
+// marking is an atomic test-and-set on the bitmap. Objects that live only
+// in alternates are not descended into.
+//
+// prune() deletes unreachable loose objects and repack() writes the
+// reachable ones to a single new pack (with pack_builder) and deletes the
+// old packs. Both take an expiry time: anything newer is kept, which
+// protects objects written by concurrent operations that are not referenced
+// yet. Packs with a .keep file are never deleted.
+class gc : public libgit2_api {
+public:
+  struct report {
+    size_t objects;   // distinct objects found
+    size_t reachable; // among them, reachable
+    std::vector<oid> unreachable_loose;
+    std::vector<oid> unreachable_packed;
+  };
+
+  // Prepare `num_threads` workers (0 = one per hardware thread) over `repo`,
+  // which must outlive this object
+  explicit gc(const repository &repo, size_t num_threads = 0);
+
+  // Enumerate objects, mark the reachable ones and report the others
+  report mark();
+
+  // Whether `id` was found reachable by the last mark()
+  bool is_reachable(const oid &id) const;
+
+  // Delete unreachable loose objects last modified before `expire`
+  // Returns the number of objects deleted. Requires mark().
+  size_t prune(std::time_t expire);
+
+  // Write the reachable objects, and those of packs modified at or after
+  // `expire`, to one new pack; then delete the other packs (except kept
+  // ones) and the loose objects the new pack contains
+  // Returns the id of the new pack. Requires mark().
+  oid repack(std::time_t expire);
+
+private:
+  enum location : uint8_t {
+    loose = 1,
+    packed = 2, // in a pack without a .keep file
+    kept = 4,   // in a pack with a .keep file
+  };
+
+  void enumerate();
+  void require_mark() const;
+  // 1 if newly marked, 0 if already marked, -1 if not a local object
+  int mark_object(const git_oid &id);
+  void mark_tree(const repository &handle, const git_oid &id);
+  std::string loose_path(const git_oid &id) const;
+
+  const repository &repo_;
+  thread_pool pool_;
+  std::vector<repository> handles_;
+  std::string objects_dir_;
+
+  // Sorted ids, their locations, and one reachability bit each
+  std::vector<git_oid> ids_;
+  std::vector<uint8_t> locations_;
+  std::unique_ptr<std::atomic<uint64_t>[]> bitmap_;
+  std::vector<std::string> packs_; // base paths (without .pack/.idx)
+  std::vector<std::time_t> pack_mtimes_;
+  std::vector<bool> pack_kept_;
+  std::vector<git_oid> commit_order_; // as listed by the revwalk
+  bool marked_;
+};
+
+} // namespace cppgit2
@@ -0,0 +1,124 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/string_view.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cppgit2 {
+
+// Compiled gitignore rules for classifying many paths at once
+//
+// repository::is_path_ignored asks libgit2 about one path at a time. An
+// ignore_matcher reads $GIT_DIR/info/exclude and core.excludesFile once,
+// and the .gitignore file of each directory of the working tree the first
+// time a path in it is asked about. Each file is compiled into a frame:
+// literal names and "*.ext" patterns are found by hashing the file name,
+// and the other patterns are only handed to wildmatch when the path starts
+// with their literal prefix. Directories are cached with whether they are
+// ignored, so everything below an ignored directory is answered without
+// looking at any rule, and so is any path in a directory seen before.
+//
+// Paths are relative to the working directory; a trailing '/' marks a
+// directory. Rules follow git: the last matching line of a file wins, deeper
+// .gitignore files before info/exclude before core.excludesFile, '!'
+// re-includes but not below an ignored directory, and core.ignorecase is
+// honoured. ".git" is always ignored. Rules added with
+// repository::add_ignore_rules are kept inside libgit2 and are not seen;
+// pass them as `extra_rules`, which come first, as libgit2 checks its
+// added rules before any file.
+//
+// is_ignored() and is_directory_ignored() can be called from several
+// threads at once.
+class ignore_matcher : public libgit2_api {
+public:
+  // Read the repository-wide rules of `repo`, which must have a working
+  // directory, after `extra_rules` (gitignore syntax, relative to the top
+  // level). classify() uses `num_threads` workers (0 = one per hardware
+  // thread), started on its first call
+  explicit ignore_matcher(const repository &repo, size_t num_threads = 0,
+                          const std::string &extra_rules = std::string());
+
+  ignore_matcher(const ignore_matcher &) = delete;
+  ignore_matcher &operator=(const ignore_matcher &) = delete;
+
+  // Whether `path` is ignored, by a rule or because a directory above it is
+  bool is_ignored(string_view path) const;
+
+  // is_ignored() for every path, split across the workers; sorted paths
+  // share their directory between neighbours
+  std::vector<bool> classify(const std::vector<std::string> &paths);
+
+  // Whether the directory `path` ("" for the top level, otherwise with or
+  // without a trailing '/') and everything below it is ignored; a scanner
+  // can skip it without listing it
+  bool is_directory_ignored(string_view path) const;
+
+private:
+  enum class pattern_kind : uint8_t {
+    name,          // literal file name
+    suffix,        // '*' then a literal
+    basename_glob, // wildcards, no '/': matched against the file name
+    path_glob      // matched against the path below the frame's directory
+  };
+
+  struct rule {
+    uint32_t pattern_offset; // in strings, folded with core.ignorecase
+    uint32_t pattern_length;
+    uint32_t prefix_length; // literal characters the pattern starts with
+    pattern_kind kind;
+    bool negated;        // "!pattern"
+    bool directory_only; // "pattern/"
+  };
+
+  struct frame {
+    std::string strings;
+    std::vector<rule> rules;
+    // Rule indexes, ascending
+    std::unordered_map<std::string, std::vector<uint32_t>> by_name;
+    std::unordered_map<std::string, std::vector<uint32_t>> by_extension;
+    std::vector<uint32_t> others;
+  };
+
+  // A directory of the working tree; kept until the matcher goes away
+  struct directory {
+    std::string path; // "" or ending in '/'
+    const directory *parent;
+    frame rules;     // its .gitignore
+    bool ignored;    // itself or a directory above
+  };
+
+  // Matching state, reused from path to path
+  struct scratch {
+    std::vector<uint32_t> candidates;
+    std::string key;
+    std::string folded;
+  };
+
+  void parse(const std::string &content, frame &f) const;
+  const directory *find_directory(string_view path) const;
+  int match_frame(const frame &f, string_view relative, string_view basename,
+                  bool is_directory, scratch &s) const;
+  bool match_stack(const directory *dir, string_view path, bool is_directory,
+                   scratch &s) const;
+  bool is_ignored(string_view path, const directory *&last,
+                  scratch &s) const;
+
+  std::string workdir_;
+  bool ignore_case_;
+  frame extra_;  // given to the constructor
+  frame info_;   // $GIT_DIR/info/exclude
+  frame global_; // core.excludesFile
+  size_t num_threads_;
+  std::unique_ptr<thread_pool> pool_;
+  mutable std::mutex mutex_; // guards directories_
+  mutable std::unordered_map<std::string, std::unique_ptr<directory>>
+      directories_;
+};
+
+} // namespace cppgit2
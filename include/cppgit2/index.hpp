@@ -332,6 +332,7 @@ private:
   friend class pathspec;
   friend class rebase;
   friend class repository;
+  friend class sparse_checkout;
   git_index *c_ptr_;
   ownership owner_;
 };
@@ -0,0 +1,222 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/index.hpp>
+#include <cppgit2/mapped_file.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/string_view.hpp>
+#include <git2.h>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cppgit2 {
+
+// Read-only, memory-mapped view of an index (dircache) file
+//
+// Unlike `index`, opening a view only maps the file and reads its header.
+// Entry boundaries are located on first access, in parallel across the
+// blocks listed by the IEOT extension when the index has one (written with
+// index.threads), and entries themselves are never copied: their fields are
+// decoded from the mapped bytes on demand and paths are handed out as
+// string_views. Versions 2, 3 and 4 are supported; for version 4 the
+// prefix-compressed paths are expanded once into a per-block buffer.
+//
+// The view does not verify the trailing checksum and rejects split indexes.
+// It is safe to read from several threads at once.
+class index_view {
+public:
+  // Lightweight view of one entry; valid while the index_view lives
+  class entry {
+  public:
+    index::time ctime() const {
+      return index::time{static_cast<int32_t>(be32(0)), be32(4)};
+    }
+
+    index::time mtime() const {
+      return index::time{static_cast<int32_t>(be32(8)), be32(12)};
+    }
+
+    uint32_t dev() const { return be32(16); }
+
+    uint32_t ino() const { return be32(20); }
+
+    uint32_t mode() const { return be32(24); }
+
+    uint32_t uid() const { return be32(28); }
+
+    uint32_t gid() const { return be32(32); }
+
+    uint32_t file_size() const { return be32(36); }
+
+    oid id() const { return oid(&raw_id()); }
+
+    // Object id without constructing an `oid`
+    const git_oid &raw_id() const {
+      return *reinterpret_cast<const git_oid *>(record_ + 40);
+    }
+
+    // On-disk flags (GIT_INDEX_ENTRY_*: stage, extended, valid)
+    uint16_t flags() const {
+      return static_cast<uint16_t>((record_[60] << 8) | record_[61]);
+    }
+
+    // On-disk extended flags (intent_to_add, skip_worktree), 0 if none
+    uint16_t flags_extended() const {
+      return (flags() & GIT_INDEX_ENTRY_EXTENDED)
+                 ? static_cast<uint16_t>((record_[62] << 8) | record_[63])
+                 : 0;
+    }
+
+    int stage() const {
+      return (flags() & GIT_INDEX_ENTRY_STAGEMASK) >> GIT_INDEX_ENTRY_STAGESHIFT;
+    }
+
+    bool is_conflict() const { return stage() > 0; }
+
+    bool skip_worktree() const {
+      return (flags_extended() & GIT_INDEX_ENTRY_SKIP_WORKTREE) != 0;
+    }
+
+    bool intent_to_add() const {
+      return (flags_extended() & GIT_INDEX_ENTRY_INTENT_TO_ADD) != 0;
+    }
+
+    // Path relative to the repository root (no allocation)
+    string_view path() const { return path_; }
+
+  private:
+    friend class index_view;
+    entry(const unsigned char *record, string_view path)
+        : record_(record), path_(path) {}
+
+    uint32_t be32(size_t offset) const {
+      auto p = record_ + offset;
+      return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+             (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    const unsigned char *record_;
+    string_view path_;
+  };
+
+  class iterator {
+  public:
+    entry operator*() const { return view_->entry_at(position_); }
+    iterator &operator++() {
+      ++position_;
+      return *this;
+    }
+    bool operator==(const iterator &other) const {
+      return position_ == other.position_;
+    }
+    bool operator!=(const iterator &other) const { return !(*this == other); }
+    size_t position() const { return position_; }
+
+  private:
+    friend class index_view;
+    iterator(const index_view *view, size_t position)
+        : view_(view), position_(position) {}
+    const index_view *view_;
+    size_t position_;
+  };
+
+  static const size_t npos = static_cast<size_t>(-1);
+
+  // Map the index file at `path`
+  // Entry boundaries are located with up to `num_threads` workers
+  // (0 = one per hardware thread) when the index has an IEOT extension.
+  explicit index_view(const std::string &path, size_t num_threads = 0);
+
+  // Map the index of `repo` (<gitdir>/index); a repository without an
+  // index file has an empty index
+  explicit index_view(const repository &repo, size_t num_threads = 0);
+
+  index_view(const index_view &) = delete;
+  index_view &operator=(const index_view &) = delete;
+
+  // Index format version (2, 3 or 4)
+  unsigned int version() const { return version_; }
+
+  // Number of entries, read from the header (does not parse entries)
+  size_t size() const { return entry_count_; }
+
+  // Checksum stored at the end of the file
+  oid checksum() const;
+
+  // Entry at position `i`, in index order (path, then stage)
+  entry entry_at(size_t i) const;
+
+  iterator begin() const { return iterator(this, 0); }
+
+  iterator end() const { return iterator(this, entry_count_); }
+
+  // Position of the entry for `path` at `stage`, or npos
+  size_t find(string_view path, int stage = 0) const;
+
+  // Position of the first entry whose path is not less than `path`
+  size_t lower_bound(string_view path) const;
+
+  // Positions [first, second) of the entries under directory `prefix`
+  // (given without a trailing slash; an empty prefix covers every entry)
+  std::pair<size_t, size_t> directory_range(string_view prefix) const;
+
+  // Whether the index carries the extension with signature `signature`
+  // (e.g. "TREE", "UNTR", "IEOT")
+  bool has_extension(const char *signature) const;
+
+  // Tree id that the cache-tree (TREE extension) records for directory
+  // `path` ("" for the root). Returns false if the index has no TREE
+  // extension or the directory's entry was invalidated.
+  bool cached_tree(string_view path, oid &id) const;
+
+private:
+  struct slot {
+    const unsigned char *record;
+    const char *path;
+    size_t path_length;
+  };
+
+  struct block {
+    size_t offset;
+    size_t first;
+    size_t count;
+  };
+
+  struct extension {
+    char signature[4];
+    size_t offset;
+    size_t size;
+  };
+
+  struct tree_cache_entry {
+    std::string path;
+    git_oid id;
+  };
+
+  void open(size_t num_threads);
+  void load() const;
+  void load_extensions() const;
+  void load_tree_cache() const;
+  size_t parse_block(const block &b, std::vector<char> *arena) const;
+  size_t extensions_offset_from_eoie() const;
+  const extension *find_extension(const char *signature) const;
+
+  mapped_file file_;
+  unsigned int version_;
+  size_t entry_count_;
+  size_t num_threads_;
+
+  // Filled lazily
+  mutable std::once_flag entries_loaded_;
+  mutable std::vector<slot> slots_;
+  mutable std::vector<std::vector<char>> paths_;
+  mutable std::once_flag extensions_loaded_;
+  mutable size_t extensions_offset_;
+  mutable std::vector<extension> extensions_;
+  mutable std::once_flag tree_cache_loaded_;
+  mutable std::vector<tree_cache_entry> tree_cache_;
+};
+
+} // namespace cppgit2
@@ -10,6 +10,11 @@ class libgit2_api {
 public:
   libgit2_api() { git_libgit2_init(); }
 
+  // Copies (and moves) shut down on destruction too
+  libgit2_api(const libgit2_api &) { git_libgit2_init(); }
+
+  libgit2_api &operator=(const libgit2_api &) = default;
+
   ~libgit2_api() { git_libgit2_shutdown(); }
 
   std::tuple<int, int, int> version() const {
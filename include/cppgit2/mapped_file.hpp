@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Read-only view of a whole file's contents
+//
+// The file is memory-mapped where the platform supports it and read into
+// memory otherwise. Used by the read-only views over git's on-disk formats
+// (index, packed-refs, ...).
+class mapped_file {
+public:
+  // Empty mapping
+  mapped_file();
+
+  // Map `path`; throws git_exception if it cannot be opened or mapped
+  explicit mapped_file(const std::string &path);
+
+  // A copy of `contents`, standing for `path`
+  mapped_file(const std::string &path,
+              const std::vector<unsigned char> &contents);
+
+  // Unmap
+  ~mapped_file();
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  // Move constructor (appropriate other's mapping)
+  mapped_file(mapped_file &&other);
+
+  // Move assignment constructor (appropriate other's mapping)
+  mapped_file &operator=(mapped_file &&other);
+
+  const unsigned char *data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+  const std::string &path() const { return path_; }
+
+private:
+  void release();
+
+  std::string path_;
+  const unsigned char *data_;
+  size_t size_;
+  bool mapped_;
+  std::vector<unsigned char> buffer_;
+};
+
+} // namespace cppgit2
@@ -1,6 +1,7 @@
 #pragma once
 #include <cppgit2/git_exception.hpp>
 #include <cppgit2/libgit2_api.hpp>
+#include <cstring>
 #include <git2.h>
 #include <string>
 
@@ -108,4 +109,25 @@ private:
   git_oid c_struct_;
 };
 
+// Hash functor for oids, so that they can key unordered containers
+// Object ids are uniformly distributed, so their leading bytes already make a
+// good hash. Also accepts raw git_oids, which avoid the libgit2_api overhead
+// of oid in large in-memory sets.
+struct oid_hash {
+  size_t operator()(const git_oid &id) const {
+    size_t result;
+    memcpy(&result, id.id, sizeof(result));
+    return result;
+  }
+  size_t operator()(const oid &id) const { return (*this)(*id.c_ptr()); }
+};
+
+// Equality functor matching oid_hash
+struct oid_equal {
+  bool operator()(const git_oid &lhs, const git_oid &rhs) const {
+    return git_oid_equal(&lhs, &rhs);
+  }
+  bool operator()(const oid &lhs, const oid &rhs) const { return lhs == rhs; }
+};
+
 } // namespace cppgit2
@@ -67,8 +67,9 @@ public:
   void
   set_progress_callback(std::function<void(int, uint32_t, uint32_t)> callback);
 
-  // Set number of threads to spawn
-  void set_threads(unsigned int num_threads);
+  // Set number of threads to spawn (0 = autodetect)
+  // Returns the number of threads that will be used
+  unsigned int set_threads(unsigned int num_threads);
 
   // Write the new pack and corresponding index file to path.
   void write(const std::string &path, unsigned int mode,
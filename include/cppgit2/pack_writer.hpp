@@ -0,0 +1,98 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <git2.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cppgit2 {
+
+// Writes objects straight into a new pack of a repository
+//
+// Objects are appended already compressed (see compress()), so callers can
+// deflate on many threads and append from one thread at a time. Nothing is
+// deltified. finish() stores the object count in the pack header, computes
+// the pack checksum, writes a version 2 .idx and moves both files into
+// objects/pack under their pack-<checksum> names, where the object database
+// picks them up. An unfinished pack is deleted with the writer.
+class pack_writer : public libgit2_api {
+public:
+  // Start a pack in the objects directory of `repo`, which must outlive
+  // the writer
+  explicit pack_writer(const repository &repo);
+
+  // Delete the pack unless finish() has run
+  ~pack_writer();
+
+  pack_writer(const pack_writer &) = delete;
+  pack_writer &operator=(const pack_writer &) = delete;
+
+  // zlib-compress `size` bytes of `data` into `out` (any thread)
+  // `level` is a zlib level, -1 for zlib's default.
+  static void compress(const void *data, size_t size,
+                       std::vector<unsigned char> &out, int level = -1);
+
+  // Append the object `id` of `type`, `size` bytes long, given its
+  // compressed content
+  // Returns false, writing nothing, if the pack already holds `id`.
+  bool append(const git_oid &id, git_object_t type, size_t size,
+              const unsigned char *compressed, size_t compressed_size);
+
+  // Whether `id` was appended
+  bool contains(const git_oid &id) const;
+
+  // Number of appended objects whose id starts with the first `length` hex
+  // digits of `prefix`; the id of the first one goes to `out`
+  // Looks at every object, as the ids are not kept in order.
+  size_t find_prefix(const git_oid &prefix, size_t length, git_oid &out) const;
+
+  // Type and size of the appended object `id`; false if there is none
+  bool read_header(const git_oid &id, git_object_t &type, size_t &size) const;
+
+  // Inflate the appended object `id` into `out`, which has room for its
+  // size; false if there is no such object
+  bool read(const git_oid &id, void *out);
+
+  // Call `fn` with the id of each appended object, in order
+  template <typename F> void for_each(F fn) const {
+    for (auto &e : entries_)
+      fn(e.id);
+  }
+
+  // Number of objects appended
+  size_t size() const { return entries_.size(); }
+
+  // Complete the pack and return its checksum (the name of the pack)
+  // With no objects, nothing is written and the zero id is returned.
+  oid finish();
+
+private:
+  struct entry {
+    git_oid id;
+    uint64_t offset; // of the object header
+    uint64_t size;
+    uint64_t compressed_size;
+    uint32_t crc;
+    uint8_t header_size;
+    git_object_t type;
+  };
+
+  void write(const void *data, size_t size);
+  void discard();
+
+  const repository &repo_;
+  std::string pack_dir_;
+  std::string temp_path_;
+  FILE *file_;
+  uint64_t offset_;
+  uint32_t crc_; // of the object being written
+  std::vector<entry> entries_;
+  std::unordered_map<git_oid, size_t, oid_hash, oid_equal> positions_;
+};
+
+} // namespace cppgit2
@@ -0,0 +1,132 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/mapped_file.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/string_view.hpp>
+#include <git2.h>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Read-only, memory-mapped view of a packed-refs file
+//
+// libgit2's refdb parses the whole of packed-refs into a hash map whenever
+// the file changes. The view only maps the file: a lookup is a binary
+// search over the mapped lines, as in git itself, and iteration walks the
+// lines in place, handing out names as string_views and decoding targets
+// on demand. Files written by git since 2.x are sorted (the "sorted" trait
+// in their header); an unsorted file is indexed once, on construction.
+//
+// Only the packed references are seen: a loose reference file overrides
+// its packed entry, and is not looked at here.
+class packed_refs_view {
+public:
+  // One reference; valid while the packed_refs_view lives
+  class entry {
+  public:
+    // Full name, e.g. "refs/heads/main" (no allocation)
+    string_view name() const { return name_; }
+
+    // Target object id
+    oid target() const;
+
+    // Target as 40 hex digits, as stored (no allocation)
+    string_view target_hex() const {
+      return string_view(record_, GIT_OID_HEXSZ);
+    }
+
+    // Whether the file records what the target peels to (annotated tags)
+    bool has_peeled() const { return peeled_ != nullptr; }
+
+    // Id of the object the target peels to; only if has_peeled()
+    oid peeled() const;
+
+  private:
+    friend class packed_refs_view;
+    entry(const char *record, string_view name, const char *peeled)
+        : record_(record), name_(name), peeled_(peeled) {}
+
+    const char *record_;
+    string_view name_;
+    const char *peeled_; // hex digits of the "^" line, or null
+  };
+
+  class iterator {
+  public:
+    entry operator*() const { return view_->entry_at(position_); }
+    iterator &operator++() {
+      position_ = view_->next(position_);
+      return *this;
+    }
+    bool operator==(const iterator &other) const {
+      return position_ == other.position_;
+    }
+    bool operator!=(const iterator &other) const { return !(*this == other); }
+
+  private:
+    friend class packed_refs_view;
+    iterator(const packed_refs_view *view, size_t position)
+        : view_(view), position_(position) {}
+    const packed_refs_view *view_;
+    size_t position_; // byte offset of the record, or index when unsorted
+  };
+
+  // Pair of iterators, usable in range-based for loops
+  struct range {
+    iterator first;
+    iterator last;
+    iterator begin() const { return first; }
+    iterator end() const { return last; }
+  };
+
+  // Map the packed-refs file at `path`; a missing file is an empty view
+  explicit packed_refs_view(const std::string &path);
+
+  // Map the packed-refs file of `repo`
+  explicit packed_refs_view(const repository &repo);
+
+  packed_refs_view(const packed_refs_view &) = delete;
+  packed_refs_view &operator=(const packed_refs_view &) = delete;
+
+  bool empty() const { return begin() == end(); }
+
+  // Header traits
+  bool is_sorted() const { return sorted_; }
+  bool is_peeled() const { return peeled_; }             // refs/tags/ peeled
+  bool is_fully_peeled() const { return fully_peeled_; } // all refs peeled
+
+  iterator begin() const { return iterator(this, sorted_ ? start_ : 0); }
+
+  iterator end() const {
+    return iterator(this, sorted_ ? file_.size() : records_.size());
+  }
+
+  // The reference named `name`, or end()
+  iterator find(string_view name) const;
+
+  // The first reference whose name is not less than `name`
+  iterator lower_bound(string_view name) const;
+
+  // The references whose names start with `prefix`, e.g. "refs/heads/"
+  range with_prefix(string_view prefix) const;
+
+private:
+  void open();
+  entry entry_at(size_t position) const;
+  size_t next(size_t position) const;
+  size_t record_end(size_t offset) const;
+  string_view name_at(size_t offset) const;
+  void throw_corrupted(size_t offset) const;
+
+  mapped_file file_;
+  const char *data_;
+  size_t start_; // of the first record, past the header
+  bool sorted_;
+  bool peeled_;
+  bool fully_peeled_;
+  std::vector<size_t> records_; // record offsets by name, if not sorted
+};
+
+} // namespace cppgit2
@@ -0,0 +1,75 @@
+#pragma once
+#include <cppgit2/checkout.hpp>
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/index.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/object.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/sparse_checkout.hpp>
+#include <git2.h>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Checkout that writes files on a pool of worker threads
+//
+// The checkout is planned by libgit2 itself, as a dry run with the caller's
+// options, so strategy, paths, baseline, conflict detection and notify
+// callbacks behave exactly as in repository::checkout_*. A conflict or a
+// non-zero notify callback aborts before anything is touched. The planned
+// removals are then carried out, and the planned file writes (blob lookup,
+// inflate, smudge filters, write) run in parallel, each worker with its own
+// repository handle; .gitattributes files are written first, so that the
+// filters see the attributes of the new tree. Symlinks (plain files with
+// core.symlinks=false) and submodule directories are created serially.
+// Finally the index entries of the written and removed paths are
+// updated with fresh stat data, like libgit2 does.
+//
+// The progress callback is serialized but may run on a worker thread.
+// Falls back to libgit2's serial checkout on Windows.
+class parallel_checkout : public libgit2_api {
+public:
+  struct statistics {
+    size_t files_written;
+    size_t bytes_written;
+    size_t files_removed;
+  };
+
+  // Prepare `num_threads` workers (0 = one per hardware thread) over `repo`,
+  // which must outlive the checkout
+  explicit parallel_checkout(const repository &repo, size_t num_threads = 0);
+
+  // Update files in the index and working tree to match HEAD
+  void checkout_head(const checkout::options &options = checkout::options());
+
+  // Update files in the working tree to match the content of the index
+  void checkout_index(const cppgit2::index &index,
+                      const checkout::options &options = checkout::options());
+
+  // Update files in the index and working tree to match the content of the
+  // tree pointed at by the treeish
+  void checkout_tree(const object &treeish,
+                     const checkout::options &options = checkout::options());
+
+  // Honor a sparse checkout cone, or stop honoring it with nullptr
+  // Planned writes outside the cone are not done: whatever is at the path
+  // is removed and the index entry is marked skip_worktree. `sparse` must
+  // outlive the checkouts.
+  void set_sparse_checkout(const sparse_checkout *sparse) { sparse_ = sparse; }
+
+  // Counters of the last checkout
+  const statistics &stats() const { return stats_; }
+
+private:
+  void run(const git_object *treeish, git_index *index,
+           const checkout::options &options);
+
+  const repository &repo_;
+  size_t num_threads_;
+  std::vector<repository> handles_;
+  const sparse_checkout *sparse_;
+  statistics stats_;
+};
+
+} // namespace cppgit2
@@ -0,0 +1,74 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <git2.h>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Many reference updates applied together, through packed-refs
+//
+// transaction and repository::create_reference write one loose reference
+// file, with its own lock file, per reference. A batch instead locks every
+// reference it updates and packed-refs, as git's packed transactions do,
+// checks every update against the current targets (compare-and-swap), and
+// writes all new targets in a single rewrite of packed-refs, which is
+// renamed into place at once. Loose files of the references involved are
+// removed afterwards, as `git pack-refs` does, so the packed targets take
+// effect.
+//
+// Only direct references under refs/ can be updated; no reflog entries are
+// written, and the reflogs of deleted references are removed. A repository
+// switched to reftable (see reftable::attach) has no packed-refs, and
+// commit() throws; use a transaction there.
+class reference_batch : public libgit2_api {
+public:
+  // Start an empty batch on `repo`, which must outlive the batch
+  explicit reference_batch(const repository &repo);
+
+  // Set `name` to `target`, whatever its current target
+  void update(const std::string &name, const oid &target);
+
+  // Set `name` to `target` if it currently points to `expected`
+  void update(const std::string &name, const oid &expected,
+              const oid &target);
+
+  // Create `name`, which must not exist yet
+  void create(const std::string &name, const oid &target);
+
+  // Delete `name`, whatever its current target
+  void remove(const std::string &name);
+
+  // Delete `name` if it currently points to `expected`
+  void remove(const std::string &name, const oid &expected);
+
+  // Number of updates queued
+  size_t size() const { return updates_.size(); }
+
+  // Apply all updates, or none
+  // Returns the names of the references whose current target is not the
+  // expected one; if there are any, nothing is changed. Throws
+  // git_exception if a lock is held by someone else (error_code::locked),
+  // a name is invalid or a new target does not exist. The batch is empty
+  // afterwards.
+  std::vector<std::string> commit();
+
+private:
+  struct update_entry {
+    std::string name;
+    git_oid expected; // zero: must not exist
+    git_oid target;   // zero: delete
+    bool verify;
+  };
+
+  void add(const std::string &name, const git_oid *expected,
+           const git_oid &target);
+
+  const repository &repo_;
+  std::vector<update_entry> updates_;
+};
+
+} // namespace cppgit2
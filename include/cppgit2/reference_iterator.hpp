@@ -0,0 +1,140 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/packed_refs_view.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/string_view.hpp>
+#include <git2.h>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Single-pass enumeration of the references under a prefix, in name order
+//
+// repository::for_each_reference has libgit2 allocate a git_reference (a
+// loose file lookup or a copy of the packed entry) for every ref, wrapped
+// and passed through a std::function; for_each_reference_name copies every
+// name. This reads the files backend directly: packed-refs through a
+// packed_refs_view, merged with the loose references found below the
+// prefix, which override their packed entries. Entries hand out names as
+// string_views and target ids already resolved through symbolic references.
+// What a target peels to is worked out only when peeled() is called, and
+// comes from packed-refs when recorded there. Past the loose names gathered
+// on construction, iterating allocates nothing per reference.
+//
+// Only names under refs/ are listed, not HEAD or other pseudo-references,
+// and loose references are only looked for below refs/. Per-worktree
+// references (refs/bisect/, refs/worktree/) are not listed, and only the
+// files backend is read: not a backend attached with e.g. reftable::attach.
+class reference_iterator {
+public:
+  // One reference; valid until the iterator moves on
+  class entry {
+  public:
+    // Full name, e.g. "refs/heads/main"
+    string_view name() const { return name_; }
+
+    bool is_symbolic() const { return symbolic_; }
+
+    // Name of the reference pointed to; only if is_symbolic()
+    string_view symbolic_target() const { return symbolic_target_; }
+
+    // Whether target() is known: false for a symbolic reference to a
+    // missing one
+    bool is_resolved() const { return resolved_; }
+
+    // Target object id, after following symbolic references
+    const oid &target() const { return target_; }
+
+    // Id of the first object that is not a tag, starting from target()
+    // (target() itself unless it is an annotated tag); looked up on the
+    // first call only
+    const oid &peeled() const;
+
+  private:
+    friend class reference_iterator;
+    entry() : owner_(nullptr) {}
+
+    const reference_iterator *owner_;
+    string_view name_;
+    string_view symbolic_target_;
+    bool symbolic_;
+    bool resolved_;
+    oid target_;
+    mutable oid peeled_;
+    mutable bool peel_known_;
+  };
+
+  // Input iterator over the remaining references
+  class iterator {
+  public:
+    const entry &operator*() const { return owner_->current_; }
+    const entry *operator->() const { return &owner_->current_; }
+    iterator &operator++() {
+      if (!owner_->next())
+        owner_ = nullptr;
+      return *this;
+    }
+    bool operator==(const iterator &other) const {
+      return owner_ == other.owner_;
+    }
+    bool operator!=(const iterator &other) const { return !(*this == other); }
+
+  private:
+    friend class reference_iterator;
+    explicit iterator(reference_iterator *owner) : owner_(owner) {}
+    reference_iterator *owner_; // null at the end
+  };
+
+  // References of `repo` whose names start with `prefix`
+  explicit reference_iterator(const repository &repo,
+                              const std::string &prefix = "refs/");
+
+  ~reference_iterator();
+
+  reference_iterator(const reference_iterator &) = delete;
+  reference_iterator &operator=(const reference_iterator &) = delete;
+
+  // Move to the next reference; false past the last one
+  bool next();
+
+  // The reference next() moved to
+  const entry &current() const { return current_; }
+
+  // Starts the walk if next() was never called; single pass
+  iterator begin() {
+    if (!started_ && !next())
+      return end();
+    return done_ ? end() : iterator(this);
+  }
+
+  iterator end() { return iterator(nullptr); }
+
+private:
+  void scan_loose(const std::string &directory);
+  bool read_loose(string_view name, std::string &buffer) const;
+  bool load_loose(string_view name);
+  void load_packed(const packed_refs_view::entry &packed);
+  void resolve(string_view name);
+  oid peel(const oid &id) const;
+
+  git_repository *repo_;
+  std::string common_dir_;
+  std::string prefix_;
+  packed_refs_view packed_;
+  packed_refs_view::range packed_range_;
+  std::string loose_names_;    // NUL-terminated names
+  std::vector<size_t> loose_;  // offsets into loose_names_, sorted by name
+  size_t loose_position_;
+  mutable std::string path_;   // reused for loose file paths
+  std::string buffer_;         // the current loose file
+  std::string resolve_buffer_; // files read while resolving
+  std::string resolve_name_;
+  mutable git_odb *odb_;
+  entry current_;
+  bool started_;
+  bool done_;
+};
+
+} // namespace cppgit2
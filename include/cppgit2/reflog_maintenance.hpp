@@ -0,0 +1,114 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/string_view.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <ctime>
+#include <functional>
+#include <git2.h>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Reading and expiring all the reflogs of a repository at once
+//
+// repository::read_reflog parses one log into a git_reflog, and expiring
+// means reading, editing and writing every log in turn. Here the log files
+// (logs/HEAD and everything below logs/refs/) are found with one directory
+// scan and parsed in place from a mapped_file. for_each_entry() streams
+// their entries; expire() applies a policy to the logs in parallel, each
+// worker with its own repository handle for reachability checks, and
+// replaces each log that changes through <log>.lock while holding the
+// reference's lock, as `git reflog expire` does. tip_index() collects the
+// ids recorded in all the logs into one sorted array, which gc uses as
+// reachability roots.
+//
+// The references are locked through the refdb, so expire() works with any
+// backend that keeps its reflogs in logs/: the files backend and reftable.
+class reflog_maintenance : public libgit2_api {
+public:
+  // One line of a reflog; views valid during the callback only
+  struct entry {
+    oid old_id;
+    oid new_id;
+    string_view committer; // "Name <email>"
+    std::time_t time;
+    int offset_minutes;
+    string_view message;
+  };
+
+  struct policy {
+    policy()
+        : expire(0), expire_unreachable(0), rewrite(false), dry_run(false) {}
+
+    // Entries older than this are dropped (0: none)
+    std::time_t expire;
+    // Entries older than this are dropped unless their new id is reachable
+    // from the reference's current target (0: none)
+    std::time_t expire_unreachable;
+    // Set the old id of an entry that follows dropped ones to the new id of
+    // the entry now before it, so the log has no gaps
+    bool rewrite;
+    // Only count what would be dropped
+    bool dry_run;
+  };
+
+  struct report {
+    size_t logs;    // logs looked at
+    size_t entries; // entries in them
+    size_t expired; // entries dropped
+    size_t rewritten;                 // logs replaced
+    std::vector<std::string> locked; // logs skipped: reference locked
+  };
+
+  // Ids recorded in the reflogs (old and new, except zero), sorted and
+  // deduplicated
+  class tip_index {
+  public:
+    bool contains(const oid &id) const;
+    size_t size() const { return ids_.size(); }
+    const std::vector<git_oid> &ids() const { return ids_; }
+
+  private:
+    friend class reflog_maintenance;
+    std::vector<git_oid> ids_;
+  };
+
+  // Prepare `num_threads` workers (0 = one per hardware thread) over `repo`,
+  // which must outlive this object
+  explicit reflog_maintenance(const repository &repo, size_t num_threads = 0);
+
+  // Names of the references that have a reflog, "HEAD" included, sorted;
+  // found again on every call
+  std::vector<std::string> names() const;
+
+  // Call `visitor` for every entry of every reflog, oldest first within
+  // each log
+  void for_each_entry(
+      const std::function<void(string_view refname, const entry &)> &visitor)
+      const;
+
+  // Apply `p` to every reflog
+  report expire(const policy &p);
+
+  // Collect the ids of all reflog entries, those of the logs of every
+  // linked worktree (HEAD and per-worktree references) included
+  tip_index build_tip_index();
+
+private:
+  std::string log_path(const std::string &name) const;
+  void scan(const std::string &logs_dir, const std::string &directory,
+            std::vector<std::string> &names) const;
+  std::vector<std::string> all_log_paths() const;
+
+  const repository &repo_;
+  thread_pool pool_;
+  std::vector<repository> handles_;
+  std::string git_dir_;    // HEAD and its log
+  std::string common_dir_; // everything else
+};
+
+} // namespace cppgit2
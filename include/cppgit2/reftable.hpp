@@ -0,0 +1,73 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/repository.hpp>
+#include <cstdint>
+#include <git2.h>
+#include <string>
+
+namespace cppgit2 {
+
+// Reference database backend storing references in a reftable stack
+//
+// A reftable is an immutable, sorted file of references, cut into blocks
+// (block_size bytes, padded) of prefix-compressed records with restart
+// points, and indexed by a (multi-level) block index, so a lookup reads a
+// handful of blocks whatever the number of references. The stack is the
+// list of tables in `tables.list`, oldest first; a reference is what the
+// newest table holding it says (which may be a deletion). Every update
+// (a write, a delete, a rename, or a whole reference transaction) adds one
+// small table and replaces tables.list atomically under tables.list.lock,
+// after its compare-and-swap checks. The stack is then compacted as git
+// does: tables are merged from the newest end until their sizes form a
+// geometric sequence (of ratio `compaction_factor`), so it holds
+// O(log n) tables. refdb::compress() merges the whole stack.
+//
+// The files follow the reftable format version 1 (SHA-1), without object
+// or log blocks. As in git, the common stack is <commondir>/reftable and a
+// linked worktree keeps HEAD and its other per-worktree references
+// (refs/bisect/, refs/worktree/, refs/rewritten/) in <gitdir>/reftable.
+//
+// Reflogs are not in the stacks: they stay in logs/, handled by the files
+// backend, and a reference without a log has an empty one. git keeps the
+// reflogs of a reftable repository in log blocks instead, so git does not
+// see these reflogs and this backend does not see git's; a table holding
+// log blocks is refused rather than compacted away. Sharing a repository
+// with git is therefore limited to references.
+//
+// migrate() is a one-way switch: the references of every worktree are
+// copied into the stacks, then core.repositoryformatversion is set to 1 and
+// extensions.refStorage to "reftable", then packed-refs and the loose
+// references are removed and HEAD points to refs/heads/.invalid. Programs
+// that do not know the extension refuse to open the repository instead of
+// reading stale references. The repository::open functions and
+// repository::reopen() accept such repositories and attach the backend to
+// every handle they return (with default options); a handle obtained any
+// other way needs attach().
+class reftable : public libgit2_api {
+public:
+  struct options {
+    options() : block_size(4096), restart_interval(16), compaction_factor(2) {}
+
+    uint32_t block_size;       // bytes per block
+    uint32_t restart_interval; // records between restart points
+    uint32_t compaction_factor;
+  };
+
+  // Switch `repo` (all its worktrees) to reftable if it still uses the
+  // files backend, then attach() the backend to `repo`. Cannot be undone
+  static void migrate(const repository &repo, const options &opts = options());
+
+  // Make the reftable stacks the reference database of `repo`, which must
+  // have been switched with migrate()
+  static void attach(const repository &repo, const options &opts = options());
+
+  // Let libgit2 open repositories with extensions.refStorage; migrate()
+  // and the repository::open functions call it. Process-wide
+  static void enable_extension();
+
+  // Whether `repo` has been switched to reftable
+  static bool is_enabled(const repository &repo);
+};
+
+} // namespace cppgit2
@@ -41,6 +41,7 @@
 #include <git2.h>
 #include <string>
 #include <utility>
+#include <vector>
 
 namespace cppgit2 {
 
@@ -162,6 +163,8 @@ public:
 
   // Open a git repository
   // Auto-detects if `path` is normal or bare repo and fails if neither
+  // A repository switched to reftable gets the reftable backend, here and
+  // in the other open functions (see reftable::migrate).
   static repository open(const std::string &path);
 
   // Fast open for bare repositories
@@ -422,6 +425,13 @@ public:
   // associated with it, so use with care.
   static repository wrap_odb(const cppgit2::odb &odb);
 
+  // Open a new, independent handle on this repository
+  // libgit2 repositories must not be used by several threads at once, so
+  // parallel code gives each worker thread its own handle. The working
+  // directory and namespace of this handle are carried over, and so is the
+  // reftable backend of a repository switched to reftable.
+  repository reopen() const;
+
   // Access to libgit2 C ptr
   const git_repository *c_ptr() const;
 
@@ -523,6 +533,21 @@ public:
   // and write it to the Object Database as a loose blob
   oid create_blob_from_workdir(const std::string &relative_path) const;
 
+  // Destination of create_blobs_from_paths()
+  enum class blob_storage { loose, pack };
+
+  // Read many files and write them to the Object Database as blobs
+  // Files are mapped whole and hashed and compressed on `num_threads`
+  // threads (0 = one per hardware thread), each with its own handle on
+  // this repository. With blob_storage::pack, the new blobs go to a single
+  // pack instead of loose objects. Symbolic links are stored as their
+  // target, as create_blob_from_disk() does. Returns the ids in the order
+  // of `paths`.
+  std::vector<oid>
+  create_blobs_from_paths(const std::vector<std::string> &paths,
+                          blob_storage storage = blob_storage::loose,
+                          size_t num_threads = 0) const;
+
   // Lookup a blob object from a repository.
   blob lookup_blob(const oid &id) const;
 
@@ -1400,6 +1425,7 @@ public:
   worktree open_worktree() const;
 
 private:
+  friend class blame_cache;
   friend class index;
   friend class pathspec;
   friend class remote;
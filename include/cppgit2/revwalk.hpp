@@ -104,6 +104,7 @@ public:
   const git_revwalk *c_ptr() const;
 
 private:
+  friend class blame_batch;
   friend class pack_builder;
   friend class repository;
   bool done_;
@@ -0,0 +1,94 @@
+#pragma once
+#include <cppgit2/diff.hpp>
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/index.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/repository.hpp>
+#include <git2.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cppgit2 {
+
+// Cone-mode sparse checkout
+//
+// The patterns of $GIT_DIR/info/sparse-checkout are compiled into a trie of
+// directories, as in git's cone mode: files directly in the root or in a
+// parent of an included directory are included, and so is everything below
+// an included (recursive) directory. Matching a path costs one lookup per
+// directory level, whatever the number of patterns.
+//
+// Only cone patterns are understood ("/*", "!/*/", "/dir/" and
+// "!/dir/*/"); other patterns throw git_exception. Without a
+// sparse-checkout file, or when core.sparseCheckout is false, every path is
+// included.
+//
+// apply() marks index entries outside the cone skip_worktree, which
+// status_engine honors; parallel_checkout honors the cone directly (see
+// parallel_checkout::set_sparse_checkout) and restrict() filters diffs.
+class sparse_checkout : public libgit2_api {
+public:
+  // Load the sparse-checkout file and core.sparseCheckout of `repo`, which
+  // must outlive this object
+  explicit sparse_checkout(const repository &repo);
+
+  // Whether core.sparseCheckout is set and paths are filtered
+  bool enabled() const { return enabled_; }
+
+  // Replace the cone by `directories` (recursive, relative to the working
+  // directory) and their parents, like `git sparse-checkout set`
+  void set_directories(const std::vector<std::string> &directories);
+
+  // Include one more directory, like `git sparse-checkout add`
+  void add_directory(const std::string &directory);
+
+  // Recursively included directories, in path order
+  std::vector<std::string> directories() const;
+
+  // Write the patterns to the sparse-checkout file and enable
+  // core.sparseCheckout and core.sparseCheckoutCone
+  void write();
+
+  // Whether the file at `path` is in the cone
+  bool includes(const std::string &path) const;
+
+  // Whether anything below `directory` is in the cone
+  // Walks can skip directories for which this is false.
+  bool includes_directory(const std::string &directory) const;
+
+  // Set skip_worktree on the entries of `index` outside the cone and clear
+  // it on the others, then write the index if it is backed by a file
+  // With `update_workdir`, the files of newly skipped entries are removed
+  // unless their stat data shows local changes, and the files of newly
+  // included entries are checked out. Returns the number of entries whose
+  // flag changed.
+  size_t apply(cppgit2::index &index, bool update_workdir = true) const;
+
+  // Make a diff skip the deltas of paths outside the cone
+  // Meant for diffs against the working directory. Replaces the notify
+  // callback of `options`; this object must outlive the diff.
+  void restrict(diff::options &options) const;
+
+private:
+  struct node {
+    bool recursive = false;
+    // Sorted by name
+    std::vector<std::pair<std::string, std::unique_ptr<node>>> children;
+
+    const node *find(const char *name, size_t size) const;
+  };
+
+  node *insert(const std::string &directory);
+  void parse(const std::string &text);
+  static void collect(const node &current, const std::string &prefix,
+                      std::vector<std::string> *directories,
+                      std::string *patterns);
+
+  const repository &repo_;
+  bool enabled_;
+  node root_;
+};
+
+} // namespace cppgit2
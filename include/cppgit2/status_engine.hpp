@@ -0,0 +1,107 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/status.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <functional>
+#include <git2.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Parallel status computation
+//
+// Equivalent to repository::for_each_status for the common cases, but the
+// index is read through an index_view and split by directory across a thread
+// pool: each worker checks the stat data of its entries relative to an open
+// directory handle and only hashes files whose stat data changed or that are
+// racily clean. HEAD-to-index differences use the index's cache-tree to skip
+// unchanged directories.
+//
+// Two optional inputs make repeated runs cheaper:
+//  - an untracked cache: directory listings keyed by the directory's mtime,
+//    persisted to a file, so unchanged directories are not read again
+//  - a change list (e.g. from a file system monitor): only the listed paths,
+//    and everything under listed directories, are examined
+//
+// Supported options: show, pathspec, include_untracked, include_ignored,
+// recurse_untracked_dirs and disable_pathspec_match. Renames are not
+// detected, submodules are not inspected and the index is never written.
+// Ignore rules are evaluated by an ignore_matcher, which cannot see rules
+// added with repository::add_ignore_rules; pass such rules to the
+// constructor instead.
+class status_engine : public libgit2_api {
+public:
+  struct statistics {
+    size_t stat_calls;          // entries and directories stat'ed
+    size_t hashed;              // files whose content was hashed
+    size_t directories_read;    // directory listings read from disk
+    size_t directories_cached;  // directory listings taken from the cache
+  };
+
+  // Prepare an engine over `repo`, which must outlive the engine
+  // `num_threads` workers are started (0 = one per hardware thread), each
+  // with its own repository handle. `ignore_rules` (gitignore syntax) are
+  // checked before any ignore file, like rules added with
+  // repository::add_ignore_rules.
+  status_engine(const repository &repo,
+                const status::options &options = status::options(),
+                size_t num_threads = 0,
+                const std::string &ignore_rules = std::string());
+
+  ~status_engine();
+
+  // Keep directory listings in `path` between runs
+  // The file is loaded now if it exists and rewritten after every run.
+  void set_untracked_cache(const std::string &path);
+
+  // Compute the status of the whole working directory and call `visitor`
+  // once per path that is not current, in path order
+  void for_each_status(
+      std::function<void(const std::string &, status::status_type)> visitor);
+
+  // Same, but trust that nothing outside `changed_paths` changed since the
+  // index was written; paths are relative to the working directory and may
+  // name directories
+  void for_each_status(
+      const std::vector<std::string> &changed_paths,
+      std::function<void(const std::string &, status::status_type)> visitor);
+
+  // Counters of the last run
+  const statistics &stats() const { return stats_; }
+
+private:
+  struct cached_directory {
+    int64_t mtime_seconds;
+    uint32_t mtime_nanoseconds;
+    std::vector<std::pair<std::string, bool>> children; // name, is directory
+  };
+  typedef std::map<std::string, cached_directory> untracked_cache;
+
+  struct run_state;
+
+  void run(const std::vector<std::string> *changed_paths,
+           std::function<void(const std::string &, status::status_type)> visitor);
+  void load_untracked_cache();
+  void save_untracked_cache() const;
+
+  const repository &repo_;
+  git_status_options options_;
+  std::string ignore_rules_;
+  std::vector<std::string> pathspec_;
+  git_pathspec *compiled_pathspec_;
+  bool trust_filemode_;
+  bool trust_ctime_;
+  thread_pool pool_;
+  std::vector<repository> handles_;
+  std::string untracked_cache_path_;
+  untracked_cache untracked_cache_;
+  int64_t untracked_cache_written_;
+  statistics stats_;
+};
+
+} // namespace cppgit2
@@ -0,0 +1,128 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+namespace cppgit2 {
+
+// Non-owning view of a character range (pointer + length)
+//
+// Stand-in for C++17's std::string_view, used by the read-only views
+// (index_view, tree_view, packed_refs_view, ...) to hand out paths and names
+// without allocating. The viewed memory must outlive the view.
+class string_view {
+public:
+  static const size_t npos = static_cast<size_t>(-1);
+
+  string_view() : data_(""), size_(0) {}
+
+  string_view(const char *data, size_t size) : data_(data), size_(size) {}
+
+  string_view(const char *data) : data_(data), size_(strlen(data)) {}
+
+  string_view(const std::string &value)
+      : data_(value.data()), size_(value.size()) {}
+
+  const char *data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  char operator[](size_t i) const { return data_[i]; }
+
+  const char *begin() const { return data_; }
+
+  const char *end() const { return data_ + size_; }
+
+  // Copy the viewed characters into a std::string
+  std::string to_string() const { return std::string(data_, size_); }
+
+  // View of [pos, pos + count), clamped to the end of this view
+  string_view substr(size_t pos, size_t count = npos) const {
+    pos = std::min(pos, size_);
+    return string_view(data_ + pos, std::min(count, size_ - pos));
+  }
+
+  // Byte-wise comparison (<0, 0, >0), the order git uses for paths
+  int compare(string_view other) const {
+    auto common = std::min(size_, other.size_);
+    int result = common ? memcmp(data_, other.data_, common) : 0;
+    if (result)
+      return result;
+    return size_ < other.size_ ? -1 : (size_ > other.size_ ? 1 : 0);
+  }
+
+  bool starts_with(string_view prefix) const {
+    return size_ >= prefix.size_ &&
+           (prefix.size_ == 0 || !memcmp(data_, prefix.data_, prefix.size_));
+  }
+
+  bool ends_with(string_view suffix) const {
+    return size_ >= suffix.size_ &&
+           (suffix.size_ == 0 || !memcmp(data_ + size_ - suffix.size_,
+                                         suffix.data_, suffix.size_));
+  }
+
+  size_t find(char c, size_t pos = 0) const {
+    for (; pos < size_; ++pos)
+      if (data_[pos] == c)
+        return pos;
+    return npos;
+  }
+
+  size_t rfind(char c) const {
+    for (size_t i = size_; i > 0; --i)
+      if (data_[i - 1] == c)
+        return i - 1;
+    return npos;
+  }
+
+private:
+  const char *data_;
+  size_t size_;
+};
+
+inline bool operator==(string_view lhs, string_view rhs) {
+  return lhs.size() == rhs.size() && lhs.compare(rhs) == 0;
+}
+
+inline bool operator!=(string_view lhs, string_view rhs) {
+  return !(lhs == rhs);
+}
+
+inline bool operator<(string_view lhs, string_view rhs) {
+  return lhs.compare(rhs) < 0;
+}
+
+inline bool operator>(string_view lhs, string_view rhs) {
+  return lhs.compare(rhs) > 0;
+}
+
+inline bool operator<=(string_view lhs, string_view rhs) {
+  return lhs.compare(rhs) <= 0;
+}
+
+inline bool operator>=(string_view lhs, string_view rhs) {
+  return lhs.compare(rhs) >= 0;
+}
+
+inline std::ostream &operator<<(std::ostream &out, string_view value) {
+  return out.write(value.data(), value.size());
+}
+
+// FNV-1a hash, for unordered containers keyed by string_view
+struct string_view_hash {
+  size_t operator()(string_view value) const {
+    size_t hash = static_cast<size_t>(14695981039346656037ULL);
+    for (char c : value) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= static_cast<size_t>(1099511628211ULL);
+    }
+    return hash;
+  }
+};
+
+} // namespace cppgit2
@@ -0,0 +1,62 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cppgit2 {
+
+// Fixed-size pool of worker threads
+//
+// libgit2 objects (repositories, revwalks, diffs, ...) must not be shared
+// between threads. Tasks receive the index of the worker running them so
+// that callers can keep one handle per worker, e.g. one repository::reopen()
+// per worker.
+class thread_pool {
+public:
+  // Start `num_threads` workers
+  // If `num_threads` is 0, one worker per hardware thread is started.
+  explicit thread_pool(size_t num_threads = 0);
+
+  // Wait for queued tasks and join the workers
+  ~thread_pool();
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  // Number of worker threads
+  size_t size() const { return workers_.size(); }
+
+  // Queue a task; `worker` is the index of the worker that runs it
+  void submit(std::function<void(size_t worker)> task);
+
+  // Block until every queued task has finished
+  // If any task threw, the first exception is rethrown here.
+  void wait();
+
+  // Run fn(i, worker) for every i in [0, count) and wait for completion
+  void parallel_for(size_t count,
+                    const std::function<void(size_t i, size_t worker)> &fn);
+
+  // Number of workers to start for a requested thread count
+  // (0 means one per hardware thread)
+  static size_t resolve_size(size_t num_threads);
+
+private:
+  void run(size_t worker);
+
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void(size_t)>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable task_available_;
+  std::condition_variable all_done_;
+  size_t pending_;
+  bool stopping_;
+  std::exception_ptr error_;
+};
+
+} // namespace cppgit2
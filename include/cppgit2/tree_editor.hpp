@@ -0,0 +1,66 @@
+#pragma once
+#include <cppgit2/file_mode.hpp>
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/tree.hpp>
+#include <git2.h>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Applies a batch of path edits to a tree
+//
+// Like repository::create_updated_tree, but meant for thousands of edits:
+// the edits are sorted and grouped by directory, each affected tree is read
+// once, and only the trees on the path of an edit are rewritten; untouched
+// subtrees are kept by id. Directories that end up empty are dropped.
+// With more than one thread, the top-level directories are rebuilt in
+// parallel, each worker with its own repository handle.
+//
+// When a path is edited several times, the last edit wins. Removing a path
+// that does not exist throws git_exception (notfound).
+class tree_editor : public libgit2_api {
+public:
+  // Edit trees of `repo`, which must outlive the editor
+  // `num_threads` workers are used by apply() (0 = one per hardware thread)
+  explicit tree_editor(const repository &repo, size_t num_threads = 1);
+
+  // Add or replace the blob, symlink or submodule at `path`
+  void upsert(const std::string &path, const oid &id, file_mode mode);
+
+  // Remove the file or directory at `path`
+  void remove(const std::string &path);
+
+  // Queue a tree::update (its path is copied)
+  void add(const tree::update &update);
+
+  // Number of queued edits
+  size_t size() const { return edits_.size(); }
+
+  // Forget the queued edits
+  void clear() { edits_.clear(); }
+
+  // Apply the queued edits to `baseline` (which may be an empty tree()) and
+  // return the id of the new root tree
+  oid apply(const tree &baseline);
+
+  // Number of tree objects written by the last apply()
+  size_t trees_written() const { return trees_written_; }
+
+private:
+  struct edit {
+    std::string path;
+    git_oid id;
+    uint32_t mode; // 0 = remove
+  };
+
+  const repository &repo_;
+  size_t num_threads_;
+  std::vector<edit> edits_;
+  size_t trees_written_;
+};
+
+} // namespace cppgit2
@@ -0,0 +1,76 @@
+#pragma once
+#include <cppgit2/file_mode.hpp>
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/string_view.hpp>
+#include <cppgit2/tree.hpp>
+#include <git2.h>
+#include <vector>
+
+namespace cppgit2 {
+
+// Flat, read-only array of the entries of one tree
+//
+// Entries are plain records whose name and id point into the tree object
+// itself, so iterating, indexing and find() never allocate; the only
+// allocation is the array, made once on construction. Entries are in git
+// tree order (directories sort as if their name ended with '/'), and find()
+// is a binary search.
+class tree_view {
+public:
+  struct entry {
+    string_view name;
+    const git_oid *raw_id; // points into the tree object
+    uint32_t mode;
+
+    oid id() const { return oid(raw_id); }
+
+    cppgit2::file_mode file_mode() const {
+      return static_cast<cppgit2::file_mode>(mode);
+    }
+
+    bool is_tree() const { return mode == GIT_FILEMODE_TREE; }
+
+    bool is_blob() const {
+      return mode == GIT_FILEMODE_BLOB || mode == GIT_FILEMODE_BLOB_EXECUTABLE;
+    }
+
+    bool is_link() const { return mode == GIT_FILEMODE_LINK; }
+
+    bool is_submodule() const { return mode == GIT_FILEMODE_COMMIT; }
+  };
+
+  typedef const entry *iterator;
+
+  // View the entries of `source`, which must outlive the view
+  explicit tree_view(const tree &source);
+
+  // Read the tree `id` from the object database of `repo` without going
+  // through git_tree; the view keeps the raw object alive
+  tree_view(const repository &repo, const oid &id);
+
+  ~tree_view();
+
+  tree_view(tree_view &&other);
+  tree_view &operator=(tree_view &&other);
+  tree_view(const tree_view &) = delete;
+  tree_view &operator=(const tree_view &) = delete;
+
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+
+  const entry &operator[](size_t index) const { return entries_[index]; }
+
+  iterator begin() const { return entries_.data(); }
+  iterator end() const { return entries_.data() + entries_.size(); }
+
+  // Entry named `name` (a file or a directory), or nullptr
+  const entry *find(const string_view &name) const;
+
+private:
+  git_odb_object *object_;
+  std::vector<entry> entries_;
+};
+
+} // namespace cppgit2
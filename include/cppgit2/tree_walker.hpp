@@ -0,0 +1,131 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/string_view.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <cppgit2/tree_view.hpp>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace cppgit2 {
+
+// Parallel recursive traversal of a tree
+//
+// Subtrees are spread over the workers with per-worker task queues: a
+// worker takes its own most recent task (depth first) and idle workers
+// steal the oldest task of another worker (large subtrees near the root).
+// Once its queue holds a few tasks, a worker descends into further
+// subtrees itself instead of queuing them. Trees are read as tree_views
+// through one repository handle per worker, and the path prefix handed to
+// the visitor is the worker's own buffer, extended and truncated in place;
+// queued subtrees share one copy of their parent's path. Idle workers
+// sleep until a task is queued.
+//
+// Repeated subtrees (same id at several paths) can be entered only once,
+// which is what per-tree aggregates need.
+class tree_walker : public libgit2_api {
+public:
+  // Called for every entry with the path of its directory ("" or ending
+  // with '/'), valid for the duration of the call
+  // Return a positive value to skip a subtree, a negative one to stop.
+  typedef std::function<int(const string_view &prefix,
+                            const tree_view::entry &entry, size_t worker)>
+      visitor;
+
+  // Called once per distinct tree
+  typedef std::function<void(const git_oid &id, const tree_view &entries,
+                             size_t worker)>
+      tree_visitor;
+
+  // Prepare `num_threads` workers (0 = one per hardware thread) over `repo`,
+  // which must outlive the walker
+  explicit tree_walker(const repository &repo, size_t num_threads = 0);
+
+  // Visit every entry below the tree `root`, in pre-order within each
+  // directory but in no global order
+  // With `unique_trees`, a subtree whose id was already entered at another
+  // path is not entered again (its own entry is still visited).
+  void walk(const oid &root, const visitor &fn, bool unique_trees = false);
+
+  // Visit `root` and every distinct tree below it once, from several
+  // workers at a time
+  void for_each_tree(const oid &root, const tree_visitor &fn);
+
+  // Bottom-up aggregate over the distinct trees below `root`: the value of
+  // a tree is `init` combined with leaf(e) for its non-tree entries and
+  // with the value of each subtree entry
+  // Leaves are evaluated in parallel, subtrees combined serially; returns
+  // the value of every tree (the root's under `root`).
+  template <typename T>
+  std::unordered_map<git_oid, T, oid_hash, oid_equal>
+  aggregate(const oid &root,
+            const std::function<T(const tree_view::entry &)> &leaf,
+            const std::function<void(T &, const T &)> &combine,
+            const T &init = T());
+
+  // Number of trees read by the last walk
+  size_t trees_read() const { return trees_read_; }
+
+private:
+  void run(const git_oid &root, bool unique_trees, const visitor *entry_fn,
+           const tree_visitor *tree_fn);
+
+  thread_pool pool_;
+  std::vector<repository> handles_;
+  size_t trees_read_;
+};
+
+template <typename T>
+std::unordered_map<git_oid, T, oid_hash, oid_equal>
+tree_walker::aggregate(const oid &root,
+                       const std::function<T(const tree_view::entry &)> &leaf,
+                       const std::function<void(T &, const T &)> &combine,
+                       const T &init) {
+  struct partial {
+    T value;
+    std::vector<git_oid> subtrees;
+  };
+  std::unordered_map<git_oid, partial, oid_hash, oid_equal> partials;
+  std::mutex mutex;
+  for_each_tree(root, [&](const git_oid &id, const tree_view &entries,
+                          size_t) {
+    partial result{init, std::vector<git_oid>()};
+    for (auto &e : entries) {
+      if (e.is_tree())
+        result.subtrees.push_back(*e.raw_id);
+      else
+        combine(result.value, leaf(e));
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    partials.emplace(id, std::move(result));
+  });
+
+  // Post-order over the tree DAG, without recursion
+  std::unordered_map<git_oid, T, oid_hash, oid_equal> values;
+  std::vector<std::pair<git_oid, bool>> stack{{*root.c_ptr(), false}};
+  while (!stack.empty()) {
+    auto top = stack.back();
+    stack.pop_back();
+    if (values.count(top.first))
+      continue;
+    auto &p = partials.at(top.first);
+    if (!top.second) {
+      stack.emplace_back(top.first, true);
+      for (auto &child : p.subtrees)
+        if (!values.count(child))
+          stack.emplace_back(child, false);
+      continue;
+    }
+    T value = p.value;
+    for (auto &child : p.subtrees)
+      combine(value, values.at(child));
+    values.emplace(top.first, std::move(value));
+  }
+  return values;
+}
+
+} // namespace cppgit2
@@ -0,0 +1,60 @@
+#pragma once
+#include <cppgit2/file_mode.hpp>
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/libgit2_api.hpp>
+#include <cppgit2/oid.hpp>
+#include <cppgit2/repository.hpp>
+#include <git2.h>
+#include <string>
+#include <vector>
+
+namespace cppgit2 {
+
+// Writes a whole hierarchy of trees from a sorted stream of paths
+//
+// Paths must be appended in byte order (the order of `git ls-files`), which
+// is also the order of entries in git trees. Only the directories on the
+// path of the last entry are open at any time, each as the already
+// serialized tree object being built; a directory is written to the object
+// database as soon as a path outside of it arrives. Memory is thus bounded
+// by depth times directory size, not by the number of paths.
+//
+// Paths that are not sorted, duplicated, or that are both a file and a
+// directory throw git_exception (invalid).
+class tree_writer : public libgit2_api {
+public:
+  // Write to the object database of `repo`, which must outlive the writer
+  explicit tree_writer(const repository &repo);
+  ~tree_writer();
+
+  tree_writer(const tree_writer &) = delete;
+  tree_writer &operator=(const tree_writer &) = delete;
+
+  // Add a blob, symlink or submodule at `path` (relative, '/'-separated)
+  void append(const std::string &path, const oid &id, file_mode mode);
+
+  // Write the directories still open and return the id of the root tree
+  // (the empty tree if nothing was appended); the writer can then be reused
+  oid finish();
+
+  // Number of tree objects written so far
+  size_t trees_written() const { return trees_written_; }
+
+private:
+  struct directory {
+    std::string name;
+    std::string entries;   // serialized tree content
+    // Names of files a later directory could collide with: each one is a
+    // prefix of the next, as with "a", "a-b", "a-b.c"
+    std::vector<std::string> files;
+  };
+
+  void close_directory();
+
+  git_odb *odb_;
+  std::vector<directory> open_; // open_[0] is the root
+  std::string last_path_;
+  size_t trees_written_;
+};
+
+} // namespace cppgit2
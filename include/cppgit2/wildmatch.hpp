@@ -0,0 +1,15 @@
+#pragma once
+#include <cppgit2/string_view.hpp>
+
+namespace cppgit2 {
+
+// Glob matching as git does it for gitignore and gitattributes patterns
+//
+// '*' and '?' match any characters, "[...]" is a bracket expression (with
+// '!' or '^' to negate, ranges and [:class:] names) and '\' escapes the
+// next character. With `pathname`, none of these match '/', while "**"
+// between slashes (or at either end) matches any number of directories.
+// Matching is case-sensitive; fold both sides first to ignore case.
+bool wildmatch(string_view pattern, string_view text, bool pathname);
+
+} // namespace cppgit2
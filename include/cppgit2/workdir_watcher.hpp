@@ -0,0 +1,89 @@
+#pragma once
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/status.hpp>
+#include <cppgit2/status_engine.hpp>
+#include <cppgit2/strarray.hpp>
+#include <functional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cppgit2 {
+
+// Watches a working directory with inotify and collects the paths that
+// changed, so that status can look at those paths only
+//
+// Every directory of the working directory is watched, except .git and, by
+// default, ignored directories. A full scan is needed first (nothing is
+// known about changes made before the watch started), after the kernel
+// dropped events (queue overflow) and after the index file was replaced
+// (e.g. by `git add` or `git reset`), since status then depends on paths that
+// did not change on disk; needs_full_scan() reports all three.
+//
+// for_each_status() keeps the dirty set equal to the paths that were not
+// current in the last run plus those changed since, which is what a
+// status_engine change list needs.
+//
+// Linux only: the constructor throws git_exception on other platforms.
+class workdir_watcher {
+public:
+  // Start watching the working directory of `repo`, which must outlive the
+  // watcher
+  explicit workdir_watcher(const repository &repo, bool watch_ignored = false);
+
+  // Stop watching
+  ~workdir_watcher();
+
+  workdir_watcher(const workdir_watcher &) = delete;
+  workdir_watcher &operator=(const workdir_watcher &) = delete;
+
+  // Read pending events, waiting up to `timeout_ms` for the first one
+  // (0 = do not wait, -1 = wait indefinitely)
+  // Returns true if any event was read.
+  bool poll(int timeout_ms = 0);
+
+  // Paths (relative to the working directory) changed since the last
+  // take_dirty_paths(), in order; directories stand for everything below
+  std::vector<std::string> dirty_paths() const;
+
+  // Return the dirty paths and start collecting anew
+  std::vector<std::string> take_dirty_paths();
+
+  // Whether the dirty paths cannot be trusted and a full status is needed
+  bool needs_full_scan() const { return needs_full_scan_; }
+
+  // Dirty paths as a pathspec, for status::options::set_pathspec
+  // Use together with status::options::flag::disable_pathspec_match.
+  strarray pathspec() const;
+
+  // Poll, then report the status of the dirty paths through `engine` (or of
+  // everything if a full scan is needed) and keep the paths that are not
+  // current as the new dirty set
+  void for_each_status(
+      status_engine &engine,
+      std::function<void(const std::string &, status::status_type)> visitor);
+
+  // Descriptor to wait on in an event loop (readable when events are
+  // pending)
+  int file_descriptor() const { return fd_; }
+
+  // Number of directories being watched
+  size_t watch_count() const { return watches_.size(); }
+
+private:
+  void add_watches(const std::string &dir);
+  bool is_ignored_directory(const std::string &dir) const;
+
+  const repository &repo_;
+  std::string workdir_;
+  bool watch_ignored_;
+  int fd_;
+  int git_dir_watch_;
+  std::unordered_map<int, std::string> watches_;
+  std::set<std::string> dirty_;
+  bool needs_full_scan_;
+};
+
+} // namespace cppgit2
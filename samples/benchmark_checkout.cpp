@@ -0,0 +1,81 @@
+#include <cppgit2/parallel_checkout.hpp>
+#include <cppgit2/repository.hpp>
+#include <chrono>
+#include <iostream>
+#include <string>
+using namespace cppgit2;
+
+// Compares libgit2's checkout with parallel_checkout on a synthetic tree.
+// A fresh repository is created at <scratch_path>, with <files> small files
+// (default 200000) spread over two directory levels, and the tree is checked
+// out into two new target directories below it.
+
+template <typename F> double time_ms(F fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+oid build_tree(repository &repo, size_t files) {
+  const size_t files_per_directory = 100, directories_per_top = 100;
+  tree_builder root(repo);
+  size_t written = 0;
+  for (size_t top = 0; written < files; ++top) {
+    tree_builder top_builder(repo);
+    for (size_t dir = 0; dir < directories_per_top && written < files; ++dir) {
+      tree_builder dir_builder(repo);
+      for (size_t file = 0; file < files_per_directory && written < files;
+           ++file, ++written) {
+        auto content = "file " + std::to_string(written) + "\n";
+        dir_builder.insert("file" + std::to_string(file) + ".txt",
+                           repo.create_blob_from_buffer(content),
+                           file_mode::blob);
+      }
+      top_builder.insert("dir" + std::to_string(dir), dir_builder.write(),
+                         file_mode::tree);
+    }
+    root.insert("top" + std::to_string(top), top_builder.write(),
+                file_mode::tree);
+  }
+  return root.write();
+}
+
+void report(const char *name, double ms, size_t files) {
+  std::cout << name << ms << " ms (" << static_cast<size_t>(files / (ms / 1000))
+            << " files/sec)\n";
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 4) {
+    std::cout << "Usage: ./executable <scratch_path> [files] [threads]\n";
+    return 1;
+  }
+  std::string path = argv[1];
+  if (path.back() != '/')
+    path += '/';
+  size_t files = argc >= 3 ? std::stoul(argv[2]) : 200000;
+  size_t threads = argc == 4 ? std::stoul(argv[3]) : 0;
+
+  auto repo = repository::init(path, false);
+  oid tree_id;
+  double build_ms = time_ms([&] { tree_id = build_tree(repo, files); });
+  std::cout << "synthetic tree:         " << build_ms << " ms (" << files
+            << " files)\n";
+  auto tree = repo.lookup_object(tree_id, object::object_type::tree);
+
+  checkout::options options;
+  options.set_strategy(checkout::checkout_strategy::force |
+                       checkout::checkout_strategy::dont_update_index);
+
+  options.set_target_directory(path + "libgit2-checkout");
+  report("libgit2 checkout:       ",
+         time_ms([&] { repo.checkout_tree(tree, options); }), files);
+
+  parallel_checkout checkout(repo, threads);
+  options.set_target_directory(path + "parallel-checkout");
+  report("parallel_checkout:      ",
+         time_ms([&] { checkout.checkout_tree(tree, options); }), files);
+  std::cout << "  " << checkout.stats().files_written << " files, "
+            << checkout.stats().bytes_written << " bytes written\n";
+}
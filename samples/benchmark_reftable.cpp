@@ -0,0 +1,94 @@
+#include <cppgit2/reference_batch.hpp>
+#include <cppgit2/reftable.hpp>
+#include <cppgit2/repository.hpp>
+#include <chrono>
+#include <iostream>
+#include <string>
+using namespace cppgit2;
+
+// Compares the files backend (packed-refs) with the reftable backend.
+// Two fresh repositories are created below <scratch_path>, each holding one
+// commit and <refs> branches (default 100000), which are then looked up,
+// listed and updated one at a time.
+
+template <typename F> double time_ms(F fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+std::string branch_name(size_t i) {
+  return "refs/heads/branch-" + std::to_string(i);
+}
+
+oid initial_commit(repository &repo) {
+  signature author("benchmark", "benchmark@example.com");
+  auto tree = repo.lookup_tree(tree_builder(repo).write());
+  return repo.create_commit("HEAD", author, author, "UTF-8", "initial\n",
+                            tree, {});
+}
+
+void run(const char *backend, repository &repo, size_t refs) {
+  const size_t lookups = 100000, updates = 1000;
+  auto id = repo.head().target();
+  size_t found = 0;
+  double lookup_ms = time_ms([&] {
+    for (size_t i = 0; i < lookups; ++i)
+      found += repo.reference_name_to_id(branch_name(i * 7919 % refs)) == id;
+  });
+  size_t listed = 0;
+  double list_ms = time_ms([&] {
+    repo.for_each_reference_name([&](const std::string &) { ++listed; });
+  });
+  double update_ms = time_ms([&] {
+    for (size_t i = 0; i < updates; ++i)
+      repo.create_reference(branch_name(i * 104729 % refs), id, true,
+                            "update");
+  });
+  std::cout << backend << "\n"
+            << "  " << lookups << " lookups:    " << lookup_ms << " ms ("
+            << found << " found)\n"
+            << "  list all:          " << list_ms << " ms (" << listed
+            << " refs)\n"
+            << "  " << updates << " updates:     " << update_ms << " ms\n";
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    std::cout << "Usage: ./executable <scratch_path> [refs]\n";
+    return 1;
+  }
+  std::string path = argv[1];
+  if (path.back() != '/')
+    path += '/';
+  size_t refs = argc == 3 ? std::stoul(argv[2]) : 100000;
+
+  auto files = repository::init(path + "files", false);
+  auto id = initial_commit(files);
+  double files_ms = time_ms([&] {
+    reference_batch batch(files);
+    for (size_t i = 0; i < refs; ++i)
+      batch.create(branch_name(i), id);
+    batch.commit();
+  });
+  std::cout << "files: " << refs << " refs packed in " << files_ms << " ms\n";
+
+  auto table = repository::init(path + "reftable", false);
+  id = initial_commit(table);
+  double table_ms = time_ms([&] {
+    reftable::migrate(table);
+    auto tx = table.create_transaction();
+    signature committer("benchmark", "benchmark@example.com");
+    for (size_t i = 0; i < refs; ++i) {
+      tx.lock_reference(branch_name(i));
+      tx.set_target(branch_name(i), id, committer, "create");
+    }
+    tx.commit();
+  });
+  std::cout << "reftable: " << refs << " refs written in " << table_ms
+            << " ms\n";
+
+  run("files backend", files, refs);
+  run("reftable backend", table, refs);
+}
@@ -0,0 +1,79 @@
+#include <cppgit2/repository.hpp>
+#include <cppgit2/status_engine.hpp>
+#include <cppgit2/workdir_watcher.hpp>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+using namespace cppgit2;
+
+// Compares full status scans with watcher-driven incremental status.
+// Each iteration rewrites a scratch file in the working directory, which is
+// removed at the end.
+
+template <typename F> double time_ms(F fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    std::cout << "Usage: ./executable <repo_path> [iterations]\n";
+    return 1;
+  }
+  int iterations = argc == 3 ? std::stoi(argv[2]) : 20;
+
+  auto repo = repository::open(argv[1]);
+  status::options options;
+  options.set_flags(status::options::flag::include_untracked);
+  status_engine engine(repo, options);
+
+  size_t count = 0;
+  auto count_paths = [&count](const std::string &, status::status_type) {
+    count++;
+  };
+
+  double libgit2_ms = time_ms([&] { repo.for_each_status(options, count_paths); });
+  std::cout << "libgit2 status:         " << libgit2_ms << " ms (" << count
+            << " paths)\n";
+
+  count = 0;
+  double engine_ms = time_ms([&] { engine.for_each_status(count_paths); });
+  std::cout << "status_engine (full):   " << engine_ms << " ms (" << count
+            << " paths)\n";
+
+  double setup_ms = 0;
+  std::unique_ptr<workdir_watcher> watcher;
+  try {
+    setup_ms = time_ms([&] { watcher.reset(new workdir_watcher(repo)); });
+  } catch (const git_exception &e) {
+    std::cout << "watcher unavailable: " << e.what() << "\n";
+    return 0;
+  }
+  std::cout << "watcher setup:          " << setup_ms << " ms ("
+            << watcher->watch_count() << " directories)\n";
+
+  // First run is a full scan
+  watcher->for_each_status(engine, count_paths);
+
+  auto scratch = repo.workdir() + ".cppgit2-watch-benchmark";
+  double total_ms = 0;
+  for (int i = 0; i < iterations; ++i) {
+    {
+      std::ofstream out(scratch);
+      out << "iteration " << i << "\n";
+    }
+    watcher->poll(100);
+    count = 0;
+    total_ms += time_ms([&] { watcher->for_each_status(engine, count_paths); });
+  }
+  std::remove(scratch.c_str());
+
+  std::cout << "watch-driven status:    " << total_ms / iterations
+            << " ms per run (" << iterations << " runs, " << count
+            << " paths)\n";
+}
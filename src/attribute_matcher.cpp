@@ -0,0 +1,626 @@
+#include <cppgit2/attribute_matcher.hpp>
+#include <cppgit2/config.hpp>
+#include <cppgit2/config_view.hpp>
+#include <cppgit2/data_buffer.hpp>
+#include <cppgit2/index_view.hpp>
+#include <cppgit2/tree_view.hpp>
+#include <cppgit2/wildmatch.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sys/stat.h>
+
+namespace cppgit2 {
+
+namespace {
+
+typedef attribute::attribute_value state;
+
+const char attributes_file[] = ".gitattributes";
+
+bool has_wildcards(string_view text) {
+  for (char c : text)
+    if (c == '*' || c == '?' || c == '[' || c == '\\')
+      return true;
+  return false;
+}
+
+bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+void fold_case(std::string &text) {
+  for (auto &c : text)
+    if (c >= 'A' && c <= 'Z')
+      c = static_cast<char>(c - 'A' + 'a');
+}
+
+// Attribute names as git accepts them
+bool is_valid_name(string_view name) {
+  if (name.empty() || name[0] == '-')
+    return false;
+  for (char c : name)
+    if (!(isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_' ||
+          c == '.'))
+      return false;
+  return true;
+}
+
+// A pattern in double quotes, with C escapes; `i` is moved past it
+bool unquote(string_view line, size_t &i, std::string &out) {
+  out.clear();
+  for (++i; i < line.size(); ++i) {
+    char c = line[i];
+    if (c == '"') {
+      ++i;
+      return true;
+    }
+    if (c != '\\') {
+      out += c;
+      continue;
+    }
+    if (++i == line.size())
+      return false;
+    c = line[i];
+    switch (c) {
+    case 'a': out += '\a'; break;
+    case 'b': out += '\b'; break;
+    case 'f': out += '\f'; break;
+    case 'n': out += '\n'; break;
+    case 'r': out += '\r'; break;
+    case 't': out += '\t'; break;
+    case 'v': out += '\v'; break;
+    case '0': case '1': case '2': case '3': {
+      if (i + 2 >= line.size())
+        return false;
+      int code = 0;
+      for (int digit = 0; digit < 3; ++digit, ++i) {
+        if (line[i] < '0' || line[i] > '7')
+          return false;
+        code = code * 8 + (line[i] - '0');
+      }
+      --i;
+      out += static_cast<char>(code);
+      break;
+    }
+    default: out += c; break;
+    }
+  }
+  return false;
+}
+
+bool read_file(const std::string &path, std::string &content) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  content.clear();
+  char chunk[4096];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    content.append(chunk, read);
+  fclose(file);
+  return true;
+}
+
+bool read_blob(git_odb *odb, const oid &id, std::string &content) {
+  git_odb_object *object = nullptr;
+  if (!odb || git_odb_read(&object, odb, id.c_ptr()) != 0) {
+    git_error_clear();
+    return false;
+  }
+  content.assign(static_cast<const char *>(git_odb_object_data(object)),
+                 git_odb_object_size(object));
+  git_odb_object_free(object);
+  return true;
+}
+
+bool file_exists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+// First `file` found in libgit2's search path for `level`
+std::string find_in_search_path(git_config_level_t level, const char *file) {
+  data_buffer buffer(nullptr);
+  if (git_libgit2_opts(GIT_OPT_GET_SEARCH_PATH, level, buffer.c_ptr()) != 0) {
+    git_error_clear();
+    return "";
+  }
+  auto directories = buffer.to_string();
+  size_t start = 0;
+  while (start <= directories.size()) {
+    auto end = directories.find(GIT_PATH_LIST_SEPARATOR, start);
+    if (end == std::string::npos)
+      end = directories.size();
+    if (end > start) {
+      auto path = directories.substr(start, end - start) + "/" + file;
+      if (file_exists(path))
+        return path;
+    }
+    start = end + 1;
+  }
+  return "";
+}
+
+void collect_tree(const repository &repo, const oid &id,
+                  const std::string &directory, std::vector<oid> &blobs,
+                  std::vector<std::string> &directories) {
+  tree_view tree(repo, id);
+  for (auto &e : tree) {
+    if (e.is_tree()) {
+      collect_tree(repo, e.id(), directory + e.name.to_string() + "/", blobs,
+                   directories);
+    } else if (e.is_blob() && e.name == attributes_file) {
+      blobs.push_back(e.id());
+      directories.push_back(directory);
+    }
+  }
+}
+
+} // namespace
+
+attribute_matcher::attribute_matcher(const repository &repo,
+                                     attribute::flag flags, size_t num_threads)
+    : pool_(num_threads), ignore_case_(false) {
+  auto order = static_cast<uint32_t>(flags) & 3;
+  bool bare = repo.is_bare();
+  bool index_only = bare || order == static_cast<uint32_t>(
+                                         attribute::flag::index_only);
+  std::string workdir = bare ? std::string() : repo.workdir();
+
+  // The .gitattributes files below the top level are found in the index
+  std::vector<source_file> files;
+  bool has_root = false;
+  if (file_exists(repo.path() + "index")) {
+    index_view index(repo, 1);
+    for (auto e : index) {
+      auto path = e.path();
+      if (e.stage() != 0 ||
+          !(path == attributes_file ||
+            (path.ends_with(attributes_file) &&
+             path[path.size() - strlen(attributes_file) - 1] == '/')))
+        continue;
+      source_file file;
+      file.directory =
+          path.substr(0, path.size() - strlen(attributes_file)).to_string();
+      file.top_level = file.directory.empty();
+      has_root = has_root || file.top_level;
+      if (!index_only)
+        file.path = workdir + path.to_string();
+      file.blob = e.id();
+      file.has_blob = true;
+      files.push_back(file);
+    }
+  }
+  if (!has_root && !index_only) {
+    source_file file;
+    file.top_level = true;
+    file.path = workdir + attributes_file;
+    file.has_blob = false;
+    files.push_back(file);
+  }
+  load(repo, files, flags);
+}
+
+attribute_matcher::attribute_matcher(const repository &repo,
+                                     const oid &treeish, attribute::flag flags,
+                                     size_t num_threads)
+    : pool_(num_threads), ignore_case_(false) {
+  auto raw = const_cast<git_repository *>(repo.c_ptr());
+  git_object *object = nullptr, *tree = nullptr;
+  git_exception::throw_nonzero(
+      git_object_lookup(&object, raw, treeish.c_ptr(), GIT_OBJECT_ANY));
+  int ret = git_object_peel(&tree, object, GIT_OBJECT_TREE);
+  git_object_free(object);
+  git_exception::throw_nonzero(ret);
+  oid root(git_object_id(tree));
+  git_object_free(tree);
+
+  std::vector<oid> blobs;
+  std::vector<std::string> directories;
+  collect_tree(repo, root, "", blobs, directories);
+  std::vector<source_file> files;
+  for (size_t i = 0; i < blobs.size(); ++i) {
+    source_file file;
+    file.directory = directories[i];
+    file.top_level = file.directory.empty();
+    file.blob = blobs[i];
+    file.has_blob = true;
+    files.push_back(file);
+  }
+  load(repo, files, flags);
+}
+
+// `files` are the .gitattributes files; the others are added here
+void attribute_matcher::load(const repository &repo,
+                             std::vector<source_file> &files,
+                             attribute::flag flags) {
+  config_view cfg(repo);
+  ignore_case_ = cfg.value_as_bool("core.ignorecase", false);
+  bool file_first =
+      (static_cast<uint32_t>(flags) & 3) ==
+      static_cast<uint32_t>(attribute::flag::file_then_index);
+
+  git_odb *odb = nullptr;
+  git_exception::throw_nonzero(
+      git_repository_odb(&odb, const_cast<git_repository *>(repo.c_ptr())));
+  auto read = [&](source_file &file) {
+    bool from_file = !file.path.empty();
+    if (from_file && (file_first || !file.has_blob) &&
+        read_file(file.path, file.content))
+      return true;
+    if (file.has_blob && read_blob(odb, file.blob, file.content))
+      return true;
+    return from_file && read_file(file.path, file.content);
+  };
+  auto add = [&](source_file &file) -> size_t {
+    if (!read(file))
+      return static_cast<size_t>(-1);
+    frames_.push_back(parse(file));
+    return frames_.size() - 1;
+  };
+
+  try {
+    // Lowest precedence first, so that the last definition of a macro wins
+    source_file builtin;
+    builtin.top_level = true;
+    builtin.has_blob = false;
+    builtin.content = "[attr]binary -diff -merge -text\n";
+    parse(builtin);
+
+    source_file system, global, info;
+    system.top_level = global.top_level = info.top_level = true;
+    system.has_blob = global.has_blob = info.has_blob = false;
+    if ((static_cast<uint32_t>(flags) &
+         static_cast<uint32_t>(attribute::flag::no_system)) == 0)
+      system.path = find_in_search_path(GIT_CONFIG_LEVEL_SYSTEM, "gitattributes");
+    auto configured = cfg.value_as_string("core.attributesfile", "");
+    global.path = configured.empty()
+                      ? find_in_search_path(GIT_CONFIG_LEVEL_XDG, "attributes")
+                      : config::parse_path(configured.to_string());
+    info.path = repo.commondir() + "info/attributes";
+
+    size_t system_frame = add(system);
+    size_t global_frame = add(global);
+    for (auto &file : files) {
+      auto index = add(file);
+      if (index != static_cast<size_t>(-1))
+        directory_frames_[file.directory] = index;
+      file.content.clear();
+    }
+    size_t info_frame = add(info);
+
+    if (info_frame != static_cast<size_t>(-1))
+      first_frames_.push_back(info_frame);
+    if (global_frame != static_cast<size_t>(-1))
+      last_frames_.push_back(global_frame);
+    if (system_frame != static_cast<size_t>(-1))
+      last_frames_.push_back(system_frame);
+  } catch (...) {
+    git_odb_free(odb);
+    throw;
+  }
+  git_odb_free(odb);
+}
+
+uint32_t attribute_matcher::intern(string_view name) {
+  auto key = name.to_string();
+  auto found = attribute_ids_.find(key);
+  if (found != attribute_ids_.end())
+    return found->second;
+  auto id = static_cast<uint32_t>(attribute_names_.size());
+  attribute_ids_.emplace(key, id);
+  attribute_names_.push_back(key);
+  macros_.push_back(macro{false, 0, 0});
+  return id;
+}
+
+// Lines are "pattern attr1 -attr2 !attr3 attr4=value ...", or
+// "[attr]name ..." to define a macro
+attribute_matcher::frame attribute_matcher::parse(const source_file &file) {
+  frame result;
+  result.directory = file.directory;
+  string_view text(file.content);
+  std::string pattern;
+  size_t position = 0;
+  while (position < text.size()) {
+    auto end = text.find('\n', position);
+    if (end == string_view::npos)
+      end = text.size();
+    auto line = text.substr(position, end - position);
+    position = end + 1;
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line = line.substr(0, line.size() - 1);
+
+    size_t i = 0;
+    while (i < line.size() && is_blank(line[i]))
+      ++i;
+    if (i == line.size() || line[i] == '#')
+      continue;
+    if (line[i] == '"') {
+      if (!unquote(line, i, pattern))
+        continue;
+    } else {
+      size_t start = i;
+      while (i < line.size() && !is_blank(line[i]))
+        ++i;
+      pattern.assign(line.data() + start, i - start);
+    }
+
+    bool is_macro = string_view(pattern).starts_with("[attr]");
+    if (is_macro) {
+      // Only top-level files may define macros
+      if (!file.top_level || !is_valid_name(string_view(pattern).substr(6)))
+        continue;
+    } else if (pattern.empty() || pattern[0] == '!') {
+      // Negative patterns are not allowed
+      continue;
+    }
+
+    auto first = static_cast<uint32_t>(assignments_.size());
+    while (true) {
+      while (i < line.size() && is_blank(line[i]))
+        ++i;
+      if (i == line.size())
+        break;
+      size_t start = i;
+      while (i < line.size() && !is_blank(line[i]))
+        ++i;
+      auto token = line.substr(start, i - start);
+      assignment a;
+      a.text_offset = a.text_length = 0;
+      if (token[0] == '-' || token[0] == '!') {
+        a.state = token[0] == '-' ? state::false_ : state::unspecified;
+        token = token.substr(1);
+      } else {
+        auto equals = token.find('=');
+        if (equals == string_view::npos) {
+          a.state = state::true_;
+        } else {
+          a.state = state::string;
+          a.text_offset = static_cast<uint32_t>(strings_.size());
+          a.text_length = static_cast<uint32_t>(token.size() - equals - 1);
+          strings_.append(token.data() + equals + 1, a.text_length);
+          token = token.substr(0, equals);
+        }
+      }
+      if (!is_valid_name(token))
+        continue;
+      a.attr = intern(token);
+      assignments_.push_back(a);
+    }
+    auto count = static_cast<uint32_t>(assignments_.size()) - first;
+
+    if (is_macro) {
+      macros_[intern(string_view(pattern).substr(6))] =
+          macro{true, first, count};
+      continue;
+    }
+    // Directory-only patterns never match a file
+    if (count == 0 || pattern[pattern.size() - 1] == '/')
+      continue;
+
+    bool anchored = pattern[0] == '/';
+    if (anchored)
+      pattern.erase(0, 1);
+    if (ignore_case_)
+      fold_case(pattern);
+    rule r;
+    r.pattern_offset = static_cast<uint32_t>(strings_.size());
+    r.pattern_length = static_cast<uint32_t>(pattern.size());
+    r.first = first;
+    r.count = count;
+    strings_ += pattern;
+    auto index = static_cast<uint32_t>(result.rules.size());
+    string_view rest = string_view(pattern).substr(1);
+    if (anchored || pattern.find('/') != std::string::npos) {
+      r.kind = pattern_kind::path_glob;
+      result.others.push_back(index);
+    } else if (!has_wildcards(pattern)) {
+      r.kind = pattern_kind::name;
+      result.by_name[pattern].push_back(index);
+    } else if (pattern[0] == '*' && !has_wildcards(rest)) {
+      r.kind = pattern_kind::suffix;
+      auto dot = rest.rfind('.');
+      if (dot != string_view::npos)
+        result.by_extension[rest.substr(dot).to_string()].push_back(index);
+      else
+        result.others.push_back(index);
+    } else {
+      r.kind = pattern_kind::basename_glob;
+      result.others.push_back(index);
+    }
+    result.rules.push_back(r);
+  }
+  return result;
+}
+
+attribute_matcher::query
+attribute_matcher::compile(const std::vector<std::string> &names) const {
+  query q;
+  q.slot_of.assign(attribute_names_.size(), -1);
+  q.slots = 0;
+  for (auto &name : names) {
+    auto found = attribute_ids_.find(name);
+    if (found == attribute_ids_.end()) {
+      q.asked.push_back(-1);
+      continue;
+    }
+    auto &slot = q.slot_of[found->second];
+    if (slot < 0)
+      slot = static_cast<int32_t>(q.slots++);
+    q.asked.push_back(slot);
+  }
+  // Macros that set a followed attribute, directly or through another macro
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t id = 0; id < macros_.size(); ++id) {
+      auto &m = macros_[id];
+      if (q.slot_of[id] >= 0 || !m.defined)
+        continue;
+      for (uint32_t i = 0; i < m.count; ++i) {
+        if (q.slot_of[assignments_[m.first + i].attr] >= 0) {
+          q.slot_of[id] = static_cast<int32_t>(q.slots++);
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+  return q;
+}
+
+// The frames that apply to paths in `directory`, highest precedence first:
+// info/attributes, the .gitattributes files from the deepest directory up,
+// core.attributesFile and the system file
+void attribute_matcher::frames_for(string_view directory, scratch &s) const {
+  s.frames.clear();
+  for (auto index : first_frames_)
+    s.frames.push_back(&frames_[index]);
+  size_t end = directory.size();
+  while (true) {
+    s.key.assign(directory.data(), end);
+    auto found = directory_frames_.find(s.key);
+    if (found != directory_frames_.end())
+      s.frames.push_back(&frames_[found->second]);
+    if (end == 0)
+      break;
+    auto slash = directory.substr(0, end - 1).rfind('/');
+    end = slash == string_view::npos ? 0 : slash + 1;
+  }
+  for (auto index : last_frames_)
+    s.frames.push_back(&frames_[index]);
+  s.directory.assign(directory.data(), directory.size());
+  s.has_directory = true;
+}
+
+bool attribute_matcher::matches(const frame &f, const rule &r,
+                                string_view path, string_view basename) const {
+  string_view pattern(strings_.data() + r.pattern_offset, r.pattern_length);
+  switch (r.kind) {
+  case pattern_kind::name:
+    return basename == pattern;
+  case pattern_kind::suffix:
+    return basename.ends_with(pattern.substr(1));
+  case pattern_kind::basename_glob:
+    return wildmatch(pattern, basename, false);
+  case pattern_kind::path_glob:
+    return wildmatch(pattern, path.substr(f.directory.size()), true);
+  }
+  return false;
+}
+
+// Set the followed attributes of `count` assignments not set yet, last
+// first, expanding macros that get set; true once all are set
+bool attribute_matcher::fill(uint32_t first, uint32_t count, const query &q,
+                             scratch &s, size_t &remaining) const {
+  for (uint32_t i = count; i-- > 0;) {
+    auto &a = assignments_[first + i];
+    auto slot = q.slot_of[a.attr];
+    if (slot < 0 || s.known[slot])
+      continue;
+    s.known[slot] = true;
+    s.values[slot].state = a.state;
+    s.values[slot].text =
+        string_view(strings_.data() + a.text_offset, a.text_length);
+    if (--remaining == 0)
+      return true;
+    auto &m = macros_[a.attr];
+    if (m.defined && a.state == state::true_ &&
+        fill(m.first, m.count, q, s, remaining))
+      return true;
+  }
+  return false;
+}
+
+void attribute_matcher::lookup(string_view path, const query &q, scratch &s,
+                               value *out) const {
+  auto slash = path.rfind('/');
+  auto directory =
+      slash == string_view::npos ? string_view() : path.substr(0, slash + 1);
+  if (!s.has_directory || directory != string_view(s.directory))
+    frames_for(directory, s);
+
+  string_view subject = path;
+  if (ignore_case_) {
+    s.folded.assign(path.data(), path.size());
+    fold_case(s.folded);
+    subject = s.folded;
+  }
+  auto basename = subject.substr(directory.size());
+
+  s.values.assign(q.slots, value{state::unspecified, string_view()});
+  s.known.assign(q.slots, false);
+  size_t remaining = q.slots;
+  for (auto f : s.frames) {
+    if (remaining == 0)
+      break;
+    // Rules that may match, last first: only wildcard patterns are not
+    // picked by the file name
+    s.candidates.assign(f->others.begin(), f->others.end());
+    if (!f->by_name.empty()) {
+      s.key.assign(basename.data(), basename.size());
+      auto found = f->by_name.find(s.key);
+      if (found != f->by_name.end())
+        s.candidates.insert(s.candidates.end(), found->second.begin(),
+                            found->second.end());
+    }
+    auto dot = basename.rfind('.');
+    if (!f->by_extension.empty() && dot != string_view::npos) {
+      s.key.assign(basename.data() + dot, basename.size() - dot);
+      auto found = f->by_extension.find(s.key);
+      if (found != f->by_extension.end())
+        s.candidates.insert(s.candidates.end(), found->second.begin(),
+                            found->second.end());
+    }
+    std::sort(s.candidates.begin(), s.candidates.end(),
+              std::greater<uint32_t>());
+
+    for (auto index : s.candidates) {
+      auto &r = f->rules[index];
+      bool followed = false;
+      for (uint32_t i = 0; i < r.count && !followed; ++i)
+        followed = q.slot_of[assignments_[r.first + i].attr] >= 0;
+      if (followed && matches(*f, r, subject, basename) &&
+          fill(r.first, r.count, q, s, remaining))
+        break;
+    }
+  }
+
+  for (size_t j = 0; j < q.asked.size(); ++j)
+    out[j] = q.asked[j] < 0 ? value{state::unspecified, string_view()}
+                            : s.values[q.asked[j]];
+}
+
+std::vector<attribute_matcher::value>
+attribute_matcher::lookup(string_view path,
+                          const std::vector<std::string> &names) const {
+  auto q = compile(names);
+  scratch s;
+  s.has_directory = false;
+  std::vector<value> result(names.size());
+  lookup(path, q, s, result.data());
+  return result;
+}
+
+std::vector<attribute_matcher::value>
+attribute_matcher::lookup(const std::vector<std::string> &paths,
+                          const std::vector<std::string> &names) {
+  auto q = compile(names);
+  std::vector<value> result(paths.size() * names.size());
+  if (result.empty())
+    return result;
+  // Contiguous runs, so that sorted neighbours share their frames
+  size_t chunks = std::min(paths.size(), pool_.size() * 4);
+  pool_.parallel_for(chunks, [&](size_t chunk, size_t) {
+    scratch s;
+    s.has_directory = false;
+    size_t begin = paths.size() * chunk / chunks;
+    size_t end = paths.size() * (chunk + 1) / chunks;
+    for (size_t i = begin; i < end; ++i)
+      lookup(paths[i], q, s, &result[i * names.size()]);
+  });
+  return result;
+}
+
+} // namespace cppgit2
@@ -1,4 +1,5 @@
 #include <cppgit2/blame.hpp>
+#include <cstring>
 
 namespace cppgit2 {
 
@@ -47,4 +48,156 @@ size_t blame::hunk_count() const { return git_blame_get_hunk_count(c_ptr_); }
 
 const git_blame *blame::c_ptr() const { return c_ptr_; }
 
+blame::hunk_list::record::record(const git_blame_hunk &source)
+    : c_struct(source), has_final_signature(source.final_signature),
+      has_orig_signature(source.orig_signature) {
+  if (source.orig_path)
+    orig_path = source.orig_path;
+  if (has_final_signature) {
+    final_signature = *source.final_signature;
+    if (source.final_signature->name)
+      final_name = source.final_signature->name;
+    if (source.final_signature->email)
+      final_email = source.final_signature->email;
+  }
+  if (has_orig_signature) {
+    orig_signature = *source.orig_signature;
+    if (source.orig_signature->name)
+      orig_name = source.orig_signature->name;
+    if (source.orig_signature->email)
+      orig_email = source.orig_signature->email;
+  }
+  bind();
+}
+
+blame::hunk_list::record::record(const record &other)
+    : c_struct(other.c_struct), final_signature(other.final_signature),
+      orig_signature(other.orig_signature), orig_path(other.orig_path),
+      final_name(other.final_name), final_email(other.final_email),
+      orig_name(other.orig_name), orig_email(other.orig_email),
+      has_final_signature(other.has_final_signature),
+      has_orig_signature(other.has_orig_signature) {
+  bind();
+}
+
+blame::hunk_list::record &
+blame::hunk_list::record::operator=(const record &other) {
+  if (this != &other) {
+    c_struct = other.c_struct;
+    final_signature = other.final_signature;
+    orig_signature = other.orig_signature;
+    orig_path = other.orig_path;
+    final_name = other.final_name;
+    final_email = other.final_email;
+    orig_name = other.orig_name;
+    orig_email = other.orig_email;
+    has_final_signature = other.has_final_signature;
+    has_orig_signature = other.has_orig_signature;
+    bind();
+  }
+  return *this;
+}
+
+void blame::hunk_list::record::bind() {
+  c_struct.orig_path = orig_path.c_str();
+  final_signature.name = const_cast<char *>(final_name.c_str());
+  final_signature.email = const_cast<char *>(final_email.c_str());
+  orig_signature.name = const_cast<char *>(orig_name.c_str());
+  orig_signature.email = const_cast<char *>(orig_email.c_str());
+  c_struct.final_signature = has_final_signature ? &final_signature : nullptr;
+  c_struct.orig_signature = has_orig_signature ? &orig_signature : nullptr;
+}
+
+blame::hunk_list::hunk_list(const blame &source) {
+  auto count = source.hunk_count();
+  for (size_t i = 0; i < count; ++i)
+    append(source.hunk_by_index(static_cast<uint32_t>(i)));
+}
+
+void blame::hunk_list::push(const record &next) {
+  if (!records_.empty()) {
+    auto &last = records_.back().c_struct;
+    if (git_oid_equal(&last.final_commit_id, &next.c_struct.final_commit_id) &&
+        git_oid_equal(&last.orig_commit_id, &next.c_struct.orig_commit_id) &&
+        last.boundary == next.c_struct.boundary &&
+        last.orig_start_line_number + last.lines_in_hunk ==
+            next.c_struct.orig_start_line_number &&
+        records_.back().orig_path == next.orig_path) {
+      last.lines_in_hunk += next.c_struct.lines_in_hunk;
+      return;
+    }
+  }
+  auto final_start_line_number = line_count() + 1;
+  records_.push_back(next);
+  records_.back().c_struct.final_start_line_number = final_start_line_number;
+}
+
+void blame::hunk_list::append(const hunk &source,
+                              size_t orig_start_line_number,
+                              size_t lines_in_hunk) {
+  if (!lines_in_hunk)
+    return;
+  record next(*source.c_ptr());
+  next.c_struct.orig_start_line_number = orig_start_line_number;
+  next.c_struct.lines_in_hunk = lines_in_hunk;
+  push(next);
+}
+
+void blame::hunk_list::append(const hunk &source) {
+  append(source, source.orig_start_line_number(), source.lines_in_hunk());
+}
+
+void blame::hunk_list::append(size_t lines_in_hunk, const oid &commit_id,
+                              const signature &author,
+                              const std::string &orig_path,
+                              size_t orig_start_line_number, bool boundary) {
+  if (!lines_in_hunk)
+    return;
+  git_blame_hunk source;
+  memset(&source, 0, sizeof(source));
+  source.lines_in_hunk = lines_in_hunk;
+  source.final_commit_id = *commit_id.c_ptr();
+  source.final_signature = const_cast<git_signature *>(author.c_ptr());
+  source.orig_commit_id = *commit_id.c_ptr();
+  source.orig_path = orig_path.c_str();
+  source.orig_start_line_number = orig_start_line_number;
+  source.orig_signature = const_cast<git_signature *>(author.c_ptr());
+  source.boundary = boundary ? 1 : 0;
+  push(record(source));
+}
+
+blame::hunk blame::hunk_list::hunk_by_index(size_t index) const {
+  if (index >= records_.size())
+    throw git_exception("blame hunk index out of range",
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::invalid);
+  return hunk(&records_[index].c_struct);
+}
+
+blame::hunk blame::hunk_list::hunk_by_line(size_t lineno) const {
+  // Hunks are contiguous and sorted by their final start line
+  size_t low = 0, high = records_.size();
+  while (low < high) {
+    auto mid = low + (high - low) / 2;
+    auto &candidate = records_[mid].c_struct;
+    if (lineno < candidate.final_start_line_number)
+      high = mid;
+    else if (lineno >=
+             candidate.final_start_line_number + candidate.lines_in_hunk)
+      low = mid + 1;
+    else
+      return hunk(&candidate);
+  }
+  throw git_exception("blame line number out of range",
+                      git_exception::error_class::invalid,
+                      git_exception::error_code::invalid);
+}
+
+size_t blame::hunk_list::line_count() const {
+  if (records_.empty())
+    return 0;
+  auto &last = records_.back().c_struct;
+  return last.final_start_line_number + last.lines_in_hunk - 1;
+}
+
 } // namespace cppgit2
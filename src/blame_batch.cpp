@@ -0,0 +1,595 @@
+#include <cppgit2/blame_batch.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+
+namespace cppgit2 {
+
+namespace {
+
+// Lines [final_start, final_start + count) of the blamed file, which are
+// lines [current_start, current_start + count) in the suspect's version
+struct segment {
+  size_t final_start;
+  size_t current_start;
+  size_t count;
+};
+
+// Lines of one file that are still looking for the commit that wrote them
+struct suspect {
+  size_t path;      // the blamed file
+  std::string name; // its path in the suspect's commit
+  git_oid blob;
+  std::vector<segment> segments;
+};
+
+// Lines handed over to a commit
+struct attribution {
+  size_t final_start;
+  size_t count;
+  size_t orig_start;
+  git_oid commit;
+  std::string orig_path;
+  bool boundary;
+};
+
+// Zero-context hunk of a line diff between a parent and a child blob
+struct line_hunk {
+  size_t old_start, old_lines, new_start, new_lines;
+};
+
+// How one parent relates to a suspect's file
+struct parent_file {
+  bool exists;
+  bool unchanged;
+  git_oid blob;
+  std::string name; // differs from the suspect's when the file was renamed
+};
+
+// Outcome of processing one suspect at one commit
+struct suspect_result {
+  std::vector<std::pair<size_t, suspect>> passed; // (parent index, suspect)
+  std::vector<attribution> blamed;
+};
+
+using suspect_map =
+    std::unordered_map<git_oid, std::vector<suspect>, oid_hash, oid_equal>;
+
+size_t count_lines(const char *data, size_t size) {
+  if (!size)
+    return 0;
+  size_t lines = std::count(data, data + size, '\n');
+  return data[size - 1] == '\n' ? lines : lines + 1;
+}
+
+void append_segment(std::vector<segment> &segments, size_t final_start,
+                    size_t current_start, size_t count) {
+  if (!count)
+    return;
+  if (!segments.empty()) {
+    auto &last = segments.back();
+    if (last.final_start + last.count == final_start &&
+        last.current_start + last.count == current_start) {
+      last.count += count;
+      return;
+    }
+  }
+  segments.push_back(segment{final_start, current_start, count});
+}
+
+// Split segments of the child's version into the lines that are unchanged in
+// the parent (renumbered to the parent's version) and the lines the child
+// added
+void pass_through(const std::vector<line_hunk> &hunks,
+                  const std::vector<segment> &segments,
+                  std::vector<segment> &passed, std::vector<segment> &kept) {
+  for (auto &seg : segments) {
+    auto current = seg.current_start;
+    auto final_start = seg.final_start;
+    auto remaining = seg.count;
+
+    // Lines after a hunk move by the difference of its old and new sizes.
+    // A pure deletion (new_lines == 0) sits right after line new_start.
+    long long offset = 0;
+    size_t h = 0;
+    auto hunk_end = [](const line_hunk &hunk) {
+      return hunk.new_lines ? hunk.new_start + hunk.new_lines
+                            : hunk.new_start + 1;
+    };
+    while (h < hunks.size() && hunk_end(hunks[h]) <= current) {
+      offset += static_cast<long long>(hunks[h].old_lines) -
+                static_cast<long long>(hunks[h].new_lines);
+      ++h;
+    }
+
+    while (remaining) {
+      size_t lines;
+      if (h < hunks.size() && hunks[h].new_lines &&
+          current >= hunks[h].new_start) {
+        // Inside lines added by the child
+        lines = std::min(remaining, hunk_end(hunks[h]) - current);
+        append_segment(kept, final_start, current, lines);
+      } else {
+        auto next = h < hunks.size() ? (hunks[h].new_lines
+                                            ? hunks[h].new_start
+                                            : hunks[h].new_start + 1)
+                                     : std::numeric_limits<size_t>::max();
+        lines = std::min(remaining, next - current);
+        append_segment(passed, final_start,
+                       static_cast<size_t>(current + offset), lines);
+      }
+      current += lines;
+      final_start += lines;
+      remaining -= lines;
+      if (h < hunks.size() && current >= hunk_end(hunks[h])) {
+        offset += static_cast<long long>(hunks[h].old_lines) -
+                  static_cast<long long>(hunks[h].new_lines);
+        ++h;
+      }
+    }
+  }
+}
+
+std::vector<line_hunk> diff_lines(git_repository *repo, const git_oid &parent,
+                                  const git_oid &child,
+                                  const git_blame_options &blame_options) {
+  git_diff_options options;
+  git_exception::throw_nonzero(
+      git_diff_options_init(&options, GIT_DIFF_OPTIONS_VERSION));
+  options.context_lines = 0;
+  options.interhunk_lines = 0;
+  options.flags |= GIT_DIFF_FORCE_TEXT;
+  if (blame_options.flags & GIT_BLAME_IGNORE_WHITESPACE)
+    options.flags |= GIT_DIFF_IGNORE_WHITESPACE;
+
+  git_blob *old_blob = nullptr, *new_blob = nullptr;
+  std::vector<line_hunk> result;
+  auto hunk_cb = [](const git_diff_delta *, const git_diff_hunk *hunk,
+                    void *payload) {
+    auto hunks = reinterpret_cast<std::vector<line_hunk> *>(payload);
+    hunks->push_back(line_hunk{static_cast<size_t>(hunk->old_start),
+                               static_cast<size_t>(hunk->old_lines),
+                               static_cast<size_t>(hunk->new_start),
+                               static_cast<size_t>(hunk->new_lines)});
+    return 0;
+  };
+
+  int ret = git_blob_lookup(&old_blob, repo, &parent);
+  if (!ret)
+    ret = git_blob_lookup(&new_blob, repo, &child);
+  if (!ret)
+    ret = git_diff_blobs(old_blob, nullptr, new_blob, nullptr, &options,
+                         nullptr, nullptr, hunk_cb, nullptr, &result);
+  git_blob_free(old_blob);
+  git_blob_free(new_blob);
+  git_exception::throw_nonzero(ret);
+  return result;
+}
+
+// Figure out which of a suspect's lines each parent is responsible for
+suspect_result process_suspect(git_repository *repo, const suspect &current,
+                               const git_oid &commit_id,
+                               const std::vector<parent_file> &parents,
+                               const git_blame_options &options) {
+  suspect_result result;
+
+  // Same content as a parent: everything came from there
+  for (size_t p = 0; p < parents.size(); ++p) {
+    if (parents[p].unchanged) {
+      result.passed.emplace_back(p, current);
+      return result;
+    }
+  }
+
+  auto remaining = current.segments;
+  for (size_t p = 0; p < parents.size() && !remaining.empty(); ++p) {
+    if (!parents[p].exists)
+      continue;
+    auto hunks = diff_lines(repo, parents[p].blob, current.blob, options);
+    suspect parent_suspect{current.path, parents[p].name, parents[p].blob, {}};
+    std::vector<segment> kept;
+    pass_through(hunks, remaining, parent_suspect.segments, kept);
+    if (!parent_suspect.segments.empty())
+      result.passed.emplace_back(p, std::move(parent_suspect));
+    remaining.swap(kept);
+  }
+
+  for (auto &seg : remaining)
+    result.blamed.push_back(attribution{seg.final_start, seg.count,
+                                        seg.current_start, commit_id,
+                                        current.name, false});
+  return result;
+}
+
+// Merge suspects of the same file that reached a commit through several
+// children
+void merge_suspects(std::vector<suspect> &suspects) {
+  std::sort(suspects.begin(), suspects.end(),
+            [](const suspect &a, const suspect &b) {
+              return a.path < b.path || (a.path == b.path && a.name < b.name);
+            });
+  std::vector<suspect> merged;
+  for (auto &s : suspects) {
+    if (!merged.empty() && merged.back().path == s.path &&
+        merged.back().name == s.name) {
+      auto &segments = merged.back().segments;
+      segments.insert(segments.end(), s.segments.begin(), s.segments.end());
+    } else {
+      merged.push_back(std::move(s));
+    }
+  }
+  for (auto &s : merged)
+    std::sort(s.segments.begin(), s.segments.end(),
+              [](const segment &a, const segment &b) {
+                return a.current_start < b.current_start;
+              });
+  suspects.swap(merged);
+}
+
+// Follow the suspects at `added` (indexes into `suspects`), whose paths the
+// parent does not have, through whole-file renames, as git blame does
+void find_renames(git_repository *repo, git_tree *parent_tree,
+                  git_tree *child_tree, const std::vector<suspect> &suspects,
+                  const std::vector<size_t> &added,
+                  std::vector<parent_file> &result) {
+  std::unordered_map<std::string, std::vector<size_t>> index_of;
+  for (auto i : added)
+    index_of[suspects[i].name].push_back(i);
+
+  git_diff_options options;
+  git_diff_find_options find_options;
+  git_exception::throw_nonzero(
+      git_diff_options_init(&options, GIT_DIFF_OPTIONS_VERSION));
+  git_exception::throw_nonzero(git_diff_find_options_init(
+      &find_options, GIT_DIFF_FIND_OPTIONS_VERSION));
+  options.flags |= GIT_DIFF_SKIP_BINARY_CHECK;
+  find_options.flags = GIT_DIFF_FIND_RENAMES;
+
+  git_diff *diff = nullptr;
+  int ret = git_diff_tree_to_tree(&diff, repo, parent_tree, child_tree,
+                                  &options);
+  if (!ret)
+    ret = git_diff_find_similar(diff, &find_options);
+  if (ret) {
+    git_diff_free(diff);
+    git_exception::throw_nonzero(ret);
+  }
+
+  auto count = git_diff_num_deltas(diff);
+  for (size_t d = 0; d < count; ++d) {
+    auto delta = git_diff_get_delta(diff, d);
+    if (delta->status != GIT_DELTA_RENAMED)
+      continue;
+    auto found = index_of.find(delta->new_file.path);
+    if (found == index_of.end())
+      continue;
+    for (auto i : found->second) {
+      auto &file = result[i];
+      file.exists = true;
+      file.blob = delta->old_file.id;
+      file.name = delta->old_file.path;
+    }
+  }
+  git_diff_free(diff);
+}
+
+// Resolve, for each suspect, how the parent's version differs
+// One tree diff per parent covers all the paths
+std::vector<parent_file>
+resolve_parent_files(git_repository *repo, git_tree *child_tree,
+                     git_commit *parent, const std::vector<suspect> &suspects) {
+  std::vector<parent_file> result;
+  result.reserve(suspects.size());
+  std::vector<const char *> pathspec;
+  pathspec.reserve(suspects.size());
+  for (auto &s : suspects) {
+    result.push_back(parent_file{true, true, git_oid(), s.name});
+    pathspec.push_back(s.name.c_str());
+  }
+
+  git_diff_options options;
+  git_exception::throw_nonzero(
+      git_diff_options_init(&options, GIT_DIFF_OPTIONS_VERSION));
+  options.flags |= GIT_DIFF_DISABLE_PATHSPEC_MATCH | GIT_DIFF_SKIP_BINARY_CHECK;
+  options.pathspec.strings = const_cast<char **>(pathspec.data());
+  options.pathspec.count = pathspec.size();
+
+  git_tree *parent_tree = nullptr;
+  git_diff *diff = nullptr;
+  int ret = git_commit_tree(&parent_tree, parent);
+  if (!ret)
+    ret = git_diff_tree_to_tree(&diff, repo, parent_tree, child_tree, &options);
+  if (ret) {
+    git_tree_free(parent_tree);
+    git_exception::throw_nonzero(ret);
+  }
+
+  // Several files may have reached the same path through renames
+  std::unordered_map<std::string, std::vector<size_t>> index_of;
+  for (size_t i = 0; i < suspects.size(); ++i)
+    index_of[suspects[i].name].push_back(i);
+
+  std::vector<size_t> added;
+  auto count = git_diff_num_deltas(diff);
+  for (size_t d = 0; d < count; ++d) {
+    auto delta = git_diff_get_delta(diff, d);
+    auto found = index_of.find(delta->new_file.path);
+    if (found == index_of.end())
+      continue;
+    bool exists = delta->status != GIT_DELTA_ADDED &&
+                  (delta->old_file.flags & GIT_DIFF_FLAG_EXISTS) &&
+                  delta->old_file.mode != GIT_FILEMODE_TREE;
+    for (auto i : found->second) {
+      auto &file = result[i];
+      file.unchanged = false;
+      file.exists = exists;
+      file.blob = delta->old_file.id;
+      if (!exists)
+        added.push_back(i);
+    }
+  }
+  git_diff_free(diff);
+
+  if (!added.empty()) {
+    try {
+      find_renames(repo, parent_tree, child_tree, suspects, added, result);
+    } catch (...) {
+      git_tree_free(parent_tree);
+      throw;
+    }
+  }
+  git_tree_free(parent_tree);
+  return result;
+}
+
+} // namespace
+
+blame_batch::blame_batch(const repository &repo, const blame::options &options)
+    : repo_(repo), options_(*options.c_ptr()) {}
+
+void blame_batch::add_path(const std::string &path) { paths_.push_back(path); }
+
+void blame_batch::add_paths(const std::vector<std::string> &paths) {
+  paths_.insert(paths_.end(), paths.begin(), paths.end());
+}
+
+std::map<std::string, blame::hunk_list> blame_batch::run(size_t num_threads) {
+  auto repo = const_cast<git_repository *>(repo_.c_ptr());
+  std::map<std::string, blame::hunk_list> result;
+
+  // Deduplicate, keeping a stable index per path
+  std::vector<std::string> paths(paths_);
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+  if (paths.empty())
+    return result;
+
+  git_oid newest;
+  if (git_oid_is_zero(&options_.newest_commit))
+    git_exception::throw_nonzero(
+        git_reference_name_to_id(&newest, repo, "HEAD"));
+  else
+    newest = options_.newest_commit;
+  bool has_oldest = !git_oid_is_zero(&options_.oldest_commit);
+
+  // One repository handle per worker
+  thread_pool pool(num_threads);
+  std::vector<repository> handles;
+  handles.reserve(pool.size());
+  for (size_t i = 0; i < pool.size(); ++i)
+    handles.push_back(repo_.reopen());
+  auto handle = [&handles](size_t worker) {
+    return const_cast<git_repository *>(handles[worker].c_ptr());
+  };
+
+  // Initial suspects: every line of every file, at the newest commit
+  std::vector<suspect> initial(paths.size());
+  std::vector<std::vector<attribution>> blamed(paths.size());
+  {
+    git_commit *commit = nullptr;
+    git_tree *tree = nullptr;
+    int ret = git_commit_lookup(&commit, repo, &newest);
+    if (!ret)
+      ret = git_commit_tree(&tree, commit);
+    git_commit_free(commit);
+    git_exception::throw_nonzero(ret);
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+      git_tree_entry *entry = nullptr;
+      ret = git_tree_entry_bypath(&entry, tree, paths[i].c_str());
+      if (!ret && git_tree_entry_type(entry) != GIT_OBJECT_BLOB) {
+        git_tree_entry_free(entry);
+        git_tree_free(tree);
+        throw git_exception("not a file: " + paths[i],
+                            git_exception::error_class::invalid,
+                            git_exception::error_code::invalid);
+      }
+      if (ret) {
+        git_tree_free(tree);
+        git_exception::throw_nonzero(ret);
+      }
+      initial[i].path = i;
+      initial[i].name = paths[i];
+      initial[i].blob = *git_tree_entry_id(entry);
+      git_tree_entry_free(entry);
+    }
+    git_tree_free(tree);
+  }
+
+  pool.parallel_for(paths.size(), [&](size_t i, size_t worker) {
+    git_blob *blob = nullptr;
+    git_exception::throw_nonzero(
+        git_blob_lookup(&blob, handle(worker), &initial[i].blob));
+    auto lines = count_lines(static_cast<const char *>(git_blob_rawcontent(blob)),
+                             static_cast<size_t>(git_blob_rawsize(blob)));
+    git_blob_free(blob);
+    if (lines)
+      initial[i].segments.push_back(segment{1, 1, lines});
+  });
+
+  suspect_map suspects;
+  for (auto &s : initial)
+    if (!s.segments.empty())
+      suspects[newest].push_back(std::move(s));
+
+  // Walk history once for all paths. Topological order guarantees that all
+  // children of a commit hand over their lines before the commit is visited.
+  revwalk walk(nullptr, ownership::user);
+  git_exception::throw_nonzero(git_revwalk_new(&walk.c_ptr_, repo));
+  git_exception::throw_nonzero(git_revwalk_sorting(
+      walk.c_ptr_, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME));
+  if (options_.flags & GIT_BLAME_FIRST_PARENT)
+    git_exception::throw_nonzero(git_revwalk_simplify_first_parent(walk.c_ptr_));
+  git_exception::throw_nonzero(git_revwalk_push(walk.c_ptr_, &newest));
+  if (has_oldest) {
+    // Stop the walk at the oldest commit
+    git_commit *oldest = nullptr;
+    git_exception::throw_nonzero(
+        git_commit_lookup(&oldest, repo, &options_.oldest_commit));
+    for (unsigned int p = 0; p < git_commit_parentcount(oldest); ++p)
+      git_revwalk_hide(walk.c_ptr_, git_commit_parent_id(oldest, p));
+    git_commit_free(oldest);
+  }
+
+  git_oid commit_id;
+  while (!suspects.empty() && git_revwalk_next(&commit_id, walk.c_ptr_) == 0) {
+    auto found = suspects.find(commit_id);
+    if (found == suspects.end())
+      continue;
+    std::vector<suspect> here(std::move(found->second));
+    suspects.erase(found);
+    merge_suspects(here);
+
+    git_commit *commit = nullptr;
+    git_exception::throw_nonzero(git_commit_lookup(&commit, repo, &commit_id));
+    unsigned int parent_count = git_commit_parentcount(commit);
+    if (parent_count > 1 && (options_.flags & GIT_BLAME_FIRST_PARENT))
+      parent_count = 1;
+    bool boundary = parent_count == 0 ||
+                    (has_oldest &&
+                     git_oid_equal(&commit_id, &options_.oldest_commit));
+
+    if (boundary) {
+      for (auto &s : here)
+        for (auto &seg : s.segments)
+          blamed[s.path].push_back(attribution{seg.final_start, seg.count,
+                                               seg.current_start, commit_id,
+                                               s.name, true});
+      git_commit_free(commit);
+      continue;
+    }
+
+    // One diff per parent, shared by every path with lines at this commit
+    std::vector<git_oid> parent_ids(parent_count);
+    std::vector<std::vector<parent_file>> parent_files(parent_count);
+    {
+      git_tree *tree = nullptr;
+      int ret = git_commit_tree(&tree, commit);
+      for (unsigned int p = 0; !ret && p < parent_count; ++p) {
+        git_commit *parent = nullptr;
+        parent_ids[p] = *git_commit_parent_id(commit, p);
+        ret = git_commit_parent(&parent, commit, p);
+        if (ret)
+          break;
+        try {
+          parent_files[p] = resolve_parent_files(repo, tree, parent, here);
+        } catch (...) {
+          git_commit_free(parent);
+          git_tree_free(tree);
+          git_commit_free(commit);
+          throw;
+        }
+        git_commit_free(parent);
+      }
+      git_tree_free(tree);
+      git_commit_free(commit);
+      git_exception::throw_nonzero(ret);
+    }
+
+    // Line attribution of the files touched by this commit, in parallel
+    std::vector<suspect_result> results(here.size());
+    auto process = [&](size_t i, git_repository *handle_repo) {
+      std::vector<parent_file> parents(parent_count);
+      for (unsigned int p = 0; p < parent_count; ++p)
+        parents[p] = parent_files[p][i];
+      results[i] =
+          process_suspect(handle_repo, here[i], commit_id, parents, options_);
+    };
+
+    std::vector<size_t> changed;
+    for (size_t i = 0; i < here.size(); ++i) {
+      bool unchanged = false;
+      for (unsigned int p = 0; p < parent_count && !unchanged; ++p)
+        unchanged = parent_files[p][i].unchanged;
+      if (unchanged)
+        process(i, repo); // no diff needed
+      else
+        changed.push_back(i);
+    }
+    if (changed.size() == 1)
+      process(changed[0], repo);
+    else if (changed.size() > 1)
+      pool.parallel_for(changed.size(), [&](size_t c, size_t worker) {
+        process(changed[c], handle(worker));
+      });
+
+    for (size_t i = 0; i < results.size(); ++i) {
+      for (auto &passed : results[i].passed)
+        suspects[parent_ids[passed.first]].push_back(std::move(passed.second));
+      auto &path_blamed = blamed[here[i].path];
+      path_blamed.insert(path_blamed.end(), results[i].blamed.begin(),
+                         results[i].blamed.end());
+    }
+  }
+
+  // Lines that reached commits outside the walk (below oldest_commit) stop
+  // there, as boundary lines
+  for (auto &pending : suspects)
+    for (auto &s : pending.second)
+      for (auto &seg : s.segments)
+        blamed[s.path].push_back(attribution{seg.final_start, seg.count,
+                                             seg.current_start, pending.first,
+                                             s.name, true});
+
+  // Author signatures, looked up once per commit
+  git_mailmap *mailmap = nullptr;
+  if (options_.flags & GIT_BLAME_USE_MAILMAP)
+    git_exception::throw_nonzero(git_mailmap_from_repository(&mailmap, repo));
+  std::unordered_map<git_oid, signature, oid_hash, oid_equal> authors;
+  auto author_of = [&](const git_oid &id) -> const signature & {
+    auto found = authors.find(id);
+    if (found != authors.end())
+      return found->second;
+    git_commit *commit = nullptr;
+    git_signature *author = nullptr;
+    int ret = git_commit_lookup(&commit, repo, &id);
+    if (!ret)
+      ret = git_commit_author_with_mailmap(&author, commit, mailmap);
+    git_commit_free(commit);
+    if (ret) {
+      git_mailmap_free(mailmap);
+      git_exception::throw_nonzero(ret);
+    }
+    signature copy(author);
+    git_signature_free(author);
+    return authors.emplace(id, copy).first->second;
+  };
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    auto &path_blamed = blamed[i];
+    std::sort(path_blamed.begin(), path_blamed.end(),
+              [](const attribution &a, const attribution &b) {
+                return a.final_start < b.final_start;
+              });
+    auto &hunks = result[paths[i]];
+    for (auto &a : path_blamed)
+      hunks.append(a.count, oid(&a.commit), author_of(a.commit), a.orig_path,
+                   a.orig_start, a.boundary);
+  }
+  git_mailmap_free(mailmap);
+
+  return result;
+}
+
+} // namespace cppgit2
@@ -0,0 +1,350 @@
+#include <cppgit2/blame_cache.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace cppgit2 {
+
+namespace {
+
+const char *blame_cache_magic = "cppgit2-blame-cache";
+const int blame_cache_version = 1;
+
+void throw_malformed(const std::string &path) {
+  throw git_exception("malformed blame cache: " + path,
+                      git_exception::error_class::invalid,
+                      git_exception::error_code::invalid);
+}
+
+// Strings are written as <length>:<bytes> so that paths and names may contain
+// spaces and newlines
+void write_string(std::ostream &out, const char *value) {
+  auto length = value ? strlen(value) : 0;
+  out << length << ':';
+  out.write(value, length);
+}
+
+bool read_string(std::istream &in, std::string &value) {
+  size_t length;
+  if (!(in >> length) || in.get() != ':')
+    return false;
+  value.resize(length);
+  if (length)
+    in.read(&value[0], length);
+  return static_cast<bool>(in);
+}
+
+void write_signature(std::ostream &out, const git_signature *sig) {
+  if (!sig) {
+    out << " 0";
+    return;
+  }
+  out << " 1 ";
+  write_string(out, sig->name);
+  out << ' ';
+  write_string(out, sig->email);
+  out << ' ' << sig->when.time << ' ' << sig->when.offset << ' '
+      << (sig->when.sign == '-' ? '-' : '+');
+}
+
+bool read_signature(std::istream &in, git_signature &sig, std::string &name,
+                    std::string &email, bool &present) {
+  int flag;
+  if (!(in >> flag))
+    return false;
+  present = flag != 0;
+  if (!present)
+    return true;
+  char sign;
+  if (!read_string(in, name) || !read_string(in, email) ||
+      !(in >> sig.when.time >> sig.when.offset >> sign))
+    return false;
+  sig.when.sign = sign;
+  sig.name = const_cast<char *>(name.c_str());
+  sig.email = const_cast<char *>(email.c_str());
+  return true;
+}
+
+} // namespace
+
+blame_cache::blame_cache(const repository &repo, const blame::options &options,
+                         size_t max_commits_per_path)
+    : repo_(repo.c_ptr_), options_(*options.c_ptr()),
+      max_commits_per_path_(max_commits_per_path ? max_commits_per_path : 1),
+      stats_{0, 0, 0} {
+  options_.min_line = 0;
+  options_.max_line = 0;
+  memset(&options_.oldest_commit, 0, sizeof(git_oid));
+  memset(&options_.newest_commit, 0, sizeof(git_oid));
+}
+
+const blame::hunk_list &blame_cache::blame_file(const std::string &path) {
+  oid head;
+  git_exception::throw_nonzero(
+      git_reference_name_to_id(head.c_ptr(), repo_, "HEAD"));
+  return blame_file(path, head);
+}
+
+const blame::hunk_list &blame_cache::blame_file(const std::string &path,
+                                                const oid &commit_id) {
+  auto commit_hex = commit_id.to_hex_string();
+  auto entry = entries_.find(path);
+
+  blame::hunk_list result;
+  bool reused = false;
+  if (entry != entries_.end()) {
+    auto cached = entry->second.blames.find(commit_hex);
+    if (cached != entry->second.blames.end()) {
+      stats_.hits++;
+      return cached->second;
+    }
+    auto base_hex = closest_ancestor(entry->second, commit_id);
+    reused = !base_hex.empty() &&
+             blame_incremental(path, commit_id, base_hex,
+                               entry->second.blames.at(base_hex), result);
+  }
+  if (reused) {
+    stats_.incremental++;
+  } else {
+    result = blame_full(path, commit_id);
+    stats_.full++;
+  }
+
+  // Only a successful blame creates an entry
+  insert(path, commit_hex, std::move(result));
+  return entries_.at(path).blames.at(commit_hex);
+}
+
+bool blame_cache::contains(const std::string &path,
+                           const oid &commit_id) const {
+  auto entry = entries_.find(path);
+  return entry != entries_.end() &&
+         entry->second.blames.count(commit_id.to_hex_string());
+}
+
+void blame_cache::evict(const std::string &path) { entries_.erase(path); }
+
+void blame_cache::clear() {
+  entries_.clear();
+  stats_ = statistics{0, 0, 0};
+}
+
+size_t blame_cache::size() const {
+  size_t result = 0;
+  for (auto &entry : entries_)
+    result += entry.second.blames.size();
+  return result;
+}
+
+void blame_cache::insert(const std::string &path,
+                         const std::string &commit_hex,
+                         blame::hunk_list &&hunks) {
+  auto &entry = entries_[path];
+  if (!entry.blames.count(commit_hex))
+    entry.order.push_back(commit_hex);
+  entry.blames[commit_hex] = std::move(hunks);
+
+  // Keep the newest insertions; the one just made is never evicted
+  while (entry.order.size() > max_commits_per_path_) {
+    entry.blames.erase(entry.order.front());
+    entry.order.erase(entry.order.begin());
+  }
+}
+
+std::string blame_cache::closest_ancestor(const path_entry &entry,
+                                          const oid &commit_id) const {
+  std::string result;
+  size_t best_distance = std::numeric_limits<size_t>::max();
+  for (auto &candidate : entry.blames) {
+    oid candidate_id(candidate.first);
+    if (git_graph_descendant_of(repo_, commit_id.c_ptr(),
+                                candidate_id.c_ptr()) != 1)
+      continue;
+    size_t ahead = 0, behind = 0;
+    if (git_graph_ahead_behind(&ahead, &behind, repo_, commit_id.c_ptr(),
+                               candidate_id.c_ptr()))
+      continue;
+    if (ahead < best_distance) {
+      best_distance = ahead;
+      result = candidate.first;
+    }
+  }
+  return result;
+}
+
+bool blame_cache::is_linear_extension(const oid &commit_id,
+                                      const oid &base_id) const {
+  git_oid current = *commit_id.c_ptr();
+  while (!git_oid_equal(&current, base_id.c_ptr())) {
+    git_commit *commit = nullptr;
+    git_exception::throw_nonzero(git_commit_lookup(&commit, repo_, &current));
+    bool single_parent = git_commit_parentcount(commit) == 1;
+    if (single_parent)
+      current = *git_commit_parent_id(commit, 0);
+    git_commit_free(commit);
+    if (!single_parent)
+      return false;
+  }
+  return true;
+}
+
+bool blame_cache::blame_incremental(const std::string &path,
+                                    const oid &commit_id,
+                                    const std::string &base_hex,
+                                    const blame::hunk_list &base,
+                                    blame::hunk_list &result) const {
+  oid base_id(base_hex);
+  if (!is_linear_extension(commit_id, base_id))
+    return false;
+
+  git_blame_options options = options_;
+  options.newest_commit = *commit_id.c_ptr();
+  options.oldest_commit = *base_id.c_ptr();
+
+  blame fresh(nullptr, ownership::user);
+  git_exception::throw_nonzero(
+      git_blame_file(&fresh.c_ptr_, repo_, path.c_str(), &options));
+
+  auto count = fresh.hunk_count();
+  for (size_t i = 0; i < count; ++i) {
+    auto hunk = fresh.hunk_by_index(static_cast<uint32_t>(i));
+    if (!(hunk.final_commit_id() == base_id)) {
+      result.append(hunk);
+      continue;
+    }
+
+    // These lines were traced back to the cached commit; their original line
+    // numbers index into the cached blame
+    if (hunk.orig_path() != path)
+      return false;
+    auto line = hunk.orig_start_line_number();
+    auto remaining = hunk.lines_in_hunk();
+    while (remaining) {
+      if (line > base.line_count())
+        return false;
+      auto cached = base.hunk_by_line(line);
+      auto offset = line - cached.final_start_line_number();
+      auto lines = std::min(remaining, cached.lines_in_hunk() - offset);
+      result.append(cached, cached.orig_start_line_number() + offset, lines);
+      line += lines;
+      remaining -= lines;
+    }
+  }
+  return true;
+}
+
+blame::hunk_list blame_cache::blame_full(const std::string &path,
+                                         const oid &commit_id) const {
+  git_blame_options options = options_;
+  options.newest_commit = *commit_id.c_ptr();
+
+  blame fresh(nullptr, ownership::user);
+  git_exception::throw_nonzero(
+      git_blame_file(&fresh.c_ptr_, repo_, path.c_str(), &options));
+  return blame::hunk_list(fresh);
+}
+
+void blame_cache::save(const std::string &path) const {
+  auto temporary_path = path + ".lock";
+  {
+    std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+    if (!out)
+      throw git_exception("failed to open " + temporary_path,
+                          git_exception::error_class::os);
+
+    out << blame_cache_magic << ' ' << blame_cache_version << '\n'
+        << size() << '\n';
+    for (auto &entry : entries_) {
+      for (auto &commit : entry.second.order) {
+        auto &hunks = entry.second.blames.at(commit);
+        write_string(out, entry.first.c_str());
+        out << ' ' << commit << ' ' << hunks.hunk_count() << '\n';
+        for (size_t i = 0; i < hunks.hunk_count(); ++i) {
+          auto hunk = hunks.hunk_by_index(i).c_ptr();
+          out << hunk->lines_in_hunk << ' '
+              << oid(&hunk->final_commit_id).to_hex_string() << ' '
+              << oid(&hunk->orig_commit_id).to_hex_string() << ' '
+              << hunk->orig_start_line_number << ' '
+              << static_cast<int>(hunk->boundary) << ' ';
+          write_string(out, hunk->orig_path);
+          write_signature(out, hunk->final_signature);
+          write_signature(out, hunk->orig_signature);
+          out << '\n';
+        }
+      }
+    }
+
+    out.flush();
+    if (!out) {
+      std::remove(temporary_path.c_str());
+      throw git_exception("failed to write " + temporary_path,
+                          git_exception::error_class::os);
+    }
+  }
+
+  if (std::rename(temporary_path.c_str(), path.c_str())) {
+    std::remove(temporary_path.c_str());
+    throw git_exception("failed to rename " + temporary_path + " to " + path,
+                        git_exception::error_class::os);
+  }
+}
+
+void blame_cache::load(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    throw git_exception("failed to open " + path,
+                        git_exception::error_class::os,
+                        git_exception::error_code::notfound);
+
+  std::string magic;
+  int version;
+  size_t entry_count;
+  if (!(in >> magic >> version >> entry_count) || magic != blame_cache_magic)
+    throw_malformed(path);
+  if (version != blame_cache_version)
+    throw git_exception("unsupported blame cache version in " + path,
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::invalid);
+
+  for (size_t e = 0; e < entry_count; ++e) {
+    std::string file_path, commit_hex;
+    size_t hunk_count;
+    if (!read_string(in, file_path) || !(in >> commit_hex >> hunk_count))
+      throw_malformed(path);
+
+    blame::hunk_list hunks;
+    for (size_t h = 0; h < hunk_count; ++h) {
+      git_blame_hunk hunk;
+      git_signature final_signature, orig_signature;
+      std::string final_hex, orig_hex, orig_path, final_name, final_email,
+          orig_name, orig_email;
+      int boundary;
+      bool has_final_signature, has_orig_signature;
+      memset(&hunk, 0, sizeof(hunk));
+      if (!(in >> hunk.lines_in_hunk >> final_hex >> orig_hex >>
+            hunk.orig_start_line_number >> boundary) ||
+          !read_string(in, orig_path) ||
+          !read_signature(in, final_signature, final_name, final_email,
+                          has_final_signature) ||
+          !read_signature(in, orig_signature, orig_name, orig_email,
+                          has_orig_signature))
+        throw_malformed(path);
+
+      hunk.final_commit_id = *oid(final_hex).c_ptr();
+      hunk.orig_commit_id = *oid(orig_hex).c_ptr();
+      hunk.orig_path = orig_path.c_str();
+      hunk.boundary = static_cast<char>(boundary);
+      hunk.final_signature = has_final_signature ? &final_signature : nullptr;
+      hunk.orig_signature = has_orig_signature ? &orig_signature : nullptr;
+      hunks.append(blame::hunk(&hunk));
+    }
+
+    // Validate the commit id before it becomes a key
+    oid commit_id(commit_hex);
+    insert(file_path, commit_id.to_hex_string(), std::move(hunks));
+  }
+}
+
+} // namespace cppgit2
@@ -0,0 +1,270 @@
+#include <cppgit2/bulk_write_session.hpp>
+#include <cppgit2/pack_writer.hpp>
+#include <git2/sys/odb_backend.h>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace cppgit2 {
+
+struct bulk_write_session::state {
+  std::mutex mutex;
+  std::unique_ptr<pack_writer> writer; // null between sessions
+  const bulk_write_session *owner;     // of the writer
+  git_odb_backend *backend;            // serving the session
+  int level;
+
+  // Whether `session` is the one open
+  bool is_open(const bulk_write_session *session) const {
+    return writer && owner == session;
+  }
+};
+
+// The object database keeps its backends until it is freed, so the first
+// session on a database adds one and later sessions reuse it and its state.
+// Between sessions it has no writer and answers like an empty database
+struct bulk_write_backend {
+  git_odb_backend parent;
+  std::shared_ptr<bulk_write_session::state> state;
+
+  static bulk_write_session::state &of(git_odb_backend *backend) {
+    return *reinterpret_cast<bulk_write_backend *>(backend)->state;
+  }
+
+  static int fail(const std::exception &e) {
+    git_error_set_str(GIT_ERROR_ODB, e.what());
+    return GIT_ERROR;
+  }
+
+  // A write racing with the end of the session
+  static int closed() {
+    git_error_set_str(GIT_ERROR_ODB, "bulk write session is closed");
+    return GIT_ERROR;
+  }
+
+  static void set_writable(bulk_write_session::state &s, bool writable) {
+    s.backend->write = writable ? &bulk_write_backend::write : nullptr;
+  }
+
+  static int read(void **data, size_t *size, git_object_t *type,
+                  git_odb_backend *backend, const git_oid *id) {
+    auto &s = of(backend);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!s.writer || !s.writer->read_header(*id, *type, *size))
+      return GIT_ENOTFOUND;
+    auto buffer =
+        static_cast<char *>(git_odb_backend_data_alloc(backend, *size + 1));
+    if (!buffer)
+      return GIT_ERROR;
+    try {
+      s.writer->read(*id, buffer);
+    } catch (const std::exception &e) {
+      git_odb_backend_data_free(backend, buffer);
+      return fail(e);
+    }
+    buffer[*size] = '\0';
+    *data = buffer;
+    return 0;
+  }
+
+  // The one object whose id starts with the `length` hex digits of `prefix`
+  static int find_prefix(git_odb_backend *backend, const git_oid *prefix,
+                         size_t length, git_oid &id) {
+    auto &s = of(backend);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    size_t found = s.writer ? s.writer->find_prefix(*prefix, length, id) : 0;
+    if (found == 0)
+      return GIT_ENOTFOUND;
+    if (found > 1) {
+      git_error_set_str(GIT_ERROR_ODB, "ambiguous SHA1 prefix");
+      return GIT_EAMBIGUOUS;
+    }
+    return 0;
+  }
+
+  static int read_prefix(git_oid *out, void **data, size_t *size,
+                         git_object_t *type, git_odb_backend *backend,
+                         const git_oid *prefix, size_t length) {
+    git_oid id;
+    if (int ret = find_prefix(backend, prefix, length, id))
+      return ret;
+    // The session may have ended in between
+    if (int ret = read(data, size, type, backend, &id))
+      return ret;
+    *out = id;
+    return 0;
+  }
+
+  static int exists_prefix(git_oid *out, git_odb_backend *backend,
+                           const git_oid *prefix, size_t length) {
+    git_oid id;
+    if (int ret = find_prefix(backend, prefix, length, id))
+      return ret;
+    *out = id;
+    return 0;
+  }
+
+  static int read_header(size_t *size, git_object_t *type,
+                         git_odb_backend *backend, const git_oid *id) {
+    auto &s = of(backend);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!s.writer || !s.writer->read_header(*id, *type, *size))
+      return GIT_ENOTFOUND;
+    return 0;
+  }
+
+  static int exists(git_odb_backend *backend, const git_oid *id) {
+    auto &s = of(backend);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.writer && s.writer->contains(*id);
+  }
+
+  // The object database gives up at the first backend that fails a write,
+  // so the backend only takes writes while a session is open (see
+  // set_writable), and writes go to loose objects in between
+  static int write(git_odb_backend *backend, const git_oid *id,
+                   const void *data, size_t size, git_object_t type) {
+    auto &s = of(backend);
+    int level;
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (!s.writer)
+        return closed();
+      if (s.writer->contains(*id))
+        return 0;
+      level = s.level;
+    }
+    try {
+      // Compress on the calling thread, outside the lock
+      std::vector<unsigned char> compressed;
+      pack_writer::compress(data, size, compressed, level);
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (!s.writer)
+        return closed();
+      s.writer->append(*id, type, size, compressed.data(), compressed.size());
+    } catch (const std::exception &e) {
+      return fail(e);
+    }
+    return 0;
+  }
+
+  static int foreach(git_odb_backend *backend, git_odb_foreach_cb cb,
+                     void *payload) {
+    std::vector<git_oid> ids;
+    {
+      auto &s = of(backend);
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (s.writer) {
+        ids.reserve(s.writer->size());
+        s.writer->for_each([&ids](const git_oid &id) { ids.push_back(id); });
+      }
+    }
+    for (auto &id : ids)
+      if (int ret = cb(&id, payload))
+        return ret;
+    return 0;
+  }
+
+  static void free(git_odb_backend *backend) {
+    delete reinterpret_cast<bulk_write_backend *>(backend);
+  }
+
+  // The state of the backend of `odb`, added on first use
+  static std::shared_ptr<bulk_write_session::state> attach(git_odb *odb) {
+    for (size_t i = 0, n = git_odb_num_backends(odb); i < n; ++i) {
+      git_odb_backend *existing = nullptr;
+      if (git_odb_get_backend(&existing, odb, i) == 0 &&
+          existing->free == &bulk_write_backend::free)
+        return reinterpret_cast<bulk_write_backend *>(existing)->state;
+    }
+
+    auto backend = new bulk_write_backend();
+    backend->state = std::make_shared<bulk_write_session::state>();
+    git_odb_init_backend(&backend->parent, GIT_ODB_BACKEND_VERSION);
+    backend->parent.read = &bulk_write_backend::read;
+    backend->parent.read_prefix = &bulk_write_backend::read_prefix;
+    backend->parent.read_header = &bulk_write_backend::read_header;
+    backend->parent.exists = &bulk_write_backend::exists;
+    backend->parent.exists_prefix = &bulk_write_backend::exists_prefix;
+    backend->parent.foreach = &bulk_write_backend::foreach;
+    backend->parent.free = &bulk_write_backend::free;
+    backend->state->backend = &backend->parent;
+    auto state = backend->state;
+    // Ahead of the loose and pack backends, for writes and reads alike
+    int ret = git_odb_add_backend(odb, &backend->parent,
+                                  std::numeric_limits<int>::max());
+    if (ret) {
+      delete backend;
+      git_exception::throw_nonzero(ret);
+    }
+    return state;
+  }
+};
+
+bulk_write_session::bulk_write_session(const repository &repo,
+                                       int compression_level)
+    : odb_(nullptr) {
+  git_exception::throw_nonzero(
+      git_repository_odb(&odb_, const_cast<git_repository *>(repo.c_ptr())));
+  try {
+    auto state = bulk_write_backend::attach(odb_);
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->writer)
+      throw git_exception(
+          "a bulk write session is already open on this repository",
+          git_exception::error_class::invalid,
+          git_exception::error_code::invalid);
+    state->writer.reset(new pack_writer(repo));
+    state->owner = this;
+    bulk_write_backend::set_writable(*state, true);
+    state->level = compression_level;
+    state_ = state;
+  } catch (...) {
+    git_odb_free(odb_);
+    throw;
+  }
+}
+
+bulk_write_session::~bulk_write_session() {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (state_->is_open(this)) {
+      state_->writer.reset();
+      bulk_write_backend::set_writable(*state_, false);
+    }
+  }
+  if (odb_)
+    git_odb_free(odb_);
+}
+
+oid bulk_write_session::write(const void *data, size_t length,
+                              cppgit2::object::object_type type) {
+  oid result;
+  git_exception::throw_nonzero(git_odb_write(
+      result.c_ptr(), odb_, data, length, static_cast<git_object_t>(type)));
+  return result;
+}
+
+size_t bulk_write_session::size() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->is_open(this) ? state_->writer->size() : 0;
+}
+
+bool bulk_write_session::is_open() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->is_open(this);
+}
+
+oid bulk_write_session::close() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  if (!state_->is_open(this))
+    throw git_exception("bulk write session is already closed",
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::invalid);
+  auto name = state_->writer->finish();
+  state_->writer.reset();
+  bulk_write_backend::set_writable(*state_, false);
+  return name;
+}
+
+} // namespace cppgit2
@@ -218,6 +218,8 @@ config config::snapshot() {
   return result;
 }
 
+config_view config::frozen_snapshot() const { return config_view(*this); }
+
 size_t config::size() const {
   size_t result{0};
   git_config_iterator *iter;
@@ -0,0 +1,334 @@
+#include <cppgit2/config.hpp>
+#include <cppgit2/config_view.hpp>
+#include <cppgit2/data_buffer.hpp>
+#include <cppgit2/repository.hpp>
+#include <cstring>
+#include <limits>
+#include <sys/stat.h>
+#include <unordered_map>
+
+namespace cppgit2 {
+
+namespace {
+
+// Section and key are case-insensitive; the subsection (between the first
+// and last dots) is not
+char folded(string_view name, size_t i, size_t first_dot, size_t last_dot) {
+  char c = name[i];
+  if ((i < first_dot || i > last_dot) && c >= 'A' && c <= 'Z')
+    c = static_cast<char>(c - 'A' + 'a');
+  return c;
+}
+
+uint64_t hash_name(string_view name) {
+  auto first_dot = name.find('.'), last_dot = name.rfind('.');
+  uint64_t hash = 14695981039346656037ULL; // FNV-1a
+  for (size_t i = 0; i < name.size(); ++i) {
+    hash ^= static_cast<unsigned char>(folded(name, i, first_dot, last_dot));
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// `stored` is normalized already (libgit2 lowercases section and key)
+bool same_name(string_view stored, string_view name) {
+  if (stored.size() != name.size())
+    return false;
+  auto first_dot = name.find('.'), last_dot = name.rfind('.');
+  for (size_t i = 0; i < name.size(); ++i)
+    if (stored[i] != folded(name, i, first_dot, last_dot))
+      return false;
+  return true;
+}
+
+[[noreturn]] void throw_not_found(string_view name) {
+  throw git_exception("config value '" + name.to_string() + "' was not found",
+                      git_exception::error_class::config,
+                      git_exception::error_code::notfound);
+}
+
+[[noreturn]] void throw_invalid(string_view name, const char *type) {
+  throw git_exception("failed to parse config value '" + name.to_string() +
+                          "' as " + type,
+                      git_exception::error_class::config,
+                      git_exception::error_code::invalid);
+}
+
+} // namespace
+
+config_view::config_view(const config &cfg) { build(cfg.c_ptr()); }
+
+config_view::config_view(const repository &repo)
+    : config_view(repository_files(repo)) {}
+
+// The files libgit2 loads for a repository, lowest priority first
+std::vector<config_view::watched_file>
+config_view::repository_files(const repository &repo) {
+  std::vector<watched_file> files;
+  struct global_file {
+    int (*find)(git_buf *);
+    git_config_level_t level;
+  };
+  const global_file globals[] = {
+      {git_config_find_programdata, GIT_CONFIG_LEVEL_PROGRAMDATA},
+      {git_config_find_system, GIT_CONFIG_LEVEL_SYSTEM},
+      {git_config_find_xdg, GIT_CONFIG_LEVEL_XDG},
+      {git_config_find_global, GIT_CONFIG_LEVEL_GLOBAL},
+  };
+  for (auto &global : globals) {
+    data_buffer path(nullptr);
+    if (global.find(path.c_ptr()) == 0)
+      files.push_back(stat_file(path.to_string(), global.level));
+  }
+  git_error_clear(); // files that were not found
+  files.push_back(
+      stat_file(repo.commondir() + "config", GIT_CONFIG_LEVEL_LOCAL));
+  return files;
+}
+
+// Files are looked at before they are read, so that a change made while
+// reading shows in is_current()
+config_view::config_view(std::vector<watched_file> files)
+    : files_(std::move(files)) {
+  git_config *cfg = nullptr;
+  git_exception::throw_nonzero(git_config_new(&cfg));
+  try {
+    for (auto &file : files_)
+      if (file.exists)
+        git_exception::throw_nonzero(git_config_add_file_ondisk(
+            cfg, file.path.c_str(), file.level, nullptr, 0));
+    build(cfg);
+  } catch (...) {
+    git_config_free(cfg);
+    throw;
+  }
+  git_config_free(cfg);
+}
+
+config_view::watched_file config_view::stat_file(const std::string &path,
+                                                 git_config_level_t level) {
+  watched_file file{path, level, false, 0, 0, 0};
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return file;
+  file.exists = true;
+  file.size = static_cast<int64_t>(st.st_size);
+#if defined(__APPLE__)
+  file.mtime_seconds = static_cast<int64_t>(st.st_mtimespec.tv_sec);
+  file.mtime_nanoseconds = static_cast<int64_t>(st.st_mtimespec.tv_nsec);
+#elif defined(_WIN32)
+  file.mtime_seconds = static_cast<int64_t>(st.st_mtime);
+#else
+  file.mtime_seconds = static_cast<int64_t>(st.st_mtim.tv_sec);
+  file.mtime_nanoseconds = static_cast<int64_t>(st.st_mtim.tv_nsec);
+#endif
+  return file;
+}
+
+void config_view::build(const git_config *cfg) {
+  // Values in the order libgit2 lists them (lowest priority first), then
+  // laid out again grouped by name
+  std::vector<value> read;
+  std::vector<uint32_t> read_group;
+  std::vector<std::string> names;
+  std::unordered_map<std::string, uint32_t> group_of;
+  std::string values_buffer;
+
+  git_config_iterator *iter = nullptr;
+  git_exception::throw_nonzero(git_config_iterator_new(&iter, cfg));
+  git_config_entry *entry = nullptr;
+  int ret;
+  while ((ret = git_config_next(&entry, iter)) == 0) {
+    value v;
+    v.offset = static_cast<uint32_t>(values_buffer.size());
+    v.is_set = entry->value != nullptr;
+    v.length = v.is_set ? static_cast<uint32_t>(strlen(entry->value)) : 0;
+    if (v.is_set)
+      values_buffer.append(entry->value, v.length);
+    int flag = 0;
+    v.is_bool = git_config_parse_bool(&flag, entry->value) == 0;
+    v.bool_value = flag != 0;
+    v.is_int = v.is_set && git_config_parse_int64(&v.int_value, entry->value) == 0;
+    read.push_back(v);
+
+    auto found = group_of.find(entry->name);
+    if (found == group_of.end()) {
+      found = group_of.emplace(entry->name, static_cast<uint32_t>(names.size()))
+                  .first;
+      names.push_back(entry->name);
+    }
+    read_group.push_back(found->second);
+  }
+  git_config_iterator_free(iter);
+  if (ret != GIT_ITEROVER)
+    git_exception::throw_nonzero(ret);
+  git_error_clear(); // values that did not parse as booleans or integers
+
+  if (values_buffer.size() + names.size() * 64 >
+      std::numeric_limits<uint32_t>::max())
+    throw git_exception("configuration too large",
+                        git_exception::error_class::config,
+                        git_exception::error_code::invalid);
+
+  // Names first, then the values group by group
+  buffer_.clear();
+  groups_.assign(names.size(), group{0, 0, 0, 0});
+  for (size_t g = 0; g < names.size(); ++g) {
+    groups_[g].name_offset = static_cast<uint32_t>(buffer_.size());
+    groups_[g].name_length = static_cast<uint32_t>(names[g].size());
+    buffer_ += names[g];
+  }
+  for (auto g : read_group)
+    ++groups_[g].count;
+  uint32_t first = 0;
+  for (auto &grp : groups_) {
+    grp.first = first;
+    first += grp.count;
+    grp.count = 0;
+  }
+  auto values_start = static_cast<uint32_t>(buffer_.size());
+  buffer_ += values_buffer;
+  values_.resize(read.size());
+  for (size_t i = 0; i < read.size(); ++i) {
+    auto &grp = groups_[read_group[i]];
+    auto &v = values_[grp.first + grp.count++];
+    v = read[i];
+    v.offset += values_start;
+  }
+
+  // Open addressing, linear probing, at most half full
+  size_t capacity = 8;
+  while (capacity < 2 * groups_.size())
+    capacity *= 2;
+  slots_.assign(capacity, 0);
+  for (size_t g = 0; g < groups_.size(); ++g) {
+    auto slot = hash_name(names[g]) & (capacity - 1);
+    while (slots_[slot])
+      slot = (slot + 1) & (capacity - 1);
+    slots_[slot] = static_cast<uint32_t>(g + 1);
+  }
+}
+
+const config_view::group *config_view::find_group(string_view name) const {
+  if (slots_.empty())
+    return nullptr;
+  auto mask = slots_.size() - 1;
+  for (auto slot = hash_name(name) & mask; slots_[slot];
+       slot = (slot + 1) & mask) {
+    auto &grp = groups_[slots_[slot] - 1];
+    if (same_name(string_view(buffer_.data() + grp.name_offset,
+                              grp.name_length),
+                  name))
+      return &grp;
+  }
+  return nullptr;
+}
+
+const config_view::value *config_view::find(string_view name) const {
+  auto grp = find_group(name);
+  return grp ? &values_[grp->first + grp->count - 1] : nullptr;
+}
+
+string_view config_view::value_as_string(string_view name) const {
+  auto v = find(name);
+  if (!v)
+    throw_not_found(name);
+  return string_view(buffer_.data() + v->offset, v->length);
+}
+
+bool config_view::value_as_bool(string_view name) const {
+  auto v = find(name);
+  if (!v)
+    throw_not_found(name);
+  if (!v->is_bool)
+    throw_invalid(name, "a boolean");
+  return v->bool_value;
+}
+
+int32_t config_view::value_as_int32(string_view name) const {
+  auto result = value_as_int64(name);
+  if (result < std::numeric_limits<int32_t>::min() ||
+      result > std::numeric_limits<int32_t>::max())
+    throw_invalid(name, "a 32-bit integer");
+  return static_cast<int32_t>(result);
+}
+
+int64_t config_view::value_as_int64(string_view name) const {
+  auto v = find(name);
+  if (!v)
+    throw_not_found(name);
+  if (!v->is_int)
+    throw_invalid(name, "an integer");
+  return v->int_value;
+}
+
+string_view config_view::value_as_string(string_view name,
+                                         string_view fallback) const {
+  return contains(name) ? value_as_string(name) : fallback;
+}
+
+bool config_view::value_as_bool(string_view name, bool fallback) const {
+  return contains(name) ? value_as_bool(name) : fallback;
+}
+
+int32_t config_view::value_as_int32(string_view name, int32_t fallback) const {
+  return contains(name) ? value_as_int32(name) : fallback;
+}
+
+int64_t config_view::value_as_int64(string_view name, int64_t fallback) const {
+  return contains(name) ? value_as_int64(name) : fallback;
+}
+
+std::vector<string_view> config_view::values(string_view name) const {
+  std::vector<string_view> result;
+  if (auto grp = find_group(name)) {
+    for (uint32_t i = 0; i < grp->count; ++i) {
+      auto &v = values_[grp->first + i];
+      result.push_back(string_view(buffer_.data() + v.offset, v.length));
+    }
+  }
+  return result;
+}
+
+bool config_view::is_current() const {
+  for (auto &file : files_) {
+    auto now = stat_file(file.path, file.level);
+    if (now.exists != file.exists || now.size != file.size ||
+        now.mtime_seconds != file.mtime_seconds ||
+        now.mtime_nanoseconds != file.mtime_nanoseconds)
+      return false;
+  }
+  return true;
+}
+
+config_view config_view::reload() const {
+  std::vector<watched_file> files;
+  for (auto &file : files_)
+    files.push_back(stat_file(file.path, file.level));
+  return config_view(std::move(files));
+}
+
+config_view_cache::config_view_cache(const repository &repo,
+                                     std::chrono::milliseconds check_interval)
+    : view_(std::make_shared<const config_view>(repo)),
+      interval_(check_interval), next_check_(0) {}
+
+std::shared_ptr<const config_view> config_view_cache::get() {
+  auto view = std::atomic_load(&view_);
+  auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+                 .count();
+  auto next = next_check_.load(std::memory_order_relaxed);
+  // One caller per interval wins the check
+  if (now >= next && next_check_.compare_exchange_strong(
+                         next, now + interval_.count())) {
+    if (!view->is_current()) {
+      auto fresh = std::make_shared<const config_view>(view->reload());
+      std::atomic_store(&view_, fresh);
+      view = fresh;
+    }
+  }
+  return view;
+}
+
+} // namespace cppgit2
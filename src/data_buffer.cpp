@@ -4,8 +4,12 @@
 namespace cppgit2 {
 
 
+data_buffer::data_buffer() { c_struct_ = GIT_BUF_INIT; }
+
 data_buffer::data_buffer(const git_buf *c_ptr) {
   c_struct_ = GIT_BUF_INIT;
+  if (!c_ptr)
+    return;
   c_struct_.size = c_ptr->size;
   c_struct_.ptr = c_ptr->ptr;
   c_struct_.reserved = c_ptr->reserved;
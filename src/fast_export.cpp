@@ -0,0 +1,367 @@
+#include <cppgit2/fast_export.hpp>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace cppgit2 {
+
+namespace {
+
+const size_t flush_threshold = 64 * 1024;
+const uint32_t submodule_mode = 0160000;
+
+bool starts_with(const std::string &text, const char *prefix) {
+  return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+std::string to_hex(const git_oid &id) {
+  char hex[GIT_OID_HEXSZ + 1];
+  return git_oid_tostr(hex, sizeof(hex), &id);
+}
+
+// The path as fast-import reads it: C-quoted if it starts with a quote or
+// holds a backslash or a control character
+std::string quote_path(const std::string &path) {
+  bool quote = !path.empty() && path[0] == '"';
+  for (unsigned char c : path)
+    if (c < 0x20 || c == '\\' || c == 0x7f)
+      quote = true;
+  if (!quote)
+    return path;
+  std::string result = "\"";
+  for (unsigned char c : path) {
+    switch (c) {
+    case '"': result += "\\\""; break;
+    case '\\': result += "\\\\"; break;
+    case '\a': result += "\\a"; break;
+    case '\b': result += "\\b"; break;
+    case '\f': result += "\\f"; break;
+    case '\n': result += "\\n"; break;
+    case '\r': result += "\\r"; break;
+    case '\t': result += "\\t"; break;
+    case '\v': result += "\\v"; break;
+    default:
+      if (c < 0x20 || c == 0x7f) {
+        char octal[5];
+        snprintf(octal, sizeof(octal), "\\%03o", c);
+        result += octal;
+      } else {
+        result += static_cast<char>(c);
+      }
+    }
+  }
+  return result + "\"";
+}
+
+// The value of header `name` in the raw header of a commit or tag, or ""
+std::string header_field(const std::string &header, const char *name) {
+  size_t length = strlen(name);
+  for (size_t pos = 0; pos < header.size();) {
+    size_t end = header.find('\n', pos);
+    if (end == std::string::npos)
+      end = header.size();
+    if (end - pos > length && header.compare(pos, length, name) == 0 &&
+        header[pos + length] == ' ')
+      return header.substr(pos + length + 1, end - pos - length - 1);
+    pos = end + 1;
+  }
+  return "";
+}
+
+std::string data_command(size_t size) {
+  return "data " + std::to_string(size) + "\n";
+}
+
+} // namespace
+
+fast_export::fast_export(const repository &repo)
+    : repo_(repo), odb_(nullptr), last_mark_(0), sink_(nullptr) {
+  git_exception::throw_nonzero(
+      git_repository_odb(&odb_, const_cast<git_repository *>(repo.c_ptr())));
+}
+
+fast_export::~fast_export() { git_odb_free(odb_); }
+
+void fast_export::push_reference(const std::string &name) {
+  git_reference *ref = nullptr, *resolved = nullptr;
+  auto repo = const_cast<git_repository *>(repo_.c_ptr());
+  git_exception::throw_nonzero(git_reference_lookup(&ref, repo, name.c_str()));
+  int ret = git_reference_resolve(&resolved, ref);
+  git_reference_free(ref);
+  git_exception::throw_nonzero(ret);
+  std::string full_name = git_reference_name(resolved);
+  git_reference_free(resolved);
+  if (std::find(refs_.begin(), refs_.end(), full_name) == refs_.end())
+    refs_.push_back(full_name);
+}
+
+void fast_export::push_glob(const std::string &glob) {
+  std::vector<std::string> names;
+  git_exception::throw_nonzero(git_reference_foreach_glob(
+      const_cast<git_repository *>(repo_.c_ptr()), glob.c_str(),
+      [](const char *name, void *payload) {
+        static_cast<std::vector<std::string> *>(payload)->push_back(name);
+        return 0;
+      },
+      &names));
+  for (auto &name : names)
+    push_reference(name);
+}
+
+void fast_export::hide(const oid &commit) { hidden_.push_back(*commit.c_ptr()); }
+
+fast_export::statistics fast_export::run(const sink &out) {
+  stats_ = statistics{0, 0, 0, 0, {}};
+  sink_ = &out;
+  buffer_.clear();
+  for (auto &name : refs_)
+    export_reference(name);
+  flush();
+  sink_ = nullptr;
+  return stats_;
+}
+
+fast_export::statistics fast_export::run(std::ostream &out) {
+  return run([&out](const char *data, size_t size) {
+    if (!out.write(data, static_cast<std::streamsize>(size)))
+      throw git_exception("fast-export: failed to write output",
+                          git_exception::error_class::os);
+  });
+}
+
+void fast_export::write(const char *data, size_t size) {
+  if (size >= flush_threshold) {
+    flush();
+    (*sink_)(data, size);
+    return;
+  }
+  buffer_.append(data, size);
+  if (buffer_.size() >= flush_threshold)
+    flush();
+}
+
+void fast_export::flush() {
+  if (!buffer_.empty())
+    (*sink_)(buffer_.data(), buffer_.size());
+  buffer_.clear();
+}
+
+void fast_export::write_reference(const git_oid &id) {
+  auto it = marks_.find(id);
+  write(it != marks_.end() ? ":" + std::to_string(it->second) : to_hex(id));
+}
+
+void fast_export::export_reference(const std::string &name) {
+  git_oid target;
+  git_exception::throw_nonzero(git_reference_name_to_id(
+      &target, const_cast<git_repository *>(repo_.c_ptr()), name.c_str()));
+
+  // Peel tags, keeping the outermost one for the tag command
+  std::string raw_tag;
+  size_t size;
+  git_object_t type;
+  git_exception::throw_nonzero(
+      git_odb_read_header(&size, &type, odb_, &target));
+  while (type == GIT_OBJECT_TAG) {
+    git_odb_object *object = nullptr;
+    git_exception::throw_nonzero(git_odb_read(&object, odb_, &target));
+    std::string text(static_cast<const char *>(git_odb_object_data(object)),
+                     git_odb_object_size(object));
+    git_odb_object_free(object);
+    auto header = text.substr(0, text.find("\n\n"));
+    if (raw_tag.empty())
+      raw_tag = text;
+    if (git_oid_fromstr(&target, header_field(header, "object").c_str()) ||
+        (type = git_object_string2type(header_field(header, "type").c_str())) ==
+            GIT_OBJECT_INVALID)
+      throw git_exception("fast-export: malformed tag in " + name,
+                          git_exception::error_class::object,
+                          git_exception::error_code::invalid);
+  }
+  bool annotated = !raw_tag.empty() && starts_with(name, "refs/tags/");
+
+  if (type == GIT_OBJECT_COMMIT) {
+    if (export_commits(name, target) == 0 && !annotated) {
+      write("reset " + name + "\nfrom ");
+      write_reference(target);
+      write("\n\n");
+      stats_.resets++;
+    }
+  } else if (type == GIT_OBJECT_BLOB && annotated) {
+    export_blob(target);
+  } else {
+    stats_.refs_skipped.push_back(name);
+    return;
+  }
+  if (annotated)
+    export_tag(name.substr(strlen("refs/tags/")), raw_tag, target);
+}
+
+int fast_export::is_exported(const git_oid *id, void *payload) {
+  return static_cast<fast_export *>(payload)->marks_.count(*id) ? 1 : 0;
+}
+
+size_t fast_export::export_commits(const std::string &ref,
+                                   const git_oid &tip) {
+  if (marks_.count(tip))
+    return 0;
+  auto walk = repo_.create_revwalk();
+  walk.set_sorting_mode(revwalk::sort::topological | revwalk::sort::reverse);
+  walk.push(oid(&tip));
+  for (auto &id : hidden_)
+    walk.hide(oid(&id));
+  // Whatever has a mark was written by an earlier reference or export
+  git_exception::throw_nonzero(git_revwalk_add_hide_cb(
+      const_cast<git_revwalk *>(walk.c_ptr()), &fast_export::is_exported,
+      this));
+
+  size_t count = 0;
+  for (;;) {
+    auto id = walk.next();
+    if (walk.done())
+      break;
+    export_commit(ref, repo_.lookup_commit(id));
+    count++;
+  }
+  return count;
+}
+
+void fast_export::export_commit(const std::string &ref, const commit &c) {
+  auto parents = c.parent_count();
+  auto changes = repo_.create_diff_tree_to_tree(
+      parents ? c.parent(0).tree() : tree(), c.tree());
+
+  // The blobs go first, then the commit refers to them by mark; deletions
+  // come before modifications so a file can replace a directory
+  std::string deletions, modifications;
+  char mode[16];
+  for (size_t i = 0, n = changes.size(); i < n; ++i) {
+    auto change = changes[i];
+    if (change.status() == diff::delta::type::deleted) {
+      deletions += "D " + quote_path(change.old_file().path()) + "\n";
+      continue;
+    }
+    auto file = change.new_file();
+    auto id = *file.id().c_ptr();
+    snprintf(mode, sizeof(mode), "%06o", static_cast<unsigned>(file.mode()));
+    modifications += "M ";
+    modifications += mode;
+    if (file.mode() == submodule_mode) {
+      modifications += ' ' + to_hex(id);
+    } else {
+      export_blob(id);
+      modifications += " :" + std::to_string(marks_[id]);
+    }
+    modifications += ' ' + quote_path(file.path()) + "\n";
+  }
+
+  // A root commit must not continue the history the branch already has
+  if (!parents)
+    write("reset " + ref + "\n");
+  auto id = *c.id().c_ptr();
+  marks_[id] = ++last_mark_;
+  write("commit " + ref + "\nmark :" + std::to_string(last_mark_) + "\n");
+  auto header = c.raw_header();
+  write("author " + header_field(header, "author") + "\n");
+  write("committer " + header_field(header, "committer") + "\n");
+  auto encoding = header_field(header, "encoding");
+  if (!encoding.empty())
+    write("encoding " + encoding + "\n");
+  auto message = c.message_raw();
+  write(data_command(message.size()) + message);
+  for (unsigned int i = 0; i < parents; ++i) {
+    write(i ? "merge " : "from ");
+    write_reference(*c.parent_id(i).c_ptr());
+    write("\n");
+  }
+  write(deletions + modifications + "\n");
+  stats_.commits++;
+}
+
+void fast_export::export_blob(const git_oid &id) {
+  if (marks_.count(id))
+    return;
+  git_odb_object *object = nullptr;
+  git_exception::throw_nonzero(git_odb_read(&object, odb_, &id));
+  marks_[id] = ++last_mark_;
+  auto size = git_odb_object_size(object);
+  write("blob\nmark :" + std::to_string(last_mark_) + "\n" +
+        data_command(size));
+  try {
+    write(static_cast<const char *>(git_odb_object_data(object)), size);
+  } catch (...) {
+    git_odb_object_free(object);
+    throw;
+  }
+  git_odb_object_free(object);
+  write("\n", 1);
+  stats_.blobs++;
+}
+
+void fast_export::export_tag(const std::string &name, const std::string &raw_tag,
+                             const git_oid &target) {
+  size_t end = raw_tag.find("\n\n");
+  auto header = raw_tag.substr(0, end);
+  auto message = end == std::string::npos ? "" : raw_tag.substr(end + 2);
+  write("tag " + name + "\nfrom ");
+  write_reference(target);
+  write("\n");
+  auto tagger = header_field(header, "tagger");
+  if (!tagger.empty())
+    write("tagger " + tagger + "\n");
+  write(data_command(message.size()) + message + "\n");
+  stats_.tags++;
+}
+
+void fast_export::import_marks(const std::string &path) {
+  std::ifstream file(path);
+  if (!file)
+    throw git_exception("failed to open " + path,
+                        git_exception::error_class::os,
+                        git_exception::error_code::notfound);
+  std::string line;
+  while (std::getline(file, line)) {
+    // ":<mark> <hex id>"
+    size_t space = line.find(' ');
+    git_oid id;
+    if (line.empty() || line[0] != ':' || space == std::string::npos ||
+        line.size() - space - 1 != GIT_OID_HEXSZ ||
+        git_oid_fromstrn(&id, line.c_str() + space + 1, GIT_OID_HEXSZ))
+      throw git_exception("fast-export: invalid mark line in " + path + ": " +
+                              line,
+                          git_exception::error_class::invalid,
+                          git_exception::error_code::invalid);
+    auto mark = strtoumax(line.c_str() + 1, nullptr, 10);
+    marks_[id] = mark;
+    last_mark_ = std::max(last_mark_, mark);
+  }
+}
+
+void fast_export::export_marks(const std::string &path) const {
+  std::vector<std::pair<uintmax_t, git_oid>> sorted;
+  sorted.reserve(marks_.size());
+  for (auto &m : marks_)
+    sorted.emplace_back(m.second, m.first);
+  std::sort(sorted.begin(), sorted.end(),
+            [](const std::pair<uintmax_t, git_oid> &a,
+               const std::pair<uintmax_t, git_oid> &b) {
+              return a.first < b.first;
+            });
+  auto temp = path + ".lock";
+  {
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    for (auto &m : sorted)
+      file << ':' << m.first << ' ' << to_hex(m.second) << '\n';
+    if (!file.flush())
+      throw git_exception("failed to write " + temp,
+                          git_exception::error_class::os);
+  }
+  if (std::rename(temp.c_str(), path.c_str()) != 0)
+    throw git_exception("failed to rename " + temp,
+                        git_exception::error_class::os);
+}
+
+} // namespace cppgit2
@@ -0,0 +1,816 @@
+#include <cppgit2/fast_import.hpp>
+#include <cppgit2/tree_view.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+namespace {
+
+const uint32_t directory_mode = 0040000;
+
+bool starts_with(const std::string &text, const char *prefix) {
+  return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+bool is_zero(const git_oid &id) {
+  static const git_oid zero = {{0}};
+  return !memcmp(id.id, zero.id, GIT_OID_RAWSZ);
+}
+
+void throw_parse_error(const std::string &what, const std::string &line) {
+  throw git_exception("fast-import: " + what + ": " + line,
+                      git_exception::error_class::invalid,
+                      git_exception::error_code::invalid);
+}
+
+// A path, C-quoted or not; an unquoted path ends at a space unless it is
+// `last` on its line
+std::string parse_path(const std::string &line, size_t &pos, bool last) {
+  std::string path;
+  if (pos < line.size() && line[pos] == '"') {
+    for (++pos; pos < line.size() && line[pos] != '"'; ++pos) {
+      char c = line[pos];
+      if (c != '\\') {
+        path += c;
+        continue;
+      }
+      if (++pos >= line.size())
+        break;
+      c = line[pos];
+      switch (c) {
+      case 'a': path += '\a'; break;
+      case 'b': path += '\b'; break;
+      case 'f': path += '\f'; break;
+      case 'n': path += '\n'; break;
+      case 'r': path += '\r'; break;
+      case 't': path += '\t'; break;
+      case 'v': path += '\v'; break;
+      default:
+        if (c >= '0' && c <= '3' && pos + 2 < line.size()) {
+          path += static_cast<char>(((c - '0') << 6) |
+                                    ((line[pos + 1] - '0') << 3) |
+                                    (line[pos + 2] - '0'));
+          pos += 2;
+        } else {
+          path += c; // \\ and \"
+        }
+      }
+    }
+    if (pos >= line.size())
+      throw_parse_error("unterminated quoted path", line);
+    ++pos;
+  } else {
+    size_t end = last ? line.size() : line.find(' ', pos);
+    if (end == std::string::npos)
+      end = line.size();
+    path = line.substr(pos, end - pos);
+    pos = end;
+  }
+  return path;
+}
+
+std::vector<std::string> split_path(const std::string &path,
+                                    const std::string &line) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  for (;;) {
+    size_t slash = path.find('/', start);
+    auto part = path.substr(start, slash == std::string::npos
+                                       ? std::string::npos
+                                       : slash - start);
+    if (part.empty() || part == "." || part == "..")
+      throw_parse_error("invalid path", line);
+    parts.push_back(part);
+    if (slash == std::string::npos)
+      return parts;
+    start = slash + 1;
+  }
+}
+
+uint32_t parse_mode(const std::string &text, const std::string &line) {
+  char *end = nullptr;
+  auto mode = static_cast<uint32_t>(strtoul(text.c_str(), &end, 8));
+  if (*end)
+    throw_parse_error("invalid mode", line);
+  switch (mode) {
+  case 0644:
+    return 0100644;
+  case 0755:
+    return 0100755;
+  case 0100644:
+  case 0100755:
+  case 0120000:
+  case 0160000:
+  case directory_mode:
+    return mode;
+  default:
+    throw_parse_error("invalid mode", line);
+  }
+  return 0;
+}
+
+// Order of entries in a tree object: directories compare as if their name
+// ended with '/'
+bool git_order(const std::string &a, bool a_is_tree, const std::string &b,
+               bool b_is_tree) {
+  size_t common = std::min(a.size(), b.size());
+  int result = memcmp(a.data(), b.data(), common);
+  if (result)
+    return result < 0;
+  unsigned char left = a.size() > common
+                           ? static_cast<unsigned char>(a[common])
+                           : (a_is_tree ? '/' : '\0');
+  unsigned char right = b.size() > common
+                            ? static_cast<unsigned char>(b[common])
+                            : (b_is_tree ? '/' : '\0');
+  return left < right;
+}
+
+} // namespace
+
+// Buffered line reader over the stream
+class fast_import::input {
+public:
+  explicit input(const std::function<size_t(char *, size_t)> &read)
+      : read_(read), buffer_(1 << 20), begin_(0), end_(0), pushed_(false) {}
+
+  // Next line, without its LF; false at the end of the stream
+  bool line(std::string &out) {
+    if (pushed_) {
+      pushed_ = false;
+      out.swap(pending_);
+      return true;
+    }
+    out.clear();
+    for (;;) {
+      if (begin_ == end_ && !fill())
+        return !out.empty();
+      auto start = buffer_.data() + begin_;
+      auto newline =
+          static_cast<const char *>(memchr(start, '\n', end_ - begin_));
+      if (newline) {
+        out.append(start, static_cast<size_t>(newline - start));
+        begin_ += static_cast<size_t>(newline - start) + 1;
+        return true;
+      }
+      out.append(start, end_ - begin_);
+      begin_ = end_;
+    }
+  }
+
+  // Make `text` the next line again
+  void unread(const std::string &text) {
+    pending_ = text;
+    pushed_ = true;
+  }
+
+  // Append exactly `size` bytes to `out`
+  void read(std::string &out, size_t size) {
+    while (size) {
+      if (begin_ == end_ && !fill())
+        throw git_exception("fast-import: truncated data",
+                            git_exception::error_class::invalid,
+                            git_exception::error_code::invalid);
+      size_t n = std::min(size, end_ - begin_);
+      out.append(buffer_.data() + begin_, n);
+      begin_ += n;
+      size -= n;
+    }
+  }
+
+  // Consume the next byte if it is a LF
+  void skip_newline() {
+    if ((begin_ < end_ || fill()) && buffer_[begin_] == '\n')
+      begin_++;
+  }
+
+private:
+  bool fill() {
+    begin_ = 0;
+    end_ = read_(buffer_.data(), buffer_.size());
+    return end_ > 0;
+  }
+
+  const std::function<size_t(char *, size_t)> &read_;
+  std::vector<char> buffer_;
+  size_t begin_, end_;
+  std::string pending_;
+  bool pushed_;
+};
+
+fast_import::fast_import(const repository &repo)
+    : repo_(repo), odb_(nullptr), force_(false) {
+  git_exception::throw_nonzero(
+      git_repository_odb(&odb_, const_cast<git_repository *>(repo.c_ptr())));
+}
+
+fast_import::~fast_import() {
+  session_.reset(); // discards objects of an interrupted import
+  git_odb_free(odb_);
+}
+
+fast_import::statistics fast_import::run(std::istream &in) {
+  return import_stream([&in](char *buffer, size_t size) {
+    in.read(buffer, static_cast<std::streamsize>(size));
+    if (in.bad())
+      throw git_exception("fast-import: failed to read input",
+                          git_exception::error_class::os);
+    return static_cast<size_t>(in.gcount());
+  });
+}
+
+fast_import::statistics fast_import::run(int fd) {
+#ifdef _WIN32
+  (void)fd;
+  throw git_exception("fast-import from a file descriptor is not supported "
+                      "on this platform",
+                      git_exception::error_class::os);
+#else
+  return import_stream([fd](char *buffer, size_t size) {
+    for (;;) {
+      auto n = ::read(fd, buffer, size);
+      if (n >= 0)
+        return static_cast<size_t>(n);
+      if (errno != EINTR)
+        throw git_exception("fast-import: failed to read input",
+                            git_exception::error_class::os);
+    }
+  });
+#endif
+}
+
+fast_import::statistics
+fast_import::import_stream(
+    const std::function<size_t(char *, size_t)> &read) {
+  stats_ = statistics{0, 0, 0, 0, 0, {}};
+  // Drop the session of an interrupted import before starting this one
+  session_.reset();
+  session_.reset(new bulk_write_session(repo_));
+  input in(read);
+  std::string line;
+  while (in.line(line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    if (line == "blob")
+      parse_blob(in);
+    else if (starts_with(line, "commit "))
+      parse_commit(in, line.substr(7));
+    else if (starts_with(line, "tag "))
+      parse_tag(in, line.substr(4));
+    else if (starts_with(line, "reset "))
+      parse_reset(in, line.substr(6));
+    else if (line == "checkpoint") {
+      // update_refs() closed the session; the next pack reuses its odb
+      // backend
+      update_refs();
+      session_.reset(new bulk_write_session(repo_));
+    } else if (starts_with(line, "progress ")) {
+      if (progress_)
+        progress_(string_view(line.data() + 9, line.size() - 9));
+    } else if (line == "done")
+      break;
+    else if (starts_with(line, "feature "))
+      parse_feature(line.substr(8));
+    else if (!starts_with(line, "option "))
+      throw_parse_error("unsupported command", line);
+  }
+  update_refs();
+  session_.reset();
+  if (!export_marks_path_.empty())
+    export_marks(export_marks_path_);
+  return stats_;
+}
+
+void fast_import::parse_feature(const std::string &feature) {
+  if (feature == "done" || feature == "date-format=raw")
+    return;
+  if (feature == "force")
+    force_ = true;
+  else if (starts_with(feature, "import-marks="))
+    import_marks(feature.substr(13));
+  else if (starts_with(feature, "import-marks-if-exists=")) {
+    auto path = feature.substr(23);
+    if (std::ifstream(path))
+      import_marks(path);
+  } else if (starts_with(feature, "export-marks="))
+    export_marks_path_ = feature.substr(13);
+  else
+    throw_parse_error("unsupported feature", feature);
+}
+
+bool fast_import::parse_mark(input &in, uintmax_t &mark) {
+  std::string line;
+  if (!in.line(line))
+    return false;
+  if (!starts_with(line, "mark :")) {
+    in.unread(line);
+    return false;
+  }
+  mark = strtoumax(line.c_str() + 6, nullptr, 10);
+  return true;
+}
+
+void fast_import::read_data(input &in, std::string &out) {
+  std::string line;
+  while (in.line(line) && starts_with(line, "original-oid "))
+    ;
+  if (!starts_with(line, "data "))
+    throw_parse_error("expected data", line);
+  out.clear();
+  if (starts_with(line, "data <<")) {
+    // Delimited format: lines up to the delimiter
+    auto delimiter = line.substr(7);
+    std::string text;
+    for (;;) {
+      if (!in.line(text))
+        throw_parse_error("unterminated data", line);
+      if (text == delimiter)
+        break;
+      out += text;
+      out += '\n';
+    }
+  } else {
+    in.read(out, static_cast<size_t>(strtoull(line.c_str() + 5, nullptr, 10)));
+  }
+  in.skip_newline();
+}
+
+git_oid fast_import::write_object(const std::string &data, git_object_t type) {
+  git_oid id;
+  git_exception::throw_nonzero(
+      git_odb_write(&id, odb_, data.data(), data.size(), type));
+  return id;
+}
+
+void fast_import::parse_blob(input &in) {
+  uintmax_t mark = 0;
+  bool has_mark = parse_mark(in, mark);
+  read_data(in, data_);
+  auto id = write_object(data_, GIT_OBJECT_BLOB);
+  stats_.blobs++;
+  if (has_mark)
+    marks_[mark] = id;
+}
+
+git_oid fast_import::resolve(const std::string &commitish) {
+  git_oid id;
+  if (starts_with(commitish, ":")) {
+    auto it = marks_.find(strtoumax(commitish.c_str() + 1, nullptr, 10));
+    if (it == marks_.end())
+      throw_parse_error("unknown mark", commitish);
+    return it->second;
+  }
+  auto branch = branches_.find(commitish);
+  if (branch != branches_.end() && branch->second.has_tip)
+    return branch->second.tip;
+  if (commitish.size() == GIT_OID_HEXSZ &&
+      git_oid_fromstrn(&id, commitish.c_str(), GIT_OID_HEXSZ) == 0)
+    return id;
+  git_object *object = nullptr;
+  if (git_revparse_single(&object,
+                          const_cast<git_repository *>(repo_.c_ptr()),
+                          commitish.c_str()))
+    throw_parse_error("cannot resolve", commitish);
+  id = *git_object_id(object);
+  git_object_free(object);
+  return id;
+}
+
+git_oid fast_import::commit_tree(const git_oid &commit) {
+  auto it = commit_trees_.find(commit);
+  if (it != commit_trees_.end())
+    return it->second;
+  git_odb_object *object = nullptr;
+  git_exception::throw_nonzero(git_odb_read(&object, odb_, &commit));
+  auto data = static_cast<const char *>(git_odb_object_data(object));
+  git_oid tree;
+  bool valid = git_odb_object_type(object) == GIT_OBJECT_COMMIT &&
+               git_odb_object_size(object) > 5 + GIT_OID_HEXSZ &&
+               !memcmp(data, "tree ", 5) &&
+               git_oid_fromstrn(&tree, data + 5, GIT_OID_HEXSZ) == 0;
+  git_odb_object_free(object);
+  if (!valid)
+    throw_parse_error("not a commit", oid(&commit).to_hex_string());
+  commit_trees_.emplace(commit, tree);
+  return tree;
+}
+
+void fast_import::reset_branch(branch &b, const git_oid *tip) {
+  b.root.mode = directory_mode;
+  b.has_tip = tip != nullptr;
+  if (tip) {
+    b.tip = *tip;
+    b.root.id = commit_tree(*tip);
+    b.root.subtree.reset();
+  } else {
+    b.root.subtree.reset(new tree_node());
+    b.root.subtree->dirty = true;
+  }
+}
+
+fast_import::branch &fast_import::lookup_branch(const std::string &ref) {
+  auto it = branches_.find(ref);
+  if (it != branches_.end())
+    return it->second;
+  // As in git fast-import, the ref is not read: without `from`, the first
+  // commit on a branch is a root commit, even if the ref exists
+  auto &b = branches_[ref];
+  reset_branch(b, nullptr);
+  return b;
+}
+
+fast_import::tree_node &fast_import::load(tree_entry &dir) {
+  if (!dir.subtree) {
+    std::unique_ptr<tree_node> node(new tree_node());
+    tree_view entries(repo_, oid(&dir.id));
+    for (auto &e : entries)
+      node->entries.emplace(e.name.to_string(),
+                            tree_entry{e.mode, *e.raw_id, nullptr});
+    dir.subtree = std::move(node);
+  }
+  return *dir.subtree;
+}
+
+fast_import::tree_entry *
+fast_import::find(tree_entry &dir, const std::vector<std::string> &path,
+                  size_t depth) {
+  auto &node = load(dir);
+  auto it = node.entries.find(path[depth]);
+  if (it == node.entries.end())
+    return nullptr;
+  if (depth + 1 == path.size())
+    return &it->second;
+  if (it->second.mode != directory_mode)
+    return nullptr;
+  return find(it->second, path, depth + 1);
+}
+
+void fast_import::set_path(tree_entry &dir,
+                           const std::vector<std::string> &path, size_t depth,
+                           uint32_t mode, const git_oid &id) {
+  auto &node = load(dir);
+  node.dirty = true;
+  auto &e = node.entries[path[depth]];
+  if (depth + 1 == path.size()) {
+    e.mode = mode;
+    e.id = id;
+    e.subtree.reset();
+    return;
+  }
+  if (e.mode != directory_mode) {
+    // New directory, or one replacing a file
+    e.mode = directory_mode;
+    e.subtree.reset(new tree_node());
+    e.subtree->dirty = true;
+  }
+  set_path(e, path, depth + 1, mode, id);
+}
+
+bool fast_import::remove_path(tree_entry &dir,
+                              const std::vector<std::string> &path,
+                              size_t depth) {
+  auto &node = load(dir);
+  auto it = node.entries.find(path[depth]);
+  if (it == node.entries.end())
+    return false;
+  if (depth + 1 == path.size()) {
+    node.entries.erase(it);
+  } else {
+    if (it->second.mode != directory_mode ||
+        !remove_path(it->second, path, depth + 1))
+      return false;
+    // git has no empty directories
+    if (it->second.subtree->entries.empty())
+      node.entries.erase(it);
+  }
+  node.dirty = true;
+  return true;
+}
+
+const git_oid &fast_import::write_tree(tree_entry &dir) {
+  if (!dir.subtree || !dir.subtree->dirty)
+    return dir.id;
+  std::vector<std::pair<const std::string *, tree_entry *>> entries;
+  entries.reserve(dir.subtree->entries.size());
+  for (auto &child : dir.subtree->entries) {
+    auto &e = child.second;
+    if (e.mode == directory_mode) {
+      write_tree(e);
+      if (e.subtree && e.subtree->entries.empty())
+        continue;
+    }
+    entries.emplace_back(&child.first, &e);
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const std::pair<const std::string *, tree_entry *> &a,
+               const std::pair<const std::string *, tree_entry *> &b) {
+              return git_order(*a.first, a.second->mode == directory_mode,
+                               *b.first, b.second->mode == directory_mode);
+            });
+
+  std::string data;
+  for (auto &entry : entries) {
+    char mode[8];
+    snprintf(mode, sizeof(mode), "%o", entry.second->mode);
+    data += mode;
+    data += ' ';
+    data += *entry.first;
+    data += '\0';
+    data.append(reinterpret_cast<const char *>(entry.second->id.id),
+                GIT_OID_RAWSZ);
+  }
+  dir.id = write_object(data, GIT_OBJECT_TREE);
+  dir.subtree->dirty = false;
+  stats_.trees++;
+  return dir.id;
+}
+
+void fast_import::parse_file_change(input &in, const std::string &line,
+                                    branch &b) {
+  if (line == "deleteall") {
+    b.root.subtree.reset(new tree_node());
+    b.root.subtree->dirty = true;
+    return;
+  }
+  size_t pos = 2;
+  if (line[0] == 'D') {
+    remove_path(b.root, split_path(parse_path(line, pos, true), line), 0);
+    return;
+  }
+  if (line[0] == 'C' || line[0] == 'R') {
+    auto source = split_path(parse_path(line, pos, false), line);
+    if (pos >= line.size() || line[pos] != ' ')
+      throw_parse_error("missing destination", line);
+    ++pos;
+    auto target = split_path(parse_path(line, pos, true), line);
+    auto entry = find(b.root, source, 0);
+    if (!entry)
+      throw_parse_error("path not in branch", line);
+    uint32_t mode = entry->mode;
+    git_oid id = mode == directory_mode ? write_tree(*entry) : entry->id;
+    if (line[0] == 'R')
+      remove_path(b.root, source, 0);
+    set_path(b.root, target, 0, mode, id);
+    return;
+  }
+
+  // M <mode> <dataref> <path>
+  size_t space = line.find(' ', pos);
+  if (space == std::string::npos)
+    throw_parse_error("invalid file change", line);
+  uint32_t mode = parse_mode(line.substr(pos, space - pos), line);
+  pos = space + 1;
+  space = line.find(' ', pos);
+  if (space == std::string::npos)
+    throw_parse_error("invalid file change", line);
+  auto dataref = line.substr(pos, space - pos);
+  pos = space + 1;
+  auto path = split_path(parse_path(line, pos, true), line);
+  git_oid id;
+  if (dataref == "inline") {
+    read_data(in, data_);
+    id = write_object(data_, GIT_OBJECT_BLOB);
+    stats_.blobs++;
+  } else {
+    id = resolve(dataref);
+  }
+  set_path(b.root, path, 0, mode, id);
+}
+
+void fast_import::parse_commit(input &in, const std::string &ref) {
+  auto &b = lookup_branch(ref);
+  uintmax_t mark = 0;
+  bool has_mark = parse_mark(in, mark);
+
+  std::string line, author, committer, encoding, message;
+  while (in.line(line)) {
+    if (starts_with(line, "author "))
+      author = line.substr(7);
+    else if (starts_with(line, "committer "))
+      committer = line.substr(10);
+    else if (starts_with(line, "encoding "))
+      encoding = line.substr(9);
+    else if (!starts_with(line, "original-oid "))
+      break;
+  }
+  if (committer.empty())
+    throw_parse_error("missing committer", ref);
+  in.unread(line);
+  read_data(in, message);
+
+  std::vector<git_oid> merges;
+  bool more = in.line(line);
+  if (more && starts_with(line, "from ")) {
+    auto from = resolve(line.substr(5));
+    if (is_zero(from))
+      reset_branch(b, nullptr);
+    else if (!b.has_tip || !git_oid_equal(&from, &b.tip))
+      reset_branch(b, &from);
+    more = in.line(line);
+  }
+  for (; more && starts_with(line, "merge "); more = in.line(line))
+    merges.push_back(resolve(line.substr(6)));
+  for (; more && (starts_with(line, "M ") || starts_with(line, "D ") ||
+                  starts_with(line, "C ") || starts_with(line, "R ") ||
+                  line == "deleteall");
+       more = in.line(line))
+    parse_file_change(in, line, b);
+  if (more) {
+    if (starts_with(line, "N "))
+      throw_parse_error("notes are not supported", line);
+    in.unread(line);
+  }
+
+  auto tree = write_tree(b.root);
+  char hex[GIT_OID_HEXSZ + 1];
+  std::string text = "tree ";
+  text += git_oid_tostr(hex, sizeof(hex), &tree);
+  text += '\n';
+  auto add_parent = [&](const git_oid &parent) {
+    text += "parent ";
+    text += git_oid_tostr(hex, sizeof(hex), &parent);
+    text += '\n';
+  };
+  if (b.has_tip)
+    add_parent(b.tip);
+  for (auto &parent : merges)
+    add_parent(parent);
+  text += "author " + (author.empty() ? committer : author) + "\n";
+  text += "committer " + committer + "\n";
+  if (!encoding.empty())
+    text += "encoding " + encoding + "\n";
+  text += '\n';
+  text += message;
+
+  auto id = write_object(text, GIT_OBJECT_COMMIT);
+  stats_.commits++;
+  b.has_tip = true;
+  b.tip = id;
+  commit_trees_.emplace(id, tree);
+  if (has_mark)
+    marks_[mark] = id;
+}
+
+void fast_import::parse_tag(input &in, const std::string &name) {
+  uintmax_t mark = 0;
+  bool has_mark = parse_mark(in, mark);
+  std::string line, tagger, message;
+  if (!in.line(line) || !starts_with(line, "from "))
+    throw_parse_error("expected from", line);
+  auto target = resolve(line.substr(5));
+  while (in.line(line)) {
+    if (starts_with(line, "tagger "))
+      tagger = line.substr(7);
+    else if (!starts_with(line, "original-oid "))
+      break;
+  }
+  in.unread(line);
+  read_data(in, message);
+
+  size_t size;
+  git_object_t type;
+  git_exception::throw_nonzero(
+      git_odb_read_header(&size, &type, odb_, &target));
+  char hex[GIT_OID_HEXSZ + 1];
+  std::string text = "object ";
+  text += git_oid_tostr(hex, sizeof(hex), &target);
+  text += "\ntype ";
+  text += git_object_type2string(type);
+  text += "\ntag " + name + "\n";
+  if (!tagger.empty())
+    text += "tagger " + tagger + "\n";
+  text += '\n';
+  text += message;
+
+  auto id = write_object(text, GIT_OBJECT_TAG);
+  stats_.tags++;
+  tags_["refs/tags/" + name] = id;
+  if (has_mark)
+    marks_[mark] = id;
+}
+
+void fast_import::parse_reset(input &in, const std::string &ref) {
+  auto &b = branches_[ref];
+  std::string line;
+  if (in.line(line)) {
+    if (starts_with(line, "from ")) {
+      auto from = resolve(line.substr(5));
+      reset_branch(b, is_zero(from) ? nullptr : &from);
+      return;
+    }
+    in.unread(line);
+  }
+  reset_branch(b, nullptr);
+}
+
+void fast_import::update_refs() {
+  // The objects must be in place before any ref points to them
+  session_->close();
+
+  auto repo = const_cast<git_repository *>(repo_.c_ptr());
+  std::vector<std::pair<std::string, git_oid>> updates;
+  for (auto &b : branches_) {
+    // A tag command for the same ref wins, as it does in git fast-import
+    if (!b.second.has_tip || tags_.count(b.first))
+      continue;
+    git_oid current;
+    if (git_reference_name_to_id(&current, repo, b.first.c_str()) == 0) {
+      if (git_oid_equal(&current, &b.second.tip))
+        continue;
+      if (!force_ &&
+          git_graph_descendant_of(repo, &b.second.tip, &current) != 1) {
+        stats_.refs_skipped.push_back(b.first);
+        continue;
+      }
+    }
+    updates.emplace_back(b.first, b.second.tip);
+  }
+  for (auto &tag : tags_) {
+    git_oid current;
+    if (git_reference_name_to_id(&current, repo, tag.first.c_str()) != 0 ||
+        !git_oid_equal(&current, &tag.second))
+      updates.emplace_back(tag.first, tag.second);
+  }
+  if (updates.empty())
+    return;
+
+  git_transaction *transaction = nullptr;
+  git_exception::throw_nonzero(git_transaction_new(&transaction, repo));
+  int ret = 0;
+  for (size_t i = 0; !ret && i < updates.size(); ++i) {
+    ret = git_transaction_lock_ref(transaction, updates[i].first.c_str());
+    if (!ret)
+      ret = git_transaction_set_target(transaction, updates[i].first.c_str(),
+                                       &updates[i].second, nullptr,
+                                       "fast-import");
+  }
+  if (!ret)
+    ret = git_transaction_commit(transaction);
+  git_transaction_free(transaction);
+  git_exception::throw_nonzero(ret);
+  stats_.refs_updated += updates.size();
+}
+
+oid fast_import::mark(uintmax_t number) const {
+  auto it = marks_.find(number);
+  if (it == marks_.end())
+    throw git_exception("no mark :" + std::to_string(number),
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::notfound);
+  return oid(&it->second);
+}
+
+void fast_import::import_marks(const std::string &path) {
+  std::ifstream file(path);
+  if (!file)
+    throw git_exception("failed to open " + path,
+                        git_exception::error_class::os,
+                        git_exception::error_code::notfound);
+  std::string line;
+  while (std::getline(file, line)) {
+    // ":<mark> <hex id>"
+    size_t space = line.find(' ');
+    git_oid id;
+    if (line.empty() || line[0] != ':' || space == std::string::npos ||
+        line.size() - space - 1 != GIT_OID_HEXSZ ||
+        git_oid_fromstrn(&id, line.c_str() + space + 1, GIT_OID_HEXSZ))
+      throw_parse_error("invalid mark line in " + path, line);
+    marks_[strtoumax(line.c_str() + 1, nullptr, 10)] = id;
+  }
+}
+
+void fast_import::export_marks(const std::string &path) const {
+  std::vector<std::pair<uintmax_t, git_oid>> sorted(marks_.begin(),
+                                                    marks_.end());
+  std::sort(sorted.begin(), sorted.end(),
+            [](const std::pair<uintmax_t, git_oid> &a,
+               const std::pair<uintmax_t, git_oid> &b) {
+              return a.first < b.first;
+            });
+  auto temp = path + ".lock";
+  {
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    char hex[GIT_OID_HEXSZ + 1];
+    for (auto &m : sorted)
+      file << ':' << m.first << ' ' << git_oid_tostr(hex, sizeof(hex), &m.second)
+           << '\n';
+    if (!file.flush())
+      throw git_exception("failed to write " + temp,
+                          git_exception::error_class::os);
+  }
+  if (std::rename(temp.c_str(), path.c_str()) != 0)
+    throw git_exception("failed to rename " + temp,
+                        git_exception::error_class::os);
+}
+
+} // namespace cppgit2
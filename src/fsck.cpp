@@ -0,0 +1,523 @@
+#include <cppgit2/fsck.hpp>
+#include <cppgit2/reflog_maintenance.hpp>
+#include <cppgit2/string_view.hpp>
+#include <cppgit2/tree_view.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <initializer_list>
+
+namespace cppgit2 {
+
+namespace {
+
+const uint8_t bad = 0x80; // flag on types_: unreadable or hash mismatch
+
+bool oid_less(const git_oid &a, const git_oid &b) {
+  return memcmp(a.id, b.id, GIT_OID_RAWSZ) < 0;
+}
+
+std::string hex(const git_oid &id) {
+  char buffer[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(buffer, sizeof(buffer), &id);
+  return buffer;
+}
+
+// One odb per repository handle, freed on scope exit
+class odb_handles {
+public:
+  explicit odb_handles(const std::vector<repository> &handles)
+      : odbs_(handles.size(), nullptr) {
+    for (size_t i = 0; i < handles.size(); ++i) {
+      int ret = git_repository_odb(
+          &odbs_[i], const_cast<git_repository *>(handles[i].c_ptr()));
+      if (ret) {
+        release();
+        git_exception::throw_nonzero(ret);
+      }
+    }
+  }
+  ~odb_handles() { release(); }
+  git_odb *operator[](size_t i) const { return odbs_[i]; }
+
+private:
+  void release() {
+    for (auto odb : odbs_)
+      if (odb)
+        git_odb_free(odb);
+    odbs_.clear();
+  }
+  std::vector<git_odb *> odbs_;
+};
+
+// Reads "<key> <value>\n" at `p`, advancing past it
+bool header(const char *&p, const char *end, const char *key,
+            string_view &value) {
+  size_t length = strlen(key);
+  if (static_cast<size_t>(end - p) <= length || memcmp(p, key, length) ||
+      p[length] != ' ')
+    return false;
+  auto start = p + length + 1;
+  auto newline = static_cast<const char *>(
+      memchr(start, '\n', static_cast<size_t>(end - start)));
+  if (!newline)
+    return false;
+  value = string_view(start, static_cast<size_t>(newline - start));
+  p = newline + 1;
+  return true;
+}
+
+bool parse_id(const string_view &value, git_oid *out) {
+  return value.size() == GIT_OID_HEXSZ &&
+         git_oid_fromstrn(out, value.data(), GIT_OID_HEXSZ) == 0;
+}
+
+// "Name <email> <seconds> <+|-hhmm>"
+bool valid_ident(const string_view &value) {
+  auto begin = value.data(), end = value.data() + value.size();
+  auto open = std::find(begin, end, '<');
+  if (open == end || std::find(begin, open, '>') != open)
+    return false;
+  auto close = std::find(open, end, '>');
+  if (close == end || std::find(open + 1, close, '<') != close)
+    return false;
+  auto p = close + 1;
+  if (p == end || *p++ != ' ' || p == end ||
+      !isdigit(static_cast<unsigned char>(*p)))
+    return false;
+  while (p != end && isdigit(static_cast<unsigned char>(*p)))
+    ++p;
+  if (end - p != 6 || p[0] != ' ' || (p[1] != '+' && p[1] != '-'))
+    return false;
+  return std::all_of(p + 2, end, [](char c) {
+    return isdigit(static_cast<unsigned char>(c)) != 0;
+  });
+}
+
+// Format checks; each returns an empty string or what is wrong
+
+std::string check_commit(const char *p, const char *end, git_oid *tree,
+                         std::vector<git_oid> *parents) {
+  string_view value;
+  git_oid id;
+  if (!header(p, end, "tree", value) || !parse_id(value, &id))
+    return "missing or invalid tree line";
+  if (tree)
+    *tree = id;
+  while (header(p, end, "parent", value)) {
+    if (!parse_id(value, &id))
+      return "invalid parent line";
+    if (parents)
+      parents->push_back(id);
+  }
+  if (!header(p, end, "author", value) || !valid_ident(value))
+    return "missing or invalid author line";
+  if (!header(p, end, "committer", value) || !valid_ident(value))
+    return "missing or invalid committer line";
+  return std::string();
+}
+
+std::string check_tag(const char *p, const char *end, git_oid *target,
+                      git_object_t *target_type) {
+  string_view value;
+  git_oid id;
+  if (!header(p, end, "object", value) || !parse_id(value, &id))
+    return "missing or invalid object line";
+  if (!header(p, end, "type", value))
+    return "missing type line";
+  auto type = git_object_string2type(value.to_string().c_str());
+  if (type != GIT_OBJECT_COMMIT && type != GIT_OBJECT_TREE &&
+      type != GIT_OBJECT_BLOB && type != GIT_OBJECT_TAG)
+    return "invalid type line";
+  if (!header(p, end, "tag", value) || value.empty())
+    return "missing or invalid tag line";
+  if (p < end && *p != '\n') {
+    if (!header(p, end, "tagger", value) || !valid_ident(value))
+      return "invalid tagger line";
+  }
+  if (target)
+    *target = id;
+  if (target_type)
+    *target_type = type;
+  return std::string();
+}
+
+bool is_dot_git(const string_view &name) {
+  return name.size() == 4 && name[0] == '.' &&
+         tolower(static_cast<unsigned char>(name[1])) == 'g' &&
+         tolower(static_cast<unsigned char>(name[2])) == 'i' &&
+         tolower(static_cast<unsigned char>(name[3])) == 't';
+}
+
+bool valid_mode(uint32_t mode) {
+  switch (mode) {
+  case 0040000:
+  case 0100644:
+  case 0100755:
+  case 0100664: // written by early versions of git
+  case 0120000:
+  case 0160000:
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::string check_tree(const char *p, const char *end) {
+  string_view previous;
+  bool previous_is_tree = false;
+  bool first = true;
+  // "<octal mode> <name>\0<20-byte id>"
+  while (p < end) {
+    if (*p == '0')
+      return "zero-padded file mode";
+    uint32_t mode = 0;
+    for (; p < end && *p >= '0' && *p <= '7'; ++p)
+      mode = (mode << 3) | static_cast<uint32_t>(*p - '0');
+    if (p >= end || *p != ' ')
+      return "truncated entry";
+    auto name_start = ++p;
+    p = static_cast<const char *>(
+        memchr(p, '\0', static_cast<size_t>(end - p)));
+    if (!p || end - p < 1 + GIT_OID_RAWSZ)
+      return "truncated entry";
+    string_view name(name_start, static_cast<size_t>(p - name_start));
+    p += 1 + GIT_OID_RAWSZ;
+
+    std::string quoted = "'" + name.to_string() + "'";
+    if (!valid_mode(mode))
+      return "bad file mode for " + quoted;
+    if (name.empty())
+      return "empty entry name";
+    if (name.find('/') != string_view::npos)
+      return "entry name " + quoted + " contains '/'";
+    if (name == "." || name == ".." || is_dot_git(name))
+      return "invalid entry name " + quoted;
+
+    bool is_tree = mode == 0040000;
+    if (!first) {
+      if (previous == name)
+        return "duplicate entry " + quoted;
+      // Directories sort as if their name ended with '/'
+      size_t common = std::min(previous.size(), name.size());
+      int order = memcmp(previous.data(), name.data(), common);
+      if (!order) {
+        unsigned char left = previous.size() > common
+                                 ? static_cast<unsigned char>(previous[common])
+                                 : (previous_is_tree ? '/' : '\0');
+        unsigned char right = name.size() > common
+                                  ? static_cast<unsigned char>(name[common])
+                                  : (is_tree ? '/' : '\0');
+        order = left < right ? -1 : 1;
+      }
+      if (order > 0)
+        return "entry " + quoted + " is out of order";
+    }
+    previous = name;
+    previous_is_tree = is_tree;
+    first = false;
+  }
+  return std::string();
+}
+
+} // namespace
+
+fsck::fsck(const repository &repo, size_t num_threads)
+    : repo_(repo), pool_(num_threads), problems_(0) {
+  handles_.reserve(pool_.size());
+  for (size_t i = 0; i < pool_.size(); ++i)
+    handles_.push_back(repo.reopen());
+}
+
+size_t fsck::find(const git_oid &id) const {
+  auto it = std::lower_bound(ids_.begin(), ids_.end(), id, oid_less);
+  if (it == ids_.end() || !git_oid_equal(&*it, &id))
+    return ids_.size();
+  return static_cast<size_t>(it - ids_.begin());
+}
+
+int fsck::visit(const git_oid &id) {
+  size_t index = find(id);
+  if (index == ids_.size())
+    return -1;
+  uint64_t bit = uint64_t(1) << (index % 64);
+  return (visited_[index / 64].fetch_or(bit) & bit) ? 0 : 1;
+}
+
+void fsck::report(const reporter &fn, problem_type type, const git_oid &id,
+                  const std::string &path, const std::string &message) {
+  std::lock_guard<std::mutex> lock(report_mutex_);
+  problems_++;
+  fn(problem{type, oid(&id), path, message});
+}
+
+fsck::statistics fsck::check(const reporter &fn, bool connectivity) {
+  statistics stats{0, 0, 0, 0, 0, 0};
+  problems_ = 0;
+
+  git_odb *odb = nullptr;
+  git_exception::throw_nonzero(
+      git_repository_odb(&odb, const_cast<git_repository *>(repo_.c_ptr())));
+  ids_.clear();
+  int ret = git_odb_foreach(
+      odb,
+      [](const git_oid *id, void *payload) {
+        static_cast<std::vector<git_oid> *>(payload)->push_back(*id);
+        return 0;
+      },
+      &ids_);
+  git_odb_free(odb);
+  git_exception::throw_nonzero(ret);
+  // The same object can be both loose and packed
+  std::sort(ids_.begin(), ids_.end(), oid_less);
+  ids_.erase(std::unique(ids_.begin(), ids_.end(),
+                         [](const git_oid &a, const git_oid &b) {
+                           return git_oid_equal(&a, &b) != 0;
+                         }),
+             ids_.end());
+  types_.assign(ids_.size(), 0);
+  visited_.reset(new std::atomic<uint64_t>[(ids_.size() + 63) / 64]());
+
+  verify_objects(fn, stats);
+  if (connectivity)
+    check_connectivity(fn);
+  stats.problems = problems_;
+  return stats;
+}
+
+void fsck::verify_objects(const reporter &fn, statistics &stats) {
+  odb_handles odbs(handles_);
+  std::atomic<size_t> counts[5];
+  for (auto &count : counts)
+    count = 0;
+
+  // Each index is written by one worker only
+  pool_.parallel_for(ids_.size(), [&](size_t i, size_t worker) {
+    auto &id = ids_[i];
+    git_odb_object *object = nullptr;
+    int ret = git_odb_read(&object, odbs[worker], &id);
+    if (ret) {
+      types_[i] = bad;
+      report(fn,
+             ret == GIT_EMISMATCH ? problem_type::hash_mismatch
+                                  : problem_type::unreadable,
+             id, std::string(), git_exception(ret).what());
+      return;
+    }
+    auto type = git_odb_object_type(object);
+    auto data = static_cast<const char *>(git_odb_object_data(object));
+    size_t size = git_odb_object_size(object);
+    types_[i] = static_cast<uint8_t>(type);
+    if (type >= GIT_OBJECT_COMMIT && type <= GIT_OBJECT_TAG)
+      counts[type]++;
+
+    git_oid actual;
+    if (git_odb_hash(&actual, data, size, type) == 0 &&
+        !git_oid_equal(&actual, &id)) {
+      types_[i] |= bad;
+      report(fn, problem_type::hash_mismatch, id, std::string(),
+             "content hashes to " + hex(actual));
+    }
+
+    std::string error;
+    switch (type) {
+    case GIT_OBJECT_COMMIT:
+      error = check_commit(data, data + size, nullptr, nullptr);
+      break;
+    case GIT_OBJECT_TREE:
+      error = check_tree(data, data + size);
+      break;
+    case GIT_OBJECT_TAG:
+      error = check_tag(data, data + size, nullptr, nullptr);
+      break;
+    default:
+      break;
+    }
+    git_odb_object_free(object);
+    if (!error.empty()) {
+      // A malformed tree would break the walk; other objects are followed
+      // as far as they parse
+      if (type == GIT_OBJECT_TREE)
+        types_[i] |= bad;
+      report(fn, problem_type::malformed, id, std::string(),
+             std::string(git_object_type2string(type)) + ": " + error);
+    }
+  });
+
+  stats.objects = ids_.size();
+  stats.commits = counts[GIT_OBJECT_COMMIT];
+  stats.trees = counts[GIT_OBJECT_TREE];
+  stats.blobs = counts[GIT_OBJECT_BLOB];
+  stats.tags = counts[GIT_OBJECT_TAG];
+}
+
+bool fsck::check_link(const git_oid &id, git_object_t expected,
+                      const std::string &path, const reporter &fn) {
+  size_t index = find(id);
+  auto name = git_object_type2string(expected);
+  if (index == ids_.size()) {
+    report(fn, problem_type::missing, id, path,
+           std::string("missing ") + name);
+    return false;
+  }
+  if (types_[index] & bad) {
+    report(fn, problem_type::broken_link, id, path,
+           std::string("corrupt ") + name);
+    return false;
+  }
+  auto actual = static_cast<git_object_t>(types_[index]);
+  if (actual != expected) {
+    report(fn, problem_type::wrong_type, id, path,
+           std::string("expected ") + name + ", found " +
+               git_object_type2string(actual));
+    return false;
+  }
+  return true;
+}
+
+void fsck::walk_tree(const repository &handle, const git_oid &id,
+                     std::string &path, const reporter &fn) {
+  if (visit(id) != 1)
+    return;
+  tree_view entries(handle, oid(&id));
+  for (auto &entry : entries) {
+    if (entry.is_submodule()) // gitlinks point into another repository
+      continue;
+    size_t length = path.size();
+    path.append(entry.name.data(), entry.name.size());
+    if (entry.is_tree()) {
+      if (check_link(*entry.raw_id, GIT_OBJECT_TREE, path, fn)) {
+        path += '/';
+        walk_tree(handle, *entry.raw_id, path, fn);
+      }
+    } else if (check_link(*entry.raw_id, GIT_OBJECT_BLOB, path, fn)) {
+      visit(*entry.raw_id);
+    }
+    path.resize(length);
+  }
+}
+
+void fsck::check_connectivity(const reporter &fn) {
+  auto repo = const_cast<git_repository *>(repo_.c_ptr());
+
+  // Roots: references (and HEAD), reflog entries, the index
+  std::vector<std::pair<git_oid, std::string>> roots;
+  std::vector<std::string> names{"HEAD"};
+  {
+    git_reference_iterator *iterator = nullptr;
+    git_exception::throw_nonzero(git_reference_iterator_new(&iterator, repo));
+    git_reference *ref = nullptr;
+    while (git_reference_next(&ref, iterator) == 0) {
+      names.push_back(git_reference_name(ref));
+      git_reference_free(ref);
+    }
+    git_reference_iterator_free(iterator);
+  }
+  for (auto &name : names) {
+    git_reference *ref = nullptr;
+    if (git_reference_lookup(&ref, repo, name.c_str()))
+      continue;
+    git_reference *direct = nullptr;
+    if (git_reference_resolve(&direct, ref) == 0) {
+      roots.emplace_back(*git_reference_target(direct), name);
+      git_reference_free(direct);
+    }
+    git_reference_free(ref);
+  }
+  // Both ids of every entry, reached as "<ref>@{<time>}" like git fsck
+  reflog_maintenance(repo_, 1).for_each_entry(
+      [&](string_view name, const reflog_maintenance::entry &e) {
+        for (auto id : {e.old_id.c_ptr(), e.new_id.c_ptr()})
+          if (!git_oid_is_zero(id))
+            roots.emplace_back(*id, name.to_string() + "@{" +
+                                        std::to_string(e.time) + "}");
+      });
+  {
+    git_index *index = nullptr;
+    if (!git_repository_is_bare(repo) &&
+        git_repository_index(&index, repo) == 0) {
+      for (size_t i = 0; i < git_index_entrycount(index); ++i) {
+        auto entry = git_index_get_byindex(index, i);
+        if ((entry->mode & 0170000) != 0160000 &&
+            check_link(entry->id, GIT_OBJECT_BLOB,
+                       std::string("index:") + entry->path, fn))
+          visit(entry->id);
+      }
+      git_index_free(index);
+    }
+  }
+
+  git_odb *odb = nullptr;
+  git_exception::throw_nonzero(git_repository_odb(&odb, repo));
+  auto read = [&](const git_oid &id, std::string &data) {
+    git_odb_object *object = nullptr;
+    if (git_odb_read(&object, odb, &id))
+      return false;
+    data.assign(static_cast<const char *>(git_odb_object_data(object)),
+                git_odb_object_size(object));
+    git_odb_object_free(object);
+    return true;
+  };
+
+  // Peel tags; commits are listed serially (only their headers are parsed)
+  // and the trees they point to are walked below
+  std::vector<git_oid> commits;
+  std::vector<std::pair<git_oid, std::string>> trees;
+  std::string data;
+  for (auto &root : roots) {
+    git_oid id = root.first;
+    auto &path = root.second;
+    size_t index = find(id);
+    if (index == ids_.size()) {
+      report(fn, problem_type::missing, id, path, "missing object");
+      continue;
+    }
+    while (!(types_[index] & bad)) {
+      auto type = static_cast<git_object_t>(types_[index]);
+      if (type == GIT_OBJECT_COMMIT) {
+        commits.push_back(id);
+      } else if (type == GIT_OBJECT_TREE) {
+        trees.emplace_back(id, path + ":");
+      } else if (visit(id) == 1 && type == GIT_OBJECT_TAG &&
+                 read(id, data)) {
+        git_oid target;
+        git_object_t target_type;
+        if (check_tag(data.data(), data.data() + data.size(), &target,
+                      &target_type)
+                .empty() &&
+            check_link(target, target_type, path, fn)) {
+          id = target;
+          index = find(id);
+          continue;
+        }
+      }
+      break;
+    }
+  }
+
+  while (!commits.empty()) {
+    git_oid id = commits.back();
+    commits.pop_back();
+    if (visit(id) != 1 || !read(id, data))
+      continue;
+    git_oid tree;
+    std::vector<git_oid> parents;
+    if (!check_commit(data.data(), data.data() + data.size(), &tree, &parents)
+             .empty())
+      continue; // already reported
+    auto name = hex(id);
+    if (check_link(tree, GIT_OBJECT_TREE, name, fn))
+      trees.emplace_back(tree, name + ":");
+    for (auto &parent : parents)
+      if (check_link(parent, GIT_OBJECT_COMMIT, name, fn))
+        commits.push_back(parent);
+  }
+  git_odb_free(odb);
+
+  pool_.parallel_for(trees.size(), [&](size_t i, size_t worker) {
+    std::string path = trees[i].second;
+    walk_tree(handles_[worker], trees[i].first, path, fn);
+  });
+}
+
+} // namespace cppgit2
@@ -0,0 +1,551 @@
+#include <cppgit2/gc.hpp>
+#include <cppgit2/mapped_file.hpp>
+#include <cppgit2/reflog_maintenance.hpp>
+#include <cppgit2/reftable.hpp>
+#include <cppgit2/tree_view.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+namespace {
+
+uint32_t be32(const unsigned char *p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+bool oid_less(const git_oid &a, const git_oid &b) {
+  return memcmp(a.id, b.id, GIT_OID_RAWSZ) < 0;
+}
+
+bool is_zero(const git_oid &id) {
+  static const git_oid zero = {{0}};
+  return !memcmp(id.id, zero.id, GIT_OID_RAWSZ);
+}
+
+// Object ids listed by a pack .idx file (version 1 or 2)
+std::vector<git_oid> read_pack_index(const std::string &path) {
+  mapped_file file(path);
+  auto data = file.data();
+  size_t size = file.size();
+  size_t fanout = 0, stride = GIT_OID_RAWSZ, first = 0;
+  if (size >= 8 && !memcmp(data, "\377tOc", 4)) {
+    if (be32(data + 4) != 2)
+      throw git_exception("unsupported pack index version in " + path,
+                          git_exception::error_class::odb,
+                          git_exception::error_code::invalid);
+    fanout = 8;
+    first = 8 + 256 * 4;
+  } else {
+    first = 256 * 4;
+    stride = 4 + GIT_OID_RAWSZ;
+  }
+  if (size < first)
+    throw git_exception("truncated pack index " + path,
+                        git_exception::error_class::odb,
+                        git_exception::error_code::invalid);
+  size_t count = be32(data + fanout + 255 * 4);
+  if ((size - first) / stride < count)
+    throw git_exception("truncated pack index " + path,
+                        git_exception::error_class::odb,
+                        git_exception::error_code::invalid);
+
+  std::vector<git_oid> ids(count);
+  auto p = data + first + (stride - GIT_OID_RAWSZ);
+  for (size_t i = 0; i < count; ++i, p += stride)
+    memcpy(ids[i].id, p, GIT_OID_RAWSZ);
+  return ids;
+}
+
+bool parse_hex_id(const char *hex, git_oid *out) {
+  return git_oid_fromstrn(out, hex, GIT_OID_HEXSZ) == 0;
+}
+
+void throw_os_error(const std::string &what, const std::string &path) {
+  throw git_exception(what + " " + path + ": " + strerror(errno),
+                      git_exception::error_class::os);
+}
+
+// Loose reference files below `git_dir` + `directory`
+void scan_refs(const std::string &git_dir, const std::string &directory,
+               std::vector<std::string> &names) {
+#ifndef _WIN32
+  DIR *dir = opendir((git_dir + directory).c_str());
+  if (!dir)
+    return;
+  while (auto found = readdir(dir)) {
+    std::string name = found->d_name;
+    if (name == "." || name == ".." ||
+        (name.size() > 5 && name.compare(name.size() - 5, 5, ".lock") == 0))
+      continue;
+    name = directory + name;
+    struct stat st;
+    if (stat((git_dir + name).c_str(), &st) != 0)
+      continue;
+    if (S_ISDIR(st.st_mode))
+      scan_refs(git_dir, name + "/", names);
+    else
+      names.push_back(name);
+  }
+  closedir(dir);
+#else
+  (void)git_dir;
+  (void)directory;
+  (void)names;
+#endif
+}
+
+// HEAD and the references a linked worktree keeps for itself, in its own
+// directory below <commondir>/worktrees/, or in its own reftable stack
+std::vector<std::string> per_worktree_names(git_repository *repo,
+                                            bool reftable) {
+  std::vector<std::string> names{"HEAD"};
+  std::string git_dir = git_repository_path(repo);
+  if (git_dir == git_repository_commondir(repo))
+    return names;
+  for (auto prefix : {"refs/bisect/", "refs/worktree/", "refs/rewritten/"}) {
+    if (!reftable) {
+      scan_refs(git_dir, prefix, names);
+      continue;
+    }
+    git_reference_iterator *iterator = nullptr;
+    git_exception::throw_nonzero(git_reference_iterator_glob_new(
+        &iterator, repo, (std::string(prefix) + "*").c_str()));
+    const char *name = nullptr;
+    while (git_reference_next_name(&name, iterator) == 0)
+      names.push_back(name);
+    git_reference_iterator_free(iterator);
+  }
+  return names;
+}
+
+// The other worktrees sharing `repo`'s objects: the linked ones, and the
+// main one when `repo` is linked. A worktree that cannot be opened is
+// skipped. In a reftable repository, each handle gets the reftable backend
+std::vector<repository> other_worktrees(const repository &repo) {
+  auto raw = const_cast<git_repository *>(repo.c_ptr());
+  std::vector<repository> result;
+  git_repository *opened = nullptr;
+  if (git_repository_is_worktree(raw) &&
+      git_repository_open(&opened, repo.commondir().c_str()) == 0)
+    result.push_back(repository(opened));
+
+  git_strarray names{nullptr, 0};
+  git_exception::throw_nonzero(git_worktree_list(&names, raw));
+  auto own_path = repo.path();
+  for (size_t i = 0; i < names.count; ++i) {
+    git_worktree *worktree = nullptr;
+    opened = nullptr;
+    if (git_worktree_lookup(&worktree, raw, names.strings[i]) == 0 &&
+        git_repository_open_from_worktree(&opened, worktree) == 0) {
+      if (own_path == git_repository_path(opened))
+        git_repository_free(opened);
+      else
+        result.push_back(repository(opened));
+    }
+    git_worktree_free(worktree);
+  }
+  git_strarray_dispose(&names);
+  git_error_clear();
+  if (reftable::is_enabled(repo))
+    for (auto &handle : result)
+      reftable::attach(handle);
+  return result;
+}
+
+// Add the targets of the references `names` of `repo` to `roots`
+void add_targets(git_repository *repo, const std::vector<std::string> &names,
+                 std::vector<git_oid> &roots) {
+  for (auto &name : names) {
+    git_reference *resolved = nullptr;
+    if (git_reference_lookup(&resolved, repo, name.c_str()) == 0) {
+      git_reference *direct = nullptr;
+      if (git_reference_resolve(&direct, resolved) == 0) {
+        roots.push_back(*git_reference_target(direct));
+        git_reference_free(direct);
+      }
+      git_reference_free(resolved);
+    }
+  }
+}
+
+// Names of the shared references of `repo`
+std::vector<std::string> reference_names(git_repository *repo) {
+  std::vector<std::string> names;
+  git_reference_iterator *iterator = nullptr;
+  git_exception::throw_nonzero(git_reference_iterator_new(&iterator, repo));
+  git_reference *ref = nullptr;
+  while (git_reference_next(&ref, iterator) == 0) {
+    names.push_back(git_reference_name(ref));
+    git_reference_free(ref);
+  }
+  git_reference_iterator_free(iterator);
+  return names;
+}
+
+} // namespace
+
+gc::gc(const repository &repo, size_t num_threads)
+    : repo_(repo), pool_(num_threads),
+      objects_dir_(repo.commondir() + "objects/"),
+      marked_(false) {
+  handles_.reserve(pool_.size());
+  for (size_t i = 0; i < pool_.size(); ++i)
+    handles_.push_back(repo.reopen());
+}
+
+std::string gc::loose_path(const git_oid &id) const {
+  char hex[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(hex, sizeof(hex), &id);
+  return objects_dir_ + std::string(hex, 2) + "/" + (hex + 2);
+}
+
+void gc::enumerate() {
+#ifdef _WIN32
+  throw git_exception("gc is not supported on this platform",
+                      git_exception::error_class::os);
+#else
+  std::vector<std::pair<git_oid, uint8_t>> found;
+  packs_.clear();
+  pack_mtimes_.clear();
+  pack_kept_.clear();
+
+  // Loose objects: objects/xx/<38 hex digits>
+  for (int fan = 0; fan < 256; ++fan) {
+    char prefix[3];
+    snprintf(prefix, sizeof(prefix), "%02x", fan);
+    auto dir = opendir((objects_dir_ + prefix).c_str());
+    if (!dir)
+      continue;
+    while (auto entry = readdir(dir)) {
+      if (strlen(entry->d_name) != GIT_OID_HEXSZ - 2)
+        continue;
+      std::string hex = std::string(prefix) + entry->d_name;
+      git_oid id;
+      if (parse_hex_id(hex.c_str(), &id))
+        found.emplace_back(id, static_cast<uint8_t>(loose));
+    }
+    closedir(dir);
+  }
+
+  // Packed objects, from the pack indexes
+  auto pack_dir = objects_dir_ + "pack/";
+  if (auto dir = opendir(pack_dir.c_str())) {
+    std::vector<std::string> names;
+    while (auto entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.size() > 4 && name.compare(name.size() - 4, 4, ".idx") == 0)
+        names.push_back(name.substr(0, name.size() - 4));
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (auto &name : names) {
+      auto base = pack_dir + name;
+      struct stat st;
+      if (stat((base + ".pack").c_str(), &st) < 0)
+        continue; // index without a pack
+      bool is_kept = access((base + ".keep").c_str(), F_OK) == 0;
+      packs_.push_back(base);
+      pack_mtimes_.push_back(st.st_mtime);
+      pack_kept_.push_back(is_kept);
+      auto flags = static_cast<uint8_t>(is_kept ? kept : packed);
+      for (auto &id : read_pack_index(base + ".idx"))
+        found.emplace_back(id, flags);
+    }
+  }
+
+  std::sort(found.begin(), found.end(),
+            [](const std::pair<git_oid, uint8_t> &a,
+               const std::pair<git_oid, uint8_t> &b) {
+              return oid_less(a.first, b.first);
+            });
+  ids_.clear();
+  locations_.clear();
+  for (auto &object : found) {
+    if (!ids_.empty() && git_oid_equal(&ids_.back(), &object.first)) {
+      locations_.back() |= object.second;
+      continue;
+    }
+    ids_.push_back(object.first);
+    locations_.push_back(object.second);
+  }
+  bitmap_.reset(new std::atomic<uint64_t>[(ids_.size() + 63) / 64]());
+#endif
+}
+
+int gc::mark_object(const git_oid &id) {
+  auto it = std::lower_bound(ids_.begin(), ids_.end(), id, oid_less);
+  if (it == ids_.end() || !git_oid_equal(&*it, &id))
+    return -1;
+  size_t index = static_cast<size_t>(it - ids_.begin());
+  uint64_t bit = uint64_t(1) << (index % 64);
+  return (bitmap_[index / 64].fetch_or(bit) & bit) ? 0 : 1;
+}
+
+void gc::mark_tree(const repository &handle, const git_oid &id) {
+  if (mark_object(id) != 1)
+    return;
+  tree_view entries(handle, oid(&id));
+  for (auto &entry : entries) {
+    if (entry.is_tree())
+      mark_tree(handle, *entry.raw_id);
+    else if (!entry.is_submodule()) // gitlinks point into another repository
+      mark_object(*entry.raw_id);
+  }
+}
+
+gc::report gc::mark() {
+  marked_ = false;
+  enumerate();
+  auto repo = const_cast<git_repository *>(repo_.c_ptr());
+
+  // Roots: references (and HEAD), reflogs, the index; of the other
+  // worktrees, their HEAD, their own references and their index
+  std::vector<git_oid> roots;
+  add_targets(repo, reference_names(repo), roots);
+  auto worktrees = other_worktrees(repo_);
+  std::vector<git_repository *> worktree_repos{repo};
+  for (auto &worktree : worktrees)
+    worktree_repos.push_back(const_cast<git_repository *>(worktree.c_ptr()));
+  bool uses_reftable = reftable::is_enabled(repo_);
+  for (auto handle : worktree_repos)
+    add_targets(handle, per_worktree_names(handle, uses_reftable), roots);
+  // Every id recorded in a reflog, including those of deleted references
+  // and of the other worktrees' HEADs
+  auto reflog_tips = reflog_maintenance(repo_, 1).build_tip_index();
+  roots.insert(roots.end(), reflog_tips.ids().begin(), reflog_tips.ids().end());
+  roots.erase(std::remove_if(roots.begin(), roots.end(), is_zero),
+              roots.end());
+
+  std::vector<git_oid> trees;
+  for (auto handle : worktree_repos) {
+    git_index *index = nullptr;
+    if (!git_repository_is_bare(handle) &&
+        git_repository_index(&index, handle) == 0) {
+      for (size_t i = 0; i < git_index_entrycount(index); ++i) {
+        auto entry = git_index_get_byindex(index, i);
+        if ((entry->mode & 0170000) != 0160000)
+          mark_object(entry->id);
+      }
+      git_index_free(index);
+    }
+  }
+
+  // Peel tags; commits go to the revwalk, trees are walked below
+  git_odb *odb = nullptr;
+  git_exception::throw_nonzero(git_repository_odb(&odb, repo));
+  git_revwalk *walk = nullptr;
+  int ret = git_revwalk_new(&walk, repo);
+  for (size_t i = 0; !ret && i < roots.size(); ++i) {
+    git_oid id = roots[i];
+    for (;;) {
+      size_t size;
+      git_object_t type;
+      ret = git_odb_read_header(&size, &type, odb, &id);
+      if (ret == GIT_ENOTFOUND) {
+        ret = 0; // e.g. a reflog entry whose commit is long gone
+        break;
+      }
+      if (ret)
+        break;
+      if (type == GIT_OBJECT_COMMIT) {
+        ret = git_revwalk_push(walk, &id);
+      } else if (type == GIT_OBJECT_TREE) {
+        trees.push_back(id);
+      } else if (type == GIT_OBJECT_TAG && mark_object(id)) {
+        git_tag *tag = nullptr;
+        ret = git_tag_lookup(&tag, repo, &id);
+        if (ret)
+          break;
+        id = *git_tag_target_id(tag);
+        git_tag_free(tag);
+        continue;
+      } else {
+        mark_object(id);
+      }
+      break;
+    }
+  }
+  commit_order_.clear();
+  git_oid commit;
+  while (!ret && (ret = git_revwalk_next(&commit, walk)) == 0) {
+    mark_object(commit);
+    commit_order_.push_back(commit);
+  }
+  if (ret == GIT_ITEROVER)
+    ret = 0;
+  git_revwalk_free(walk);
+  git_odb_free(odb);
+  git_exception::throw_nonzero(ret);
+
+  // Trees of the commits, in parallel
+  size_t commit_count = commit_order_.size();
+  pool_.parallel_for(commit_count + trees.size(), [&](size_t i,
+                                                      size_t worker) {
+    auto &handle = handles_[worker];
+    if (i >= commit_count) {
+      mark_tree(handle, trees[i - commit_count]);
+      return;
+    }
+    git_commit *c = nullptr;
+    git_exception::throw_nonzero(
+        git_commit_lookup(&c, const_cast<git_repository *>(handle.c_ptr()),
+                          &commit_order_[i]));
+    git_oid tree_id = *git_commit_tree_id(c);
+    git_commit_free(c);
+    mark_tree(handle, tree_id);
+  });
+  marked_ = true;
+
+  report result{ids_.size(), 0, {}, {}};
+  for (size_t i = 0; i < ids_.size(); ++i) {
+    if (bitmap_[i / 64].load() & (uint64_t(1) << (i % 64))) {
+      result.reachable++;
+      continue;
+    }
+    if (locations_[i] & loose)
+      result.unreachable_loose.push_back(oid(&ids_[i]));
+    if (locations_[i] & (packed | kept))
+      result.unreachable_packed.push_back(oid(&ids_[i]));
+  }
+  return result;
+}
+
+void gc::require_mark() const {
+  if (!marked_)
+    throw git_exception("gc::mark() has not run",
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::invalid);
+}
+
+bool gc::is_reachable(const oid &id) const {
+  require_mark();
+  auto it = std::lower_bound(ids_.begin(), ids_.end(), *id.c_ptr(), oid_less);
+  if (it == ids_.end() || !git_oid_equal(&*it, id.c_ptr()))
+    return false;
+  size_t index = static_cast<size_t>(it - ids_.begin());
+  return (bitmap_[index / 64].load() & (uint64_t(1) << (index % 64))) != 0;
+}
+
+size_t gc::prune(std::time_t expire) {
+  require_mark();
+  size_t removed = 0;
+#ifndef _WIN32
+  for (size_t i = 0; i < ids_.size(); ++i) {
+    if (!(locations_[i] & loose) ||
+        (bitmap_[i / 64].load() & (uint64_t(1) << (i % 64))))
+      continue;
+    auto path = loose_path(ids_[i]);
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0 || st.st_mtime >= expire)
+      continue;
+    if (unlink(path.c_str()) < 0) {
+      if (errno != ENOENT)
+        throw_os_error("failed to remove", path);
+      continue;
+    }
+    locations_[i] &= static_cast<uint8_t>(~loose);
+    removed++;
+    rmdir(path.substr(0, path.rfind('/')).c_str()); // only if empty
+  }
+  git_odb *odb = nullptr;
+  if (git_repository_odb(&odb, const_cast<git_repository *>(repo_.c_ptr())) ==
+      0) {
+    git_odb_refresh(odb);
+    git_odb_free(odb);
+  }
+#endif
+  return removed;
+}
+
+oid gc::repack(std::time_t expire) {
+  require_mark();
+  auto builder = repo_.initialize_pack_builder();
+  builder.set_threads(static_cast<unsigned int>(pool_.size()));
+
+  // Objects found only in kept packs stay there
+  std::vector<bool> inserted(ids_.size());
+  auto insert = [&](size_t index) {
+    if (inserted[index] || locations_[index] == kept)
+      return;
+    inserted[index] = true;
+    builder.insert_object(oid(&ids_[index]));
+  };
+  auto index_of = [this](const git_oid &id) {
+    return static_cast<size_t>(
+        std::lower_bound(ids_.begin(), ids_.end(), id, oid_less) -
+        ids_.begin());
+  };
+
+  // Commits in revwalk order first, as pack_builder recommends
+  for (auto &commit : commit_order_) {
+    size_t index = index_of(commit);
+    if (index < ids_.size() && git_oid_equal(&ids_[index], &commit))
+      insert(index);
+  }
+  for (size_t i = 0; i < ids_.size(); ++i)
+    if (bitmap_[i / 64].load() & (uint64_t(1) << (i % 64)))
+      insert(i);
+  // Unreachable objects of recent packs survive the repack, including any
+  // written to the pack since mark()
+  for (size_t p = 0; p < packs_.size(); ++p) {
+    if (pack_kept_[p] || pack_mtimes_[p] < expire)
+      continue;
+    for (auto &id : read_pack_index(packs_[p] + ".idx")) {
+      size_t index = index_of(id);
+      if (index < ids_.size() && git_oid_equal(&ids_[index], &id))
+        insert(index);
+      else
+        builder.insert_object(oid(&id));
+    }
+  }
+
+  std::function<void(const indexer::progress &)> progress =
+      [](const indexer::progress &) {};
+  builder.write(objects_dir_ + "pack", 0, progress);
+  auto pack = builder.hash();
+  auto new_base = objects_dir_ + "pack/pack-" + pack.to_hex_string();
+
+#ifndef _WIN32
+  for (size_t p = 0; p < packs_.size(); ++p) {
+    if (pack_kept_[p] || packs_[p] == new_base)
+      continue;
+    // The index goes last: a pack without one is invisible
+    for (auto suffix : {".pack", ".rev", ".bitmap", ".idx"}) {
+      auto path = packs_[p] + suffix;
+      if (unlink(path.c_str()) < 0 && errno != ENOENT)
+        throw_os_error("failed to remove", path);
+    }
+  }
+  // Loose copies of packed objects
+  for (size_t i = 0; i < ids_.size(); ++i) {
+    if (!inserted[i] || !(locations_[i] & loose))
+      continue;
+    auto path = loose_path(ids_[i]);
+    if (unlink(path.c_str()) == 0)
+      rmdir(path.substr(0, path.rfind('/')).c_str()); // only if empty
+  }
+#endif
+  git_odb *odb = nullptr;
+  if (git_repository_odb(&odb, const_cast<git_repository *>(repo_.c_ptr())) ==
+      0) {
+    git_odb_refresh(odb);
+    git_odb_free(odb);
+  }
+  marked_ = false; // locations changed
+  return pack;
+}
+
+} // namespace cppgit2
@@ -0,0 +1,355 @@
+#include <cppgit2/config.hpp>
+#include <cppgit2/config_view.hpp>
+#include <cppgit2/data_buffer.hpp>
+#include <cppgit2/ignore_matcher.hpp>
+#include <cppgit2/wildmatch.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sys/stat.h>
+
+namespace cppgit2 {
+
+namespace {
+
+const char ignore_file[] = ".gitignore";
+
+bool is_wildcard(char c) {
+  return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+bool has_wildcards(string_view text) {
+  for (char c : text)
+    if (is_wildcard(c))
+      return true;
+  return false;
+}
+
+size_t literal_prefix(string_view text) {
+  size_t length = 0;
+  while (length < text.size() && !is_wildcard(text[length]))
+    ++length;
+  return length;
+}
+
+void fold_case(std::string &text) {
+  for (auto &c : text)
+    if (c >= 'A' && c <= 'Z')
+      c = static_cast<char>(c - 'A' + 'a');
+}
+
+// Trailing spaces are dropped unless escaped with '\'
+string_view trim_trailing_spaces(string_view line) {
+  size_t end = line.size();
+  for (size_t i = 0; i < line.size(); ++i) {
+    if (line[i] == ' ') {
+      if (end == line.size())
+        end = i;
+    } else {
+      if (line[i] == '\\')
+        ++i;
+      end = line.size();
+    }
+  }
+  return line.substr(0, end);
+}
+
+bool read_file(const std::string &path, std::string &content) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  content.clear();
+  char chunk[4096];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    content.append(chunk, read);
+  fclose(file);
+  return true;
+}
+
+bool file_exists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+// First `file` found in libgit2's search path for `level`
+std::string find_in_search_path(git_config_level_t level, const char *file) {
+  data_buffer buffer(nullptr);
+  if (git_libgit2_opts(GIT_OPT_GET_SEARCH_PATH, level, buffer.c_ptr()) != 0) {
+    git_error_clear();
+    return "";
+  }
+  auto directories = buffer.to_string();
+  size_t start = 0;
+  while (start <= directories.size()) {
+    auto end = directories.find(GIT_PATH_LIST_SEPARATOR, start);
+    if (end == std::string::npos)
+      end = directories.size();
+    if (end > start) {
+      auto path = directories.substr(start, end - start) + "/" + file;
+      if (file_exists(path))
+        return path;
+    }
+    start = end + 1;
+  }
+  return "";
+}
+
+} // namespace
+
+ignore_matcher::ignore_matcher(const repository &repo, size_t num_threads,
+                               const std::string &extra_rules)
+    : workdir_(repo.workdir()), ignore_case_(false),
+      num_threads_(num_threads) {
+  config_view cfg(repo);
+  ignore_case_ = cfg.value_as_bool("core.ignorecase", false);
+  parse(extra_rules, extra_);
+  std::string content;
+  if (read_file(repo.commondir() + "info/exclude", content))
+    parse(content, info_);
+  auto configured = cfg.value_as_string("core.excludesfile", "");
+  auto global = configured.empty()
+                    ? find_in_search_path(GIT_CONFIG_LEVEL_XDG, "ignore")
+                    : config::parse_path(configured.to_string());
+  if (!global.empty() && read_file(global, content))
+    parse(content, global_);
+}
+
+void ignore_matcher::parse(const std::string &content, frame &f) const {
+  string_view text(content);
+  std::string pattern;
+  size_t position = 0;
+  while (position < text.size()) {
+    auto end = text.find('\n', position);
+    if (end == string_view::npos)
+      end = text.size();
+    auto line = text.substr(position, end - position);
+    position = end + 1;
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line = line.substr(0, line.size() - 1);
+    if (line.empty() || line[0] == '#')
+      continue;
+    line = trim_trailing_spaces(line);
+
+    rule r;
+    r.negated = line.starts_with("!");
+    if (r.negated)
+      line = line.substr(1);
+    r.directory_only = line.ends_with("/");
+    if (r.directory_only)
+      line = line.substr(0, line.size() - 1);
+    bool anchored = line.starts_with("/");
+    if (anchored)
+      line = line.substr(1);
+    if (line.empty())
+      continue;
+
+    pattern.assign(line.data(), line.size());
+    if (ignore_case_)
+      fold_case(pattern);
+    r.pattern_offset = static_cast<uint32_t>(f.strings.size());
+    r.pattern_length = static_cast<uint32_t>(pattern.size());
+    r.prefix_length = static_cast<uint32_t>(literal_prefix(pattern));
+    f.strings += pattern;
+
+    auto index = static_cast<uint32_t>(f.rules.size());
+    string_view rest = string_view(pattern).substr(1);
+    if (anchored || pattern.find('/') != std::string::npos) {
+      r.kind = pattern_kind::path_glob;
+      f.others.push_back(index);
+    } else if (!has_wildcards(pattern)) {
+      r.kind = pattern_kind::name;
+      f.by_name[pattern].push_back(index);
+    } else if (pattern[0] == '*' && !has_wildcards(rest)) {
+      r.kind = pattern_kind::suffix;
+      auto dot = rest.rfind('.');
+      if (dot != string_view::npos)
+        f.by_extension[rest.substr(dot).to_string()].push_back(index);
+      else
+        f.others.push_back(index);
+    } else {
+      r.kind = pattern_kind::basename_glob;
+      f.others.push_back(index);
+    }
+    f.rules.push_back(r);
+  }
+}
+
+// 1 if the last rule of `f` matching says ignored, 0 if it re-includes,
+// -1 if none matches
+int ignore_matcher::match_frame(const frame &f, string_view relative,
+                                string_view basename, bool is_directory,
+                                scratch &s) const {
+  if (f.rules.empty())
+    return -1;
+  s.candidates.assign(f.others.begin(), f.others.end());
+  if (!f.by_name.empty()) {
+    s.key.assign(basename.data(), basename.size());
+    auto found = f.by_name.find(s.key);
+    if (found != f.by_name.end())
+      s.candidates.insert(s.candidates.end(), found->second.begin(),
+                          found->second.end());
+  }
+  auto dot = basename.rfind('.');
+  if (!f.by_extension.empty() && dot != string_view::npos) {
+    s.key.assign(basename.data() + dot, basename.size() - dot);
+    auto found = f.by_extension.find(s.key);
+    if (found != f.by_extension.end())
+      s.candidates.insert(s.candidates.end(), found->second.begin(),
+                          found->second.end());
+  }
+  std::sort(s.candidates.begin(), s.candidates.end(),
+            std::greater<uint32_t>());
+
+  for (auto index : s.candidates) {
+    auto &r = f.rules[index];
+    if (r.directory_only && !is_directory)
+      continue;
+    string_view pattern(f.strings.data() + r.pattern_offset, r.pattern_length);
+    bool matched = false;
+    switch (r.kind) {
+    case pattern_kind::name:
+      matched = basename == pattern;
+      break;
+    case pattern_kind::suffix:
+      matched = basename.ends_with(pattern.substr(1));
+      break;
+    case pattern_kind::basename_glob:
+      matched = wildmatch(pattern, basename, false);
+      break;
+    case pattern_kind::path_glob:
+      matched = relative.size() >= r.prefix_length &&
+                memcmp(relative.data(), pattern.data(), r.prefix_length) ==
+                    0 &&
+                wildmatch(pattern, relative, true);
+      break;
+    }
+    if (matched)
+      return r.negated ? 0 : 1;
+  }
+  return -1;
+}
+
+// Rules for `path` (no trailing '/'), in a child of `dir`: the extra rules
+// first, as libgit2 checks its added rules, then the .gitignore files from `dir` up,
+// then info/exclude, then core.excludesFile
+bool ignore_matcher::match_stack(const directory *dir, string_view path,
+                                 bool is_directory, scratch &s) const {
+  auto slash = path.rfind('/');
+  auto basename = slash == string_view::npos ? path : path.substr(slash + 1);
+  int extra = match_frame(extra_, path, basename, is_directory, s);
+  if (extra >= 0)
+    return extra == 1;
+  for (auto d = dir; d; d = d->parent) {
+    int result = match_frame(d->rules, path.substr(d->path.size()), basename,
+                             is_directory, s);
+    if (result >= 0)
+      return result == 1;
+  }
+  int result = match_frame(info_, path, basename, is_directory, s);
+  if (result < 0)
+    result = match_frame(global_, path, basename, is_directory, s);
+  return result == 1;
+}
+
+// The directory `path` ("" or ending in '/'), with its parents; created and
+// its .gitignore read on first use. Readers race only to create the same
+// node twice, and the second copy is dropped
+const ignore_matcher::directory *
+ignore_matcher::find_directory(string_view path) const {
+  std::string key(path.data(), path.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = directories_.find(key);
+    if (found != directories_.end())
+      return found->second.get();
+  }
+
+  std::unique_ptr<directory> node(new directory);
+  node->path = key;
+  node->parent = nullptr;
+  node->ignored = false;
+  if (!path.empty()) {
+    auto name = path.substr(0, path.size() - 1);
+    auto slash = name.rfind('/');
+    node->parent = find_directory(
+        slash == string_view::npos ? string_view() : name.substr(0, slash + 1));
+    auto basename = slash == string_view::npos ? name : name.substr(slash + 1);
+    if (node->parent->ignored || basename == ".git") {
+      node->ignored = true;
+    } else {
+      scratch s;
+      if (ignore_case_) {
+        s.folded.assign(name.data(), name.size());
+        fold_case(s.folded);
+        name = s.folded;
+      }
+      node->ignored = match_stack(node->parent, name, true, s);
+    }
+  }
+  // Nothing below an ignored directory is looked at
+  std::string content;
+  if (!node->ignored && read_file(workdir_ + key + ignore_file, content))
+    parse(content, node->rules);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  return directories_.emplace(key, std::move(node)).first->second.get();
+}
+
+bool ignore_matcher::is_ignored(string_view path, const directory *&last,
+                                scratch &s) const {
+  bool is_directory = path.ends_with("/");
+  auto name = is_directory ? path.substr(0, path.size() - 1) : path;
+  if (name.empty())
+    return false;
+  auto slash = name.rfind('/');
+  auto parent =
+      slash == string_view::npos ? string_view() : name.substr(0, slash + 1);
+  if (!last || string_view(last->path) != parent)
+    last = find_directory(parent);
+  if (last->ignored || name.substr(parent.size()) == ".git")
+    return true;
+  if (ignore_case_) {
+    s.folded.assign(name.data(), name.size());
+    fold_case(s.folded);
+    name = s.folded;
+  }
+  return match_stack(last, name, is_directory, s);
+}
+
+bool ignore_matcher::is_ignored(string_view path) const {
+  const directory *last = nullptr;
+  scratch s;
+  return is_ignored(path, last, s);
+}
+
+bool ignore_matcher::is_directory_ignored(string_view path) const {
+  if (path.empty())
+    return false;
+  if (path.ends_with("/"))
+    return find_directory(path)->ignored;
+  return find_directory(path.to_string() + "/")->ignored;
+}
+
+std::vector<bool>
+ignore_matcher::classify(const std::vector<std::string> &paths) {
+  std::vector<uint8_t> ignored(paths.size(), 0);
+  if (!paths.empty()) {
+    if (!pool_)
+      pool_.reset(new thread_pool(num_threads_));
+    // Contiguous runs, so that sorted neighbours share their directory
+    size_t chunks = std::min(paths.size(), pool_->size() * 4);
+    pool_->parallel_for(chunks, [&](size_t chunk, size_t) {
+      const directory *last = nullptr;
+      scratch s;
+      size_t begin = paths.size() * chunk / chunks;
+      size_t end = paths.size() * (chunk + 1) / chunks;
+      for (size_t i = begin; i < end; ++i)
+        ignored[i] = is_ignored(paths[i], last, s) ? 1 : 0;
+    });
+  }
+  return std::vector<bool>(ignored.begin(), ignored.end());
+}
+
+} // namespace cppgit2
@@ -0,0 +1,396 @@
+#include <cppgit2/index_view.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace cppgit2 {
+
+namespace {
+
+const size_t header_size = 12;
+const size_t checksum_size = GIT_OID_RAWSZ;
+// ctime, mtime, dev, ino, mode, uid, gid, size, oid, flags
+const size_t entry_header_size = 62;
+const size_t eoie_size = 8 + 4 + GIT_OID_RAWSZ;
+
+uint32_t be32(const unsigned char *p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+         (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+uint16_t be16(const unsigned char *p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+void throw_corrupted(const std::string &path, const std::string &reason) {
+  throw git_exception("corrupted index " + path + ": " + reason,
+                      git_exception::error_class::index,
+                      git_exception::error_code::invalid);
+}
+
+// The index file at `path`; a missing one is an empty index (version 2, no
+// entries), as libgit2 has it
+mapped_file open_index(const std::string &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0 || errno != ENOENT)
+    return mapped_file(path);
+  static const unsigned char empty[] = {
+      'D',  'I',  'R',  'C',  0,    0,    0,    2,    0,    0,    0,    0,
+      0x39, 0xd8, 0x90, 0x13, 0x9e, 0xe5, 0x35, 0x6c, 0x7e, 0xf5, 0x72, 0x21,
+      0x6c, 0xeb, 0xcf, 0xd2, 0x7a, 0x8a, 0x9d, 0xbf};
+  return mapped_file(path, std::vector<unsigned char>(
+                               empty, empty + sizeof(empty)));
+}
+
+} // namespace
+
+index_view::index_view(const std::string &path, size_t num_threads)
+    : file_(path) {
+  open(num_threads);
+}
+
+index_view::index_view(const repository &repo, size_t num_threads)
+    : file_(open_index(repo.path() + "index")) {
+  open(num_threads);
+}
+
+void index_view::open(size_t num_threads) {
+  auto data = file_.data();
+  if (file_.size() < header_size + checksum_size || memcmp(data, "DIRC", 4))
+    throw_corrupted(file_.path(), "bad header");
+  version_ = be32(data + 4);
+  if (version_ < 2 || version_ > 4)
+    throw_corrupted(file_.path(), "unsupported version");
+  entry_count_ = be32(data + 8);
+  if (entry_count_ > (file_.size() - header_size) / entry_header_size)
+    throw_corrupted(file_.path(), "too many entries for file size");
+  num_threads_ = num_threads;
+  extensions_offset_ = 0;
+}
+
+oid index_view::checksum() const {
+  return oid(reinterpret_cast<const git_oid *>(file_.data() + file_.size() -
+                                               checksum_size));
+}
+
+index_view::entry index_view::entry_at(size_t i) const {
+  load();
+  if (i >= slots_.size())
+    throw git_exception("index entry out of range",
+                        git_exception::error_class::index,
+                        git_exception::error_code::notfound);
+  auto &s = slots_[i];
+  return entry(s.record, string_view(s.path, s.path_length));
+}
+
+size_t index_view::lower_bound(string_view path) const {
+  load();
+  auto found = std::lower_bound(
+      slots_.begin(), slots_.end(), path, [](const slot &s, string_view p) {
+        return string_view(s.path, s.path_length) < p;
+      });
+  return static_cast<size_t>(found - slots_.begin());
+}
+
+const size_t index_view::npos;
+
+size_t index_view::find(string_view path, int stage) const {
+  for (auto i = lower_bound(path); i < slots_.size(); ++i) {
+    auto e = entry(slots_[i].record,
+                   string_view(slots_[i].path, slots_[i].path_length));
+    if (e.path() != path)
+      break;
+    if (e.stage() == stage)
+      return i;
+  }
+  return npos;
+}
+
+std::pair<size_t, size_t> index_view::directory_range(string_view prefix) const {
+  load();
+  if (prefix.empty())
+    return std::make_pair(size_t(0), slots_.size());
+
+  // Entries under "dir" sort between "dir/" and "dir0" ('0' follows '/')
+  std::string from = prefix.to_string() + '/';
+  std::string to = prefix.to_string() + char('/' + 1);
+  return std::make_pair(lower_bound(from), lower_bound(to));
+}
+
+bool index_view::has_extension(const char *signature) const {
+  load_extensions();
+  return find_extension(signature) != nullptr;
+}
+
+const index_view::extension *
+index_view::find_extension(const char *signature) const {
+  for (auto &ext : extensions_)
+    if (!memcmp(ext.signature, signature, 4))
+      return &ext;
+  return nullptr;
+}
+
+size_t index_view::extensions_offset_from_eoie() const {
+  // EOIE ("end of index entries") is always the last extension and records
+  // where the extensions start, so they can be read before the entries
+  auto data = file_.data();
+  auto size = file_.size();
+  if (size < header_size + 8 + eoie_size + checksum_size)
+    return 0;
+  auto eoie = data + size - checksum_size - 8 - eoie_size;
+  if (memcmp(eoie, "EOIE", 4) || be32(eoie + 4) != eoie_size)
+    return 0;
+  size_t offset = be32(eoie + 8);
+  if (offset < header_size || offset > static_cast<size_t>(eoie - data))
+    return 0;
+  return offset;
+}
+
+void index_view::load_extensions() const {
+  std::call_once(extensions_loaded_, [this] {
+    auto offset = extensions_offset_from_eoie();
+    if (!offset) {
+      // No EOIE: the extensions start right after the last entry
+      load();
+      offset = extensions_offset_;
+    }
+
+    auto data = file_.data();
+    auto end = file_.size() - checksum_size;
+    std::vector<extension> result;
+    while (offset + 8 <= end) {
+      extension ext;
+      memcpy(ext.signature, data + offset, 4);
+      ext.offset = offset + 8;
+      ext.size = be32(data + offset + 4);
+      if (ext.size > end - ext.offset)
+        throw_corrupted(file_.path(), "extension runs past end of file");
+      result.push_back(ext);
+      offset = ext.offset + ext.size;
+    }
+    if (offset != end)
+      throw_corrupted(file_.path(), "trailing bytes after extensions");
+    extensions_.swap(result);
+  });
+}
+
+void index_view::load() const {
+  std::call_once(entries_loaded_, [this] {
+    slots_.resize(entry_count_);
+
+    // Use the IEOT extension (offsets of independently parsable blocks of
+    // entries) when there is one; version 4 resets path compression at the
+    // start of each block
+    std::vector<block> blocks;
+    auto extensions_offset = extensions_offset_from_eoie();
+    if (extensions_offset && thread_pool::resolve_size(num_threads_) > 1) {
+      load_extensions();
+      auto ieot = find_extension("IEOT");
+      if (ieot && ieot->size >= 4 && (ieot->size - 4) % 8 == 0 &&
+          be32(file_.data() + ieot->offset) == 1) {
+        size_t first = 0;
+        for (size_t p = ieot->offset + 4; p < ieot->offset + ieot->size;
+             p += 8) {
+          block b{be32(file_.data() + p), first, be32(file_.data() + p + 4)};
+          first += b.count;
+          blocks.push_back(b);
+        }
+        bool valid = first == entry_count_ && !blocks.empty() &&
+                     blocks[0].offset == header_size;
+        for (size_t i = 0; valid && i < blocks.size(); ++i)
+          valid = blocks[i].offset >= header_size &&
+                  blocks[i].offset < extensions_offset &&
+                  (i == 0 || blocks[i].offset > blocks[i - 1].offset);
+        if (!valid)
+          blocks.clear();
+      }
+    }
+
+    if (blocks.size() > 1) {
+      paths_.resize(version_ == 4 ? blocks.size() : 0);
+      std::vector<size_t> block_ends(blocks.size());
+      thread_pool pool(std::min(thread_pool::resolve_size(num_threads_),
+                                blocks.size()));
+      pool.parallel_for(blocks.size(), [&](size_t i, size_t) {
+        block_ends[i] =
+            parse_block(blocks[i], version_ == 4 ? &paths_[i] : nullptr);
+      });
+      for (size_t i = 0; i + 1 < blocks.size(); ++i)
+        if (block_ends[i] != blocks[i + 1].offset)
+          throw_corrupted(file_.path(), "IEOT block offsets do not match");
+      extensions_offset_ = block_ends.back();
+    } else {
+      paths_.resize(version_ == 4 ? 1 : 0);
+      extensions_offset_ =
+          parse_block(block{header_size, 0, entry_count_},
+                      version_ == 4 ? &paths_[0] : nullptr);
+    }
+
+    if (extensions_offset && extensions_offset != extensions_offset_)
+      throw_corrupted(file_.path(), "EOIE offset does not match entries");
+
+    // Split indexes keep most entries in a shared index file
+    auto end = file_.size() - checksum_size;
+    for (auto p = extensions_offset_; p + 8 <= end;
+         p += 8 + be32(file_.data() + p + 4)) {
+      if (be32(file_.data() + p + 4) > end - p - 8)
+        break;
+      if (!memcmp(file_.data() + p, "link", 4))
+        throw git_exception("split index is not supported by index_view",
+                            git_exception::error_class::index,
+                            git_exception::error_code::invalid);
+    }
+  });
+}
+
+size_t index_view::parse_block(const block &b, std::vector<char> *arena) const {
+  auto data = file_.data();
+  auto limit = file_.size() - checksum_size;
+  auto pos = b.offset;
+  std::vector<size_t> arena_offsets;
+  if (version_ == 4)
+    arena_offsets.reserve(b.count);
+  size_t previous_offset = 0, previous_length = 0;
+
+  for (size_t i = 0; i < b.count; ++i) {
+    if (pos + entry_header_size > limit)
+      throw_corrupted(file_.path(), "truncated entry");
+    auto record = data + pos;
+    auto flags = be16(record + 60);
+    auto name = pos + entry_header_size;
+    if (flags & GIT_INDEX_ENTRY_EXTENDED) {
+      if (version_ < 3)
+        throw_corrupted(file_.path(), "extended flags in version 2 entry");
+      name += 2;
+    }
+
+    auto &s = slots_[b.first + i];
+    s.record = record;
+
+    if (version_ < 4) {
+      auto terminator = static_cast<const unsigned char *>(
+          memchr(data + name, 0, limit - std::min(name, limit)));
+      if (!terminator)
+        throw_corrupted(file_.path(), "unterminated path");
+      s.path = reinterpret_cast<const char *>(data + name);
+      s.path_length = static_cast<size_t>(terminator - (data + name));
+      // Entries are NUL-padded to a multiple of eight bytes
+      pos += (name - pos + s.path_length + 8) & ~size_t(7);
+      continue;
+    }
+
+    // Version 4: <varint bytes to strip from previous path><suffix>\0
+    size_t strip = 0;
+    unsigned char c;
+    do {
+      if (name >= limit)
+        throw_corrupted(file_.path(), "truncated path prefix");
+      c = data[name++];
+      strip = (strip << 7) | (c & 0x7f);
+      if (c & 0x80)
+        strip++;
+    } while (c & 0x80);
+    if (strip > previous_length)
+      throw_corrupted(file_.path(), "path prefix too long");
+    auto terminator = static_cast<const unsigned char *>(
+        memchr(data + name, 0, limit - std::min(name, limit)));
+    if (!terminator)
+      throw_corrupted(file_.path(), "unterminated path");
+    auto suffix_length = static_cast<size_t>(terminator - (data + name));
+
+    auto kept = previous_length - strip;
+    auto offset = arena->size();
+    arena->resize(offset + kept + suffix_length + 1);
+    auto buffer = &(*arena)[0];
+    if (kept)
+      memcpy(buffer + offset, buffer + previous_offset, kept);
+    memcpy(buffer + offset + kept, data + name, suffix_length);
+    buffer[offset + kept + suffix_length] = '\0';
+
+    arena_offsets.push_back(offset);
+    s.path_length = kept + suffix_length;
+    previous_offset = offset;
+    previous_length = s.path_length;
+    pos = name + suffix_length + 1;
+  }
+
+  // The arena may have moved while growing; point paths at it now
+  for (size_t i = 0; i < arena_offsets.size(); ++i)
+    slots_[b.first + i].path = &(*arena)[arena_offsets[i]];
+  return pos;
+}
+
+void index_view::load_tree_cache() const {
+  std::call_once(tree_cache_loaded_, [this] {
+    load_extensions();
+    auto ext = find_extension("TREE");
+    if (!ext)
+      return;
+
+    // Pre-order list of: <name>\0<entry count> <subtree count>\n[<oid>]
+    // An entry count of -1 marks an invalidated directory (no oid)
+    auto p = reinterpret_cast<const char *>(file_.data() + ext->offset);
+    auto end = p + ext->size;
+    std::vector<std::pair<std::string, long>> parents; // path, subtrees left
+    std::vector<tree_cache_entry> result;
+    while (p < end) {
+      auto name_end = static_cast<const char *>(memchr(p, 0, end - p));
+      if (!name_end)
+        throw_corrupted(file_.path(), "bad TREE extension");
+      std::string name(p, name_end);
+      p = name_end + 1;
+
+      std::string counts(p, std::find(p, end, '\n'));
+      p += counts.size() + 1;
+      char *rest = nullptr;
+      long entries = strtol(counts.c_str(), &rest, 10);
+      long subtrees = strtol(rest, &rest, 10);
+      if (p > end || subtrees < 0)
+        throw_corrupted(file_.path(), "bad TREE extension");
+
+      std::string path;
+      if (!parents.empty()) {
+        path = parents.back().first.empty() ? name
+                                            : parents.back().first + "/" + name;
+        parents.back().second--;
+      }
+      if (entries >= 0) {
+        if (end - p < static_cast<long>(GIT_OID_RAWSZ))
+          throw_corrupted(file_.path(), "bad TREE extension");
+        tree_cache_entry e;
+        e.path = path;
+        memcpy(e.id.id, p, GIT_OID_RAWSZ);
+        result.push_back(e);
+        p += GIT_OID_RAWSZ;
+      }
+
+      parents.emplace_back(path, subtrees);
+      while (!parents.empty() && parents.back().second == 0)
+        parents.pop_back();
+    }
+
+    std::sort(result.begin(), result.end(),
+              [](const tree_cache_entry &a, const tree_cache_entry &b) {
+                return a.path < b.path;
+              });
+    tree_cache_.swap(result);
+  });
+}
+
+bool index_view::cached_tree(string_view path, oid &id) const {
+  load_tree_cache();
+  auto found = std::lower_bound(
+      tree_cache_.begin(), tree_cache_.end(), path,
+      [](const tree_cache_entry &e, string_view p) {
+        return string_view(e.path) < p;
+      });
+  if (found == tree_cache_.end() || string_view(found->path) != path)
+    return false;
+  id = oid(&found->id);
+  return true;
+}
+
+} // namespace cppgit2
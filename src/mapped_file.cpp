@@ -0,0 +1,104 @@
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/mapped_file.hpp>
+#include <fstream>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+mapped_file::mapped_file()
+    : data_(nullptr), size_(0), mapped_(false) {}
+
+mapped_file::mapped_file(const std::string &path)
+    : path_(path), data_(nullptr), size_(0), mapped_(false) {
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw git_exception("failed to open " + path,
+                        git_exception::error_class::os,
+                        git_exception::error_code::notfound);
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    ::close(fd);
+    throw git_exception("failed to stat " + path,
+                        git_exception::error_class::os);
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_) {
+    void *address = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED) {
+      ::close(fd);
+      throw git_exception("failed to mmap " + path,
+                          git_exception::error_class::os);
+    }
+    data_ = static_cast<const unsigned char *>(address);
+    mapped_ = true;
+  }
+  ::close(fd);
+#else
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in)
+    throw git_exception("failed to open " + path,
+                        git_exception::error_class::os,
+                        git_exception::error_code::notfound);
+  buffer_.resize(static_cast<size_t>(in.tellg()));
+  in.seekg(0);
+  if (!buffer_.empty() &&
+      !in.read(reinterpret_cast<char *>(&buffer_[0]), buffer_.size()))
+    throw git_exception("failed to read " + path,
+                        git_exception::error_class::os);
+  data_ = buffer_.empty() ? nullptr : &buffer_[0];
+  size_ = buffer_.size();
+#endif
+}
+
+mapped_file::mapped_file(const std::string &path,
+                         const std::vector<unsigned char> &contents)
+    : path_(path), data_(nullptr), size_(contents.size()), mapped_(false),
+      buffer_(contents) {
+  data_ = buffer_.empty() ? nullptr : &buffer_[0];
+}
+
+mapped_file::~mapped_file() { release(); }
+
+mapped_file::mapped_file(mapped_file &&other)
+    : path_(std::move(other.path_)), data_(other.data_), size_(other.size_),
+      mapped_(other.mapped_), buffer_(std::move(other.buffer_)) {
+  other.data_ = nullptr;
+  other.size_ = 0;
+  other.mapped_ = false;
+}
+
+mapped_file &mapped_file::operator=(mapped_file &&other) {
+  if (this != &other) {
+    release();
+    path_ = std::move(other.path_);
+    data_ = other.data_;
+    size_ = other.size_;
+    mapped_ = other.mapped_;
+    buffer_ = std::move(other.buffer_);
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.mapped_ = false;
+  }
+  return *this;
+}
+
+void mapped_file::release() {
+#ifndef _WIN32
+  if (mapped_)
+    munmap(const_cast<unsigned char *>(data_), size_);
+#endif
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+  buffer_.clear();
+}
+
+} // namespace cppgit2
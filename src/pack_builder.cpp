@@ -104,9 +104,8 @@ void pack_builder::set_progress_callback(
     git_packbuilder_set_callbacks(c_ptr_, callback_c, (void *)(&wrapper)));
 }
 
-void pack_builder::set_threads(unsigned int num_threads) {
-  git_exception::throw_nonzero(
-    git_packbuilder_set_threads(c_ptr_, num_threads));
+unsigned int pack_builder::set_threads(unsigned int num_threads) {
+  return git_packbuilder_set_threads(c_ptr_, num_threads);
 }
 
 void pack_builder::write(
@@ -0,0 +1,458 @@
+#include <cppgit2/pack_writer.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+namespace {
+
+// SHA-1 of the pack and index files (object ids come from libgit2)
+class sha1 {
+public:
+  sha1() : used_(0), length_(0) {
+    state_[0] = 0x67452301;
+    state_[1] = 0xefcdab89;
+    state_[2] = 0x98badcfe;
+    state_[3] = 0x10325476;
+    state_[4] = 0xc3d2e1f0;
+  }
+
+  void update(const void *data, size_t size) {
+    auto p = static_cast<const unsigned char *>(data);
+    length_ += size;
+    while (size) {
+      size_t n = std::min(size, sizeof(block_) - used_);
+      memcpy(block_ + used_, p, n);
+      used_ += n;
+      p += n;
+      size -= n;
+      if (used_ == sizeof(block_)) {
+        transform(block_);
+        used_ = 0;
+      }
+    }
+  }
+
+  void final(unsigned char out[GIT_OID_RAWSZ]) {
+    uint64_t bits = length_ * 8;
+    unsigned char pad = 0x80;
+    update(&pad, 1);
+    pad = 0;
+    while (used_ != 56)
+      update(&pad, 1);
+    unsigned char size[8];
+    for (int i = 0; i < 8; ++i)
+      size[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+    update(size, 8);
+    for (int i = 0; i < 20; ++i)
+      out[i] = static_cast<unsigned char>(state_[i / 4] >> (24 - 8 * (i % 4)));
+  }
+
+private:
+  static uint32_t rotate(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+  void transform(const unsigned char *block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i)
+      w[i] = (static_cast<uint32_t>(block[4 * i]) << 24) |
+             (static_cast<uint32_t>(block[4 * i + 1]) << 16) |
+             (static_cast<uint32_t>(block[4 * i + 2]) << 8) |
+             static_cast<uint32_t>(block[4 * i + 3]);
+    for (int i = 16; i < 80; ++i)
+      w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3],
+             e = state_[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5a827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      uint32_t t = rotate(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotate(b, 30);
+      b = a;
+      a = t;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+  }
+
+  uint32_t state_[5];
+  unsigned char block_[64];
+  size_t used_;
+  uint64_t length_;
+};
+
+void put32(std::vector<unsigned char> &out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.push_back(static_cast<unsigned char>(value >> shift));
+}
+
+void throw_os_error(const std::string &what, const std::string &path) {
+  throw git_exception(what + " " + path + ": " + strerror(errno),
+                      git_exception::error_class::os);
+}
+
+#ifdef _WIN32
+[[noreturn]] void throw_unsupported() {
+  throw git_exception("pack_writer is not supported on this platform",
+                      git_exception::error_class::os);
+}
+#endif
+
+// Write all of `data` to a new file in `dir` and return its path
+std::string write_temporary(const std::string &dir,
+                            const std::vector<unsigned char> &data) {
+  std::string path = dir + "tmp_idx_XXXXXX";
+#ifdef _WIN32
+  (void)data;
+  throw_unsupported();
+#else
+  int fd = mkstemp(&path[0]);
+  if (fd < 0)
+    throw_os_error("failed to create", path);
+  size_t done = 0;
+  while (done < data.size()) {
+    auto n = ::write(fd, data.data() + done, data.size() - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      ::close(fd);
+      unlink(path.c_str());
+      throw_os_error("failed to write", path);
+    }
+    done += static_cast<size_t>(n);
+  }
+  // Once, before the caller renames it into place
+  if (fsync(fd) < 0) {
+    ::close(fd);
+    unlink(path.c_str());
+    throw_os_error("failed to write", path);
+  }
+  fchmod(fd, 0444);
+  ::close(fd);
+#endif
+  return path;
+}
+
+} // namespace
+
+pack_writer::pack_writer(const repository &repo)
+    : repo_(repo), pack_dir_(repo.commondir() + "objects/pack/"),
+      file_(nullptr), offset_(0), crc_(0) {
+#ifdef _WIN32
+  throw_unsupported();
+#else
+  mkdir(pack_dir_.c_str(), 0777);
+  temp_path_ = pack_dir_ + "tmp_pack_XXXXXX";
+  int fd = mkstemp(&temp_path_[0]);
+  if (fd < 0)
+    throw_os_error("failed to create", temp_path_);
+  file_ = fdopen(fd, "w+b");
+  if (!file_) {
+    ::close(fd);
+    unlink(temp_path_.c_str());
+    throw_os_error("failed to open", temp_path_);
+  }
+  // The object count is filled in by finish()
+  const unsigned char header[12] = {'P', 'A', 'C', 'K', 0, 0, 0, 2,
+                                    0,   0,   0,   0};
+  try {
+    write(header, sizeof(header));
+  } catch (...) {
+    discard();
+    throw;
+  }
+#endif
+}
+
+pack_writer::~pack_writer() { discard(); }
+
+void pack_writer::discard() {
+  if (!file_)
+    return;
+  fclose(file_);
+  file_ = nullptr;
+  remove(temp_path_.c_str());
+}
+
+void pack_writer::compress(const void *data, size_t size,
+                           std::vector<unsigned char> &out, int level) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit(&stream, level) != Z_OK)
+    throw git_exception("failed to initialize zlib",
+                        git_exception::error_class::zlib);
+  out.resize(deflateBound(&stream, static_cast<uLong>(size)) + 64);
+  auto input = static_cast<const unsigned char *>(data);
+  size_t done = 0;
+  int ret = Z_OK;
+  // zlib counts in uInt, so large inputs go in several steps
+  while (ret == Z_OK) {
+    size_t chunk = std::min<size_t>(size - done, 1u << 30);
+    stream.next_in = const_cast<unsigned char *>(input + done);
+    stream.avail_in = static_cast<uInt>(chunk);
+    if (out.size() - stream.total_out < (1u << 16))
+      out.resize(out.size() * 2);
+    stream.next_out = out.data() + stream.total_out;
+    stream.avail_out = static_cast<uInt>(
+        std::min<size_t>(out.size() - stream.total_out, 1u << 30));
+    bool last = done + chunk == size;
+    ret = deflate(&stream, last ? Z_FINISH : Z_NO_FLUSH);
+    done += chunk - stream.avail_in;
+  }
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (ret != Z_STREAM_END)
+    throw git_exception("failed to compress object",
+                        git_exception::error_class::zlib);
+}
+
+void pack_writer::write(const void *data, size_t size) {
+  if (size && fwrite(data, 1, size, file_) != size)
+    throw_os_error("failed to write", temp_path_);
+  crc_ = static_cast<uint32_t>(
+      crc32(crc_, static_cast<const Bytef *>(data), static_cast<uInt>(size)));
+  offset_ += size;
+}
+
+bool pack_writer::append(const git_oid &id, git_object_t type, size_t size,
+                         const unsigned char *compressed,
+                         size_t compressed_size) {
+  if (!file_)
+    throw git_exception("pack is already finished",
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::invalid);
+  if (positions_.count(id))
+    return false;
+
+  // Type and size: 4 bits of size in the first byte, then 7 per byte
+  unsigned char header[16];
+  size_t length = 0;
+  uint64_t remaining = size;
+  header[length] = static_cast<unsigned char>((static_cast<unsigned>(type) << 4) |
+                                              (remaining & 0x0f));
+  remaining >>= 4;
+  while (remaining) {
+    header[length++] |= 0x80;
+    header[length] = static_cast<unsigned char>(remaining & 0x7f);
+    remaining >>= 7;
+  }
+  length++;
+
+  uint64_t offset = offset_;
+  crc_ = static_cast<uint32_t>(crc32(0, Z_NULL, 0));
+  write(header, length);
+  // crc32() takes a uInt length too
+  for (size_t done = 0; done < compressed_size;) {
+    size_t chunk = std::min<size_t>(compressed_size - done, 1u << 30);
+    write(compressed + done, chunk);
+    done += chunk;
+  }
+  positions_.emplace(id, entries_.size());
+  entries_.push_back(entry{id, offset, size, compressed_size, crc_,
+                           static_cast<uint8_t>(length), type});
+  return true;
+}
+
+bool pack_writer::contains(const git_oid &id) const {
+  return positions_.count(id) != 0;
+}
+
+size_t pack_writer::find_prefix(const git_oid &prefix, size_t length,
+                                git_oid &out) const {
+  size_t found = 0;
+  for (auto &e : entries_)
+    if (git_oid_ncmp(&e.id, &prefix, length) == 0 && found++ == 0)
+      out = e.id;
+  return found;
+}
+
+bool pack_writer::read_header(const git_oid &id, git_object_t &type,
+                              size_t &size) const {
+  auto it = positions_.find(id);
+  if (it == positions_.end())
+    return false;
+  auto &e = entries_[it->second];
+  type = e.type;
+  size = static_cast<size_t>(e.size);
+  return true;
+}
+
+bool pack_writer::read(const git_oid &id, void *out) {
+  auto it = positions_.find(id);
+  if (it == positions_.end())
+    return false;
+  auto &e = entries_[it->second];
+#ifdef _WIN32
+  (void)e;
+  (void)out;
+  throw_unsupported();
+#else
+  if (fflush(file_))
+    throw_os_error("failed to write", temp_path_);
+  std::vector<unsigned char> compressed(static_cast<size_t>(e.compressed_size));
+  size_t done = 0;
+  while (done < compressed.size()) {
+    auto n = pread(fileno(file_), compressed.data() + done,
+                   compressed.size() - done,
+                   static_cast<off_t>(e.offset + e.header_size + done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw_os_error("failed to read", temp_path_);
+    done += static_cast<size_t>(n);
+  }
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK)
+    throw git_exception("failed to initialize zlib",
+                        git_exception::error_class::zlib);
+  auto output = static_cast<unsigned char *>(out);
+  int ret = Z_OK;
+  // As in compress(), zlib takes at most a uInt at a time
+  while (ret == Z_OK) {
+    size_t in_left = compressed.size() - stream.total_in;
+    size_t out_left = static_cast<size_t>(e.size) - stream.total_out;
+    stream.next_in = compressed.data() + stream.total_in;
+    stream.avail_in = static_cast<uInt>(std::min<size_t>(in_left, 1u << 30));
+    stream.next_out = output + stream.total_out;
+    stream.avail_out = static_cast<uInt>(std::min<size_t>(out_left, 1u << 30));
+    ret = inflate(&stream, Z_NO_FLUSH);
+  }
+  bool complete = ret == Z_STREAM_END && stream.total_out == e.size;
+  inflateEnd(&stream);
+  if (!complete)
+    throw git_exception("corrupt object in pack " + temp_path_,
+                        git_exception::error_class::zlib);
+#endif
+  return true;
+}
+
+oid pack_writer::finish() {
+  if (!file_)
+    throw git_exception("pack is already finished",
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::invalid);
+  if (entries_.empty()) {
+    static const unsigned char zero[GIT_OID_RAWSZ] = {0};
+    discard();
+    return oid(zero);
+  }
+#ifndef _WIN32
+  // Object count, then the checksum of the whole file
+  std::vector<unsigned char> count;
+  put32(count, static_cast<uint32_t>(entries_.size()));
+  unsigned char checksum[GIT_OID_RAWSZ];
+  {
+    sha1 hash;
+    std::vector<unsigned char> buffer(1 << 20);
+    if (fflush(file_) || fseek(file_, 8, SEEK_SET) ||
+        fwrite(count.data(), 1, 4, file_) != 4 || fflush(file_) ||
+        fseek(file_, 0, SEEK_SET))
+      throw_os_error("failed to write", temp_path_);
+    for (uint64_t done = 0; done < offset_;) {
+      size_t n = fread(buffer.data(), 1, buffer.size(), file_);
+      if (!n)
+        throw_os_error("failed to read", temp_path_);
+      hash.update(buffer.data(), n);
+      done += n;
+    }
+    hash.final(checksum);
+    if (fseek(file_, 0, SEEK_END) ||
+        fwrite(checksum, 1, sizeof(checksum), file_) != sizeof(checksum) ||
+        fflush(file_) || fsync(fileno(file_)) < 0)
+      throw_os_error("failed to write", temp_path_);
+  }
+  fchmod(fileno(file_), 0444);
+  fclose(file_);
+  file_ = nullptr;
+
+  // Version 2 index: fan-out table, ids, CRCs, 31-bit offsets (or indexes
+  // into a table of 64-bit ones), then both checksums
+  std::vector<entry> sorted(entries_);
+  std::sort(sorted.begin(), sorted.end(), [](const entry &a, const entry &b) {
+    return memcmp(a.id.id, b.id.id, GIT_OID_RAWSZ) < 0;
+  });
+  std::vector<unsigned char> index{0xff, 't', 'O', 'c'};
+  put32(index, 2);
+  size_t position = 0;
+  for (unsigned fan = 0; fan < 256; ++fan) {
+    while (position < sorted.size() && sorted[position].id.id[0] <= fan)
+      position++;
+    put32(index, static_cast<uint32_t>(position));
+  }
+  for (auto &e : sorted)
+    index.insert(index.end(), e.id.id, e.id.id + GIT_OID_RAWSZ);
+  for (auto &e : sorted)
+    put32(index, e.crc);
+  std::vector<uint64_t> large;
+  for (auto &e : sorted) {
+    if (e.offset < 0x80000000u) {
+      put32(index, static_cast<uint32_t>(e.offset));
+    } else {
+      put32(index, 0x80000000u | static_cast<uint32_t>(large.size()));
+      large.push_back(e.offset);
+    }
+  }
+  for (auto offset : large) {
+    put32(index, static_cast<uint32_t>(offset >> 32));
+    put32(index, static_cast<uint32_t>(offset));
+  }
+  index.insert(index.end(), checksum, checksum + sizeof(checksum));
+  unsigned char index_checksum[GIT_OID_RAWSZ];
+  sha1 hash;
+  hash.update(index.data(), index.size());
+  hash.final(index_checksum);
+  index.insert(index.end(), index_checksum,
+               index_checksum + sizeof(index_checksum));
+
+  oid name(checksum);
+  auto base = pack_dir_ + "pack-" + name.to_hex_string();
+  auto index_path = write_temporary(pack_dir_, index);
+  // The index goes last: a pack without one is invisible
+  if (rename(temp_path_.c_str(), (base + ".pack").c_str()) < 0) {
+    unlink(index_path.c_str());
+    unlink(temp_path_.c_str());
+    throw_os_error("failed to rename", temp_path_);
+  }
+  if (rename(index_path.c_str(), (base + ".idx").c_str()) < 0) {
+    unlink(index_path.c_str());
+    throw_os_error("failed to rename", index_path);
+  }
+
+  git_odb *odb = nullptr;
+  if (git_repository_odb(&odb, const_cast<git_repository *>(repo_.c_ptr())) ==
+      0) {
+    git_odb_refresh(odb);
+    git_odb_free(odb);
+  }
+  return name;
+#else
+  throw_unsupported();
+#endif
+}
+
+} // namespace cppgit2
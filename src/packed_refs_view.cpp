@@ -0,0 +1,181 @@
+#include <cppgit2/packed_refs_view.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace cppgit2 {
+
+namespace {
+
+const char header_prefix[] = "# pack-refs with:";
+
+oid parse_hex(const char *hex) {
+  git_oid id;
+  if (git_oid_fromstrn(&id, hex, GIT_OID_HEXSZ))
+    throw git_exception("corrupted packed-refs entry",
+                        git_exception::error_class::reference,
+                        git_exception::error_code::invalid);
+  return oid(&id);
+}
+
+} // namespace
+
+oid packed_refs_view::entry::target() const { return parse_hex(record_); }
+
+oid packed_refs_view::entry::peeled() const { return parse_hex(peeled_); }
+
+packed_refs_view::packed_refs_view(const std::string &path)
+    : data_(nullptr), start_(0), sorted_(false), peeled_(false),
+      fully_peeled_(false) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0)
+    file_ = mapped_file(path);
+  else if (errno != ENOENT)
+    throw git_exception("failed to open " + path,
+                        git_exception::error_class::os);
+  open();
+}
+
+packed_refs_view::packed_refs_view(const repository &repo)
+    : packed_refs_view(repo.commondir() + "packed-refs") {}
+
+void packed_refs_view::open() {
+  data_ = reinterpret_cast<const char *>(file_.data());
+  auto size = file_.size();
+  if (size == 0) {
+    sorted_ = true; // nothing to index
+    return;
+  }
+  if (data_[size - 1] != '\n')
+    throw_corrupted(size - 1);
+
+  if (data_[0] == '#') {
+    auto eol = static_cast<const char *>(memchr(data_, '\n', size));
+    start_ = static_cast<size_t>(eol - data_) + 1;
+    string_view header(data_, start_ - 1);
+    if (header.starts_with(header_prefix)) {
+      auto traits = header.substr(strlen(header_prefix)).to_string() + " ";
+      sorted_ = traits.find(" sorted ") != std::string::npos;
+      peeled_ = traits.find(" peeled ") != std::string::npos;
+      fully_peeled_ = traits.find(" fully-peeled ") != std::string::npos;
+    }
+  }
+  if (sorted_)
+    return;
+
+  // Written before git sorted packed-refs: index the records by name
+  for (size_t offset = start_; offset < size; offset = record_end(offset))
+    records_.push_back(offset);
+  std::stable_sort(records_.begin(), records_.end(),
+                   [this](size_t a, size_t b) {
+                     return name_at(a) < name_at(b);
+                   });
+}
+
+void packed_refs_view::throw_corrupted(size_t offset) const {
+  throw git_exception("corrupted packed-refs " + file_.path() +
+                          " at offset " + std::to_string(offset),
+                      git_exception::error_class::reference,
+                      git_exception::error_code::invalid);
+}
+
+// Past the record at `offset` and its "^" line, if any
+size_t packed_refs_view::record_end(size_t offset) const {
+  auto size = file_.size();
+  auto eol = static_cast<const char *>(
+      memchr(data_ + offset, '\n', size - offset));
+  size_t end = static_cast<size_t>(eol - data_) + 1;
+  if (end < size && data_[end] == '^')
+    end = static_cast<size_t>(
+              static_cast<const char *>(memchr(data_ + end, '\n', size - end)) -
+              data_) +
+          1;
+  return end;
+}
+
+// "<40 hex digits> <name>\n"
+string_view packed_refs_view::name_at(size_t offset) const {
+  auto size = file_.size();
+  if (size - offset < GIT_OID_HEXSZ + 3 ||
+      data_[offset + GIT_OID_HEXSZ] != ' ')
+    throw_corrupted(offset);
+  auto name = data_ + offset + GIT_OID_HEXSZ + 1;
+  auto eol = static_cast<const char *>(
+      memchr(name, '\n', size - offset - GIT_OID_HEXSZ - 1));
+  if (eol == name)
+    throw_corrupted(offset);
+  return string_view(name, static_cast<size_t>(eol - name));
+}
+
+packed_refs_view::entry packed_refs_view::entry_at(size_t position) const {
+  auto offset = sorted_ ? position : records_[position];
+  auto name = name_at(offset);
+  size_t next_line = static_cast<size_t>(name.end() - data_) + 1;
+  const char *peeled = nullptr;
+  if (next_line < file_.size() && data_[next_line] == '^') {
+    if (file_.size() - next_line < GIT_OID_HEXSZ + 2 ||
+        data_[next_line + GIT_OID_HEXSZ + 1] != '\n')
+      throw_corrupted(next_line);
+    peeled = data_ + next_line + 1;
+  }
+  return entry(data_ + offset, name, peeled);
+}
+
+size_t packed_refs_view::next(size_t position) const {
+  return sorted_ ? record_end(position) : position + 1;
+}
+
+packed_refs_view::iterator
+packed_refs_view::lower_bound(string_view name) const {
+  if (!sorted_) {
+    auto found = std::lower_bound(
+        records_.begin(), records_.end(), name,
+        [this](size_t offset, string_view n) { return name_at(offset) < n; });
+    return iterator(this, static_cast<size_t>(found - records_.begin()));
+  }
+
+  // Both ends are always at the start of a record (or the end of the
+  // file); the middle is moved back to the start of its record
+  size_t low = start_, high = file_.size();
+  while (low < high) {
+    size_t record = low + (high - low) / 2;
+    while (record > low && data_[record - 1] != '\n')
+      --record;
+    if (data_[record] == '^') {
+      if (record == low)
+        throw_corrupted(record);
+      --record;
+      while (record > low && data_[record - 1] != '\n')
+        --record;
+    }
+    if (name_at(record) < name)
+      low = record_end(record);
+    else
+      high = record;
+  }
+  return iterator(this, low);
+}
+
+packed_refs_view::iterator packed_refs_view::find(string_view name) const {
+  auto found = lower_bound(name);
+  if (found != end() && (*found).name() == name)
+    return found;
+  return end();
+}
+
+packed_refs_view::range
+packed_refs_view::with_prefix(string_view prefix) const {
+  // Names starting with the prefix sort before its successor: the prefix
+  // with its last byte incremented, after dropping trailing 0xff bytes
+  std::string successor = prefix.to_string();
+  while (!successor.empty() &&
+         static_cast<unsigned char>(successor.back()) == 0xff)
+    successor.pop_back();
+  if (successor.empty())
+    return range{lower_bound(prefix), end()};
+  successor.back() = static_cast<char>(successor.back() + 1);
+  return range{lower_bound(prefix), lower_bound(successor)};
+}
+
+} // namespace cppgit2
@@ -0,0 +1,529 @@
+#include <cppgit2/parallel_checkout.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <initializer_list>
+#include <mutex>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+namespace {
+
+struct planned_write {
+  std::string path;
+  git_oid id;
+  uint32_t mode;
+  bool skip_worktree; // outside the sparse checkout cone
+#ifndef _WIN32
+  struct stat st; // after writing, for the index
+#endif
+};
+
+// What libgit2's dry run decided to do, collected from notifications
+struct checkout_plan {
+  git_checkout_notify_cb notify_cb;
+  void *notify_payload;
+  unsigned int notify_flags;
+  unsigned int strategy;
+  std::vector<planned_write> writes;
+  std::vector<std::string> removals;       // tracked files leaving the tree
+  std::vector<std::string> extra_removals; // untracked or ignored
+};
+
+int record_notification(git_checkout_notify_t why, const char *path,
+                        const git_diff_file *baseline,
+                        const git_diff_file *target,
+                        const git_diff_file *workdir, void *payload) {
+  auto plan = reinterpret_cast<checkout_plan *>(payload);
+  if (plan->notify_cb && (why & plan->notify_flags)) {
+    int ret = plan->notify_cb(why, path, baseline, target, workdir,
+                              plan->notify_payload);
+    if (ret)
+      return ret;
+  }
+
+  if (why == GIT_CHECKOUT_NOTIFY_UPDATED) {
+    if (target && target->mode != GIT_FILEMODE_UNREADABLE) {
+      planned_write write;
+      write.path = path;
+      write.id = target->id;
+      write.mode = target->mode;
+      write.skip_worktree = false;
+      plan->writes.push_back(write);
+    } else {
+      plan->removals.push_back(path);
+    }
+  } else if ((why == GIT_CHECKOUT_NOTIFY_UNTRACKED &&
+              (plan->strategy & GIT_CHECKOUT_REMOVE_UNTRACKED)) ||
+             (why == GIT_CHECKOUT_NOTIFY_IGNORED &&
+              (plan->strategy & GIT_CHECKOUT_REMOVE_IGNORED))) {
+    plan->extra_removals.push_back(path);
+  }
+  return 0;
+}
+
+#ifndef _WIN32
+
+void throw_os_error(const std::string &what, const std::string &path) {
+  throw git_exception(what + " " + path + ": " + strerror(errno),
+                      git_exception::error_class::os);
+}
+
+// Remove a file, symlink or directory tree; a missing path is not an error
+void remove_all(const std::string &path) {
+  struct stat st;
+  if (lstat(path.c_str(), &st) < 0) {
+    if (errno == ENOENT || errno == ENOTDIR)
+      return;
+    throw_os_error("failed to stat", path);
+  }
+  if (S_ISDIR(st.st_mode)) {
+    auto dir = opendir(path.c_str());
+    if (!dir)
+      throw_os_error("failed to open directory", path);
+    std::vector<std::string> names;
+    while (auto entry = readdir(dir))
+      if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+        names.push_back(entry->d_name);
+    closedir(dir);
+    for (auto &name : names)
+      remove_all(path + "/" + name);
+    if (rmdir(path.c_str()) < 0 && errno != ENOENT)
+      throw_os_error("failed to remove directory", path);
+  } else if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+    throw_os_error("failed to remove", path);
+  }
+}
+
+// Create `path` and its parents below `root`; whatever non-directory is in
+// the way was planned for removal and is removed
+void make_directories(const std::string &root, const std::string &path,
+                      unsigned int mode) {
+  for (size_t slash = path.find('/');; slash = path.find('/', slash + 1)) {
+    auto absolute = root + path.substr(0, slash);
+    if (mkdir(absolute.c_str(), mode) < 0) {
+      if (errno != EEXIST)
+        throw_os_error("failed to create directory", absolute);
+      struct stat st;
+      if (lstat(absolute.c_str(), &st) == 0 && !S_ISDIR(st.st_mode)) {
+        remove_all(absolute);
+        if (mkdir(absolute.c_str(), mode) < 0 && errno != EEXIST)
+          throw_os_error("failed to create directory", absolute);
+      }
+    }
+    if (slash == std::string::npos)
+      break;
+  }
+}
+
+void write_all(int fd, const char *data, size_t size,
+               const std::string &path) {
+  while (size) {
+    auto written = write(fd, data, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      throw_os_error("failed to write", path);
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+// Create `path` holding `data` and stat it into `st`
+void write_file(const std::string &path, const char *data, size_t size,
+                int open_flags, unsigned int mode, struct stat &st) {
+  int fd = open(path.c_str(), open_flags, mode);
+  if (fd < 0)
+    throw_os_error("failed to create", path);
+  try {
+    write_all(fd, data, size, path);
+    if (fstat(fd, &st) < 0)
+      throw_os_error("failed to stat", path);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+}
+
+bool is_attributes_file(const std::string &path) {
+  static const char name[] = ".gitattributes";
+  auto slash = path.rfind('/');
+  return path.compare(slash == std::string::npos ? 0 : slash + 1,
+                      std::string::npos, name) == 0;
+}
+
+#endif
+
+} // namespace
+
+parallel_checkout::parallel_checkout(const repository &repo,
+                                     size_t num_threads)
+    : repo_(repo), num_threads_(thread_pool::resolve_size(num_threads)),
+      sparse_(nullptr), stats_{0, 0, 0} {
+  handles_.reserve(num_threads_);
+  for (size_t i = 0; i < num_threads_; ++i)
+    handles_.push_back(repo_.reopen());
+}
+
+void parallel_checkout::checkout_head(const checkout::options &options) {
+  auto repo = const_cast<git_repository *>(repo_.c_ptr());
+  git_reference *head = nullptr;
+  git_object *tree = nullptr;
+  int ret = git_repository_head(&head, repo);
+  if (!ret)
+    ret = git_reference_peel(&tree, head, GIT_OBJECT_TREE);
+  git_reference_free(head);
+  git_exception::throw_nonzero(ret);
+  try {
+    run(tree, nullptr, options);
+  } catch (...) {
+    git_object_free(tree);
+    throw;
+  }
+  git_object_free(tree);
+}
+
+void parallel_checkout::checkout_index(const cppgit2::index &index,
+                                       const checkout::options &options) {
+  run(nullptr, const_cast<git_index *>(index.c_ptr()), options);
+}
+
+void parallel_checkout::checkout_tree(const object &treeish,
+                                      const checkout::options &options) {
+  run(treeish.c_ptr(), nullptr, options);
+}
+
+void parallel_checkout::run(const git_object *treeish, git_index *index,
+                            const checkout::options &options) {
+  auto repo = const_cast<git_repository *>(repo_.c_ptr());
+  stats_ = statistics{0, 0, 0};
+
+#ifdef _WIN32
+  if (treeish)
+    git_exception::throw_nonzero(
+        git_checkout_tree(repo, treeish, options.c_ptr()));
+  else
+    git_exception::throw_nonzero(
+        git_checkout_index(repo, index, options.c_ptr()));
+#else
+  const git_checkout_options &user = *options.c_ptr();
+  unsigned int strategy = user.checkout_strategy;
+
+  // 1. Plan: libgit2 dry run with the caller's options
+  checkout_plan plan;
+  plan.notify_cb = user.notify_cb;
+  plan.notify_payload = user.notify_payload;
+  plan.notify_flags = user.notify_flags;
+  plan.strategy = strategy;
+
+  git_checkout_options dry_run = user;
+  dry_run.checkout_strategy |= GIT_CHECKOUT_DRY_RUN;
+  dry_run.notify_cb = record_notification;
+  dry_run.notify_payload = &plan;
+  dry_run.notify_flags = user.notify_flags | GIT_CHECKOUT_NOTIFY_UPDATED;
+  if (strategy & GIT_CHECKOUT_REMOVE_UNTRACKED)
+    dry_run.notify_flags |= GIT_CHECKOUT_NOTIFY_UNTRACKED;
+  if (strategy & GIT_CHECKOUT_REMOVE_IGNORED)
+    dry_run.notify_flags |= GIT_CHECKOUT_NOTIFY_IGNORED;
+  dry_run.progress_cb = nullptr;
+  dry_run.perfdata_cb = nullptr;
+
+  if (treeish)
+    git_exception::throw_nonzero(git_checkout_tree(repo, treeish, &dry_run));
+  else
+    git_exception::throw_nonzero(git_checkout_index(repo, index, &dry_run));
+
+  if ((strategy & GIT_CHECKOUT_DRY_RUN) ||
+      !(strategy & (GIT_CHECKOUT_SAFE | GIT_CHECKOUT_FORCE)))
+    return;
+
+  std::string root;
+  if (user.target_directory) {
+    root = user.target_directory;
+    if (!root.empty() && root.back() != '/')
+      root += '/';
+    // Created if missing, like libgit2 does
+    for (size_t slash = root.find('/', 1); slash != std::string::npos;
+         slash = root.find('/', slash + 1))
+      if (mkdir(root.substr(0, slash).c_str(), 0755) < 0 && errno != EEXIST)
+        throw_os_error("failed to create directory", root.substr(0, slash));
+  } else {
+    root = repo_.workdir();
+  }
+  unsigned int dir_mode = user.dir_mode ? user.dir_mode : 0755;
+  int open_flags = user.file_open_flags ? user.file_open_flags
+                                        : (O_CREAT | O_TRUNC | O_WRONLY);
+  open_flags |= O_CLOEXEC;
+
+  // Like libgit2, symlinks are written as plain files holding their target
+  // when core.symlinks is false
+  bool symlinks = true;
+  git_config *config = nullptr;
+  if (!git_repository_config_snapshot(&config, repo)) {
+    int value;
+    if (!git_config_get_bool(&value, config, "core.symlinks"))
+      symlinks = value != 0;
+    git_config_free(config);
+  }
+  git_error_clear();
+
+  std::mutex progress_mutex;
+  size_t completed = 0;
+  size_t total = plan.writes.size() + plan.removals.size();
+  auto progress = [&](const char *path) {
+    if (!user.progress_cb)
+      return;
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    user.progress_cb(path, completed, total, user.progress_payload);
+  };
+  progress(nullptr);
+
+  // 2. Removals, then the directories they leave empty
+  std::vector<std::string> removed_dirs;
+  for (auto *list : {&plan.removals, &plan.extra_removals}) {
+    for (auto &path : *list) {
+      auto relative = path;
+      if (!relative.empty() && relative.back() == '/')
+        relative.pop_back();
+      remove_all(root + relative);
+      stats_.files_removed++;
+      for (auto slash = relative.rfind('/'); slash != std::string::npos;
+           slash = relative.rfind('/', slash - 1)) {
+        removed_dirs.push_back(relative.substr(0, slash));
+        if (!slash)
+          break;
+      }
+      if (list == &plan.removals) {
+        completed++;
+        progress(path.c_str());
+      }
+    }
+  }
+  // Deepest first
+  std::sort(removed_dirs.begin(), removed_dirs.end(),
+            [](const std::string &a, const std::string &b) {
+              return a.size() != b.size() ? a.size() > b.size() : a < b;
+            });
+  removed_dirs.erase(std::unique(removed_dirs.begin(), removed_dirs.end()),
+                     removed_dirs.end());
+  for (auto &dir : removed_dirs)
+    rmdir((root + dir).c_str()); // fails harmlessly unless empty
+
+  // Paths outside the sparse checkout cone are not materialized
+  size_t skipped = 0;
+  if (sparse_ && sparse_->enabled()) {
+    for (auto &write : plan.writes) {
+      if (sparse_->includes(write.path))
+        continue;
+      write.skip_worktree = true;
+      remove_all(root + write.path);
+      skipped++;
+      completed++;
+      progress(write.path.c_str());
+    }
+  }
+
+  // 3. Parent directories, created once, in order
+  std::sort(plan.writes.begin(), plan.writes.end(),
+            [](const planned_write &a, const planned_write &b) {
+              return a.path < b.path;
+            });
+  std::string last_dir;
+  for (auto &write : plan.writes) {
+    if (write.skip_worktree)
+      continue;
+    auto slash = write.path.rfind('/');
+    if (slash == std::string::npos)
+      continue;
+    auto dir = write.path.substr(0, slash);
+    if (dir != last_dir) {
+      make_directories(root, dir, dir_mode);
+      last_dir = dir;
+    }
+  }
+
+  // 4. Regular files on the pool; symlinks and submodules afterwards.
+  // The smudge filters of a file depend on the .gitattributes files above
+  // it, so those are all written before the pool starts
+  std::vector<size_t> attributes, files, others;
+  for (size_t i = 0; i < plan.writes.size(); ++i) {
+    auto mode = plan.writes[i].mode;
+    if (plan.writes[i].skip_worktree)
+      continue;
+    if (mode != GIT_FILEMODE_BLOB && mode != GIT_FILEMODE_BLOB_EXECUTABLE)
+      others.push_back(i);
+    else if (is_attributes_file(plan.writes[i].path))
+      attributes.push_back(i);
+    else
+      files.push_back(i);
+  }
+
+  std::atomic<size_t> bytes_written(0);
+  auto write_blob = [&](planned_write &write, git_repository *handle_repo) {
+    auto absolute = root + write.path;
+    git_blob *blob = nullptr;
+    git_exception::throw_nonzero(git_blob_lookup(&blob, handle_repo, &write.id));
+
+    git_buf filtered = GIT_BUF_INIT;
+    const char *data;
+    size_t size;
+    if (user.disable_filters) {
+      data = static_cast<const char *>(git_blob_rawcontent(blob));
+      size = static_cast<size_t>(git_blob_rawsize(blob));
+    } else {
+      git_blob_filter_options filter_options = GIT_BLOB_FILTER_OPTIONS_INIT;
+      int ret = git_blob_filter(&filtered, blob, write.path.c_str(),
+                                &filter_options);
+      if (ret) {
+        git_blob_free(blob);
+        git_exception::throw_nonzero(ret);
+      }
+      data = filtered.ptr;
+      size = filtered.size;
+    }
+
+    struct stat existing;
+    if (lstat(absolute.c_str(), &existing) == 0) {
+      // Replaced, not rewritten in place: resets the mode and never
+      // writes through a symlink
+      if (S_ISDIR(existing.st_mode))
+        remove_all(absolute);
+      else
+        unlink(absolute.c_str());
+    }
+
+    unsigned int file_mode =
+        user.file_mode ? user.file_mode
+                       : (write.mode == GIT_FILEMODE_BLOB_EXECUTABLE ? 0755
+                                                                      : 0644);
+    try {
+      write_file(absolute, data, size, open_flags, file_mode, write.st);
+    } catch (...) {
+      git_buf_dispose(&filtered);
+      git_blob_free(blob);
+      throw;
+    }
+    git_buf_dispose(&filtered);
+    git_blob_free(blob);
+    bytes_written += size;
+  };
+
+  for (auto i : attributes) {
+    write_blob(plan.writes[i], repo);
+    completed++;
+    progress(plan.writes[i].path.c_str());
+  }
+
+  {
+    thread_pool pool(std::min(num_threads_, std::max<size_t>(files.size(), 1)));
+    pool.parallel_for(files.size(), [&](size_t i, size_t worker) {
+      auto &write = plan.writes[files[i]];
+      write_blob(write, const_cast<git_repository *>(handles_[worker].c_ptr()));
+      {
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        completed++;
+      }
+      progress(write.path.c_str());
+    });
+  }
+
+  for (auto i : others) {
+    auto &write = plan.writes[i];
+    auto absolute = root + write.path;
+    if (write.mode == GIT_FILEMODE_LINK) {
+      git_blob *blob = nullptr;
+      git_exception::throw_nonzero(git_blob_lookup(&blob, repo, &write.id));
+      std::string target(static_cast<const char *>(git_blob_rawcontent(blob)),
+                         static_cast<size_t>(git_blob_rawsize(blob)));
+      git_blob_free(blob);
+      remove_all(absolute);
+      if (!symlinks) {
+        write_file(absolute, target.data(), target.size(), open_flags,
+                   user.file_mode ? user.file_mode : 0644, write.st);
+      } else {
+        if (symlink(target.c_str(), absolute.c_str()) < 0)
+          throw_os_error("failed to create symlink", absolute);
+        if (lstat(absolute.c_str(), &write.st) < 0)
+          throw_os_error("failed to stat", absolute);
+      }
+      bytes_written += target.size();
+    } else if (write.mode == GIT_FILEMODE_COMMIT) {
+      // Submodules get an empty directory, as with libgit2
+      make_directories(root, write.path, dir_mode);
+      if (lstat(absolute.c_str(), &write.st) < 0)
+        throw_os_error("failed to stat", absolute);
+    } else {
+      continue;
+    }
+    completed++;
+    progress(write.path.c_str());
+  }
+  stats_.files_written = plan.writes.size() - skipped;
+  stats_.bytes_written = bytes_written;
+
+  // 5. Index entries of the written and removed paths
+  if (strategy & GIT_CHECKOUT_DONT_UPDATE_INDEX)
+    return;
+  git_index *target_index = index;
+  if (!target_index)
+    git_exception::throw_nonzero(git_repository_index(&target_index, repo));
+
+  int ret = 0;
+  for (size_t i = 0; !ret && i < plan.writes.size(); ++i) {
+    auto &write = plan.writes[i];
+    git_index_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.id = write.id;
+    entry.path = write.path.c_str();
+    entry.mode = write.mode;
+    if (write.skip_worktree) {
+      entry.flags_extended = GIT_INDEX_ENTRY_SKIP_WORKTREE;
+      ret = git_index_add(target_index, &entry);
+      continue;
+    }
+#if defined(__APPLE__)
+    entry.ctime.seconds = static_cast<int32_t>(write.st.st_ctimespec.tv_sec);
+    entry.ctime.nanoseconds = static_cast<uint32_t>(write.st.st_ctimespec.tv_nsec);
+    entry.mtime.seconds = static_cast<int32_t>(write.st.st_mtimespec.tv_sec);
+    entry.mtime.nanoseconds = static_cast<uint32_t>(write.st.st_mtimespec.tv_nsec);
+#else
+    entry.ctime.seconds = static_cast<int32_t>(write.st.st_ctim.tv_sec);
+    entry.ctime.nanoseconds = static_cast<uint32_t>(write.st.st_ctim.tv_nsec);
+    entry.mtime.seconds = static_cast<int32_t>(write.st.st_mtim.tv_sec);
+    entry.mtime.nanoseconds = static_cast<uint32_t>(write.st.st_mtim.tv_nsec);
+#endif
+    entry.dev = static_cast<uint32_t>(write.st.st_dev);
+    entry.ino = static_cast<uint32_t>(write.st.st_ino);
+    entry.uid = write.st.st_uid;
+    entry.gid = write.st.st_gid;
+    entry.file_size = write.mode == GIT_FILEMODE_COMMIT
+                          ? 0
+                          : static_cast<uint32_t>(write.st.st_size);
+    ret = git_index_add(target_index, &entry);
+  }
+  for (size_t i = 0; !ret && i < plan.removals.size(); ++i) {
+    ret = git_index_remove_bypath(target_index, plan.removals[i].c_str());
+    if (ret == GIT_ENOTFOUND)
+      ret = 0;
+  }
+  // Only an index backed by a file is written
+  if (!ret && !(strategy & GIT_CHECKOUT_DONT_WRITE_INDEX) &&
+      git_index_path(target_index))
+    ret = git_index_write(target_index);
+  if (!index)
+    git_index_free(target_index);
+  git_exception::throw_nonzero(ret);
+#endif
+}
+
+} // namespace cppgit2
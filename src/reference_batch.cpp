@@ -0,0 +1,466 @@
+#include <cppgit2/mapped_file.hpp>
+#include <cppgit2/reference.hpp>
+#include <cppgit2/reference_batch.hpp>
+#include <cppgit2/reftable.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+namespace {
+
+#ifndef _WIN32
+
+const char packed_refs_header[] = "# pack-refs with:";
+
+struct packed_ref {
+  std::string name;
+  git_oid id;
+  git_oid peeled;
+  bool has_peeled;
+};
+
+bool is_zero(const git_oid &id) {
+  static const git_oid zero = {{0}};
+  return !memcmp(id.id, zero.id, GIT_OID_RAWSZ);
+}
+
+bool starts_with(const std::string &text, const char *prefix) {
+  return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+std::string to_hex(const git_oid &id) {
+  char hex[GIT_OID_HEXSZ + 1];
+  return git_oid_tostr(hex, sizeof(hex), &id);
+}
+
+void throw_os_error(const std::string &what, const std::string &path) {
+  throw git_exception(what + " " + path + ": " + strerror(errno),
+                      git_exception::error_class::os);
+}
+
+void throw_invalid(const std::string &message) {
+  throw git_exception(message, git_exception::error_class::reference,
+                      git_exception::error_code::invalid);
+}
+
+// `path`.lock, created exclusively as git does; renamed over `path` by
+// commit(), removed otherwise
+class lock_file {
+public:
+  explicit lock_file(const std::string &path)
+      : path_(path), lock_path_(path + ".lock"), fd_(-1) {
+    fd_ = ::open(lock_path_.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd_ < 0) {
+      if (errno == EEXIST)
+        throw git_exception("failed to lock " + path + ": " + lock_path_ +
+                                " exists",
+                            git_exception::error_class::reference,
+                            git_exception::error_code::locked);
+      throw_os_error("failed to create", lock_path_);
+    }
+  }
+
+  ~lock_file() { release(); }
+
+  lock_file(const lock_file &) = delete;
+  lock_file &operator=(const lock_file &) = delete;
+
+  void write(const std::string &data) {
+    size_t done = 0;
+    while (done < data.size()) {
+      auto n = ::write(fd_, data.data() + done, data.size() - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        throw_os_error("failed to write", lock_path_);
+      done += static_cast<size_t>(n);
+    }
+  }
+
+  void commit() {
+    if (fsync(fd_) < 0)
+      throw_os_error("failed to write", lock_path_);
+    ::close(fd_);
+    fd_ = -1;
+    if (std::rename(lock_path_.c_str(), path_.c_str()) != 0) {
+      unlink(lock_path_.c_str());
+      throw_os_error("failed to rename", lock_path_);
+    }
+    lock_path_.clear();
+  }
+
+  // Remove the lock, leaving `path` as it is
+  void release() {
+    if (fd_ >= 0)
+      ::close(fd_);
+    fd_ = -1;
+    if (!lock_path_.empty())
+      unlink(lock_path_.c_str());
+    lock_path_.clear();
+  }
+
+  const std::string &path() const { return path_; }
+
+private:
+  std::string path_;
+  std::string lock_path_;
+  int fd_;
+};
+
+// Whether the directory `path` holds anything
+bool has_entries(const std::string &path) {
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return false;
+  bool found = false;
+  while (auto entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+      found = true;
+      break;
+    }
+  }
+  closedir(dir);
+  return found;
+}
+
+// Remove the directories left empty above the loose file of `name`, up to
+// (not including) refs/<category>/
+void remove_empty_parents(const std::string &base, const std::string &name) {
+  auto category = name.find('/', strlen("refs/"));
+  auto end = name.rfind('/');
+  while (end != std::string::npos && end > category) {
+    if (rmdir((base + name.substr(0, end)).c_str()) != 0)
+      break;
+    end = name.rfind('/', end - 1);
+  }
+}
+
+// Create the directories of the reference `name` below `base`, for its lock
+// file; a file in the way is a reference `name` cannot be created below
+void create_parents(const std::string &base, const std::string &name) {
+  for (auto slash = name.find('/', strlen("refs/")); slash != std::string::npos;
+       slash = name.find('/', slash + 1)) {
+    auto directory = base + name.substr(0, slash);
+    if (mkdir(directory.c_str(), 0777) == 0)
+      continue;
+    struct stat st;
+    if (errno != EEXIST)
+      throw_os_error("failed to create", directory);
+    if (stat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+      throw git_exception("cannot create " + name + ": " +
+                              name.substr(0, slash) + " exists",
+                          git_exception::error_class::reference,
+                          git_exception::error_code::exists);
+  }
+}
+
+// Remove the lock files and the directories made for them
+void release_all(const std::string &base,
+                 std::vector<std::unique_ptr<lock_file>> &locks) {
+  for (auto &lock : locks) {
+    lock->release();
+    remove_empty_parents(base, lock->path().substr(base.size()));
+  }
+}
+
+// Parse packed-refs; tells which peeled lines it promises through
+// `peeled` (for refs/tags) and `fully_peeled` (for all references)
+std::vector<packed_ref> read_packed_refs(const std::string &path,
+                                         bool &peeled, bool &fully_peeled) {
+  std::vector<packed_ref> refs;
+  peeled = fully_peeled = true; // what a new file will promise
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    if (errno != ENOENT)
+      throw_os_error("failed to read", path);
+    return refs;
+  }
+  mapped_file file(path);
+  auto data = reinterpret_cast<const char *>(file.data());
+  auto size = file.size();
+  bool sorted = false;
+  peeled = fully_peeled = false;
+  for (size_t pos = 0; pos < size;) {
+    auto eol = static_cast<const char *>(memchr(data + pos, '\n', size - pos));
+    size_t end = eol ? static_cast<size_t>(eol - data) : size;
+    std::string line(data + pos, end - pos);
+    pos = end + 1;
+    if (line.empty())
+      continue;
+    if (line[0] == '#') {
+      if (starts_with(line, packed_refs_header)) {
+        auto traits = line.substr(strlen(packed_refs_header)) + " ";
+        peeled = traits.find(" peeled ") != std::string::npos;
+        fully_peeled = traits.find(" fully-peeled ") != std::string::npos;
+        sorted = traits.find(" sorted ") != std::string::npos;
+      }
+      continue;
+    }
+    git_oid id;
+    if (line[0] == '^') {
+      if (refs.empty() || line.size() != GIT_OID_HEXSZ + 1 ||
+          git_oid_fromstrn(&id, line.c_str() + 1, GIT_OID_HEXSZ))
+        throw_invalid("malformed line in " + path + ": " + line);
+      refs.back().peeled = id;
+      refs.back().has_peeled = true;
+      continue;
+    }
+    if (line.size() < GIT_OID_HEXSZ + 2 || line[GIT_OID_HEXSZ] != ' ' ||
+        git_oid_fromstrn(&id, line.c_str(), GIT_OID_HEXSZ))
+      throw_invalid("malformed line in " + path + ": " + line);
+    refs.push_back(packed_ref{line.substr(GIT_OID_HEXSZ + 1), id, id, false});
+  }
+  if (!sorted)
+    std::stable_sort(refs.begin(), refs.end(),
+                     [](const packed_ref &a, const packed_ref &b) {
+                       return a.name < b.name;
+                     });
+  return refs;
+}
+
+const packed_ref *find_packed(const std::vector<packed_ref> &refs,
+                              const std::string &name) {
+  auto it = std::lower_bound(
+      refs.begin(), refs.end(), name,
+      [](const packed_ref &ref, const std::string &n) { return ref.name < n; });
+  return it != refs.end() && it->name == name ? &*it : nullptr;
+}
+
+// The target of the loose reference file `path`
+git_oid read_loose_ref(const std::string &path, const std::string &name) {
+  std::ifstream file(path, std::ios::binary);
+  std::string content;
+  if (!file || !std::getline(file, content))
+    throw git_exception("failed to read " + path,
+                        git_exception::error_class::os);
+  git_oid id;
+  if (starts_with(content, "ref: "))
+    throw_invalid("cannot update symbolic reference " + name + " in a batch");
+  if (content.size() < GIT_OID_HEXSZ ||
+      git_oid_fromstrn(&id, content.c_str(), GIT_OID_HEXSZ))
+    throw_invalid("corrupt loose reference " + path);
+  return id;
+}
+
+#endif
+
+} // namespace
+
+reference_batch::reference_batch(const repository &repo) : repo_(repo) {}
+
+void reference_batch::add(const std::string &name, const git_oid *expected,
+                          const git_oid &target) {
+  update_entry entry;
+  entry.name = name;
+  entry.verify = expected != nullptr;
+  entry.expected = expected ? *expected : git_oid{{0}};
+  entry.target = target;
+  updates_.push_back(std::move(entry));
+}
+
+void reference_batch::update(const std::string &name, const oid &target) {
+  add(name, nullptr, *target.c_ptr());
+}
+
+void reference_batch::update(const std::string &name, const oid &expected,
+                             const oid &target) {
+  add(name, expected.c_ptr(), *target.c_ptr());
+}
+
+void reference_batch::create(const std::string &name, const oid &target) {
+  static const git_oid zero = {{0}};
+  add(name, &zero, *target.c_ptr());
+}
+
+void reference_batch::remove(const std::string &name) {
+  add(name, nullptr, git_oid{{0}});
+}
+
+void reference_batch::remove(const std::string &name, const oid &expected) {
+  add(name, expected.c_ptr(), git_oid{{0}});
+}
+
+std::vector<std::string> reference_batch::commit() {
+  std::vector<update_entry> updates;
+  updates.swap(updates_);
+  std::vector<std::string> rejected;
+  if (updates.empty())
+    return rejected;
+#ifdef _WIN32
+  throw git_exception("reference batches are not supported on this platform",
+                      git_exception::error_class::os);
+#else
+  if (reftable::is_enabled(repo_))
+    throw git_exception("reference batches need the files backend",
+                        git_exception::error_class::reference,
+                        git_exception::error_code::invalid);
+  std::sort(updates.begin(), updates.end(),
+            [](const update_entry &a, const update_entry &b) {
+              return a.name < b.name;
+            });
+  auto repo = const_cast<git_repository *>(repo_.c_ptr());
+  git_odb *odb = nullptr;
+  git_exception::throw_nonzero(git_repository_odb(&odb, repo));
+  std::unique_ptr<git_odb, void (*)(git_odb *)> odb_guard(odb, git_odb_free);
+
+  // Everything that needs no lock: names, targets and their peeled ids
+  std::vector<packed_ref> targets;
+  targets.reserve(updates.size());
+  for (size_t i = 0; i < updates.size(); ++i) {
+    auto &u = updates[i];
+    if (!starts_with(u.name, "refs/") || !reference::is_valid_name(u.name))
+      throw_invalid("invalid reference name '" + u.name + "'");
+    if (i && updates[i - 1].name == u.name)
+      throw_invalid("reference " + u.name + " is updated twice in a batch");
+    packed_ref target{u.name, u.target, u.target, false};
+    if (!is_zero(u.target)) {
+      size_t size;
+      git_object_t type;
+      git_exception::throw_nonzero(
+          git_odb_read_header(&size, &type, odb, &u.target));
+      if (type == GIT_OBJECT_TAG) {
+        git_object *tag = nullptr, *peeled = nullptr;
+        git_exception::throw_nonzero(
+            git_object_lookup(&tag, repo, &u.target, GIT_OBJECT_TAG));
+        int ret = git_object_peel(&peeled, tag, GIT_OBJECT_ANY);
+        git_object_free(tag);
+        git_exception::throw_nonzero(ret);
+        target.peeled = *git_object_id(peeled);
+        target.has_peeled = true;
+        git_object_free(peeled);
+      }
+    }
+    targets.push_back(std::move(target));
+  }
+
+  // Every reference is locked, whether it is loose, packed or new, so that
+  // no loose file can appear behind the batch's back, then packed-refs
+  auto base = repo_.commondir();
+  std::vector<std::unique_ptr<lock_file>> locks;
+  locks.reserve(updates.size());
+  for (auto &u : updates) {
+    create_parents(base, u.name);
+    locks.emplace_back(new lock_file(base + u.name));
+  }
+  lock_file packed_lock(base + "packed-refs");
+  bool peeled, fully_peeled;
+  auto packed = read_packed_refs(base + "packed-refs", peeled, fully_peeled);
+
+  // Current targets, loose files first
+  std::vector<bool> loose(updates.size(), false);
+  std::vector<bool> created(updates.size(), false);
+  for (size_t i = 0; i < updates.size(); ++i) {
+    auto &u = updates[i];
+    auto path = base + u.name;
+    bool exists = false;
+    git_oid current;
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      current = read_loose_ref(path, u.name);
+      loose[i] = exists = true;
+    } else if (auto ref = find_packed(packed, u.name)) {
+      current = ref->id;
+      exists = true;
+    }
+    if (u.verify && (exists ? !git_oid_equal(&current, &u.expected)
+                            : !is_zero(u.expected)))
+      rejected.push_back(u.name);
+    created[i] = !exists && !is_zero(u.target);
+  }
+  if (!rejected.empty()) {
+    release_all(base, locks);
+    return rejected;
+  }
+
+  // The new packed-refs: untouched entries merged with the new targets
+  std::vector<packed_ref> result;
+  result.reserve(packed.size() + updates.size());
+  size_t p = 0;
+  for (auto &target : targets) {
+    while (p < packed.size() && packed[p].name < target.name)
+      result.push_back(std::move(packed[p++]));
+    if (p < packed.size() && packed[p].name == target.name)
+      ++p;
+    if (!is_zero(target.id))
+      result.push_back(std::move(target));
+  }
+  while (p < packed.size())
+    result.push_back(std::move(packed[p++]));
+
+  // A new reference must not be a directory of another one, or the other
+  // way around, packed or loose
+  for (size_t i = 0; i < updates.size(); ++i) {
+    if (!created[i])
+      continue;
+    auto &name = updates[i].name;
+    for (auto slash = name.find('/', strlen("refs/")); slash != std::string::npos;
+         slash = name.find('/', slash + 1)) {
+      auto prefix = name.substr(0, slash);
+      struct stat st;
+      if (find_packed(result, prefix) ||
+          (lstat((base + prefix).c_str(), &st) == 0 && S_ISREG(st.st_mode)))
+        throw git_exception("cannot create " + name + ": " + prefix +
+                                " exists",
+                            git_exception::error_class::reference,
+                            git_exception::error_code::exists);
+    }
+    auto below = std::lower_bound(
+        result.begin(), result.end(), name + "/",
+        [](const packed_ref &ref, const std::string &n) { return ref.name < n; });
+    if ((below != result.end() && starts_with(below->name, (name + "/").c_str())) ||
+        has_entries(base + name))
+      throw git_exception("cannot create " + name +
+                              ": references exist below it",
+                          git_exception::error_class::reference,
+                          git_exception::error_code::exists);
+  }
+
+  std::string text = packed_refs_header;
+  if (peeled)
+    text += " peeled";
+  if (fully_peeled)
+    text += " fully-peeled";
+  text += " sorted \n";
+  for (auto &ref : result) {
+    text += to_hex(ref.id);
+    text += ' ';
+    text += ref.name;
+    text += '\n';
+    if (ref.has_peeled &&
+        (fully_peeled || (peeled && starts_with(ref.name, "refs/tags/")))) {
+      text += '^';
+      text += to_hex(ref.peeled);
+      text += '\n';
+    }
+  }
+  packed_lock.write(text);
+  packed_lock.commit();
+
+  // Loose files would hide the new packed targets
+  for (size_t i = 0; i < updates.size(); ++i)
+    if (loose[i] && unlink(locks[i]->path().c_str()) != 0 && errno != ENOENT)
+      throw_os_error("failed to remove", locks[i]->path());
+  release_all(base, locks);
+  for (auto &u : updates) {
+    if (is_zero(u.target)) {
+      auto log = base + "logs/" + u.name;
+      if (unlink(log.c_str()) == 0)
+        remove_empty_parents(base + "logs/", u.name);
+    }
+  }
+  return rejected;
+#endif
+}
+
+} // namespace cppgit2
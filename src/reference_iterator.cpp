@@ -0,0 +1,246 @@
+#include <cppgit2/reference_iterator.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace cppgit2 {
+
+namespace {
+
+const char symbolic_prefix[] = "ref: ";
+
+string_view trim_end(string_view text) {
+  size_t size = text.size();
+  while (size > 0 && (text[size - 1] == '\n' || text[size - 1] == '\r' ||
+                      text[size - 1] == ' '))
+    --size;
+  return text.substr(0, size);
+}
+
+bool parse_hex(string_view text, git_oid *out) {
+  return text.size() >= GIT_OID_HEXSZ &&
+         git_oid_fromstrn(out, text.data(), GIT_OID_HEXSZ) == 0;
+}
+
+} // namespace
+
+reference_iterator::reference_iterator(const repository &repo,
+                                       const std::string &prefix)
+    : repo_(const_cast<git_repository *>(repo.c_ptr())),
+      common_dir_(repo.commondir()), prefix_(prefix), packed_(repo),
+      packed_range_(packed_.with_prefix(prefix)), loose_position_(0),
+      odb_(nullptr), started_(false), done_(false) {
+#ifdef _WIN32
+  throw git_exception("reference iteration is not supported on this platform",
+                      git_exception::error_class::os);
+#else
+  current_.owner_ = this;
+  // Loose references live in the directory tree below refs/; only the part
+  // holding the prefix is read, and nothing else in the common directory
+  // (objects/, logs/, ...) is
+  const std::string refs = "refs/";
+  if (string_view(prefix_).starts_with(refs))
+    scan_loose(prefix_.substr(0, prefix_.rfind('/') + 1));
+  else if (string_view(refs).starts_with(prefix_))
+    scan_loose(refs);
+  std::sort(loose_.begin(), loose_.end(), [this](size_t a, size_t b) {
+    return strcmp(loose_names_.c_str() + a, loose_names_.c_str() + b) < 0;
+  });
+#endif
+}
+
+reference_iterator::~reference_iterator() {
+  if (odb_)
+    git_odb_free(odb_);
+}
+
+// Gather the loose reference names below `directory` ("" or ending in '/')
+// that start with the prefix
+void reference_iterator::scan_loose(const std::string &directory) {
+#ifndef _WIN32
+  DIR *dir = opendir((common_dir_ + directory).c_str());
+  if (!dir)
+    return;
+  while (auto found = readdir(dir)) {
+    string_view file(found->d_name);
+    if (file == "." || file == ".." || file.ends_with(".lock"))
+      continue;
+    auto name = directory + found->d_name;
+    bool is_directory = found->d_type == DT_DIR;
+    if (found->d_type == DT_UNKNOWN) {
+      struct stat st;
+      if (stat((common_dir_ + name).c_str(), &st) != 0)
+        continue;
+      is_directory = S_ISDIR(st.st_mode);
+    }
+    if (is_directory) {
+      name += '/';
+      // Only the directories on the way to the prefix, or below it
+      if (string_view(name).starts_with(prefix_) ||
+          string_view(prefix_).starts_with(name))
+        scan_loose(name);
+    } else if (string_view(name).starts_with(prefix_)) {
+      loose_.push_back(loose_names_.size());
+      loose_names_ += name;
+      loose_names_ += '\0';
+    }
+  }
+  closedir(dir);
+#else
+  (void)directory;
+#endif
+}
+
+bool reference_iterator::next() {
+  started_ = true;
+  while (!done_) {
+    bool has_loose = loose_position_ < loose_.size();
+    bool has_packed = packed_range_.first != packed_range_.last;
+    if (!has_loose && !has_packed)
+      break;
+    string_view loose_name;
+    int order = 1;
+    if (has_loose) {
+      loose_name = string_view(loose_names_.c_str() + loose_[loose_position_]);
+      order = has_packed ? loose_name.compare((*packed_range_.first).name()) : -1;
+    }
+    if (order > 0) {
+      load_packed(*packed_range_.first);
+      ++packed_range_.first;
+      return true;
+    }
+    // A loose reference overrides its packed entry
+    if (order == 0)
+      ++packed_range_.first;
+    ++loose_position_;
+    if (load_loose(loose_name))
+      return true;
+  }
+  done_ = true;
+  return false;
+}
+
+bool reference_iterator::read_loose(string_view name,
+                                    std::string &buffer) const {
+  path_.assign(common_dir_);
+  path_.append(name.data(), name.size());
+  FILE *file = fopen(path_.c_str(), "rb");
+  if (!file)
+    return false;
+  buffer.clear();
+  char chunk[256];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    buffer.append(chunk, read);
+  fclose(file);
+  return true;
+}
+
+// Unreadable or malformed loose files are skipped, as git does
+bool reference_iterator::load_loose(string_view name) {
+  if (!read_loose(name, buffer_))
+    return false;
+  string_view content = trim_end(buffer_);
+  current_.name_ = name;
+  current_.peel_known_ = false;
+  if (content.starts_with(symbolic_prefix)) {
+    current_.symbolic_ = true;
+    current_.symbolic_target_ = content.substr(strlen(symbolic_prefix));
+    resolve(current_.symbolic_target_);
+    return true;
+  }
+  current_.symbolic_ = false;
+  current_.symbolic_target_ = string_view();
+  current_.resolved_ = true;
+  return parse_hex(content, current_.target_.c_ptr());
+}
+
+void reference_iterator::load_packed(const packed_refs_view::entry &packed) {
+  current_.name_ = packed.name();
+  current_.symbolic_ = false;
+  current_.symbolic_target_ = string_view();
+  current_.resolved_ = true;
+  git_oid_fromstrn(current_.target_.c_ptr(), packed.target_hex().data(),
+                   GIT_OID_HEXSZ);
+  // packed-refs records what tags peel to; with the "peeled" trait, a tag
+  // without a "^" line is known not to be annotated ("fully-peeled": any
+  // reference)
+  current_.peel_known_ = false;
+  if (packed.has_peeled()) {
+    current_.peeled_ = packed.peeled();
+    current_.peel_known_ = true;
+  } else if (packed_.is_fully_peeled() ||
+             (packed_.is_peeled() && packed.name().starts_with("refs/tags/"))) {
+    current_.peeled_ = current_.target_;
+    current_.peel_known_ = true;
+  }
+}
+
+// Follow the symbolic reference to `name`, as libgit2 does up to 5 levels
+void reference_iterator::resolve(string_view name) {
+  current_.resolved_ = false;
+  for (int depth = 0; depth < 5; ++depth) {
+    if (read_loose(name, resolve_buffer_)) {
+      string_view content = trim_end(resolve_buffer_);
+      if (content.starts_with(symbolic_prefix)) {
+        content = content.substr(strlen(symbolic_prefix));
+        resolve_name_.assign(content.data(), content.size());
+        name = resolve_name_;
+        continue;
+      }
+      current_.resolved_ = parse_hex(content, current_.target_.c_ptr());
+      return;
+    }
+    auto found = packed_.find(name);
+    if (found != packed_.end()) {
+      auto own_name = current_.name_;
+      auto symbolic_target = current_.symbolic_target_;
+      load_packed(*found);
+      current_.name_ = own_name;
+      current_.symbolic_ = true;
+      current_.symbolic_target_ = symbolic_target;
+    }
+    return;
+  }
+}
+
+const oid &reference_iterator::entry::peeled() const {
+  if (!peel_known_) {
+    if (!resolved_)
+      throw git_exception("reference '" + name_.to_string() +
+                              "' does not resolve to an object",
+                          git_exception::error_class::reference,
+                          git_exception::error_code::notfound);
+    peeled_ = owner_->peel(target_);
+    peel_known_ = true;
+  }
+  return peeled_;
+}
+
+oid reference_iterator::peel(const oid &id) const {
+  if (!odb_)
+    git_exception::throw_nonzero(git_repository_odb(&odb_, repo_));
+  size_t size;
+  git_object_t type;
+  git_exception::throw_nonzero(
+      git_odb_read_header(&size, &type, odb_, id.c_ptr()));
+  if (type != GIT_OBJECT_TAG)
+    return id;
+
+  git_object *tag = nullptr, *target = nullptr;
+  git_exception::throw_nonzero(
+      git_object_lookup(&tag, repo_, id.c_ptr(), GIT_OBJECT_TAG));
+  int ret = git_object_peel(&target, tag, GIT_OBJECT_ANY);
+  git_object_free(tag);
+  git_exception::throw_nonzero(ret);
+  oid result(git_object_id(target));
+  git_object_free(target);
+  return result;
+}
+
+} // namespace cppgit2
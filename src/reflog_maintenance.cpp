@@ -0,0 +1,518 @@
+#include <cppgit2/mapped_file.hpp>
+#include <cppgit2/reflog_maintenance.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+namespace {
+
+bool oid_less(const git_oid &a, const git_oid &b) {
+  return memcmp(a.id, b.id, GIT_OID_RAWSZ) < 0;
+}
+
+bool is_zero(const git_oid &id) {
+  static const git_oid zero = {{0}};
+  return !memcmp(id.id, zero.id, GIT_OID_RAWSZ);
+}
+
+void throw_os_error(const std::string &what, const std::string &path) {
+  throw git_exception(what + " " + path + ": " + strerror(errno),
+                      git_exception::error_class::os);
+}
+
+// One line of a log file
+struct log_line {
+  size_t begin; // offset of the line
+  size_t end;   // past its '\n'
+  bool valid;
+  git_oid old_id;
+  git_oid new_id;
+  string_view committer;
+  std::time_t time;
+  int offset_minutes;
+  string_view message;
+};
+
+// "<old hex> <new hex> <name> <<email>> <time> <+hhmm>\t<message>\n"
+bool parse_line(const char *line, size_t length, log_line &out) {
+  const size_t ids = 2 * GIT_OID_HEXSZ + 2;
+  if (length < ids || line[GIT_OID_HEXSZ] != ' ' || line[ids - 1] != ' ' ||
+      git_oid_fromstrn(&out.old_id, line, GIT_OID_HEXSZ) ||
+      git_oid_fromstrn(&out.new_id, line + GIT_OID_HEXSZ + 1, GIT_OID_HEXSZ))
+    return false;
+  string_view rest(line + ids, length - ids);
+  auto tab = rest.find('\t');
+  out.message = tab == string_view::npos ? string_view() : rest.substr(tab + 1);
+  string_view header = rest.substr(0, tab);
+
+  // Time and zone are the last two fields
+  auto zone_space = header.rfind(' ');
+  if (zone_space == string_view::npos)
+    return false;
+  auto time_space = header.substr(0, zone_space).rfind(' ');
+  if (time_space == string_view::npos)
+    return false;
+  string_view zone = header.substr(zone_space + 1);
+  if (zone.size() != 5 || (zone[0] != '+' && zone[0] != '-'))
+    return false;
+  int hhmm = atoi(zone.substr(1).to_string().c_str());
+  out.offset_minutes = (zone[0] == '-' ? -1 : 1) * (hhmm / 100 * 60 + hhmm % 100);
+  char *end = nullptr;
+  auto time_text = header.substr(time_space + 1, zone_space - time_space - 1);
+  std::string time_string = time_text.to_string();
+  out.time = static_cast<std::time_t>(strtoll(time_string.c_str(), &end, 10));
+  if (time_text.empty() || *end)
+    return false;
+  out.committer = header.substr(0, time_space);
+  return true;
+}
+
+// The lines of a log file, including malformed ones (kept as they are)
+std::vector<log_line> parse_log(const mapped_file &file) {
+  std::vector<log_line> lines;
+  auto data = reinterpret_cast<const char *>(file.data());
+  size_t size = file.size();
+  for (size_t offset = 0; offset < size;) {
+    auto eol = static_cast<const char *>(memchr(data + offset, '\n', size - offset));
+    size_t length = eol ? static_cast<size_t>(eol - data) - offset : size - offset;
+    log_line line;
+    line.begin = offset;
+    line.end = offset + length + (eol ? 1 : 0);
+    line.valid = parse_line(data + offset, length, line);
+    lines.push_back(line);
+    offset = line.end;
+  }
+  return lines;
+}
+
+#ifndef _WIN32
+
+// `path`.lock, created exclusively as git does; commit() renames it over
+// `path`, and it is removed otherwise
+class lock_file {
+public:
+  explicit lock_file(const std::string &path)
+      : path_(path), lock_path_(path + ".lock") {
+    fd_ = ::open(lock_path_.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd_ < 0)
+      lock_path_.clear();
+  }
+
+  ~lock_file() {
+    if (fd_ >= 0)
+      ::close(fd_);
+    if (!lock_path_.empty())
+      unlink(lock_path_.c_str());
+  }
+
+  lock_file(const lock_file &) = delete;
+  lock_file &operator=(const lock_file &) = delete;
+
+  bool locked() const { return fd_ >= 0; }
+
+  void commit(const std::string &data) {
+    size_t done = 0;
+    while (done < data.size()) {
+      auto n = ::write(fd_, data.data() + done, data.size() - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        throw_os_error("failed to write", lock_path_);
+      done += static_cast<size_t>(n);
+    }
+    if (fsync(fd_) < 0)
+      throw_os_error("failed to write", lock_path_);
+    ::close(fd_);
+    fd_ = -1;
+    if (rename(lock_path_.c_str(), path_.c_str()) != 0)
+      throw_os_error("failed to rename", lock_path_);
+    lock_path_.clear();
+  }
+
+private:
+  std::string path_;
+  std::string lock_path_;
+  int fd_;
+};
+
+#endif
+
+// Which of `candidates` (sorted) are reachable from `tips`, walking back no
+// further than a day before the oldest candidate commit; an id that is not
+// a commit is not reachable
+std::vector<bool> reachable_from(git_repository *repo,
+                                 const std::vector<git_oid> &tips,
+                                 const std::vector<git_oid> &candidates) {
+  std::vector<bool> found(candidates.size(), false);
+  git_time_t cutoff = 0;
+  bool any = false;
+  for (auto &id : candidates) {
+    git_commit *commit = nullptr;
+    if (git_commit_lookup(&commit, repo, &id) != 0)
+      continue;
+    auto time = git_commit_time(commit);
+    cutoff = any ? std::min(cutoff, time) : time;
+    any = true;
+    git_commit_free(commit);
+  }
+  if (!any)
+    return found;
+  cutoff -= 24 * 60 * 60; // clock skew
+
+  git_revwalk *walk = nullptr;
+  git_exception::throw_nonzero(git_revwalk_new(&walk, repo));
+  git_revwalk_sorting(walk, GIT_SORT_TIME);
+  bool pushed = false;
+  for (auto &tip : tips)
+    pushed = git_revwalk_push(walk, &tip) == 0 || pushed; // skips non-commits
+  size_t remaining = candidates.size();
+  git_oid id;
+  while (pushed && remaining && git_revwalk_next(&id, walk) == 0) {
+    auto it = std::lower_bound(candidates.begin(), candidates.end(), id,
+                               oid_less);
+    if (it != candidates.end() && oid_equal()(*it, id)) {
+      auto index = static_cast<size_t>(it - candidates.begin());
+      if (!found[index]) {
+        found[index] = true;
+        --remaining;
+      }
+    }
+    git_commit *commit = nullptr;
+    if (git_commit_lookup(&commit, repo, &id) == 0) {
+      bool older = git_commit_time(commit) < cutoff;
+      git_commit_free(commit);
+      if (older)
+        break;
+    }
+  }
+  git_revwalk_free(walk);
+  return found;
+}
+
+// What entries of the log of `name` must be reachable from: its target, or
+// for HEAD (which moves between branches) that of every reference, as git
+// does
+std::vector<git_oid> reachability_tips(git_repository *repo,
+                                       const std::string &name) {
+  std::vector<git_oid> tips;
+  git_oid id;
+  if (git_reference_name_to_id(&id, repo, name.c_str()) == 0)
+    tips.push_back(id);
+  if (name != "HEAD")
+    return tips;
+  git_reference_iterator *iterator = nullptr;
+  git_exception::throw_nonzero(git_reference_iterator_new(&iterator, repo));
+  git_reference *ref = nullptr;
+  while (git_reference_next(&ref, iterator) == 0) {
+    git_reference *direct = nullptr;
+    if (git_reference_resolve(&direct, ref) == 0) {
+      tips.push_back(*git_reference_target(direct));
+      git_reference_free(direct);
+    }
+    git_reference_free(ref);
+  }
+  git_reference_iterator_free(iterator);
+  return tips;
+}
+
+} // namespace
+
+bool reflog_maintenance::tip_index::contains(const oid &id) const {
+  return std::binary_search(ids_.begin(), ids_.end(), *id.c_ptr(), oid_less);
+}
+
+reflog_maintenance::reflog_maintenance(const repository &repo,
+                                       size_t num_threads)
+    : repo_(repo), pool_(num_threads), git_dir_(repo.path()),
+      common_dir_(repo.commondir()) {
+  handles_.reserve(pool_.size());
+  for (size_t i = 0; i < pool_.size(); ++i)
+    handles_.push_back(repo.reopen());
+}
+
+std::string reflog_maintenance::log_path(const std::string &name) const {
+  return (name == "HEAD" ? git_dir_ : common_dir_) + "logs/" + name;
+}
+
+// Log files below <logs_dir><directory>
+void reflog_maintenance::scan(const std::string &logs_dir,
+                              const std::string &directory,
+                              std::vector<std::string> &names) const {
+#ifndef _WIN32
+  DIR *dir = opendir((logs_dir + directory).c_str());
+  if (!dir)
+    return;
+  while (auto found = readdir(dir)) {
+    string_view file(found->d_name);
+    if (file == "." || file == ".." || file.ends_with(".lock"))
+      continue;
+    auto name = directory + found->d_name;
+    bool is_directory = found->d_type == DT_DIR;
+    if (found->d_type == DT_UNKNOWN) {
+      struct stat st;
+      if (stat((logs_dir + name).c_str(), &st) != 0)
+        continue;
+      is_directory = S_ISDIR(st.st_mode);
+    }
+    if (is_directory)
+      scan(logs_dir, name + "/", names);
+    else
+      names.push_back(name);
+  }
+  closedir(dir);
+#else
+  (void)logs_dir;
+  (void)directory;
+  (void)names;
+#endif
+}
+
+std::vector<std::string> reflog_maintenance::names() const {
+#ifdef _WIN32
+  throw git_exception("reflog maintenance is not supported on this platform",
+                      git_exception::error_class::os);
+#else
+  std::vector<std::string> names;
+  struct stat st;
+  if (stat(log_path("HEAD").c_str(), &st) == 0 && S_ISREG(st.st_mode))
+    names.push_back("HEAD");
+  scan(common_dir_ + "logs/", "refs/", names);
+  std::sort(names.begin(), names.end());
+  return names;
+#endif
+}
+
+// Paths of the logs of every worktree: those of the main worktree and the
+// shared ones in the common directory, and the logs of HEAD and of the
+// per-worktree references of each linked worktree
+std::vector<std::string> reflog_maintenance::all_log_paths() const {
+  std::vector<std::string> paths;
+#ifndef _WIN32
+  auto add_logs = [&](const std::string &dir) {
+    auto logs_dir = dir + "logs/";
+    struct stat st;
+    if (stat((logs_dir + "HEAD").c_str(), &st) == 0 && S_ISREG(st.st_mode))
+      paths.push_back(logs_dir + "HEAD");
+    std::vector<std::string> names;
+    scan(logs_dir, "refs/", names);
+    for (auto &name : names)
+      paths.push_back(logs_dir + name);
+  };
+  add_logs(common_dir_);
+  auto worktrees_dir = common_dir_ + "worktrees/";
+  if (DIR *dir = opendir(worktrees_dir.c_str())) {
+    while (auto found = readdir(dir)) {
+      string_view name(found->d_name);
+      if (name != "." && name != "..")
+        add_logs(worktrees_dir + found->d_name + "/");
+    }
+    closedir(dir);
+  }
+#endif
+  return paths;
+}
+
+void reflog_maintenance::for_each_entry(
+    const std::function<void(string_view refname, const entry &)> &visitor)
+    const {
+  entry current;
+  for (auto &name : names()) {
+    mapped_file file;
+    try {
+      file = mapped_file(log_path(name));
+    } catch (const git_exception &) {
+      continue; // removed since the scan
+    }
+    for (auto &line : parse_log(file)) {
+      if (!line.valid)
+        continue;
+      *current.old_id.c_ptr() = line.old_id;
+      *current.new_id.c_ptr() = line.new_id;
+      current.committer = line.committer;
+      current.time = line.time;
+      current.offset_minutes = line.offset_minutes;
+      current.message = line.message;
+      visitor(name, current);
+    }
+  }
+}
+
+reflog_maintenance::report reflog_maintenance::expire(const policy &p) {
+  report result{0, 0, 0, 0, {}};
+#ifdef _WIN32
+  (void)p;
+  throw git_exception("reflog maintenance is not supported on this platform",
+                      git_exception::error_class::os);
+#else
+  // Appends to a log happen under its reference's lock, taken here through
+  // the refdb so that it is the backend's own (with reftable, the stack's).
+  // The transaction is never committed: freeing it releases the locks
+  auto logs = names();
+  auto refs = repo_.create_transaction();
+  std::vector<bool> skipped(logs.size(), false);
+  for (size_t i = 0; i < logs.size(); ++i) {
+    if (git_transaction_lock_ref(refs.c_ptr(), logs[i].c_str()) != 0) {
+      skipped[i] = true;
+      result.locked.push_back(logs[i]);
+    }
+  }
+  git_error_clear();
+  std::mutex mutex;
+  pool_.parallel_for(logs.size(), [&](size_t i, size_t worker) {
+    if (skipped[i])
+      return;
+    auto &name = logs[i];
+    auto handle = const_cast<git_repository *>(handles_[worker].c_ptr());
+    auto path = log_path(name);
+    mapped_file file;
+    try {
+      file = mapped_file(path);
+    } catch (const git_exception &) {
+      return;
+    }
+    auto lines = parse_log(file);
+    std::vector<bool> drop(lines.size(), false);
+    size_t entries = 0, dropped = 0;
+
+    // The ids whose reachability may matter: those of the entries old
+    // enough to expire when unreachable, and with rewrite the new ids that
+    // may become their old ids
+    std::vector<git_oid> candidates;
+    for (auto &line : lines) {
+      if (!line.valid)
+        continue;
+      ++entries;
+      if (p.expire_unreachable && line.time < p.expire_unreachable)
+        candidates.push_back(line.old_id);
+      if (p.expire_unreachable &&
+          (p.rewrite || line.time < p.expire_unreachable))
+        candidates.push_back(line.new_id);
+    }
+    std::vector<bool> reachable;
+    if (!candidates.empty()) {
+      std::sort(candidates.begin(), candidates.end(), oid_less);
+      candidates.erase(std::unique(candidates.begin(), candidates.end(),
+                                   oid_equal()),
+                       candidates.end());
+      reachable = reachable_from(handle, reachability_tips(handle, name),
+                                 candidates);
+    }
+    auto is_reachable = [&](const git_oid &id) {
+      if (is_zero(id))
+        return true;
+      auto it = std::lower_bound(candidates.begin(), candidates.end(), id,
+                                 oid_less);
+      return static_cast<bool>(
+          reachable[static_cast<size_t>(it - candidates.begin())]);
+    };
+
+    // As in git, an entry goes if either of its ids is unreachable; with
+    // rewrite, its old id is taken to be the new id of the last kept entry
+    static const git_oid zero = {{0}};
+    const git_oid *last_kept = &zero;
+    for (size_t j = 0; j < lines.size(); ++j) {
+      auto &line = lines[j];
+      if (!line.valid)
+        continue;
+      auto &old_id = p.rewrite ? *last_kept : line.old_id;
+      if (p.expire && line.time < p.expire)
+        drop[j] = true;
+      else if (p.expire_unreachable && line.time < p.expire_unreachable)
+        drop[j] = !is_reachable(old_id) || !is_reachable(line.new_id);
+      if (!drop[j])
+        last_kept = &line.new_id;
+    }
+    for (size_t j = 0; j < lines.size(); ++j)
+      dropped += drop[j];
+
+    bool rewritten = false;
+    if (dropped && !p.dry_run) {
+      auto data = reinterpret_cast<const char *>(file.data());
+      std::string content;
+      content.reserve(file.size());
+      // With rewrite, each entry starts where the last kept one ended
+      const git_oid *previous = &zero;
+      for (size_t j = 0; j < lines.size(); ++j) {
+        auto &line = lines[j];
+        if (drop[j])
+          continue;
+        if (p.rewrite && line.valid) {
+          char hex[GIT_OID_HEXSZ + 1];
+          git_oid_tostr(hex, sizeof(hex), previous);
+          content.append(hex, GIT_OID_HEXSZ);
+          content.append(data + line.begin + GIT_OID_HEXSZ,
+                         line.end - line.begin - GIT_OID_HEXSZ);
+        } else {
+          content.append(data + line.begin, line.end - line.begin);
+        }
+        if (line.valid)
+          previous = &line.new_id;
+      }
+      lock_file log_lock(path);
+      if (!log_lock.locked()) {
+        std::lock_guard<std::mutex> guard(mutex);
+        result.locked.push_back(name);
+        return;
+      }
+      log_lock.commit(content);
+      rewritten = true;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    ++result.logs;
+    result.entries += entries;
+    result.expired += dropped;
+    result.rewritten += rewritten;
+  });
+  std::sort(result.locked.begin(), result.locked.end());
+  return result;
+#endif
+}
+
+reflog_maintenance::tip_index reflog_maintenance::build_tip_index() {
+  tip_index index;
+  auto logs = all_log_paths();
+  std::vector<std::vector<git_oid>> found(logs.size());
+  pool_.parallel_for(logs.size(), [&](size_t i, size_t) {
+    mapped_file file;
+    try {
+      file = mapped_file(logs[i]);
+    } catch (const git_exception &) {
+      return;
+    }
+    for (auto &line : parse_log(file)) {
+      if (!line.valid)
+        continue;
+      if (!is_zero(line.old_id))
+        found[i].push_back(line.old_id);
+      if (!is_zero(line.new_id))
+        found[i].push_back(line.new_id);
+    }
+  });
+  size_t total = 0;
+  for (auto &ids : found)
+    total += ids.size();
+  index.ids_.reserve(total);
+  for (auto &ids : found)
+    index.ids_.insert(index.ids_.end(), ids.begin(), ids.end());
+  std::sort(index.ids_.begin(), index.ids_.end(), oid_less);
+  index.ids_.erase(
+      std::unique(index.ids_.begin(), index.ids_.end(), oid_equal()),
+      index.ids_.end());
+  index.ids_.shrink_to_fit();
+  return index;
+}
+
+} // namespace cppgit2
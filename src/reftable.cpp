@@ -0,0 +1,1765 @@
+#include <cppgit2/mapped_file.hpp>
+#include <cppgit2/reftable.hpp>
+#include <git2/sys/refdb_backend.h>
+#include <git2/sys/refs.h>
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+#ifndef _WIN32
+
+namespace {
+
+const size_t header_size = 24; // version 1
+const size_t footer_size = 68;
+const char ref_block = 'r';
+const char index_block = 'i';
+
+enum value_type : uint8_t {
+  deletion = 0,
+  direct = 1,
+  direct_peeled = 2,
+  symbolic = 3,
+};
+
+struct ref_record {
+  std::string name;
+  uint64_t update_index;
+  uint8_t type;
+  git_oid value;
+  git_oid peeled;
+  std::string target; // of a symbolic reference
+};
+
+typedef std::function<bool(ref_record &)> record_source;
+
+bool starts_with(const std::string &text, const std::string &prefix) {
+  return text.compare(0, prefix.size(), prefix) == 0;
+}
+
+void throw_os_error(const std::string &what, const std::string &path) {
+  throw git_exception(what + " " + path + ": " + strerror(errno),
+                      git_exception::error_class::os);
+}
+
+void throw_corrupted(const std::string &path, const char *reason) {
+  throw git_exception("corrupted reftable " + path + ": " + reason,
+                      git_exception::error_class::reference,
+                      git_exception::error_code::invalid);
+}
+
+void throw_reference_error(const std::string &message,
+                           git_exception::error_code code) {
+  throw git_exception(message, git_exception::error_class::reference, code);
+}
+
+void put_be(std::string &out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i)
+    out += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+uint64_t get_be(const unsigned char *p, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+    value = (value << 8) | p[i];
+  return value;
+}
+
+// Variable-length integers as in pack offsets: 7 bits per byte, most
+// significant first, each continuation adding one
+void put_varint(std::string &out, uint64_t value) {
+  unsigned char buffer[10];
+  size_t i = sizeof(buffer) - 1;
+  buffer[i] = value & 0x7f;
+  while (value >>= 7)
+    buffer[--i] = 0x80 | (--value & 0x7f);
+  out.append(reinterpret_cast<char *>(buffer) + i, sizeof(buffer) - i);
+}
+
+bool get_varint(const unsigned char *&p, const unsigned char *end,
+                uint64_t &value) {
+  if (p >= end)
+    return false;
+  unsigned char c = *p++;
+  value = c & 0x7f;
+  while (c & 0x80) {
+    if (p >= end || value > (UINT64_MAX >> 7) - 1)
+      return false;
+    c = *p++;
+    value = ((value + 1) << 7) | (c & 0x7f);
+  }
+  return true;
+}
+
+// `path`.lock, created exclusively as git does; commit() renames it over
+// `path`, and it is removed otherwise
+class lock_file {
+public:
+  explicit lock_file(const std::string &path)
+      : path_(path), lock_path_(path + ".lock"), fd_(-1) {
+    fd_ = ::open(lock_path_.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd_ < 0) {
+      if (errno == EEXIST)
+        throw_reference_error("failed to lock " + path + ": " + lock_path_ +
+                                  " exists",
+                              git_exception::error_code::locked);
+      throw_os_error("failed to create", lock_path_);
+    }
+  }
+
+  ~lock_file() {
+    if (fd_ >= 0)
+      ::close(fd_);
+    if (!lock_path_.empty())
+      unlink(lock_path_.c_str());
+  }
+
+  lock_file(const lock_file &) = delete;
+  lock_file &operator=(const lock_file &) = delete;
+
+  void commit(const std::string &data) {
+    size_t done = 0;
+    while (done < data.size()) {
+      auto n = ::write(fd_, data.data() + done, data.size() - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        throw_os_error("failed to write", lock_path_);
+      done += static_cast<size_t>(n);
+    }
+    if (fsync(fd_) < 0)
+      throw_os_error("failed to write", lock_path_);
+    ::close(fd_);
+    fd_ = -1;
+    if (std::rename(lock_path_.c_str(), path_.c_str()) != 0)
+      throw_os_error("failed to rename", lock_path_);
+    lock_path_.clear();
+  }
+
+private:
+  std::string path_;
+  std::string lock_path_;
+  int fd_;
+};
+
+// Appends the blocks of one section to a table; the first block of the
+// file shares its bytes with the file header
+class block_writer {
+public:
+  block_writer(std::string &file, uint32_t block_size,
+               uint32_t restart_interval)
+      : file_(file), block_size_(block_size),
+        restart_interval_(restart_interval), start_(0), header_(0),
+        count_(0) {}
+
+  void start(char type) {
+    header_ = file_.size() == header_size ? header_size : 0;
+    start_ = file_.size() - header_;
+    file_ += type;
+    file_.append(3, '\0');
+    count_ = 0;
+    restarts_.clear();
+    last_key_.clear();
+  }
+
+  // Position of the current block in the file
+  size_t position() const { return start_; }
+
+  // Add a record; false if the block is full
+  bool add(const std::string &key, uint8_t type, const std::string &value) {
+    bool restart = count_ % restart_interval_ == 0;
+    if (restart && restarts_.size() == 0xffff)
+      return false;
+    size_t prefix = 0;
+    if (!restart)
+      while (prefix < key.size() && prefix < last_key_.size() &&
+             key[prefix] == last_key_[prefix])
+        ++prefix;
+    std::string record;
+    put_varint(record, prefix);
+    put_varint(record, ((key.size() - prefix) << 3) | type);
+    record.append(key, prefix, std::string::npos);
+    record += value;
+
+    size_t length = file_.size() - start_ + record.size() +
+                    3 * (restarts_.size() + (restart ? 1 : 0)) + 2;
+    if (length > block_size_) {
+      if (count_)
+        return false;
+      throw_reference_error("reference " + key + " does not fit in a block",
+                            git_exception::error_code::invalid);
+    }
+    if (restart)
+      restarts_.push_back(static_cast<uint32_t>(file_.size() - start_));
+    file_ += record;
+    last_key_ = key;
+    ++count_;
+    return true;
+  }
+
+  // Write the restart table, the block length and the padding
+  void finish() {
+    for (auto offset : restarts_)
+      put_be(file_, offset, 3);
+    put_be(file_, restarts_.size(), 2);
+    size_t length = file_.size() - start_;
+    std::string be24;
+    put_be(be24, length, 3);
+    file_.replace(start_ + header_ + 1, 3, be24);
+    file_.append(block_size_ - length, '\0');
+  }
+
+private:
+  std::string &file_;
+  uint32_t block_size_;
+  uint32_t restart_interval_;
+  size_t start_;
+  size_t header_;
+  size_t count_;
+  std::vector<uint32_t> restarts_;
+  std::string last_key_;
+};
+
+// A whole table holding the records of `source`, in name order
+std::string write_table(const record_source &source, uint64_t min_index,
+                        uint64_t max_index, const reftable::options &opts) {
+  auto header = [&](std::string &out) {
+    out += "REFT";
+    out += '\1';
+    put_be(out, opts.block_size, 3);
+    put_be(out, min_index, 8);
+    put_be(out, max_index, 8);
+  };
+  std::string file;
+  header(file);
+  block_writer writer(file, opts.block_size, opts.restart_interval);
+
+  struct index_entry {
+    std::string key; // last key of the block
+    uint64_t position;
+  };
+  std::vector<index_entry> index;
+
+  // Ref blocks
+  ref_record record;
+  std::string value, last;
+  bool open = false;
+  while (source(record)) {
+    value.clear();
+    put_varint(value, record.update_index - min_index);
+    switch (record.type) {
+    case direct:
+      value.append(reinterpret_cast<const char *>(record.value.id),
+                   GIT_OID_RAWSZ);
+      break;
+    case direct_peeled:
+      value.append(reinterpret_cast<const char *>(record.value.id),
+                   GIT_OID_RAWSZ);
+      value.append(reinterpret_cast<const char *>(record.peeled.id),
+                   GIT_OID_RAWSZ);
+      break;
+    case symbolic:
+      put_varint(value, record.target.size());
+      value += record.target;
+      break;
+    }
+    if (!open) {
+      writer.start(ref_block);
+      open = true;
+    } else if (!writer.add(record.name, record.type, value)) {
+      index.push_back(index_entry{last, writer.position()});
+      writer.finish();
+      writer.start(ref_block);
+    } else {
+      last = record.name;
+      continue;
+    }
+    writer.add(record.name, record.type, value);
+    last = record.name;
+  }
+  if (open) {
+    index.push_back(index_entry{last, writer.position()});
+    writer.finish();
+  }
+
+  // Index levels, each pointing to the blocks of the one below, until one
+  // block is left: the root
+  uint64_t index_position = 0;
+  while (index.size() > 1) {
+    std::vector<index_entry> level;
+    open = false;
+    for (auto &entry : index) {
+      value.clear();
+      put_varint(value, entry.position);
+      if (!open) {
+        writer.start(index_block);
+        open = true;
+      } else if (!writer.add(entry.key, 0, value)) {
+        level.push_back(index_entry{last, writer.position()});
+        writer.finish();
+        writer.start(index_block);
+      } else {
+        last = entry.key;
+        continue;
+      }
+      writer.add(entry.key, 0, value);
+      last = entry.key;
+    }
+    level.push_back(index_entry{last, writer.position()});
+    writer.finish();
+    index_position = level.back().position;
+    index.swap(level);
+  }
+
+  std::string footer;
+  header(footer);
+  put_be(footer, index_position, 8);
+  put_be(footer, 0, 8); // no object blocks, obj_id_len 0
+  put_be(footer, 0, 8); // no object index
+  put_be(footer, 0, 8); // no log blocks
+  put_be(footer, 0, 8); // no log index
+  put_be(footer,
+         crc32(0, reinterpret_cast<const Bytef *>(footer.data()),
+               static_cast<uInt>(footer.size())),
+         4);
+  return file + footer;
+}
+
+// One mapped table
+class table {
+public:
+  struct cursor {
+    size_t block;       // start of the current block
+    size_t block_end;   // past its records and restart table
+    size_t pos;         // next record
+    size_t records_end; // start of the restart table
+    std::string key;    // last key decoded
+    bool done;
+  };
+
+  table(const std::string &path, const std::string &name)
+      : file_(path), name_(name),
+        data_(file_.data()), size_(file_.size()) {
+    if (size_ < header_size + footer_size || memcmp(data_, "REFT", 4) ||
+        data_[4] != 1)
+      throw_corrupted(path, "bad header");
+    auto footer = data_ + size_ - footer_size;
+    if (memcmp(footer, data_, header_size))
+      throw_corrupted(path, "footer does not match header");
+    if (crc32(0, footer, footer_size - 4) != get_be(footer + footer_size - 4, 4))
+      throw_corrupted(path, "bad footer checksum");
+    min_index_ = get_be(data_ + 8, 8);
+    max_index_ = get_be(data_ + 16, 8);
+    ref_index_ = get_be(footer + 24, 8);
+
+    // Ref blocks end where the first other section (or the footer) starts
+    refs_end_ = size_ - footer_size;
+    uint64_t sections[] = {ref_index_, get_be(footer + 32, 8) >> 5,
+                           get_be(footer + 40, 8), get_be(footer + 48, 8),
+                           get_be(footer + 56, 8)};
+    for (auto position : sections)
+      if (position && position < refs_end_)
+        refs_end_ = static_cast<size_t>(position);
+    if (ref_index_ >= size_ - footer_size)
+      throw_corrupted(path, "bad index position");
+    // Reflogs are kept in logs/; a table carrying some (as git writes them)
+    // would lose them on the next compaction
+    if (get_be(footer + 48, 8) ||
+        (size_ > header_size + footer_size && data_[header_size] == 'g'))
+      throw git_exception("reftable " + path +
+                              " holds reflog blocks, which are not supported",
+                          git_exception::error_class::reference,
+                          git_exception::error_code::invalid);
+  }
+
+  const std::string &name() const { return name_; }
+  uint64_t min_update_index() const { return min_index_; }
+  uint64_t max_update_index() const { return max_index_; }
+  size_t size() const { return size_; }
+
+  // Position `c` before the first record whose name is not less than `name`
+  void seek(cursor &c, const std::string &name) const {
+    c.done = true;
+    if (refs_end_ <= header_size || data_[header_size] != ref_block)
+      return;
+    size_t offset = 0;
+    if (ref_index_) {
+      offset = static_cast<size_t>(ref_index_);
+      for (;;) {
+        auto b = read_block(offset);
+        if (b.type == ref_block)
+          break;
+        if (b.type != index_block)
+          throw_corrupted(file_.path(), "bad index block");
+        size_t pos;
+        std::string key;
+        uint8_t type;
+        if (!seek_in_block(b, name, pos, key))
+          return;
+        decode_key(b, pos, key, type);
+        offset = static_cast<size_t>(read_varint(b, pos));
+      }
+    }
+    for (;;) {
+      auto b = read_block(offset);
+      if (b.type != ref_block)
+        return;
+      c.block = offset;
+      c.block_end = b.end;
+      c.records_end = b.restarts;
+      if (seek_in_block(b, name, c.pos, c.key)) {
+        c.done = false;
+        return;
+      }
+      offset = next_block(b.end);
+      if (offset >= refs_end_)
+        return;
+    }
+  }
+
+  // The record at `c`, moving past it; false at the end of the refs
+  bool next(cursor &c, ref_record &record) const {
+    while (!c.done) {
+      if (c.pos < c.records_end) {
+        block b;
+        b.type = ref_block;
+        b.restarts = c.records_end;
+        uint8_t type;
+        decode_key(b, c.pos, c.key, type);
+        record.name = c.key;
+        record.type = type;
+        decode_ref_value(b, c.pos, record);
+        return true;
+      }
+      auto offset = next_block(c.block_end);
+      if (offset >= refs_end_) {
+        c.done = true;
+        break;
+      }
+      auto b = read_block(offset);
+      if (b.type != ref_block) {
+        c.done = true;
+        break;
+      }
+      c.block = offset;
+      c.block_end = b.end;
+      c.pos = b.begin;
+      c.records_end = b.restarts;
+      c.key.clear();
+    }
+    return false;
+  }
+
+private:
+  struct block {
+    char type;
+    size_t offset;
+    size_t begin;    // first record
+    size_t restarts; // restart table
+    size_t end;
+    size_t restart_count;
+  };
+
+  block read_block(size_t offset) const {
+    block b;
+    size_t header = offset == 0 ? header_size : 0;
+    if (offset + header + 4 > size_ - footer_size)
+      throw_corrupted(file_.path(), "block past the end");
+    b.type = static_cast<char>(data_[offset + header]);
+    size_t length = static_cast<size_t>(get_be(data_ + offset + header + 1, 3));
+    b.offset = offset;
+    b.begin = offset + header + 4;
+    b.end = offset + length;
+    if (length < header + 6 || b.end > size_ - footer_size)
+      throw_corrupted(file_.path(), "bad block length");
+    b.restart_count = static_cast<size_t>(get_be(data_ + b.end - 2, 2));
+    if (b.restart_count == 0 || 3 * b.restart_count + 2 > b.end - b.begin)
+      throw_corrupted(file_.path(), "bad restart table");
+    b.restarts = b.end - 2 - 3 * b.restart_count;
+    return b;
+  }
+
+  // Blocks are padded with zeros up to the block size
+  size_t next_block(size_t end) const {
+    while (end < refs_end_ && data_[end] == 0)
+      ++end;
+    return end;
+  }
+
+  uint64_t read_varint(const block &b, size_t &pos) const {
+    auto p = data_ + pos;
+    uint64_t value;
+    if (!get_varint(p, data_ + b.restarts, value))
+      throw_corrupted(file_.path(), "truncated record");
+    pos = static_cast<size_t>(p - data_);
+    return value;
+  }
+
+  // Decode the key of the record at `pos`, given the previous `key`
+  void decode_key(const block &b, size_t &pos, std::string &key,
+                  uint8_t &type) const {
+    uint64_t prefix = read_varint(b, pos);
+    uint64_t suffix = read_varint(b, pos);
+    type = static_cast<uint8_t>(suffix & 7);
+    suffix >>= 3;
+    if (prefix > key.size() || suffix > b.restarts - pos)
+      throw_corrupted(file_.path(), "bad record key");
+    key.resize(static_cast<size_t>(prefix));
+    key.append(reinterpret_cast<const char *>(data_ + pos),
+               static_cast<size_t>(suffix));
+    pos += static_cast<size_t>(suffix);
+  }
+
+  void decode_ref_value(const block &b, size_t &pos, ref_record &record) const {
+    record.update_index = min_index_ + read_varint(b, pos);
+    size_t ids = record.type == direct ? 1 : record.type == direct_peeled ? 2 : 0;
+    if (record.type > symbolic || b.restarts - pos < ids * GIT_OID_RAWSZ)
+      throw_corrupted(file_.path(), "bad record value");
+    if (ids > 0)
+      memcpy(record.value.id, data_ + pos, GIT_OID_RAWSZ);
+    if (ids > 1)
+      memcpy(record.peeled.id, data_ + pos + GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+    pos += ids * GIT_OID_RAWSZ;
+    if (record.type == symbolic) {
+      auto length = read_varint(b, pos);
+      if (length > b.restarts - pos)
+        throw_corrupted(file_.path(), "bad record value");
+      record.target.assign(reinterpret_cast<const char *>(data_ + pos),
+                           static_cast<size_t>(length));
+      pos += static_cast<size_t>(length);
+    }
+  }
+
+  void skip_value(const block &b, size_t &pos, uint8_t type) const {
+    if (b.type == index_block) {
+      read_varint(b, pos);
+      return;
+    }
+    ref_record record;
+    record.type = type;
+    decode_ref_value(b, pos, record);
+  }
+
+  // Find the first record of `b` whose key is not less than `name`:
+  // binary search over the restart points (whose keys are complete), then
+  // a scan. `pos` is left at that record, and `key` holds the key before it.
+  bool seek_in_block(const block &b, const std::string &name, size_t &pos,
+                     std::string &key) const {
+    size_t low = 0, high = b.restart_count;
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      size_t restart = b.offset + static_cast<size_t>(get_be(
+                                      data_ + b.restarts + 3 * mid, 3));
+      if (restart < b.begin || restart >= b.restarts)
+        throw_corrupted(file_.path(), "bad restart offset");
+      std::string restart_key;
+      uint8_t type;
+      decode_key(b, restart, restart_key, type);
+      if (restart_key <= name)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+    pos = low == 0 ? b.begin
+                   : b.offset + static_cast<size_t>(get_be(
+                                    data_ + b.restarts + 3 * (low - 1), 3));
+    key.clear();
+    while (pos < b.restarts) {
+      size_t record = pos;
+      std::string current = key;
+      uint8_t type;
+      decode_key(b, pos, current, type);
+      if (current >= name) {
+        pos = record;
+        return true;
+      }
+      skip_value(b, pos, type);
+      key.swap(current);
+    }
+    return false;
+  }
+
+  mapped_file file_;
+  std::string name_;
+  const unsigned char *data_;
+  size_t size_;
+  uint64_t min_index_;
+  uint64_t max_index_;
+  uint64_t ref_index_;
+  size_t refs_end_;
+};
+
+typedef std::vector<std::shared_ptr<const table>> table_list;
+
+// The records of several tables (oldest first) in name order; for a name
+// held by more than one, the newest table's record
+class merged_iterator {
+public:
+  explicit merged_iterator(const table_list &tables)
+      : tables_(tables), cursors_(tables.size()), heads_(tables.size()),
+        valid_(tables.size(), false) {}
+
+  void seek(const std::string &name) {
+    for (size_t i = 0; i < tables_.size(); ++i) {
+      tables_[i]->seek(cursors_[i], name);
+      valid_[i] = tables_[i]->next(cursors_[i], heads_[i]);
+    }
+  }
+
+  // The next record, from the table `source` (if given) points to
+  bool next(ref_record &out, bool keep_deletions, size_t *source = nullptr) {
+    for (;;) {
+      size_t best = tables_.size();
+      for (size_t i = 0; i < tables_.size(); ++i)
+        if (valid_[i] &&
+            (best == tables_.size() || heads_[i].name <= heads_[best].name))
+          best = i;
+      if (best == tables_.size())
+        return false;
+      std::swap(out, heads_[best]);
+      if (source)
+        *source = best;
+      for (size_t i = 0; i < tables_.size(); ++i)
+        if (valid_[i] && (i == best || heads_[i].name == out.name))
+          valid_[i] = tables_[i]->next(cursors_[i], heads_[i]);
+      if (out.type != deletion || keep_deletions)
+        return true;
+    }
+  }
+
+private:
+  table_list tables_;
+  std::vector<table::cursor> cursors_;
+  std::vector<ref_record> heads_;
+  std::vector<bool> valid_;
+};
+
+// The tables listed in tables.list
+class stack {
+public:
+  stack(const std::string &directory, const reftable::options &opts)
+      : directory_(directory), opts_(opts), stamp_{0, 0, 0, 0},
+        random_(std::random_device()()) {}
+
+  const std::string &directory() const { return directory_; }
+
+  std::string list_path() const { return directory_ + "tables.list"; }
+
+  const table_list &tables() const { return tables_; }
+
+  // Pick up changes to tables.list; a table removed by a concurrent
+  // compaction means the list is read again
+  void reload() {
+    for (int attempt = 0;; ++attempt) {
+      struct stat st;
+      if (stat(list_path().c_str(), &st) != 0) {
+        if (errno != ENOENT)
+          throw_os_error("failed to read", list_path());
+        tables_.clear();
+        stamp_ = {0, 0, 0, 0};
+        return;
+      }
+      file_stamp stamp{static_cast<uint64_t>(st.st_ino),
+                       static_cast<uint64_t>(st.st_size),
+                       static_cast<uint64_t>(st.st_mtim.tv_sec),
+                       static_cast<uint64_t>(st.st_mtim.tv_nsec)};
+      if (stamp == stamp_)
+        return;
+      try {
+        load();
+        stamp_ = stamp;
+        return;
+      } catch (const git_exception &) {
+        if (attempt == 3)
+          throw;
+      }
+    }
+  }
+
+  // The live record for `name`, if any
+  bool read(const std::string &name, ref_record &out) const {
+    for (auto it = tables_.rbegin(); it != tables_.rend(); ++it) {
+      table::cursor c;
+      (*it)->seek(c, name);
+      if ((*it)->next(c, out) && out.name == name)
+        return out.type != deletion;
+    }
+    return false;
+  }
+
+  // Whether a live reference is named `name`/...
+  bool has_children(const std::string &name) const {
+    merged_iterator it(tables_);
+    it.seek(name + "/");
+    ref_record record;
+    return it.next(record, false) && starts_with(record.name, name + "/");
+  }
+
+  // Add a table holding `records` (sorted by name, no duplicates) with the
+  // next update index, compact, and replace tables.list through `lock`
+  void add(std::vector<ref_record> &records, lock_file &lock) {
+    table_list tables = tables_;
+    tables.push_back(write_records(records));
+
+    // Merge from the newest end until each table is at least
+    // compaction_factor times the size of all newer ones
+    size_t start = tables.size() - 1;
+    uint64_t newer = tables[start]->size();
+    while (start > 0 &&
+           tables[start - 1]->size() < opts_.compaction_factor * newer) {
+      --start;
+      newer += tables[start]->size();
+    }
+    std::vector<std::string> obsolete;
+    if (start < tables.size() - 1)
+      tables = compact(tables, start, obsolete);
+    commit(tables, lock, obsolete);
+  }
+
+  // Make `records` (sorted by name, no duplicates) the whole stack, in one
+  // table
+  void replace(std::vector<ref_record> &records, lock_file &lock) {
+    auto added = write_records(records);
+    std::vector<std::string> obsolete;
+    for (auto &t : tables_)
+      obsolete.push_back(t->name());
+    commit({added}, lock, obsolete);
+  }
+
+  // Merge the whole stack into one table
+  void compact_all(lock_file &lock) {
+    if (tables_.size() < 2)
+      return;
+    std::vector<std::string> obsolete;
+    commit(compact(tables_, 0, obsolete), lock, obsolete);
+  }
+
+private:
+  struct file_stamp {
+    uint64_t ino, size, sec, nsec;
+    bool operator==(const file_stamp &o) const {
+      return ino == o.ino && size == o.size && sec == o.sec && nsec == o.nsec;
+    }
+  };
+
+  void load() {
+    FILE *file = fopen(list_path().c_str(), "rb");
+    if (!file)
+      throw_os_error("failed to read", list_path());
+    std::vector<std::string> names;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+      std::string name(line);
+      while (!name.empty() && (name.back() == '\n' || name.back() == '\r'))
+        name.pop_back();
+      if (!name.empty())
+        names.push_back(name);
+    }
+    fclose(file);
+
+    table_list tables;
+    for (auto &name : names) {
+      auto existing = std::find_if(
+          tables_.begin(), tables_.end(),
+          [&](const std::shared_ptr<const table> &t) { return t->name() == name; });
+      tables.push_back(existing != tables_.end()
+                           ? *existing
+                           : std::make_shared<const table>(directory_ + name,
+                                                           name));
+    }
+    tables_.swap(tables);
+  }
+
+  // A new table holding `records` with the next update index
+  std::shared_ptr<const table> write_records(std::vector<ref_record> &records) {
+    uint64_t index = tables_.empty() ? 1 : tables_.back()->max_update_index() + 1;
+    for (auto &record : records)
+      record.update_index = index;
+    size_t next = 0;
+    auto name = write_file(
+        [&](ref_record &out) {
+          if (next == records.size())
+            return false;
+          out = records[next++];
+          return true;
+        },
+        index, index);
+    return std::make_shared<const table>(directory_ + name, name);
+  }
+
+  // Write a table file from `source`; returns its name
+  std::string write_file(const record_source &source, uint64_t min_index,
+                         uint64_t max_index) {
+    auto data = write_table(source, min_index, max_index, opts_);
+    char name[64];
+    snprintf(name, sizeof(name), "0x%012" PRIx64 "-0x%012" PRIx64 "-%08x.ref",
+             min_index, max_index, static_cast<unsigned>(random_()));
+    std::string temp = directory_ + "tmp_XXXXXX";
+    int fd = mkstemp(&temp[0]);
+    if (fd < 0)
+      throw_os_error("failed to create", temp);
+    size_t done = 0;
+    while (done < data.size()) {
+      auto n = ::write(fd, data.data() + done, data.size() - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        ::close(fd);
+        unlink(temp.c_str());
+        throw_os_error("failed to write", temp);
+      }
+      done += static_cast<size_t>(n);
+    }
+    // Once, before the table can be listed
+    if (fsync(fd) < 0) {
+      ::close(fd);
+      unlink(temp.c_str());
+      throw_os_error("failed to write", temp);
+    }
+    fchmod(fd, 0644);
+    ::close(fd);
+    if (std::rename(temp.c_str(), (directory_ + name).c_str()) != 0) {
+      unlink(temp.c_str());
+      throw_os_error("failed to rename", temp);
+    }
+    return name;
+  }
+
+  // `tables` with those from `start` on merged into one; deletions are
+  // dropped when nothing older remains
+  table_list compact(const table_list &tables, size_t start,
+                     std::vector<std::string> &obsolete) {
+    table_list segment(tables.begin() + start, tables.end());
+    merged_iterator it(segment);
+    it.seek("");
+    bool keep_deletions = start > 0;
+    auto name = write_file(
+        [&](ref_record &out) { return it.next(out, keep_deletions); },
+        segment.front()->min_update_index(), segment.back()->max_update_index());
+    table_list result(tables.begin(), tables.begin() + start);
+    result.push_back(std::make_shared<const table>(directory_ + name, name));
+    for (auto &t : segment)
+      obsolete.push_back(t->name());
+    return result;
+  }
+
+  void commit(const table_list &tables, lock_file &lock,
+              const std::vector<std::string> &obsolete) {
+    std::string list;
+    for (auto &t : tables)
+      list += t->name() + "\n";
+    lock.commit(list);
+    tables_ = tables;
+    stamp_ = {0, 0, 0, 0};
+    // Readers that still map them keep their view
+    for (auto &name : obsolete)
+      unlink((directory_ + name).c_str());
+  }
+
+  std::string directory_;
+  reftable::options opts_;
+  table_list tables_;
+  file_stamp stamp_;
+  std::mt19937 random_;
+};
+
+ref_record record_from(const git_reference *ref) {
+  ref_record record;
+  record.name = git_reference_name(ref);
+  record.update_index = 0;
+  if (git_reference_type(ref) == GIT_REFERENCE_SYMBOLIC) {
+    record.type = symbolic;
+    record.target = git_reference_symbolic_target(ref);
+  } else {
+    record.type = direct;
+    record.value = *git_reference_target(ref);
+    if (auto peeled = git_reference_target_peel(ref)) {
+      record.type = direct_peeled;
+      record.peeled = *peeled;
+    }
+  }
+  return record;
+}
+
+ref_record deletion_of(const std::string &name) {
+  ref_record record;
+  record.name = name;
+  record.update_index = 0;
+  record.type = deletion;
+  return record;
+}
+
+git_reference *make_reference(const ref_record &record) {
+  if (record.type == symbolic)
+    return git_reference__alloc_symbolic(record.name.c_str(),
+                                         record.target.c_str());
+  return git_reference__alloc(
+      record.name.c_str(), &record.value,
+      record.type == direct_peeled ? &record.peeled : nullptr);
+}
+
+// Sort by name; of several updates to one name, the last one counts
+void sort_updates(std::vector<ref_record> &records) {
+  std::stable_sort(records.begin(), records.end(),
+                   [](const ref_record &a, const ref_record &b) {
+                     return a.name < b.name;
+                   });
+  std::vector<ref_record> unique;
+  for (auto &record : records) {
+    if (!unique.empty() && unique.back().name == record.name)
+      unique.back() = std::move(record);
+    else
+      unique.push_back(std::move(record));
+  }
+  records.swap(unique);
+}
+
+int fail(const std::exception &e) {
+  git_error_set_str(GIT_ERROR_REFERENCE, e.what());
+  auto error = dynamic_cast<const git_exception *>(&e);
+  if (error && error->code() != git_exception::error_code::ok)
+    return static_cast<int>(error->code());
+  return GIT_ERROR;
+}
+
+template <typename F> int guarded(F fn) {
+  try {
+    return fn();
+  } catch (const std::exception &e) {
+    return fail(e);
+  }
+}
+
+// References each worktree keeps for itself, as git has them: HEAD and the
+// other names outside refs/, and refs/bisect/, refs/worktree/ and
+// refs/rewritten/
+bool is_per_worktree(const std::string &name) {
+  return !starts_with(name, "refs/") || starts_with(name, "refs/bisect/") ||
+         starts_with(name, "refs/worktree/") ||
+         starts_with(name, "refs/rewritten/");
+}
+
+// Updates that start a reflog when there is none (core.logAllRefUpdates)
+enum class log_policy { none, branches, all };
+
+log_policy log_policy_of(git_repository *repo) {
+  git_config *config = nullptr;
+  git_exception::throw_nonzero(git_repository_config_snapshot(&config, repo));
+  auto policy =
+      git_repository_is_bare(repo) ? log_policy::none : log_policy::branches;
+  const char *value = nullptr;
+  int enabled = 0;
+  if (git_config_get_string(&value, config, "core.logallrefupdates") == 0 &&
+      strcasecmp(value, "always") == 0)
+    policy = log_policy::all;
+  else if (git_config_get_bool(&enabled, config, "core.logallrefupdates") == 0)
+    policy = enabled ? log_policy::branches : log_policy::none;
+  git_config_free(config);
+  git_error_clear();
+  return policy;
+}
+
+// A reflog entry for an update of a reference transaction
+struct log_request {
+  std::string name;
+  bool deleted;
+  std::shared_ptr<git_signature> who;
+  std::string message;
+};
+
+struct reftable_backend {
+  // The locks of both stacks, always taken common stack first
+  struct locks {
+    std::unique_ptr<lock_file> common;
+    std::unique_ptr<lock_file> own;
+  };
+
+  git_refdb_backend parent;
+  stack refs;                      // <commondir>/reftable
+  std::unique_ptr<stack> own_refs; // <gitdir>/reftable of a linked worktree
+  git_refdb_backend *logs;         // the files backend, which keeps reflogs
+  log_policy policy;
+  std::mutex mutex;
+  // Held from the first lock() of a transaction to the last unlock()
+  std::unique_ptr<locks> transaction_locks;
+  size_t locked;
+  std::vector<ref_record> pending;
+  std::vector<log_request> pending_logs;
+
+  reftable_backend(const std::string &directory,
+                   const std::string &own_directory,
+                   const reftable::options &opts)
+      : refs(directory, opts), logs(nullptr), policy(log_policy::none),
+        locked(0) {
+    if (!own_directory.empty())
+      own_refs.reset(new stack(own_directory, opts));
+  }
+
+  ~reftable_backend() {
+    if (logs)
+      logs->free(logs);
+  }
+
+  static reftable_backend &of(git_refdb_backend *backend) {
+    return *reinterpret_cast<reftable_backend *>(backend);
+  }
+
+  // Per-worktree references of a linked worktree are in its own stack; the
+  // common stack holds those of the main worktree
+  stack &stack_for(const std::string &name) {
+    return own_refs && is_per_worktree(name) ? *own_refs : refs;
+  }
+
+  void reload() {
+    refs.reload();
+    if (own_refs)
+      own_refs->reload();
+  }
+
+  locks lock_stacks() {
+    locks l;
+    l.common.reset(new lock_file(refs.list_path()));
+    if (own_refs)
+      l.own.reset(new lock_file(own_refs->list_path()));
+    reload();
+    return l;
+  }
+
+  bool read(const std::string &name, ref_record &out) {
+    return stack_for(name).read(name, out);
+  }
+
+  bool has_children(const std::string &name) {
+    return refs.has_children(name) ||
+           (own_refs && own_refs->has_children(name));
+  }
+
+  // Add `records` (sorted by name, no duplicates) to their stacks
+  void add(std::vector<ref_record> &records, locks &l) {
+    std::vector<ref_record> common, own;
+    for (auto &record : records)
+      (&stack_for(record.name) == &refs ? common : own)
+          .push_back(std::move(record));
+    if (!common.empty())
+      refs.add(common, *l.common);
+    if (!own.empty())
+      own_refs->add(own, *l.own);
+  }
+
+  // Compare-and-swap checks of a write to `name`, and the directory/file
+  // conflicts of a new reference (`renamed` is going away)
+  void check(const std::string &name, bool force, const git_oid *old_id,
+             const char *old_target, const std::string &renamed = "") {
+    ref_record current;
+    bool exists = read(name, current);
+    if (exists && !force)
+      throw_reference_error("failed to write reference '" + name +
+                                "': a reference with that name already exists",
+                            git_exception::error_code::exists);
+    static const git_oid zero = {{0}};
+    bool matches = true;
+    if (old_id)
+      matches = exists ? current.type != symbolic &&
+                             git_oid_equal(&current.value, old_id)
+                       : git_oid_equal(old_id, &zero) != 0;
+    if (old_target)
+      matches = matches && exists && current.type == symbolic &&
+                current.target == old_target;
+    if (!matches)
+      throw_reference_error("old reference value does not match",
+                            git_exception::error_code::modified);
+    if (exists)
+      return;
+    for (auto slash = name.find('/'); slash != std::string::npos;
+         slash = name.find('/', slash + 1)) {
+      auto prefix = name.substr(0, slash);
+      if (prefix != renamed && read(prefix, current))
+        throw_reference_error("cannot create '" + name + "': '" + prefix +
+                                  "' exists",
+                              git_exception::error_code::exists);
+    }
+    if (has_children(name))
+      throw_reference_error("cannot create '" + name +
+                                "': references exist below it",
+                            git_exception::error_code::exists);
+  }
+
+  // The id `name` ends at through symbolic references, as libgit2 follows
+  // them; false if it does not resolve
+  bool resolve(std::string name, git_oid &id) {
+    ref_record record;
+    for (int depth = 0; depth < 5 && read(name, record); ++depth) {
+      if (record.type != symbolic) {
+        id = record.value;
+        return true;
+      }
+      name = record.target;
+    }
+    return false;
+  }
+
+  // Whether an update of `name` starts a reflog when it has none
+  bool starts_log(const std::string &name) const {
+    switch (policy) {
+    case log_policy::all:
+      return true;
+    case log_policy::branches:
+      return name == "HEAD" || starts_with(name, "refs/heads/") ||
+             starts_with(name, "refs/remotes/") ||
+             starts_with(name, "refs/notes/");
+    default:
+      return false;
+    }
+  }
+
+  void append_log(const std::string &name, const git_oid &id,
+                  const git_signature *who, const std::string &message) {
+    if (logs->has_log(logs, name.c_str()) != 1 && !starts_log(name))
+      return;
+    git_reflog *log = nullptr;
+    git_exception::throw_nonzero(logs->reflog_read(&log, logs, name.c_str()));
+    std::unique_ptr<git_reflog, void (*)(git_reflog *)> guard(log,
+                                                              git_reflog_free);
+    git_exception::throw_nonzero(
+        git_reflog_append(log, &id, who, message.c_str()));
+    git_exception::throw_nonzero(logs->reflog_write(logs, log));
+  }
+
+  // Log an update of `name`, and in HEAD's reflog too when HEAD points to
+  // it, as the files backend does
+  void log_update(const std::string &name, const git_signature *who,
+                  const std::string &message) {
+    git_oid id;
+    if (!who || !resolve(name, id))
+      return;
+    append_log(name, id, who, message);
+    ref_record head;
+    if (name != "HEAD" && read("HEAD", head) && head.type == symbolic &&
+        head.target == name)
+      append_log("HEAD", id, who, message);
+  }
+
+  void drop_log(const std::string &name) {
+    int ret = logs->reflog_delete(logs, name.c_str());
+    if (ret != GIT_ENOTFOUND)
+      git_exception::throw_nonzero(ret);
+    git_error_clear();
+  }
+
+  static int exists(int *exists, git_refdb_backend *backend,
+                    const char *name) {
+    return guarded([&] {
+      auto &self = of(backend);
+      std::lock_guard<std::mutex> guard(self.mutex);
+      self.stack_for(name).reload();
+      ref_record record;
+      *exists = self.read(name, record);
+      return 0;
+    });
+  }
+
+  static int lookup(git_reference **out, git_refdb_backend *backend,
+                    const char *name) {
+    return guarded([&] {
+      auto &self = of(backend);
+      std::lock_guard<std::mutex> guard(self.mutex);
+      self.stack_for(name).reload();
+      ref_record record;
+      if (!self.read(name, record)) {
+        git_error_set_str(GIT_ERROR_REFERENCE,
+                          ("reference '" + std::string(name) + "' not found")
+                              .c_str());
+        return static_cast<int>(GIT_ENOTFOUND);
+      }
+      *out = make_reference(record);
+      return 0;
+    });
+  }
+
+  static int write(git_refdb_backend *backend, const git_reference *ref,
+                   int force, const git_signature *who, const char *message,
+                   const git_oid *old_id, const char *old_target) {
+    return guarded([&] {
+      auto &self = of(backend);
+      std::lock_guard<std::mutex> guard(self.mutex);
+      auto locks = self.lock_stacks();
+      std::vector<ref_record> records{record_from(ref)};
+      auto name = records[0].name;
+      self.check(name, force != 0, old_id, old_target);
+      self.add(records, locks);
+      self.log_update(name, who, message ? message : "");
+      return 0;
+    });
+  }
+
+  static int rename(git_reference **out, git_refdb_backend *backend,
+                    const char *old_name, const char *new_name, int force,
+                    const git_signature *who, const char *message) {
+    return guarded([&] {
+      auto &self = of(backend);
+      std::lock_guard<std::mutex> guard(self.mutex);
+      auto locks = self.lock_stacks();
+      ref_record record;
+      if (!self.read(old_name, record))
+        throw_reference_error("reference '" + std::string(old_name) +
+                                  "' not found",
+                              git_exception::error_code::notfound);
+      self.check(new_name, force != 0, nullptr, nullptr, old_name);
+      record.name = new_name;
+      std::vector<ref_record> records{record, deletion_of(old_name)};
+      sort_updates(records);
+      self.add(records, locks);
+      if (self.logs->has_log(self.logs, old_name) == 1)
+        git_exception::throw_nonzero(
+            self.logs->reflog_rename(self.logs, old_name, new_name));
+      self.log_update(new_name, who, message ? message : "");
+      *out = make_reference(record);
+      return 0;
+    });
+  }
+
+  static int del(git_refdb_backend *backend, const char *name,
+                 const git_oid *old_id, const char *old_target) {
+    return guarded([&] {
+      auto &self = of(backend);
+      std::lock_guard<std::mutex> guard(self.mutex);
+      auto locks = self.lock_stacks();
+      ref_record record;
+      if (!self.read(name, record))
+        throw_reference_error("reference '" + std::string(name) +
+                                  "' not found",
+                              git_exception::error_code::notfound);
+      self.check(name, true, old_id, old_target);
+      std::vector<ref_record> records{deletion_of(name)};
+      self.add(records, locks);
+      self.drop_log(name);
+      return 0;
+    });
+  }
+
+  static int compress(git_refdb_backend *backend) {
+    return guarded([&] {
+      auto &self = of(backend);
+      std::lock_guard<std::mutex> guard(self.mutex);
+      auto locks = self.lock_stacks();
+      self.refs.compact_all(*locks.common);
+      if (self.own_refs)
+        self.own_refs->compact_all(*locks.own);
+      return 0;
+    });
+  }
+
+  // Reflogs stay with the files backend, in logs/
+  static int has_log(git_refdb_backend *backend, const char *name) {
+    auto logs = of(backend).logs;
+    return logs->has_log(logs, name);
+  }
+
+  static int ensure_log(git_refdb_backend *backend, const char *name) {
+    auto logs = of(backend).logs;
+    return logs->ensure_log(logs, name);
+  }
+
+  // A reference without a log has an empty one. The files backend creates
+  // the file as it reads a missing log, so it is removed again
+  static int reflog_read(git_reflog **out, git_refdb_backend *backend,
+                         const char *name) {
+    auto logs = of(backend).logs;
+    bool existed = logs->has_log(logs, name) == 1;
+    int ret = logs->reflog_read(out, logs, name);
+    if (ret == 0 && !existed)
+      logs->reflog_delete(logs, name);
+    return ret;
+  }
+
+  static int reflog_write(git_refdb_backend *backend, git_reflog *reflog) {
+    auto logs = of(backend).logs;
+    return logs->reflog_write(logs, reflog);
+  }
+
+  static int reflog_rename(git_refdb_backend *backend, const char *old_name,
+                           const char *new_name) {
+    auto logs = of(backend).logs;
+    return logs->reflog_rename(logs, old_name, new_name);
+  }
+
+  static int reflog_delete(git_refdb_backend *backend, const char *name) {
+    auto logs = of(backend).logs;
+    return logs->reflog_delete(logs, name);
+  }
+
+  // Reference transactions: the stacks are locked by the first lock() and
+  // the updates collected by unlock() go into one table per stack at the
+  // last unlock()
+  static int lock(void **payload, git_refdb_backend *backend,
+                  const char *name) {
+    return guarded([&] {
+      auto &self = of(backend);
+      std::lock_guard<std::mutex> guard(self.mutex);
+      if (!self.locked)
+        self.transaction_locks.reset(new locks(self.lock_stacks()));
+      ++self.locked;
+      *payload = new std::string(name);
+      return 0;
+    });
+  }
+
+  static int unlock(git_refdb_backend *backend, void *payload, int success,
+                    int update_reflog, const git_reference *ref,
+                    const git_signature *sig, const char *message) {
+    std::unique_ptr<std::string> name(static_cast<std::string *>(payload));
+    return guarded([&] {
+      auto &self = of(backend);
+      std::lock_guard<std::mutex> guard(self.mutex);
+      if (success == 2) {
+        self.pending.push_back(deletion_of(*name));
+        self.pending_logs.push_back(log_request{*name, true, nullptr, ""});
+      } else if (success) {
+        self.pending.push_back(record_from(ref));
+        git_signature *who = nullptr;
+        if (update_reflog && sig)
+          git_exception::throw_nonzero(git_signature_dup(&who, sig));
+        if (who)
+          self.pending_logs.push_back(
+              log_request{*name, false,
+                          std::shared_ptr<git_signature>(who,
+                                                         git_signature_free),
+                          message ? message : ""});
+      }
+      if (--self.locked)
+        return 0;
+      std::vector<ref_record> records;
+      records.swap(self.pending);
+      std::vector<log_request> requests;
+      requests.swap(self.pending_logs);
+      std::unique_ptr<locks> l(std::move(self.transaction_locks));
+      if (!records.empty()) {
+        self.reload();
+        sort_updates(records);
+        self.add(records, *l);
+      }
+      for (auto &request : requests) {
+        if (request.deleted)
+          self.drop_log(request.name);
+        else
+          self.log_update(request.name, request.who.get(), request.message);
+      }
+      return 0;
+    });
+  }
+
+  static void free(git_refdb_backend *backend) { delete &of(backend); }
+};
+
+struct reftable_iterator {
+  git_reference_iterator parent;
+  merged_iterator merged;
+  // Tables of the common stack, first in `merged`, when there is a stack
+  // of the worktree's own references after them
+  size_t common_tables;
+  std::string glob;
+  std::string prefix; // every name returned starts with it
+  std::string name;
+  bool done;
+
+  reftable_iterator(const table_list &tables, size_t common)
+      : merged(tables), common_tables(common), done(false) {}
+
+  static reftable_iterator &of(git_reference_iterator *iter) {
+    return *reinterpret_cast<reftable_iterator *>(iter);
+  }
+
+  bool advance(ref_record &record) {
+    size_t source;
+    while (!done && merged.next(record, false, &source)) {
+      if (!starts_with(record.name, prefix))
+        break;
+      // The main worktree's own references
+      if (source < common_tables && is_per_worktree(record.name))
+        continue;
+      if (glob.empty() || fnmatch(glob.c_str(), record.name.c_str(), 0) == 0) {
+        name = record.name;
+        return true;
+      }
+    }
+    done = true;
+    return false;
+  }
+
+  static int next(git_reference **out, git_reference_iterator *iter) {
+    return guarded([&] {
+      ref_record record;
+      if (!of(iter).advance(record))
+        return static_cast<int>(GIT_ITEROVER);
+      *out = make_reference(record);
+      return 0;
+    });
+  }
+
+  static int next_name(const char **out, git_reference_iterator *iter) {
+    return guarded([&] {
+      ref_record record;
+      if (!of(iter).advance(record))
+        return static_cast<int>(GIT_ITEROVER);
+      *out = of(iter).name.c_str();
+      return 0;
+    });
+  }
+
+  static void free(git_reference_iterator *iter) { delete &of(iter); }
+
+  // Iterates over refs/ only, as the files backend does
+  static int create(git_reference_iterator **out, git_refdb_backend *backend,
+                    const char *glob) {
+    return guarded([&] {
+      auto &self = reftable_backend::of(backend);
+      std::lock_guard<std::mutex> guard(self.mutex);
+      self.reload();
+      auto tables = self.refs.tables();
+      size_t common = 0;
+      if (self.own_refs) {
+        common = tables.size();
+        auto &own = self.own_refs->tables();
+        tables.insert(tables.end(), own.begin(), own.end());
+      }
+      std::unique_ptr<reftable_iterator> iter(
+          new reftable_iterator(tables, common));
+      iter->parent.next = &reftable_iterator::next;
+      iter->parent.next_name = &reftable_iterator::next_name;
+      iter->parent.free = &reftable_iterator::free;
+      iter->glob = glob ? glob : "";
+      // Seek to the part of the glob before its first wildcard
+      iter->prefix = iter->glob.substr(0, iter->glob.find_first_of("*?[\\"));
+      const std::string refs = "refs/";
+      if (!starts_with(iter->prefix, refs)) {
+        if (starts_with(refs, iter->prefix))
+          iter->prefix = refs;
+        else
+          iter->done = true;
+      }
+      iter->merged.seek(iter->prefix);
+      *out = &iter.release()->parent;
+      return 0;
+    });
+  }
+};
+
+const char extension_name[] = "refstorage";
+
+// What git leaves in HEAD of a reftable repository, for programs that only
+// know the files backend
+const char invalid_head[] = "refs/heads/.invalid";
+
+void check_options(const reftable::options &opts) {
+  if (opts.block_size < 256 || opts.block_size > 0xffffff ||
+      opts.restart_interval == 0 || opts.compaction_factor < 2)
+    throw git_exception("invalid reftable options",
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::invalid);
+}
+
+bool uses_reftable(git_repository *repo) {
+  git_config *config = nullptr;
+  if (git_repository_config_snapshot(&config, repo) != 0) {
+    git_error_clear();
+    return false;
+  }
+  const char *value = nullptr;
+  bool used = git_config_get_string(&value, config, "extensions.refstorage") ==
+                  0 &&
+              strcmp(value, "reftable") == 0;
+  git_config_free(config);
+  git_error_clear();
+  return used;
+}
+
+// Loose reference files below `git_dir` + `directory`
+void scan_loose(const std::string &git_dir, const std::string &directory,
+                std::vector<std::string> &names) {
+  DIR *dir = opendir((git_dir + directory).c_str());
+  if (!dir)
+    return;
+  while (auto found = readdir(dir)) {
+    std::string name = found->d_name;
+    if (name == "." || name == ".." ||
+        (name.size() > 5 && name.compare(name.size() - 5, 5, ".lock") == 0))
+      continue;
+    name = directory + name;
+    struct stat st;
+    if (stat((git_dir + name).c_str(), &st) != 0)
+      continue;
+    if (S_ISDIR(st.st_mode))
+      scan_loose(git_dir, name + "/", names);
+    else
+      names.push_back(name);
+  }
+  closedir(dir);
+}
+
+// The references the files backend of `repo` has for the stack of its
+// worktree: HEAD and everything under refs/ for the main worktree, HEAD and
+// the per-worktree references for a linked one
+std::vector<ref_record> files_references(git_repository *repo) {
+  std::vector<ref_record> records;
+  std::vector<std::string> names{"HEAD"};
+  if (git_repository_is_worktree(repo)) {
+    for (auto prefix : {"refs/bisect/", "refs/worktree/", "refs/rewritten/"})
+      scan_loose(git_repository_path(repo), prefix, names);
+  } else {
+    git_reference_iterator *iter = nullptr;
+    git_exception::throw_nonzero(git_reference_iterator_new(&iter, repo));
+    git_reference *ref = nullptr;
+    int ret;
+    while ((ret = git_reference_next(&ref, iter)) == 0) {
+      records.push_back(record_from(ref));
+      git_reference_free(ref);
+    }
+    git_reference_iterator_free(iter);
+    if (ret != GIT_ITEROVER)
+      git_exception::throw_nonzero(ret);
+  }
+  for (auto &name : names) {
+    git_reference *ref = nullptr;
+    if (git_reference_lookup(&ref, repo, name.c_str()) != 0)
+      continue;
+    auto record = record_from(ref);
+    git_reference_free(ref);
+    if (record.type != symbolic || record.target != invalid_head)
+      records.push_back(record);
+  }
+  git_error_clear();
+  sort_updates(records);
+  return records;
+}
+
+// Make `records` all the stack in `directory` holds
+void write_stack(const std::string &directory, std::vector<ref_record> &records,
+                 const reftable::options &opts) {
+  if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST)
+    throw_os_error("failed to create", directory);
+  stack s(directory, opts);
+  lock_file lock(s.list_path());
+  s.reload();
+  s.replace(records, lock);
+}
+
+// Remove a file or directory tree; a missing path is not an error
+void remove_all(const std::string &path) {
+  struct stat st;
+  if (lstat(path.c_str(), &st) < 0) {
+    if (errno == ENOENT)
+      return;
+    throw_os_error("failed to stat", path);
+  }
+  if (S_ISDIR(st.st_mode)) {
+    auto dir = opendir(path.c_str());
+    if (!dir)
+      throw_os_error("failed to open directory", path);
+    std::vector<std::string> names;
+    while (auto entry = readdir(dir))
+      if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+        names.push_back(entry->d_name);
+    closedir(dir);
+    for (auto &name : names)
+      remove_all(path + "/" + name);
+    if (rmdir(path.c_str()) < 0 && errno != ENOENT)
+      throw_os_error("failed to remove directory", path);
+  } else if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+    throw_os_error("failed to remove", path);
+  }
+}
+
+// Empty the files backend of the worktree whose git directory is `git_dir`,
+// as git lays out a reftable repository: HEAD points to a branch that
+// cannot exist, and in the common directory packed-refs is gone and
+// refs/heads is a file, so that programs reading the files see no
+// references
+void retire_files(const std::string &git_dir, bool common) {
+  lock_file head(git_dir + "HEAD");
+  head.commit(std::string("ref: ") + invalid_head + "\n");
+  remove_all(git_dir + "refs");
+  if (!common)
+    return;
+  if (unlink((git_dir + "packed-refs").c_str()) != 0 && errno != ENOENT)
+    throw_os_error("failed to remove", git_dir + "packed-refs");
+  if (mkdir((git_dir + "refs").c_str(), 0777) != 0)
+    throw_os_error("failed to create", git_dir + "refs");
+  lock_file heads(git_dir + "refs/heads");
+  heads.commit("this repository uses the reftable format\n");
+}
+
+// Move the references of every worktree of `repo` from the files backend to
+// reftable stacks. The stacks are complete before extensions.refStorage is
+// set, and the files are removed after
+void migrate_worktrees(git_repository *repo, const reftable::options &opts) {
+  std::vector<repository> opened;
+  git_repository *main = repo;
+  if (git_repository_is_worktree(repo)) {
+    git_repository *handle = nullptr;
+    git_exception::throw_nonzero(
+        git_repository_open(&handle, git_repository_commondir(repo)));
+    opened.push_back(repository(handle));
+    main = handle;
+  }
+  std::vector<git_repository *> linked;
+  git_strarray names{nullptr, 0};
+  git_exception::throw_nonzero(git_worktree_list(&names, main));
+  for (size_t i = 0; i < names.count; ++i) {
+    git_worktree *worktree = nullptr;
+    git_repository *handle = nullptr;
+    if (git_worktree_lookup(&worktree, main, names.strings[i]) == 0 &&
+        git_repository_open_from_worktree(&handle, worktree) == 0) {
+      opened.push_back(repository(handle));
+      linked.push_back(handle);
+    }
+    git_worktree_free(worktree);
+  }
+  git_strarray_dispose(&names);
+  git_error_clear();
+
+  std::string common = git_repository_commondir(main);
+  auto records = files_references(main);
+  write_stack(common + "reftable/", records, opts);
+  for (auto handle : linked) {
+    auto own = files_references(handle);
+    write_stack(std::string(git_repository_path(handle)) + "reftable/", own,
+                opts);
+  }
+
+  git_config *config = nullptr;
+  git_exception::throw_nonzero(
+      git_config_open_ondisk(&config, (common + "config").c_str()));
+  int ret = git_config_set_int32(config, "core.repositoryformatversion", 1);
+  if (!ret)
+    ret = git_config_set_string(config, "extensions.refStorage", "reftable");
+  git_config_free(config);
+  git_exception::throw_nonzero(ret);
+
+  retire_files(common, true);
+  for (auto handle : linked)
+    retire_files(git_repository_path(handle), false);
+}
+
+} // namespace
+
+void reftable::enable_extension() {
+  git_strarray known{nullptr, 0};
+  git_exception::throw_nonzero(
+      git_libgit2_opts(GIT_OPT_GET_EXTENSIONS, &known));
+  std::vector<const char *> names(known.strings, known.strings + known.count);
+  int ret = 0;
+  if (std::find_if(names.begin(), names.end(), [](const char *name) {
+        return strcmp(name, extension_name) == 0;
+      }) == names.end()) {
+    names.push_back(extension_name);
+    ret = git_libgit2_opts(GIT_OPT_SET_EXTENSIONS, names.data(), names.size());
+  }
+  git_strarray_dispose(&known);
+  git_exception::throw_nonzero(ret);
+}
+
+bool reftable::is_enabled(const repository &repo) {
+  return uses_reftable(const_cast<git_repository *>(repo.c_ptr()));
+}
+
+void reftable::migrate(const repository &repo, const options &opts) {
+  check_options(opts);
+  enable_extension();
+  auto c_repo = const_cast<git_repository *>(repo.c_ptr());
+  if (!uses_reftable(c_repo))
+    migrate_worktrees(c_repo, opts);
+  attach(repo, opts);
+}
+
+void reftable::attach(const repository &repo, const options &opts) {
+  check_options(opts);
+  auto c_repo = const_cast<git_repository *>(repo.c_ptr());
+  if (!uses_reftable(c_repo))
+    throw git_exception("repository " + repo.path() +
+                            " does not use reftable; see reftable::migrate",
+                        git_exception::error_class::reference,
+                        git_exception::error_code::invalid);
+
+  std::string own;
+  if (repo.path() != repo.commondir())
+    own = repo.path() + "reftable/";
+  std::unique_ptr<reftable_backend> backend(
+      new reftable_backend(repo.commondir() + "reftable/", own, opts));
+  backend->policy = log_policy_of(c_repo);
+  if (backend->own_refs) {
+    // A worktree added since the migration still has its HEAD in a file
+    backend->own_refs->reload();
+    if (backend->own_refs->tables().empty()) {
+      auto records = files_references(c_repo);
+      write_stack(own, records, opts);
+      retire_files(repo.path(), false);
+    }
+  }
+  git_exception::throw_nonzero(git_refdb_backend_fs(&backend->logs, c_repo));
+
+  auto &b = backend->parent;
+  git_exception::throw_nonzero(
+      git_refdb_init_backend(&b, GIT_REFDB_BACKEND_VERSION));
+  b.exists = &reftable_backend::exists;
+  b.lookup = &reftable_backend::lookup;
+  b.iterator = &reftable_iterator::create;
+  b.write = &reftable_backend::write;
+  b.rename = &reftable_backend::rename;
+  b.del = &reftable_backend::del;
+  b.compress = &reftable_backend::compress;
+  b.has_log = &reftable_backend::has_log;
+  b.ensure_log = &reftable_backend::ensure_log;
+  b.free = &reftable_backend::free;
+  b.reflog_read = &reftable_backend::reflog_read;
+  b.reflog_write = &reftable_backend::reflog_write;
+  b.reflog_rename = &reftable_backend::reflog_rename;
+  b.reflog_delete = &reftable_backend::reflog_delete;
+  b.lock = &reftable_backend::lock;
+  b.unlock = &reftable_backend::unlock;
+
+  git_refdb *refdb = nullptr;
+  git_exception::throw_nonzero(git_repository_refdb(&refdb, c_repo));
+  int ret = git_refdb_set_backend(refdb, &b);
+  git_refdb_free(refdb);
+  git_exception::throw_nonzero(ret);
+  backend.release(); // owned by the refdb
+}
+
+#else
+
+void reftable::enable_extension() {}
+
+bool reftable::is_enabled(const repository &) { return false; }
+
+void reftable::migrate(const repository &, const options &) {
+  throw git_exception("the reftable backend is not supported on this platform",
+                      git_exception::error_class::os);
+}
+
+void reftable::attach(const repository &, const options &) {
+  throw git_exception("the reftable backend is not supported on this platform",
+                      git_exception::error_class::os);
+}
+
+#endif
+
+} // namespace cppgit2
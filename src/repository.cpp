@@ -1,8 +1,29 @@
+#include <cppgit2/mapped_file.hpp>
+#include <cppgit2/pack_writer.hpp>
+#include <cppgit2/reftable.hpp>
 #include <cppgit2/repository.hpp>
+#include <cppgit2/thread_pool.hpp>
+#include <algorithm>
 #include <functional>
+#include <mutex>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace cppgit2 {
 
+namespace {
+
+// A repository switched to reftable is opened with its reference backend
+void attach_reftable(const repository &repo) {
+  if (reftable::is_enabled(repo))
+    reftable::attach(repo);
+}
+
+} // namespace
+
 repository::repository(git_repository *c_ptr) : c_ptr_(c_ptr) {}
 
 repository::~repository() {
@@ -39,33 +60,41 @@ repository repository::init_ext(const std::string &repo_path,
 }
 
 repository repository::open(const std::string &path) {
+  reftable::enable_extension();
   repository result(nullptr);
   git_exception::throw_nonzero(
       git_repository_open(&result.c_ptr_, path.c_str()));
+  attach_reftable(result);
   return result;
 }
 
 repository repository::open_bare(const std::string &path) {
+  reftable::enable_extension();
   repository result(nullptr);
   git_exception::throw_nonzero(
       git_repository_open_bare(&result.c_ptr_, path.c_str()));
+  attach_reftable(result);
   return result;
 }
 
 repository repository::open_ext(const std::string &path, open_flag flags,
                                 const std::string &ceiling_dirs) {
+  reftable::enable_extension();
   repository result(nullptr);
   git_exception::throw_nonzero(
       git_repository_open_ext(&result.c_ptr_, path.c_str(),
                               static_cast<unsigned int>(flags),
                               ceiling_dirs.c_str()));
+  attach_reftable(result);
   return result;
 }
 
 repository repository::open_from_worktree(const worktree &wt) {
+  reftable::enable_extension();
   repository result(nullptr);
   git_exception::throw_nonzero(
       git_repository_open_from_worktree(&result.c_ptr_, wt.c_ptr_));
+  attach_reftable(result);
   return result;
 }
 
@@ -372,6 +401,23 @@ repository repository::wrap_odb(const cppgit2::odb &odb) {
   return result;
 }
 
+repository repository::reopen() const {
+  repository result(nullptr);
+  git_exception::throw_nonzero(
+      git_repository_open_ext(&result.c_ptr_, git_repository_path(c_ptr_),
+                              GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr));
+  auto workdir = git_repository_workdir(c_ptr_);
+  if (workdir)
+    git_exception::throw_nonzero(
+        git_repository_set_workdir(result.c_ptr_, workdir, 0));
+  auto nmspace = git_repository_get_namespace(c_ptr_);
+  if (nmspace)
+    git_exception::throw_nonzero(
+        git_repository_set_namespace(result.c_ptr_, nmspace));
+  attach_reftable(result);
+  return result;
+}
+
 const git_repository *repository::c_ptr() const { return c_ptr_; }
 
 annotated_commit
@@ -530,6 +576,85 @@ oid repository::create_blob_from_workdir(const std::string &relative_path) const
   return result;
 }
 
+std::vector<oid>
+repository::create_blobs_from_paths(const std::vector<std::string> &paths,
+                                    blob_storage storage,
+                                    size_t num_threads) const {
+  std::vector<oid> result(paths.size());
+  if (paths.empty())
+    return result;
+  thread_pool pool(std::min(thread_pool::resolve_size(num_threads),
+                            paths.size()));
+  std::vector<repository> handles;
+  handles.reserve(pool.size());
+  for (size_t i = 0; i < pool.size(); ++i)
+    handles.push_back(reopen());
+
+  std::unique_ptr<pack_writer> writer;
+  if (storage == blob_storage::pack)
+    writer.reset(new pack_writer(*this));
+  std::mutex writer_mutex;
+  std::vector<std::vector<unsigned char>> buffers(pool.size());
+
+  pool.parallel_for(paths.size(), [&](size_t i, size_t worker) {
+    auto &path = paths[i];
+    mapped_file file;
+    std::string link;
+    const void *data = nullptr;
+    size_t size = 0;
+#ifndef _WIN32
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
+      link.resize(static_cast<size_t>(st.st_size));
+      auto length = readlink(path.c_str(), &link[0], link.size());
+      if (length < 0)
+        throw git_exception("failed to read link " + path,
+                            git_exception::error_class::os);
+      link.resize(static_cast<size_t>(length));
+      data = link.data();
+      size = link.size();
+    } else
+#endif
+    {
+      file = mapped_file(path);
+      data = file.data();
+      size = file.size();
+    }
+
+    git_odb *odb = nullptr;
+    git_exception::throw_nonzero(git_repository_odb(
+        &odb, const_cast<git_repository *>(handles[worker].c_ptr())));
+    git_oid id;
+    int ret;
+    bool wanted = false;
+    if (!writer) {
+      ret = git_odb_write(&id, odb, data, size, GIT_OBJECT_BLOB);
+    } else {
+      ret = git_odb_hash(&id, data, size, GIT_OBJECT_BLOB);
+      wanted = !ret && !git_odb_exists(odb, &id);
+    }
+    git_odb_free(odb);
+    git_exception::throw_nonzero(ret);
+    result[i] = oid(&id);
+
+    if (wanted) {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      wanted = !writer->contains(id);
+    }
+    if (wanted) {
+      // Compress outside the lock; only the append is serialized
+      auto &buffer = buffers[worker];
+      pack_writer::compress(data, size, buffer);
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      writer->append(id, GIT_OBJECT_BLOB, size, buffer.data(), buffer.size());
+    }
+  });
+
+  if (writer)
+    writer->finish();
+  return result;
+}
+
 blob repository::lookup_blob(const oid &id) const {
   blob result;
   git_exception::throw_nonzero(
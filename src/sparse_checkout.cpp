@@ -0,0 +1,361 @@
+#include <cppgit2/sparse_checkout.hpp>
+#include <cppgit2/string_view.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+namespace {
+
+std::string sparse_checkout_file(const repository &repo) {
+  return repo.path() + "info/sparse-checkout";
+}
+
+// "a/b/" -> "a/b"; leading and repeated slashes are dropped
+std::string normalize_directory(const std::string &directory) {
+  std::string result;
+  for (size_t i = 0; i < directory.size(); ++i) {
+    if (directory[i] == '/' && (result.empty() || result.back() == '/'))
+      continue;
+    result += directory[i];
+  }
+  if (!result.empty() && result.back() == '/')
+    result.pop_back();
+  return result;
+}
+
+// Patterns escape glob characters with a backslash
+std::string unescape(const std::string &pattern) {
+  std::string result;
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    if (pattern[i] == '\\' && i + 1 < pattern.size())
+      ++i;
+    result += pattern[i];
+  }
+  return result;
+}
+
+std::string escape(const std::string &directory) {
+  std::string result;
+  for (char c : directory) {
+    if (c == '*' || c == '?' || c == '[' || c == '\\')
+      result += '\\';
+    result += c;
+  }
+  return result;
+}
+
+int skip_outside_cone(const git_diff *, const git_diff_delta *delta,
+                      const char *, void *payload) {
+  auto sparse = reinterpret_cast<const sparse_checkout *>(payload);
+  if ((delta->old_file.path && sparse->includes(delta->old_file.path)) ||
+      (delta->new_file.path && sparse->includes(delta->new_file.path)))
+    return 0;
+  return 1; // skip
+}
+
+} // namespace
+
+const sparse_checkout::node *sparse_checkout::node::find(const char *name,
+                                                         size_t size) const {
+  string_view key(name, size);
+  auto it = std::lower_bound(
+      children.begin(), children.end(), key,
+      [](const std::pair<std::string, std::unique_ptr<node>> &child,
+         const string_view &key) { return string_view(child.first) < key; });
+  if (it == children.end() || string_view(it->first) != key)
+    return nullptr;
+  return it->second.get();
+}
+
+sparse_checkout::sparse_checkout(const repository &repo)
+    : repo_(repo), enabled_(false) {
+  git_config *config = nullptr;
+  if (!git_repository_config_snapshot(
+          &config, const_cast<git_repository *>(repo_.c_ptr()))) {
+    int value;
+    if (!git_config_get_bool(&value, config, "core.sparseCheckout"))
+      enabled_ = value != 0;
+    git_config_free(config);
+  }
+
+  std::ifstream file(sparse_checkout_file(repo_), std::ios::binary);
+  if (enabled_ && file) {
+    std::stringstream text;
+    text << file.rdbuf();
+    parse(text.str());
+  } else {
+    enabled_ = false;
+    root_.recursive = true;
+  }
+}
+
+sparse_checkout::node *sparse_checkout::insert(const std::string &directory) {
+  node *current = &root_;
+  size_t start = 0;
+  while (start < directory.size()) {
+    auto slash = directory.find('/', start);
+    if (slash == std::string::npos)
+      slash = directory.size();
+    auto name = directory.substr(start, slash - start);
+    auto &children = current->children;
+    auto it = std::lower_bound(
+        children.begin(), children.end(), name,
+        [](const std::pair<std::string, std::unique_ptr<node>> &child,
+           const std::string &name) { return child.first < name; });
+    if (it == children.end() || it->first != name)
+      it = children.emplace(it, name, std::unique_ptr<node>(new node()));
+    current = it->second.get();
+    start = slash + 1;
+  }
+  return current;
+}
+
+void sparse_checkout::parse(const std::string &text) {
+  root_ = node();
+  bool root_files = false, root_only = false;
+  std::istringstream lines(text);
+  std::string line;
+  while (std::getline(lines, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    bool negative = line[0] == '!';
+    auto pattern = negative ? line.substr(1) : line;
+    if (pattern == "/*" && !negative) {
+      root_files = true;
+    } else if (pattern == "/*/" && negative) {
+      root_only = true;
+    } else if (pattern.size() > 2 && pattern[0] == '/' &&
+               pattern.back() == '/' && !negative) {
+      insert(normalize_directory(unescape(pattern)))->recursive = true;
+    } else if (pattern.size() > 4 && pattern[0] == '/' && negative &&
+               pattern.compare(pattern.size() - 3, 3, "/*/") == 0) {
+      // Only the files directly in this directory
+      insert(normalize_directory(
+                 unescape(pattern.substr(0, pattern.size() - 2))))
+          ->recursive = false;
+    } else {
+      throw git_exception("sparse-checkout pattern is not in cone mode: " +
+                              line,
+                          git_exception::error_class::invalid,
+                          git_exception::error_code::invalid);
+    }
+  }
+  // "/*" alone includes everything
+  root_.recursive = root_files && !root_only;
+}
+
+void sparse_checkout::set_directories(
+    const std::vector<std::string> &directories) {
+  root_ = node();
+  for (auto &directory : directories)
+    add_directory(directory);
+}
+
+void sparse_checkout::add_directory(const std::string &directory) {
+  auto normalized = normalize_directory(directory);
+  if (normalized.empty())
+    root_.recursive = true;
+  else
+    insert(normalized)->recursive = true;
+}
+
+void sparse_checkout::collect(const node &current, const std::string &prefix,
+                              std::vector<std::string> *directories,
+                              std::string *patterns) {
+  for (auto &child : current.children) {
+    auto path = prefix + child.first;
+    if (patterns) {
+      *patterns += "/" + escape(path) + "/\n";
+      if (!child.second->recursive)
+        *patterns += "!/" + escape(path) + "/*/\n";
+    }
+    if (child.second->recursive) {
+      if (directories)
+        directories->push_back(path);
+      continue; // everything below is included anyway
+    }
+    collect(*child.second, path + "/", directories, patterns);
+  }
+}
+
+std::vector<std::string> sparse_checkout::directories() const {
+  std::vector<std::string> result;
+  if (root_.recursive)
+    result.push_back("");
+  else
+    collect(root_, "", &result, nullptr);
+  return result;
+}
+
+void sparse_checkout::write() {
+  std::string patterns = "/*\n";
+  if (!root_.recursive) {
+    patterns += "!/*/\n";
+    collect(root_, "", nullptr, &patterns);
+  }
+
+#ifndef _WIN32
+  auto info = repo_.path() + "info";
+  if (mkdir(info.c_str(), 0777) < 0 && errno != EEXIST)
+    throw git_exception("failed to create " + info + ": " + strerror(errno),
+                        git_exception::error_class::os);
+#endif
+  auto path = sparse_checkout_file(repo_);
+  auto lock = path + ".lock";
+  {
+    std::ofstream out(lock, std::ios::binary | std::ios::trunc);
+    out << patterns;
+    if (!out.flush())
+      throw git_exception("failed to write " + lock,
+                          git_exception::error_class::os);
+  }
+  if (std::rename(lock.c_str(), path.c_str()) != 0)
+    throw git_exception("failed to rename " + lock,
+                        git_exception::error_class::os);
+
+  git_config *config = nullptr;
+  int ret = git_repository_config(
+      &config, const_cast<git_repository *>(repo_.c_ptr()));
+  if (!ret)
+    ret = git_config_set_bool(config, "core.sparseCheckout", 1);
+  if (!ret)
+    ret = git_config_set_bool(config, "core.sparseCheckoutCone", 1);
+  git_config_free(config);
+  git_exception::throw_nonzero(ret);
+  enabled_ = true;
+}
+
+bool sparse_checkout::includes(const std::string &path) const {
+  const node *current = &root_;
+  size_t start = 0;
+  for (;;) {
+    if (current->recursive)
+      return true;
+    auto slash = path.find('/', start);
+    if (slash == std::string::npos)
+      return true; // directly in the root or a parent directory
+    current = current->find(path.data() + start, slash - start);
+    if (!current)
+      return false;
+    start = slash + 1;
+  }
+}
+
+bool sparse_checkout::includes_directory(const std::string &directory) const {
+  size_t size = directory.size();
+  if (size && directory[size - 1] == '/')
+    --size;
+  const node *current = &root_;
+  size_t start = 0;
+  while (start < size) {
+    if (current->recursive)
+      return true;
+    auto slash = std::min(directory.find('/', start), size);
+    current = current->find(directory.data() + start, slash - start);
+    if (!current)
+      return false;
+    start = slash + 1;
+  }
+  return true;
+}
+
+size_t sparse_checkout::apply(cppgit2::index &index,
+                              bool update_workdir) const {
+  auto raw_index = index.c_ptr_;
+  auto workdir = repo_.workdir();
+  std::vector<std::string> included, excluded;
+  size_t changed = 0;
+
+  int ret = 0;
+  size_t count = git_index_entrycount(raw_index);
+  for (size_t i = 0; !ret && i < count; ++i) {
+    auto entry = git_index_get_byindex(raw_index, i);
+    bool skip = !includes(entry->path);
+    bool skipped = (entry->flags_extended & GIT_INDEX_ENTRY_SKIP_WORKTREE) != 0;
+    if (skip == skipped)
+      continue;
+    changed++;
+    (skip ? excluded : included).push_back(entry->path);
+
+    // Replacing an entry keeps its position
+    git_index_entry updated = *entry;
+    if (skip)
+      updated.flags_extended |= GIT_INDEX_ENTRY_SKIP_WORKTREE;
+    else
+      updated.flags_extended &= ~GIT_INDEX_ENTRY_SKIP_WORKTREE;
+    ret = git_index_add(raw_index, &updated);
+  }
+  git_exception::throw_nonzero(ret);
+
+  if (update_workdir && !workdir.empty()) {
+#ifndef _WIN32
+    std::vector<std::string> parents;
+    for (auto &path : excluded) {
+      auto entry = git_index_get_bypath(raw_index, path.c_str(), 0);
+      auto absolute = workdir + path;
+      struct stat st;
+      if (!entry || lstat(absolute.c_str(), &st) < 0)
+        continue;
+      // Files with local changes stay, as with git
+      if (static_cast<uint32_t>(st.st_size) != entry->file_size ||
+          static_cast<int32_t>(st.st_mtime) != entry->mtime.seconds ||
+          S_ISDIR(st.st_mode))
+        continue;
+      if (unlink(absolute.c_str()) == 0) {
+        auto slash = path.rfind('/');
+        if (slash != std::string::npos)
+          parents.push_back(path.substr(0, slash));
+      }
+    }
+    // Directories left empty, deepest first
+    std::sort(parents.begin(), parents.end());
+    parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+    for (auto it = parents.rbegin(); it != parents.rend(); ++it)
+      for (auto dir = *it;;) {
+        if (rmdir((workdir + dir).c_str()) < 0)
+          break;
+        auto slash = dir.rfind('/');
+        if (slash == std::string::npos)
+          break;
+        dir.resize(slash);
+      }
+#endif
+
+    if (!included.empty()) {
+      std::vector<char *> strings;
+      for (auto &path : included)
+        strings.push_back(const_cast<char *>(path.c_str()));
+      git_checkout_options options = GIT_CHECKOUT_OPTIONS_INIT;
+      options.checkout_strategy = GIT_CHECKOUT_SAFE |
+                                  GIT_CHECKOUT_RECREATE_MISSING |
+                                  GIT_CHECKOUT_DISABLE_PATHSPEC_MATCH;
+      options.paths = git_strarray{&strings[0], strings.size()};
+      git_exception::throw_nonzero(git_checkout_index(
+          const_cast<git_repository *>(repo_.c_ptr()), raw_index, &options));
+    }
+  }
+
+  if (changed && git_index_path(raw_index))
+    git_exception::throw_nonzero(git_index_write(raw_index));
+  return changed;
+}
+
+void sparse_checkout::restrict(diff::options &options) const {
+  options.c_ptr_->notify_cb = skip_outside_cone;
+  options.c_ptr_->payload = const_cast<sparse_checkout *>(this);
+}
+
+} // namespace cppgit2
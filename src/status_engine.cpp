@@ -0,0 +1,957 @@
+#include <cppgit2/ignore_matcher.hpp>
+#include <cppgit2/index_view.hpp>
+#include <cppgit2/status_engine.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <set>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+namespace {
+
+const char *untracked_cache_magic = "cppgit2-untracked-cache";
+const int untracked_cache_version = 1;
+
+// Entries handed to a worker at a time; chunks end on a directory boundary
+const size_t chunk_size = 512;
+
+typedef std::vector<std::pair<std::string, unsigned int>> status_results;
+
+// Stat data in the form the index stores it
+struct file_info {
+  uint32_t mode; // git mode: 0100644, 0100755, 0120000, 040000 or 0
+  int64_t mtime_seconds;
+  uint32_t mtime_nanoseconds;
+  int64_t ctime_seconds;
+  uint32_t ctime_nanoseconds;
+  uint64_t ino;
+  uint32_t uid;
+  uint32_t gid;
+  uint64_t size;
+};
+
+uint32_t git_mode_of(unsigned int st_mode) {
+#ifndef _WIN32
+  if (S_ISLNK(st_mode))
+    return 0120000;
+#endif
+  if ((st_mode & S_IFMT) == S_IFDIR)
+    return 040000;
+  if ((st_mode & S_IFMT) == S_IFREG)
+    return (st_mode & 0100) ? 0100755 : 0100644;
+  return 0;
+}
+
+// Open directory, used as the base of relative stat calls
+struct directory_handle {
+  directory_handle() : fd(-1), open(false) {}
+  ~directory_handle() { close(); }
+
+  bool reopen(const std::string &absolute_path) {
+    close();
+    path = absolute_path;
+#ifndef _WIN32
+    fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    open = fd >= 0;
+#else
+    struct _stat64 st;
+    open = _stat64(path.c_str(), &st) == 0 && (st.st_mode & _S_IFDIR);
+#endif
+    return open;
+  }
+
+  void close() {
+#ifndef _WIN32
+    if (fd >= 0)
+      ::close(fd);
+#endif
+    fd = -1;
+    open = false;
+  }
+
+  // 0 on success, 1 if `name` does not exist, -1 on other errors
+  // `name` must be NUL-terminated
+  int stat(const char *name, file_info &info) const {
+#ifndef _WIN32
+    struct stat st;
+    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+      return (errno == ENOENT || errno == ENOTDIR) ? 1 : -1;
+    info.mode = git_mode_of(st.st_mode);
+#if defined(__APPLE__)
+    info.mtime_seconds = st.st_mtimespec.tv_sec;
+    info.mtime_nanoseconds = static_cast<uint32_t>(st.st_mtimespec.tv_nsec);
+    info.ctime_seconds = st.st_ctimespec.tv_sec;
+    info.ctime_nanoseconds = static_cast<uint32_t>(st.st_ctimespec.tv_nsec);
+#else
+    info.mtime_seconds = st.st_mtim.tv_sec;
+    info.mtime_nanoseconds = static_cast<uint32_t>(st.st_mtim.tv_nsec);
+    info.ctime_seconds = st.st_ctim.tv_sec;
+    info.ctime_nanoseconds = static_cast<uint32_t>(st.st_ctim.tv_nsec);
+#endif
+    info.ino = st.st_ino;
+    info.uid = st.st_uid;
+    info.gid = st.st_gid;
+    info.size = static_cast<uint64_t>(st.st_size);
+#else
+    struct _stat64 st;
+    if (_stat64((path + name).c_str(), &st) < 0)
+      return errno == ENOENT ? 1 : -1;
+    info.mode = git_mode_of(st.st_mode);
+    info.mtime_seconds = st.st_mtime;
+    info.mtime_nanoseconds = 0;
+    info.ctime_seconds = st.st_ctime;
+    info.ctime_nanoseconds = 0;
+    info.ino = 0;
+    info.uid = 0;
+    info.gid = 0;
+    info.size = static_cast<uint64_t>(st.st_size);
+#endif
+    return 0;
+  }
+
+  bool read_link(const char *name, std::string &target) const {
+#ifndef _WIN32
+    std::vector<char> buffer(256);
+    for (;;) {
+      auto length = readlinkat(fd, name, &buffer[0], buffer.size());
+      if (length < 0)
+        return false;
+      if (static_cast<size_t>(length) < buffer.size()) {
+        target.assign(&buffer[0], static_cast<size_t>(length));
+        return true;
+      }
+      buffer.resize(buffer.size() * 2);
+    }
+#else
+    (void)name;
+    (void)target;
+    return false;
+#endif
+  }
+
+  std::string path; // absolute, with a trailing slash
+  int fd;
+  bool open;
+};
+
+// Names in a directory, with whether each is a directory
+// Returns false if the directory cannot be read
+bool list_directory(const std::string &absolute_path,
+                    std::vector<std::pair<std::string, bool>> &children) {
+  children.clear();
+#ifndef _WIN32
+  auto dir = opendir(absolute_path.c_str());
+  if (!dir)
+    return false;
+  while (auto entry = readdir(dir)) {
+    const char *name = entry->d_name;
+    if (!strcmp(name, ".") || !strcmp(name, ".."))
+      continue;
+    bool is_directory;
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat st;
+      if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+        continue;
+      is_directory = S_ISDIR(st.st_mode);
+    } else {
+      is_directory = entry->d_type == DT_DIR;
+    }
+    children.emplace_back(name, is_directory);
+  }
+  closedir(dir);
+#else
+  struct _finddata64i32_t data;
+  auto handle = _findfirst64i32((absolute_path + "*").c_str(), &data);
+  if (handle == -1)
+    return false;
+  do {
+    if (!strcmp(data.name, ".") || !strcmp(data.name, ".."))
+      continue;
+    children.emplace_back(data.name, (data.attrib & _A_SUBDIR) != 0);
+  } while (_findnext64i32(handle, &data) == 0);
+  _findclose(handle);
+#endif
+  std::sort(children.begin(), children.end());
+  return true;
+}
+
+// Stat an absolute path without following a final symlink
+int stat_path(const std::string &absolute_path, file_info &info) {
+  directory_handle root;
+#ifndef _WIN32
+  root.fd = AT_FDCWD;
+#endif
+  return root.stat(absolute_path.c_str(), info);
+}
+
+std::string join(const std::string &dir, string_view name) {
+  if (dir.empty())
+    return name.to_string();
+  std::string result;
+  result.reserve(dir.size() + 1 + name.size());
+  result += dir;
+  result += '/';
+  result.append(name.data(), name.size());
+  return result;
+}
+
+bool is_racy(const index_view::entry &e, const file_info &index_file) {
+  auto mtime = e.mtime();
+  return mtime.seconds > index_file.mtime_seconds ||
+         (mtime.seconds == index_file.mtime_seconds &&
+          mtime.nanoseconds >= index_file.mtime_nanoseconds);
+}
+
+} // namespace
+
+// State shared by the workers of one run
+struct status_engine::run_state {
+  run_state(const repository &repo, size_t workers)
+      : index(repo), index_file(), results(workers), caches(workers),
+        stat_calls(0), hashed(0), directories_read(0),
+        directories_cached(0) {}
+
+  index_view index;
+  file_info index_file;
+  std::string workdir;
+  std::vector<status_results> results;     // per worker
+  std::vector<untracked_cache> caches;     // per worker, listings seen
+  std::atomic<size_t> stat_calls;
+  std::atomic<size_t> hashed;
+  std::atomic<size_t> directories_read;
+  std::atomic<size_t> directories_cached;
+};
+
+status_engine::status_engine(const repository &repo,
+                             const status::options &options,
+                             size_t num_threads,
+                             const std::string &ignore_rules)
+    : repo_(repo), options_(*options.c_ptr()), ignore_rules_(ignore_rules),
+      compiled_pathspec_(nullptr),
+      trust_filemode_(true), trust_ctime_(true), pool_(num_threads),
+      untracked_cache_written_(0), stats_{0, 0, 0, 0} {
+  if (git_repository_is_bare(const_cast<git_repository *>(repo_.c_ptr())))
+    throw git_exception("status_engine requires a working directory",
+                        git_exception::error_class::repository,
+                        git_exception::error_code::barerepo);
+
+  // The options' pathspec points at the caller's strings; keep a copy
+  for (size_t i = 0; i < options_.pathspec.count; ++i)
+    pathspec_.push_back(options_.pathspec.strings[i]);
+  options_.pathspec.strings = nullptr;
+  options_.pathspec.count = 0;
+  if (!pathspec_.empty()) {
+    std::vector<char *> strings;
+    for (auto &p : pathspec_)
+      strings.push_back(const_cast<char *>(p.c_str()));
+    git_strarray array{&strings[0], strings.size()};
+    git_exception::throw_nonzero(git_pathspec_new(&compiled_pathspec_, &array));
+  }
+
+  git_config *config = nullptr;
+  if (!git_repository_config_snapshot(
+          &config, const_cast<git_repository *>(repo_.c_ptr()))) {
+    int value;
+    if (!git_config_get_bool(&value, config, "core.filemode"))
+      trust_filemode_ = value != 0;
+    if (!git_config_get_bool(&value, config, "core.trustctime"))
+      trust_ctime_ = value != 0;
+    git_config_free(config);
+  }
+
+  handles_.reserve(pool_.size());
+  for (size_t i = 0; i < pool_.size(); ++i)
+    handles_.push_back(repo_.reopen());
+}
+
+status_engine::~status_engine() { git_pathspec_free(compiled_pathspec_); }
+
+void status_engine::set_untracked_cache(const std::string &path) {
+  untracked_cache_path_ = path;
+  untracked_cache_.clear();
+  untracked_cache_written_ = 0;
+  load_untracked_cache();
+}
+
+void status_engine::for_each_status(
+    std::function<void(const std::string &, status::status_type)> visitor) {
+  run(nullptr, visitor);
+}
+
+void status_engine::for_each_status(
+    const std::vector<std::string> &changed_paths,
+    std::function<void(const std::string &, status::status_type)> visitor) {
+  run(&changed_paths, visitor);
+}
+
+void status_engine::run(
+    const std::vector<std::string> *changed_paths,
+    std::function<void(const std::string &, status::status_type)> visitor) {
+  auto repo = const_cast<git_repository *>(repo_.c_ptr());
+  run_state state(repo_, pool_.size());
+  auto &index = state.index;
+  state.workdir = repo_.workdir();
+  // Without an index file the index is empty, and nothing can be racy
+  if (stat_path(repo_.path() + "index", state.index_file) < 0)
+    throw git_exception("failed to stat the index",
+                        git_exception::error_class::os);
+
+  auto show = options_.show;
+  auto flags = options_.flags;
+  bool scan_untracked =
+      show != GIT_STATUS_SHOW_INDEX_ONLY &&
+      (flags & (GIT_STATUS_OPT_INCLUDE_UNTRACKED | GIT_STATUS_OPT_INCLUDE_IGNORED));
+  auto pathspec_flags = (flags & GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH)
+                            ? GIT_PATHSPEC_NO_GLOB
+                            : GIT_PATHSPEC_DEFAULT;
+  auto matches = [&](const char *path) {
+    return !compiled_pathspec_ ||
+           git_pathspec_matches_path(compiled_pathspec_, pathspec_flags, path) ==
+               1;
+  };
+
+  // Entries to examine: all of them, or those named by the change list
+  std::vector<size_t> positions;
+  std::vector<std::string> changed;
+  if (changed_paths) {
+    for (auto path : *changed_paths) {
+      while (!path.empty() && path.back() == '/')
+        path.pop_back();
+      changed.push_back(path);
+    }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    for (auto &path : changed) {
+      auto range = index.directory_range(path);
+      for (auto i = index.lower_bound(path);
+           i < index.size() && index.entry_at(i).path() == string_view(path);
+           ++i)
+        positions.push_back(i);
+      for (auto i = range.first; i < range.second; ++i)
+        positions.push_back(i);
+    }
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()),
+                    positions.end());
+  } else if (show != GIT_STATUS_SHOW_INDEX_ONLY) {
+    positions.resize(index.size());
+    for (size_t i = 0; i < positions.size(); ++i)
+      positions[i] = i;
+  }
+
+  // Workdir against index: chunks of entries, each ending on a directory
+  // boundary so that a worker opens every directory once
+  if (show != GIT_STATUS_SHOW_INDEX_ONLY) {
+    std::vector<std::pair<size_t, size_t>> chunks;
+    for (size_t begin = 0; begin < positions.size();) {
+      auto end = std::min(begin + chunk_size, positions.size());
+      if (end < positions.size()) {
+        auto last = index.entry_at(positions[end - 1]).path();
+        auto last_dir = last.substr(0, last.rfind('/') + 1);
+        while (end < positions.size()) {
+          auto path = index.entry_at(positions[end]).path();
+          if (path.substr(0, path.rfind('/') + 1) != last_dir)
+            break;
+          ++end;
+        }
+      }
+      chunks.emplace_back(begin, end);
+      begin = end;
+    }
+
+    pool_.parallel_for(chunks.size(), [&](size_t c, size_t worker) {
+      auto handle_repo = const_cast<git_repository *>(handles_[worker].c_ptr());
+      auto &results = state.results[worker];
+      directory_handle dir;
+      std::string dir_name;
+      bool have_dir = false;
+      string_view last_conflict;
+
+      for (auto p = chunks[c].first; p < chunks[c].second; ++p) {
+        auto e = index.entry_at(positions[p]);
+        auto path = e.path();
+        if (e.is_conflict()) {
+          if (path != last_conflict && matches(path.data()))
+            results.emplace_back(path.to_string(), GIT_STATUS_CONFLICTED);
+          last_conflict = path;
+          continue;
+        }
+        // Submodules and sparse-index directories are not inspected
+        auto mode_type = e.mode() & 0170000;
+        if (e.skip_worktree() || mode_type == 0160000 || mode_type == 040000)
+          continue;
+        // Index paths are NUL-terminated in memory
+        if (!matches(path.data()))
+          continue;
+
+        auto slash = path.rfind('/');
+        auto parent = slash == string_view::npos ? string_view()
+                                                 : path.substr(0, slash);
+        if (!have_dir || parent != string_view(dir_name)) {
+          dir_name = parent.to_string();
+          dir.reopen(state.workdir + dir_name + (dir_name.empty() ? "" : "/"));
+          have_dir = true;
+        }
+        auto name = slash == string_view::npos ? path.data()
+                                               : path.data() + slash + 1;
+
+        file_info info;
+        int found = dir.open ? dir.stat(name, info) : 1;
+        state.stat_calls++;
+        if (found < 0) {
+          results.emplace_back(path.to_string(), GIT_STATUS_WT_UNREADABLE);
+          continue;
+        }
+        if (found == 1 || info.mode == 040000) {
+          results.emplace_back(path.to_string(), GIT_STATUS_WT_DELETED);
+          continue;
+        }
+        if (e.intent_to_add()) {
+          results.emplace_back(path.to_string(), GIT_STATUS_WT_NEW);
+          continue;
+        }
+
+        bool index_link = mode_type == 0120000;
+        bool disk_link = info.mode == 0120000;
+        if (index_link != disk_link || info.mode == 0) {
+          results.emplace_back(path.to_string(), GIT_STATUS_WT_TYPECHANGE);
+          continue;
+        }
+
+        // Indexes written without nanoseconds store 0
+        auto mtime = e.mtime();
+        auto ctime = e.ctime();
+        bool same_stat =
+            mtime.seconds == static_cast<int32_t>(info.mtime_seconds) &&
+            (!mtime.nanoseconds ||
+             mtime.nanoseconds == info.mtime_nanoseconds) &&
+            (!trust_ctime_ ||
+             (ctime.seconds == static_cast<int32_t>(info.ctime_seconds) &&
+              (!ctime.nanoseconds ||
+               ctime.nanoseconds == info.ctime_nanoseconds))) &&
+            e.ino() == static_cast<uint32_t>(info.ino) &&
+            e.uid() == info.uid && e.gid() == info.gid &&
+            e.file_size() == static_cast<uint32_t>(info.size);
+        bool mode_changed = trust_filemode_ && !disk_link && e.mode() != info.mode;
+        if (mode_changed) {
+          results.emplace_back(path.to_string(), GIT_STATUS_WT_MODIFIED);
+          continue;
+        }
+        if (same_stat && !is_racy(e, state.index_file))
+          continue;
+        if (e.file_size() != static_cast<uint32_t>(info.size) &&
+            e.file_size() != 0) {
+          results.emplace_back(path.to_string(), GIT_STATUS_WT_MODIFIED);
+          continue;
+        }
+
+        // Stat data changed or cannot be trusted: compare content
+        git_oid id;
+        int ret;
+        if (disk_link) {
+          std::string target;
+          ret = dir.read_link(name, target)
+                    ? git_odb_hash(&id, target.data(), target.size(),
+                                   GIT_OBJECT_BLOB)
+                    : -1;
+        } else {
+          ret = git_repository_hashfile(&id, handle_repo,
+                                        path.to_string().c_str(),
+                                        GIT_OBJECT_BLOB, nullptr);
+        }
+        state.hashed++;
+        if (ret)
+          results.emplace_back(path.to_string(), GIT_STATUS_WT_UNREADABLE);
+        else if (!git_oid_equal(&id, &e.raw_id()))
+          results.emplace_back(path.to_string(), GIT_STATUS_WT_MODIFIED);
+      }
+    });
+  }
+
+  // Untracked and ignored files: a parallel walk of the working directory.
+  // Tracked names of a directory come from the index (skipping over whole
+  // subdirectories with a binary search), listings from the untracked cache
+  // when the directory's mtime is unchanged.
+  if (scan_untracked) {
+    bool show_untracked = (flags & GIT_STATUS_OPT_INCLUDE_UNTRACKED) != 0;
+    bool show_ignored = (flags & GIT_STATUS_OPT_INCLUDE_IGNORED) != 0;
+    bool recurse = (flags & GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS) != 0;
+
+    // Compiled once per run; directories are ignored as a whole, so the
+    // walk never descends into one
+    ignore_matcher ignores(repo_, 0, ignore_rules_);
+    auto is_ignored = [&](size_t, const std::string &path) {
+      return ignores.is_ignored(path);
+    };
+
+    // Listing of `dir` ("" for the root, otherwise without trailing slash)
+    auto read_listing =
+        [&](size_t worker, const std::string &dir,
+            std::vector<std::pair<std::string, bool>> &children) {
+          auto absolute = state.workdir + dir + (dir.empty() ? "" : "/");
+          file_info info;
+          state.stat_calls++;
+          if (stat_path(absolute, info) || info.mode != 040000)
+            return false;
+          auto cached = untracked_cache_.find(dir);
+          if (cached != untracked_cache_.end() &&
+              cached->second.mtime_seconds == info.mtime_seconds &&
+              cached->second.mtime_nanoseconds == info.mtime_nanoseconds &&
+              info.mtime_seconds < untracked_cache_written_) {
+            children = cached->second.children;
+            state.directories_cached++;
+          } else {
+            if (!list_directory(absolute, children))
+              return false;
+            state.directories_read++;
+          }
+          if (!untracked_cache_path_.empty())
+            state.caches[worker][dir] = cached_directory{
+                info.mtime_seconds, info.mtime_nanoseconds, children};
+          return true;
+        };
+
+    // Whether an untracked directory holds anything that is not ignored
+    std::function<bool(size_t, const std::string &)> has_content =
+        [&](size_t worker, const std::string &dir) {
+          std::vector<std::pair<std::string, bool>> children;
+          if (!read_listing(worker, dir, children))
+            return false;
+          for (auto &child : children) {
+            auto path = join(dir, child.first);
+            if (child.second) {
+              if (child.first == ".git")
+                return true;
+              if (!is_ignored(worker, path + "/") && has_content(worker, path))
+                return true;
+            } else if (!is_ignored(worker, path)) {
+              return true;
+            }
+          }
+          return false;
+        };
+
+    std::function<void(size_t, std::string, bool)> walk;
+    auto report = [&](size_t worker, const std::string &path,
+                      unsigned int status) {
+      state.results[worker].emplace_back(path, status);
+    };
+
+    // A directory that is not in the index is reported as "dir/" (or walked
+    // with recurse_untracked_dirs) unless it is ignored or has no content
+    auto untracked_directory = [&](size_t worker, const std::string &path) {
+      if (is_ignored(worker, path + "/")) {
+        if (show_ignored)
+          report(worker, path + "/", GIT_STATUS_IGNORED);
+        return;
+      }
+      if (!show_untracked)
+        return;
+      file_info git_dir;
+      bool nested_repo = !stat_path(state.workdir + path + "/.git", git_dir);
+      if (recurse && !nested_repo)
+        pool_.submit([&walk, path](size_t w) { walk(w, path, true); });
+      else if (nested_repo || has_content(worker, path))
+        report(worker, path + "/", GIT_STATUS_WT_NEW);
+    };
+
+    auto untracked_file = [&](size_t worker, const std::string &path) {
+      if (is_ignored(worker, path)) {
+        if (show_ignored)
+          report(worker, path, GIT_STATUS_IGNORED);
+      } else if (show_untracked) {
+        report(worker, path, GIT_STATUS_WT_NEW);
+      }
+    };
+
+    // Walk `dir`; `untracked` is set below a directory the index knows
+    // nothing about (only with recurse_untracked_dirs)
+    walk = [&](size_t worker, std::string dir, bool untracked) {
+      std::vector<std::pair<std::string, bool>> children;
+      if (!read_listing(worker, dir, children))
+        return;
+
+      std::unordered_set<string_view, string_view_hash> tracked_files;
+      std::unordered_set<string_view, string_view_hash> tracked_dirs;
+      std::unordered_set<string_view, string_view_hash> submodules;
+      if (!untracked) {
+        auto range = index.directory_range(dir);
+        auto skip = dir.empty() ? 0 : dir.size() + 1;
+        for (auto i = range.first; i < range.second;) {
+          auto e = index.entry_at(i);
+          auto rest = e.path().substr(skip);
+          auto slash = rest.find('/');
+          if (slash == string_view::npos) {
+            tracked_files.insert(rest);
+            if ((e.mode() & 0170000) == 0160000)
+              submodules.insert(rest);
+            ++i;
+          } else {
+            auto name = rest.substr(0, slash);
+            tracked_dirs.insert(name);
+            i = index.directory_range(join(dir, name)).second;
+          }
+        }
+      }
+
+      for (auto &child : children) {
+        if (dir.empty() && child.first == ".git")
+          continue;
+        auto path = join(dir, child.first);
+        if (child.second) {
+          if (child.first == ".git" || submodules.count(child.first))
+            continue;
+          if (tracked_dirs.count(child.first))
+            pool_.submit([&walk, path](size_t w) { walk(w, path, false); });
+          else
+            untracked_directory(worker, path);
+        } else if (!tracked_files.count(child.first)) {
+          untracked_file(worker, path);
+        }
+      }
+    };
+
+    if (!changed_paths) {
+      pool_.submit([&walk](size_t w) { walk(w, "", false); });
+    } else {
+      // Only the listed paths. A path below directories the index does not
+      // know is classified through its topmost untracked ancestor, which is
+      // what a full walk would report.
+      // First entry for `path` at any stage, or npos
+      auto find_any = [&](const std::string &path) {
+        auto i = index.lower_bound(path);
+        return i < index.size() && index.entry_at(i).path() == string_view(path)
+                   ? i
+                   : index_view::npos;
+      };
+      std::vector<std::string> candidates;
+      for (auto &path : changed) {
+        if (path.empty() || find_any(path) != index_view::npos)
+          continue;
+        auto candidate = path;
+        bool in_submodule = false;
+        for (auto slash = path.find('/'); slash != std::string::npos;
+             slash = path.find('/', slash + 1)) {
+          auto range = index.directory_range(path.substr(0, slash));
+          if (range.first == range.second) {
+            candidate = path.substr(0, slash);
+            auto position = find_any(candidate);
+            in_submodule = position != index_view::npos &&
+                           (index.entry_at(position).mode() & 0170000) ==
+                               0160000;
+            break;
+          }
+        }
+        if (!in_submodule)
+          candidates.push_back(candidate);
+      }
+      std::sort(candidates.begin(), candidates.end());
+      candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                       candidates.end());
+
+      for (auto &candidate : candidates) {
+        pool_.submit([&, candidate](size_t worker) {
+          file_info info;
+          if (stat_path(state.workdir + candidate, info))
+            return;
+          if (info.mode != 040000)
+            untracked_file(worker, candidate);
+          else if (index.directory_range(candidate).first !=
+                   index.directory_range(candidate).second)
+            walk(worker, candidate, false);
+          else
+            untracked_directory(worker, candidate);
+        });
+      }
+    }
+    pool_.wait();
+  }
+
+  // HEAD against index, recursing only into directories whose cache-tree
+  // entry is missing or differs from HEAD
+  status_results head_results;
+  if (show != GIT_STATUS_SHOW_WORKDIR_ONLY) {
+    git_oid head_id;
+    git_commit *head = nullptr;
+    git_tree *head_tree = nullptr;
+    int ret = git_reference_name_to_id(&head_id, repo, "HEAD");
+    if (ret && ret != GIT_ENOTFOUND && ret != GIT_EUNBORNBRANCH)
+      git_exception::throw_nonzero(ret);
+    if (!ret) {
+      ret = git_commit_lookup(&head, repo, &head_id);
+      if (!ret)
+        ret = git_commit_tree(&head_tree, head);
+      git_commit_free(head);
+      git_exception::throw_nonzero(ret);
+    }
+
+    auto added = [&](size_t first, size_t last) {
+      for (auto i = first; i < last; ++i) {
+        auto e = index.entry_at(i);
+        if (!e.is_conflict() && !e.intent_to_add())
+          head_results.emplace_back(e.path().to_string(), GIT_STATUS_INDEX_NEW);
+      }
+    };
+
+    std::function<void(const git_tree *, const std::string &)> deleted =
+        [&](const git_tree *tree, const std::string &dir) {
+          for (size_t t = 0; t < git_tree_entrycount(tree); ++t) {
+            auto te = git_tree_entry_byindex(tree, t);
+            auto path = join(dir, git_tree_entry_name(te));
+            if (git_tree_entry_type(te) == GIT_OBJECT_TREE) {
+              git_tree *subtree = nullptr;
+              git_exception::throw_nonzero(
+                  git_tree_lookup(&subtree, repo, git_tree_entry_id(te)));
+              try {
+                deleted(subtree, path);
+              } catch (...) {
+                git_tree_free(subtree);
+                throw;
+              }
+              git_tree_free(subtree);
+            } else {
+              head_results.emplace_back(path, GIT_STATUS_INDEX_DELETED);
+            }
+          }
+        };
+
+    std::function<void(const git_tree *, const std::string &, size_t, size_t)>
+        compare = [&](const git_tree *tree, const std::string &dir,
+                      size_t first, size_t last) {
+          oid cached;
+          if (index.cached_tree(dir, cached) &&
+              git_oid_equal(cached.c_ptr(), git_tree_id(tree)))
+            return;
+
+          // Children of `dir` in the index: files and subdirectory ranges.
+          // Conflicted paths are only reported as conflicted
+          std::map<std::string, size_t> files;
+          std::map<std::string, std::pair<size_t, size_t>> dirs;
+          std::set<std::string> conflicts;
+          auto skip = dir.empty() ? 0 : dir.size() + 1;
+          for (auto i = first; i < last;) {
+            auto e = index.entry_at(i);
+            auto rest = e.path().substr(skip);
+            auto slash = rest.find('/');
+            if (slash == string_view::npos || slash + 1 == rest.size()) {
+              // File, or sparse-index directory ("name/")
+              if (e.is_conflict())
+                conflicts.insert(rest.to_string());
+              else if (!e.intent_to_add())
+                files[rest.substr(0, slash).to_string()] = i;
+              ++i;
+            } else {
+              auto name = rest.substr(0, slash);
+              auto range = index.directory_range(join(dir, name));
+              dirs[name.to_string()] = range;
+              i = range.second;
+            }
+          }
+
+          for (size_t t = 0; t < git_tree_entrycount(tree); ++t) {
+            auto te = git_tree_entry_byindex(tree, t);
+            std::string name = git_tree_entry_name(te);
+            auto path = join(dir, name);
+            auto file = files.find(name);
+            auto subdir = dirs.find(name);
+            bool is_tree = git_tree_entry_type(te) == GIT_OBJECT_TREE;
+            if (!is_tree && conflicts.count(name))
+              continue;
+
+            // Same kind on both sides (a sparse-index directory pairs
+            // with a tree): compare ids and modes
+            if (file != files.end() &&
+                ((index.entry_at(file->second).mode() & 0170000) == 040000) ==
+                    is_tree) {
+              auto e = index.entry_at(file->second);
+              auto head_mode = static_cast<uint32_t>(git_tree_entry_filemode(te));
+              if ((head_mode & 0170000) != (e.mode() & 0170000))
+                head_results.emplace_back(path, GIT_STATUS_INDEX_TYPECHANGE);
+              else if (!git_oid_equal(git_tree_entry_id(te), &e.raw_id()) ||
+                       head_mode != e.mode())
+                head_results.emplace_back(path + (is_tree ? "/" : ""),
+                                          GIT_STATUS_INDEX_MODIFIED);
+              files.erase(file);
+              continue;
+            }
+
+            if (is_tree && subdir != dirs.end()) {
+              git_tree *subtree = nullptr;
+              git_exception::throw_nonzero(
+                  git_tree_lookup(&subtree, repo, git_tree_entry_id(te)));
+              try {
+                compare(subtree, path, subdir->second.first,
+                        subdir->second.second);
+              } catch (...) {
+                git_tree_free(subtree);
+                throw;
+              }
+              git_tree_free(subtree);
+              dirs.erase(subdir);
+              continue;
+            }
+
+            if (is_tree) {
+              git_tree *subtree = nullptr;
+              git_exception::throw_nonzero(
+                  git_tree_lookup(&subtree, repo, git_tree_entry_id(te)));
+              try {
+                deleted(subtree, path);
+              } catch (...) {
+                git_tree_free(subtree);
+                throw;
+              }
+              git_tree_free(subtree);
+            } else {
+              head_results.emplace_back(path, GIT_STATUS_INDEX_DELETED);
+            }
+          }
+
+          for (auto &file : files)
+            added(file.second, file.second + 1);
+          for (auto &subdir : dirs)
+            added(subdir.second.first, subdir.second.second);
+        };
+
+    try {
+      if (head_tree)
+        compare(head_tree, "", 0, index.size());
+      else
+        added(0, index.size());
+    } catch (...) {
+      git_tree_free(head_tree);
+      throw;
+    }
+    git_tree_free(head_tree);
+  }
+
+  // Merge the flags of each path and report in path order
+  status_results all(std::move(head_results));
+  for (auto &results : state.results)
+    all.insert(all.end(), results.begin(), results.end());
+  std::sort(all.begin(), all.end());
+
+  stats_.stat_calls = state.stat_calls;
+  stats_.hashed = state.hashed;
+  stats_.directories_read = state.directories_read;
+  stats_.directories_cached = state.directories_cached;
+
+  if (!untracked_cache_path_.empty() && scan_untracked) {
+    // A full run replaces the cache; a change-list run only refreshes the
+    // directories it looked at
+    if (!changed_paths)
+      untracked_cache_.clear();
+    for (auto &cache : state.caches)
+      for (auto &dir : cache)
+        untracked_cache_[dir.first] = std::move(dir.second);
+    untracked_cache_written_ = static_cast<int64_t>(::time(nullptr));
+    save_untracked_cache();
+  }
+
+  for (size_t i = 0; i < all.size();) {
+    auto flags_for_path = all[i].second;
+    auto j = i + 1;
+    for (; j < all.size() && all[j].first == all[i].first; ++j)
+      flags_for_path |= all[j].second;
+    if (matches(all[i].first.c_str()))
+      visitor(all[i].first, static_cast<status::status_type>(flags_for_path));
+    i = j;
+  }
+}
+
+void status_engine::load_untracked_cache() {
+  std::ifstream in(untracked_cache_path_, std::ios::binary);
+  if (!in)
+    return; // Created by the next run
+
+  std::string magic;
+  int version;
+  size_t count;
+  if (!(in >> magic >> version >> untracked_cache_written_ >> count) ||
+      magic != untracked_cache_magic || version != untracked_cache_version) {
+    // Unknown or damaged caches are rebuilt
+    untracked_cache_written_ = 0;
+    return;
+  }
+
+  untracked_cache result;
+  for (size_t d = 0; d < count; ++d) {
+    size_t length, children;
+    cached_directory dir;
+    std::string name;
+    if (!(in >> length) || in.get() != ':')
+      return;
+    name.resize(length);
+    if (length)
+      in.read(&name[0], length);
+    if (!(in >> dir.mtime_seconds >> dir.mtime_nanoseconds >> children))
+      return;
+    for (size_t c = 0; c < children; ++c) {
+      int is_directory;
+      std::string child;
+      if (!(in >> is_directory >> length) || in.get() != ':')
+        return;
+      child.resize(length);
+      if (length)
+        in.read(&child[0], length);
+      dir.children.emplace_back(child, is_directory != 0);
+    }
+    if (!in)
+      return;
+    result[name] = std::move(dir);
+  }
+  untracked_cache_.swap(result);
+}
+
+void status_engine::save_untracked_cache() const {
+  // Directory and file names are written as <length>:<bytes>
+  auto temporary_path = untracked_cache_path_ + ".lock";
+  {
+    std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+    if (!out)
+      throw git_exception("failed to open " + temporary_path,
+                          git_exception::error_class::os);
+    out << untracked_cache_magic << ' ' << untracked_cache_version << ' '
+        << untracked_cache_written_ << '\n'
+        << untracked_cache_.size() << '\n';
+    for (auto &dir : untracked_cache_) {
+      out << dir.first.size() << ':' << dir.first << ' '
+          << dir.second.mtime_seconds << ' ' << dir.second.mtime_nanoseconds
+          << ' ' << dir.second.children.size();
+      for (auto &child : dir.second.children)
+        out << ' ' << (child.second ? 1 : 0) << ' ' << child.first.size()
+            << ':' << child.first;
+      out << '\n';
+    }
+    out.flush();
+    if (!out) {
+      std::remove(temporary_path.c_str());
+      throw git_exception("failed to write " + temporary_path,
+                          git_exception::error_class::os);
+    }
+  }
+  if (std::rename(temporary_path.c_str(), untracked_cache_path_.c_str())) {
+    std::remove(temporary_path.c_str());
+    throw git_exception("failed to rename " + temporary_path,
+                        git_exception::error_class::os);
+  }
+}
+
+} // namespace cppgit2
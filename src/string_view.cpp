@@ -0,0 +1,8 @@
+#include <cppgit2/string_view.hpp>
+
+namespace cppgit2 {
+
+// For uses that bind npos to a reference
+const size_t string_view::npos;
+
+} // namespace cppgit2
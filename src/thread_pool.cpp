@@ -0,0 +1,107 @@
+#include <cppgit2/thread_pool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace cppgit2 {
+
+size_t thread_pool::resolve_size(size_t num_threads) {
+  if (num_threads)
+    return num_threads;
+  auto hardware = std::thread::hardware_concurrency();
+  return hardware ? hardware : 1;
+}
+
+thread_pool::thread_pool(size_t num_threads) : pending_(0), stopping_(false) {
+  auto count = resolve_size(num_threads);
+  workers_.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    workers_.emplace_back([this, i] { run(i); });
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_done_.wait(lock, [this] { return pending_ == 0; });
+    stopping_ = true;
+  }
+  task_available_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+void thread_pool::submit(std::function<void(size_t)> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+    pending_++;
+  }
+  task_available_.notify_one();
+}
+
+void thread_pool::wait() {
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_done_.wait(lock, [this] { return pending_ == 0; });
+    std::swap(error, error_);
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void thread_pool::parallel_for(
+    size_t count, const std::function<void(size_t, size_t)> &fn) {
+  if (!count)
+    return;
+
+  // One task per worker pulling indices from a shared counter keeps the queue
+  // short when count is large
+  auto next = std::make_shared<std::atomic<size_t>>(0);
+  auto tasks = std::min(count, workers_.size());
+  for (size_t t = 0; t < tasks; ++t) {
+    submit([next, count, &fn](size_t worker) {
+      size_t i;
+      try {
+        while ((i = (*next)++) < count)
+          fn(i, worker);
+      } catch (...) {
+        // Let the other workers stop early
+        *next = count;
+        throw;
+      }
+    });
+  }
+  wait();
+}
+
+void thread_pool::run(size_t worker) {
+  for (;;) {
+    std::function<void(size_t)> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_available_.wait(lock,
+                           [this] { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty())
+        return;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    try {
+      task(worker);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_)
+        error_ = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0)
+        all_done_.notify_all();
+    }
+  }
+}
+
+} // namespace cppgit2
@@ -0,0 +1,284 @@
+#include <cppgit2/thread_pool.hpp>
+#include <cppgit2/tree_editor.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+namespace cppgit2 {
+
+namespace {
+
+struct edit_ref {
+  const char *path;
+  size_t size;
+  const git_oid *id;
+  uint32_t mode; // 0 = remove
+};
+
+struct tree_entry {
+  std::string name;
+  git_oid id;
+  uint32_t mode; // 0 = removed
+};
+
+// Git sorts tree entries as if directory names ended with '/'
+bool tree_order(const tree_entry &a, const tree_entry &b) {
+  size_t common = std::min(a.name.size(), b.name.size());
+  int result = memcmp(a.name.data(), b.name.data(), common);
+  if (result)
+    return result < 0;
+  auto next = [common](const tree_entry &e) -> unsigned char {
+    if (e.name.size() > common)
+      return static_cast<unsigned char>(e.name[common]);
+    return e.mode == GIT_FILEMODE_TREE ? '/' : '\0';
+  };
+  return next(a) < next(b);
+}
+
+struct worker_handle {
+  git_repository *repo;
+  git_odb *odb;
+};
+
+// Edits below one subdirectory, rebuilt as a unit
+struct subtree_job {
+  std::string name;
+  bool has_base;
+  git_oid base;
+  const edit_ref *begin, *end;
+  size_t offset; // length of the directory prefix in the edit paths
+  bool nonempty;
+  git_oid result;
+};
+
+class rewriter {
+public:
+  explicit rewriter(std::atomic<size_t> &trees_written)
+      : trees_written_(trees_written) {}
+
+  // Rebuild the directory `base` (nullptr if it does not exist) with the
+  // edits in [begin, end), whose paths are relative after `offset` chars
+  // Returns false if the directory ends up empty, unless `keep_empty`.
+  bool rewrite(const worker_handle &handle, const git_oid *base,
+               const edit_ref *begin, const edit_ref *end, size_t offset,
+               bool keep_empty, git_oid *out, thread_pool *pool = nullptr,
+               const std::vector<worker_handle> *handles = nullptr) {
+    std::vector<tree_entry> entries;
+    if (base) {
+      git_tree *tree = nullptr;
+      git_exception::throw_nonzero(git_tree_lookup(&tree, handle.repo, base));
+      size_t count = git_tree_entrycount(tree);
+      entries.reserve(count);
+      for (size_t i = 0; i < count; ++i) {
+        auto entry = git_tree_entry_byindex(tree, i);
+        entries.push_back(tree_entry{git_tree_entry_name(entry),
+                                     *git_tree_entry_id(entry),
+                                     static_cast<uint32_t>(
+                                         git_tree_entry_filemode(entry))});
+      }
+      git_tree_free(tree);
+    }
+    std::unordered_map<std::string, size_t> positions;
+    for (size_t i = 0; i < entries.size(); ++i)
+      positions[entries[i].name] = i;
+    auto set_entry = [&](const std::string &name, const git_oid &id,
+                         uint32_t mode) {
+      auto found = positions.find(name);
+      if (found != positions.end()) {
+        entries[found->second].id = id;
+        entries[found->second].mode = mode;
+      } else {
+        positions[name] = entries.size();
+        entries.push_back(tree_entry{name, id, mode});
+      }
+    };
+
+    std::vector<subtree_job> jobs;
+    for (auto it = begin; it != end;) {
+      const char *path = it->path + offset;
+      size_t size = it->size - offset;
+      auto slash = static_cast<const char *>(memchr(path, '/', size));
+      if (!slash) {
+        std::string name(path, size);
+        if (it->mode) {
+          set_entry(name, *it->id, it->mode);
+        } else {
+          auto found = positions.find(name);
+          if (found == positions.end() || !entries[found->second].mode)
+            throw git_exception(
+                "cannot remove " + std::string(it->path, it->size) +
+                    ": not in the tree",
+                git_exception::error_class::tree,
+                git_exception::error_code::notfound);
+          entries[found->second].mode = 0;
+        }
+        ++it;
+        continue;
+      }
+
+      // Edits below the same directory are contiguous once sorted
+      size_t length = static_cast<size_t>(slash - path) + 1;
+      auto group_end = it + 1;
+      while (group_end != end && group_end->size - offset > length &&
+             memcmp(group_end->path + offset, path, length) == 0)
+        ++group_end;
+
+      subtree_job job;
+      job.name.assign(path, length - 1);
+      auto found = positions.find(job.name);
+      job.has_base = found != positions.end() &&
+                     entries[found->second].mode == GIT_FILEMODE_TREE;
+      if (job.has_base)
+        job.base = entries[found->second].id;
+      job.begin = it;
+      job.end = group_end;
+      job.offset = offset + length;
+      jobs.push_back(job);
+      it = group_end;
+    }
+
+    auto run_job = [this](subtree_job &job, const worker_handle &worker) {
+      job.nonempty = rewrite(worker, job.has_base ? &job.base : nullptr,
+                             job.begin, job.end, job.offset, false,
+                             &job.result);
+    };
+    if (pool && jobs.size() > 1) {
+      pool->parallel_for(jobs.size(), [&](size_t i, size_t worker) {
+        run_job(jobs[i], (*handles)[worker]);
+      });
+    } else {
+      for (auto &job : jobs)
+        run_job(job, handle);
+    }
+    for (auto &job : jobs) {
+      if (job.nonempty) {
+        set_entry(job.name, job.result, GIT_FILEMODE_TREE);
+      } else {
+        auto found = positions.find(job.name);
+        if (found != positions.end())
+          entries[found->second].mode = 0;
+      }
+    }
+
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [](const tree_entry &e) { return !e.mode; }),
+                  entries.end());
+    if (entries.empty() && !keep_empty)
+      return false;
+    std::sort(entries.begin(), entries.end(), tree_order);
+
+    std::string content;
+    for (auto &entry : entries) {
+      char octal[8];
+      int length = snprintf(octal, sizeof(octal), "%o ", entry.mode);
+      content.append(octal, static_cast<size_t>(length));
+      content += entry.name;
+      content += '\0';
+      content.append(reinterpret_cast<const char *>(entry.id.id),
+                     GIT_OID_RAWSZ);
+    }
+    git_exception::throw_nonzero(git_odb_write(
+        out, handle.odb, content.data(), content.size(), GIT_OBJECT_TREE));
+    trees_written_++;
+    return true;
+  }
+
+private:
+  std::atomic<size_t> &trees_written_;
+};
+
+void check_path(const std::string &path) {
+  if (path.empty() || path.front() == '/' || path.back() == '/' ||
+      path.find("//") != std::string::npos)
+    throw git_exception("invalid path: " + path,
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::invalid);
+}
+
+} // namespace
+
+tree_editor::tree_editor(const repository &repo, size_t num_threads)
+    : repo_(repo), num_threads_(thread_pool::resolve_size(num_threads)),
+      trees_written_(0) {}
+
+void tree_editor::upsert(const std::string &path, const oid &id,
+                         file_mode mode) {
+  check_path(path);
+  if (mode == file_mode::unreadable)
+    throw git_exception("invalid mode for " + path,
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::invalid);
+  edits_.push_back(edit{path, *id.c_ptr(), static_cast<uint32_t>(mode)});
+}
+
+void tree_editor::remove(const std::string &path) {
+  check_path(path);
+  edits_.push_back(edit{path, git_oid(), 0});
+}
+
+void tree_editor::add(const tree::update &update) {
+  if (update.action() == tree::update_type::remove)
+    remove(update.path());
+  else
+    upsert(update.path(), update.id(), update.file_mode());
+}
+
+oid tree_editor::apply(const tree &baseline) {
+  std::stable_sort(edits_.begin(), edits_.end(),
+                   [](const edit &a, const edit &b) { return a.path < b.path; });
+  std::vector<edit_ref> refs;
+  refs.reserve(edits_.size());
+  for (size_t i = 0; i < edits_.size(); ++i) {
+    // The last edit of a path wins
+    if (i + 1 < edits_.size() && edits_[i + 1].path == edits_[i].path)
+      continue;
+    auto &e = edits_[i];
+    refs.push_back(edit_ref{e.path.data(), e.path.size(), &e.id, e.mode});
+  }
+
+  std::vector<repository> repositories;
+  std::vector<worker_handle> handles;
+  auto close_handles = [&handles]() {
+    for (auto &handle : handles)
+      git_odb_free(handle.odb);
+  };
+  std::atomic<size_t> trees_written(0);
+  git_oid result;
+  try {
+    // Worker 0 uses `repo_`: the calling thread only uses it while the
+    // pool is idle
+    size_t workers = num_threads_ > 1 ? num_threads_ : 1;
+    repositories.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) {
+      if (i)
+        repositories.push_back(repo_.reopen());
+      worker_handle handle{const_cast<git_repository *>(
+                               i ? repositories.back().c_ptr() : repo_.c_ptr()),
+                           nullptr};
+      git_exception::throw_nonzero(git_repository_odb(&handle.odb,
+                                                      handle.repo));
+      handles.push_back(handle);
+    }
+
+    auto base = baseline.c_ptr() ? git_tree_id(baseline.c_ptr()) : nullptr;
+    rewriter writer(trees_written);
+    if (workers > 1) {
+      thread_pool pool(workers);
+      writer.rewrite(handles[0], base, refs.data(), refs.data() + refs.size(),
+                     0, true, &result, &pool, &handles);
+    } else {
+      writer.rewrite(handles[0], base, refs.data(), refs.data() + refs.size(),
+                     0, true, &result);
+    }
+  } catch (...) {
+    close_handles();
+    throw;
+  }
+  close_handles();
+  trees_written_ = trees_written;
+  return oid(&result);
+}
+
+} // namespace cppgit2
@@ -0,0 +1,124 @@
+#include <cppgit2/tree_view.hpp>
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+
+namespace cppgit2 {
+
+namespace {
+
+// Compare an entry with `name` in git tree order, `name` being taken as a
+// directory if `as_tree`
+int compare(const tree_view::entry &e, const string_view &name,
+            bool as_tree) {
+  size_t common = std::min(e.name.size(), name.size());
+  int result = memcmp(e.name.data(), name.data(), common);
+  if (result)
+    return result;
+  unsigned char left = e.name.size() > common
+                           ? static_cast<unsigned char>(e.name[common])
+                           : (e.is_tree() ? '/' : '\0');
+  unsigned char right = name.size() > common
+                            ? static_cast<unsigned char>(name[common])
+                            : (as_tree ? '/' : '\0');
+  return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+void throw_corrupt(const oid &id) {
+  throw git_exception("corrupt tree object " + id.to_hex_string(),
+                      git_exception::error_class::object,
+                      git_exception::error_code::error);
+}
+
+} // namespace
+
+tree_view::tree_view(const tree &source) : object_(nullptr) {
+  auto raw = source.c_ptr();
+  size_t count = raw ? git_tree_entrycount(raw) : 0;
+  entries_.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    auto e = git_tree_entry_byindex(raw, i);
+    entries_.push_back(entry{string_view(git_tree_entry_name(e)),
+                             git_tree_entry_id(e),
+                             static_cast<uint32_t>(git_tree_entry_filemode(e))});
+  }
+}
+
+tree_view::tree_view(const repository &repo, const oid &id) : object_(nullptr) {
+  git_odb *odb = nullptr;
+  git_exception::throw_nonzero(
+      git_repository_odb(&odb, const_cast<git_repository *>(repo.c_ptr())));
+  int ret = git_odb_read(&object_, odb, id.c_ptr());
+  git_odb_free(odb);
+  git_exception::throw_nonzero(ret);
+  if (git_odb_object_type(object_) != GIT_OBJECT_TREE) {
+    git_odb_object_free(object_);
+    throw git_exception("object " + id.to_hex_string() + " is not a tree",
+                        git_exception::error_class::invalid,
+                        git_exception::error_code::invalid);
+  }
+
+  auto data = static_cast<const char *>(git_odb_object_data(object_));
+  auto end = data + git_odb_object_size(object_);
+  try {
+    // "<octal mode> <name>\0<20-byte id>"
+    for (auto p = data; p < end;) {
+      uint32_t mode = 0;
+      for (; p < end && *p >= '0' && *p <= '7'; ++p)
+        mode = (mode << 3) | static_cast<uint32_t>(*p - '0');
+      if (p >= end || *p != ' ')
+        throw_corrupt(id);
+      auto name = ++p;
+      p = static_cast<const char *>(
+          memchr(p, '\0', static_cast<size_t>(end - p)));
+      if (!p || p == name || end - p < 1 + GIT_OID_RAWSZ)
+        throw_corrupt(id);
+      entries_.push_back(
+          entry{string_view(name, static_cast<size_t>(p - name)),
+                reinterpret_cast<const git_oid *>(p + 1), mode});
+      p += 1 + GIT_OID_RAWSZ;
+    }
+  } catch (...) {
+    git_odb_object_free(object_);
+    throw;
+  }
+}
+
+tree_view::~tree_view() {
+  if (object_)
+    git_odb_object_free(object_);
+}
+
+tree_view::tree_view(tree_view &&other)
+    : object_(other.object_), entries_(std::move(other.entries_)) {
+  other.object_ = nullptr;
+  other.entries_.clear();
+}
+
+tree_view &tree_view::operator=(tree_view &&other) {
+  if (this != &other) {
+    if (object_)
+      git_odb_object_free(object_);
+    object_ = other.object_;
+    entries_ = std::move(other.entries_);
+    other.object_ = nullptr;
+    other.entries_.clear();
+  }
+  return *this;
+}
+
+const tree_view::entry *tree_view::find(const string_view &name) const {
+  // The position depends on whether the entry is a directory, so both
+  // places are tried
+  for (bool as_tree : {false, true}) {
+    auto it = std::lower_bound(begin(), end(), name,
+                               [as_tree](const entry &e, const string_view &n) {
+                                 return compare(e, n, as_tree) < 0;
+                               });
+    if (it != end() && it->name == name && it->is_tree() == as_tree)
+      return it;
+  }
+  return nullptr;
+}
+
+} // namespace cppgit2
@@ -0,0 +1,243 @@
+#include <cppgit2/tree_walker.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <unordered_set>
+
+namespace cppgit2 {
+
+namespace {
+
+// A worker queues subtrees until it holds this many, then descends itself
+const size_t queue_target = 4;
+
+// A subtree to enter; its path is its parent's, shared by all the queued
+// subtrees of that parent, then its name
+struct walk_task {
+  git_oid id;
+  std::shared_ptr<const std::string> parent;
+  std::string name; // empty for the root
+};
+
+struct worker_queue {
+  std::mutex mutex;
+  std::deque<walk_task> tasks;
+};
+
+// Ids of entered trees, sharded to keep workers off each other's locks
+class seen_set {
+public:
+  bool insert(const git_oid &id) {
+    auto &shard = shards_[id.id[GIT_OID_RAWSZ - 1] % shard_count];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.ids.insert(id).second;
+  }
+
+private:
+  static const size_t shard_count = 64;
+  struct shard {
+    std::mutex mutex;
+    std::unordered_set<git_oid, oid_hash, oid_equal> ids;
+  };
+  shard shards_[shard_count];
+};
+
+class walk_state {
+public:
+  walk_state(std::vector<repository> &handles, bool unique_trees,
+             const tree_walker::visitor *entry_fn,
+             const tree_walker::tree_visitor *tree_fn)
+      : handles_(handles), queues_(handles.size()),
+        unique_trees_(unique_trees), entry_fn_(entry_fn), tree_fn_(tree_fn),
+        pending_(0), queued_(0), idle_(0), stopped_(false), trees_read_(0) {}
+
+  void start(const git_oid &root) {
+    if (unique_trees_)
+      seen_.insert(root);
+    push(0, walk_task{root, std::make_shared<const std::string>(),
+                      std::string()});
+  }
+
+  // Body of worker `w`: run tasks until there are none left anywhere
+  void work(size_t w) {
+    std::string buffer;
+    try {
+      while (!stopped_) {
+        walk_task task;
+        if (!pop(w, task) && !steal(w, task)) {
+          if (!wait_for_task())
+            break;
+          continue;
+        }
+        buffer = *task.parent; // keeps the buffer's capacity
+        if (!task.name.empty()) {
+          buffer += task.name;
+          buffer += '/';
+        }
+        visit_tree(w, task.id, buffer);
+        // The last task done ends the walk
+        if (--pending_ == 0)
+          wake_all();
+      }
+    } catch (...) {
+      stop();
+      throw;
+    }
+  }
+
+  size_t trees_read() const { return trees_read_; }
+
+private:
+  void push(size_t w, walk_task task) {
+    pending_++;
+    {
+      std::lock_guard<std::mutex> lock(queues_[w].mutex);
+      queues_[w].tasks.push_back(std::move(task));
+      queued_++;
+    }
+    // Pairs with the check in wait_for_task(): either the sleeper sees the
+    // task or this sees the sleeper
+    if (idle_) {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      wake_.notify_one();
+    }
+  }
+
+  // Sleep until a task is queued somewhere; false once the walk is over
+  bool wait_for_task() {
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    idle_++;
+    wake_.wait(lock, [this] { return stopped_ || !pending_ || queued_; });
+    idle_--;
+    return !stopped_ && pending_;
+  }
+
+  void wake_all() {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    wake_.notify_all();
+  }
+
+  void stop() {
+    stopped_ = true;
+    wake_all();
+  }
+
+  bool pop(size_t w, walk_task &task) {
+    std::lock_guard<std::mutex> lock(queues_[w].mutex);
+    if (queues_[w].tasks.empty())
+      return false;
+    task = std::move(queues_[w].tasks.back());
+    queues_[w].tasks.pop_back();
+    queued_--;
+    return true;
+  }
+
+  bool steal(size_t w, walk_task &task) {
+    for (size_t i = 1; i < queues_.size(); ++i) {
+      auto &victim = queues_[(w + i) % queues_.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.tasks.empty())
+        continue;
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      queued_--;
+      return true;
+    }
+    return false;
+  }
+
+  size_t queued(size_t w) {
+    std::lock_guard<std::mutex> lock(queues_[w].mutex);
+    return queues_[w].tasks.size();
+  }
+
+  void visit_tree(size_t w, const git_oid &id, std::string &prefix) {
+    tree_view entries(handles_[w], oid(&id));
+    trees_read_++;
+    if (tree_fn_)
+      (*tree_fn_)(id, entries, w);
+
+    // Copy of `prefix` for the subtrees queued from here, made once
+    std::shared_ptr<const std::string> shared_prefix;
+    for (auto &entry : entries) {
+      if (stopped_)
+        return;
+      int ret = 0;
+      if (entry_fn_) {
+        ret = (*entry_fn_)(string_view(prefix), entry, w);
+        if (ret < 0) {
+          stop();
+          return;
+        }
+      }
+      if (!entry.is_tree() || ret > 0)
+        continue;
+      if (unique_trees_ && !seen_.insert(*entry.raw_id))
+        continue;
+
+      if (queued(w) < queue_target) {
+        if (!shared_prefix)
+          shared_prefix = std::make_shared<const std::string>(prefix);
+        push(w, walk_task{*entry.raw_id, shared_prefix,
+                          entry.name.to_string()});
+        continue;
+      }
+      size_t length = prefix.size();
+      prefix.append(entry.name.data(), entry.name.size());
+      prefix += '/';
+      visit_tree(w, *entry.raw_id, prefix);
+      prefix.resize(length);
+    }
+  }
+
+  std::vector<repository> &handles_;
+  std::vector<worker_queue> queues_;
+  bool unique_trees_;
+  const tree_walker::visitor *entry_fn_;
+  const tree_walker::tree_visitor *tree_fn_;
+  seen_set seen_;
+  std::atomic<size_t> pending_; // queued or running
+  std::atomic<size_t> queued_;
+  std::atomic<size_t> idle_; // workers in wait_for_task()
+  std::mutex idle_mutex_;
+  std::condition_variable wake_;
+  std::atomic<bool> stopped_;
+  std::atomic<size_t> trees_read_;
+};
+
+} // namespace
+
+tree_walker::tree_walker(const repository &repo, size_t num_threads)
+    : pool_(num_threads), trees_read_(0) {
+  handles_.reserve(pool_.size());
+  for (size_t i = 0; i < pool_.size(); ++i)
+    handles_.push_back(repo.reopen());
+}
+
+void tree_walker::walk(const oid &root, const visitor &fn,
+                       bool unique_trees) {
+  run(*root.c_ptr(), unique_trees, &fn, nullptr);
+}
+
+void tree_walker::for_each_tree(const oid &root, const tree_visitor &fn) {
+  run(*root.c_ptr(), true, nullptr, &fn);
+}
+
+void tree_walker::run(const git_oid &root, bool unique_trees,
+                      const visitor *entry_fn, const tree_visitor *tree_fn) {
+  walk_state state(handles_, unique_trees, entry_fn, tree_fn);
+  state.start(root);
+  for (size_t w = 0; w < pool_.size(); ++w)
+    pool_.submit([&state](size_t worker) { state.work(worker); });
+  try {
+    pool_.wait();
+  } catch (...) {
+    trees_read_ = state.trees_read();
+    throw;
+  }
+  trees_read_ = state.trees_read();
+}
+
+} // namespace cppgit2
@@ -0,0 +1,115 @@
+#include <cppgit2/tree_writer.hpp>
+#include <cstdio>
+
+namespace cppgit2 {
+
+namespace {
+
+void append_entry(std::string &entries, unsigned int mode, const char *name,
+                  size_t name_size, const git_oid &id) {
+  char octal[8];
+  int length = snprintf(octal, sizeof(octal), "%o ", mode);
+  entries.append(octal, static_cast<size_t>(length));
+  entries.append(name, name_size);
+  entries += '\0';
+  entries.append(reinterpret_cast<const char *>(id.id), GIT_OID_RAWSZ);
+}
+
+// Drop the files that sort before `name` + "/" without being a prefix of
+// `name`: no directory can collide with them anymore
+void forget_files(std::vector<std::string> &files, const std::string &name) {
+  while (!files.empty() && name.compare(0, files.back().size(),
+                                        files.back()) != 0)
+    files.pop_back();
+}
+
+void throw_invalid(const std::string &message, const std::string &path) {
+  throw git_exception(message + ": " + path,
+                      git_exception::error_class::invalid,
+                      git_exception::error_code::invalid);
+}
+
+} // namespace
+
+tree_writer::tree_writer(const repository &repo)
+    : odb_(nullptr), open_(1), trees_written_(0) {
+  git_exception::throw_nonzero(git_repository_odb(
+      &odb_, const_cast<git_repository *>(repo.c_ptr())));
+}
+
+tree_writer::~tree_writer() {
+  if (odb_)
+    git_odb_free(odb_);
+}
+
+void tree_writer::close_directory() {
+  auto closed = std::move(open_.back());
+  open_.pop_back();
+  git_oid id;
+  git_exception::throw_nonzero(git_odb_write(&id, odb_, closed.entries.data(),
+                                             closed.entries.size(),
+                                             GIT_OBJECT_TREE));
+  trees_written_++;
+  append_entry(open_.back().entries, GIT_FILEMODE_TREE, closed.name.data(),
+               closed.name.size(), id);
+}
+
+void tree_writer::append(const std::string &path, const oid &id,
+                         file_mode mode) {
+  if (path.empty() || path.front() == '/' || path.back() == '/' ||
+      path.find("//") != std::string::npos)
+    throw_invalid("invalid path", path);
+  if (mode == file_mode::tree || mode == file_mode::unreadable)
+    throw_invalid("invalid mode for", path);
+  if (!last_path_.empty() && path <= last_path_)
+    throw_invalid(path == last_path_ ? "duplicate path" : "unsorted path",
+                  path);
+
+  // Keep the directories this path shares with the previous one
+  size_t depth = 1, start = 0;
+  for (size_t slash; (slash = path.find('/', start)) != std::string::npos;
+       start = slash + 1, ++depth) {
+    if (depth >= open_.size() ||
+        open_[depth].name.compare(0, std::string::npos, path, start,
+                                  slash - start) != 0)
+      break;
+  }
+  while (open_.size() > depth)
+    close_directory();
+
+  // Open the new ones
+  for (size_t slash; (slash = path.find('/', start)) != std::string::npos;
+       start = slash + 1) {
+    directory opened;
+    opened.name = path.substr(start, slash - start);
+    auto &files = open_.back().files;
+    forget_files(files, opened.name);
+    if (!files.empty() && files.back() == opened.name)
+      throw_invalid("path is both a file and a directory",
+                    path.substr(0, slash));
+    open_.push_back(std::move(opened));
+  }
+
+  auto &parent = open_.back();
+  auto name = path.substr(start);
+  forget_files(parent.files, name);
+  parent.files.push_back(std::move(name));
+  append_entry(parent.entries, static_cast<unsigned int>(mode),
+               path.data() + start, path.size() - start, *id.c_ptr());
+  last_path_ = path;
+}
+
+oid tree_writer::finish() {
+  while (open_.size() > 1)
+    close_directory();
+  git_oid id;
+  git_exception::throw_nonzero(git_odb_write(&id, odb_, open_[0].entries.data(),
+                                             open_[0].entries.size(),
+                                             GIT_OBJECT_TREE));
+  trees_written_++;
+  open_.assign(1, directory());
+  last_path_.clear();
+  return oid(&id);
+}
+
+} // namespace cppgit2
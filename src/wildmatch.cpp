@@ -0,0 +1,186 @@
+#include <cppgit2/wildmatch.hpp>
+#include <cctype>
+
+namespace cppgit2 {
+
+namespace {
+
+enum wild_result {
+  wild_match,
+  wild_no_match,
+  wild_abort_all,
+  wild_abort_to_starstar
+};
+
+bool in_class(string_view name, unsigned char c) {
+  if (name == "alnum")
+    return isalnum(c) != 0;
+  if (name == "alpha")
+    return isalpha(c) != 0;
+  if (name == "blank")
+    return c == ' ' || c == '\t';
+  if (name == "cntrl")
+    return iscntrl(c) != 0;
+  if (name == "digit")
+    return isdigit(c) != 0;
+  if (name == "graph")
+    return isgraph(c) != 0;
+  if (name == "lower")
+    return islower(c) != 0;
+  if (name == "print")
+    return isprint(c) != 0;
+  if (name == "punct")
+    return ispunct(c) != 0;
+  if (name == "space")
+    return isspace(c) != 0;
+  if (name == "upper")
+    return isupper(c) != 0;
+  return name == "xdigit" && isxdigit(c) != 0;
+}
+
+bool is_class_name(string_view name) {
+  static const char *const names[] = {"alnum", "alpha", "blank", "cntrl",
+                                      "digit", "graph", "lower", "print",
+                                      "punct", "space", "upper", "xdigit"};
+  for (auto known : names)
+    if (name == known)
+      return true;
+  return false;
+}
+
+int wild(string_view p, size_t pi, string_view t, size_t ti, bool pathname) {
+  for (; pi < p.size(); ++pi, ++ti) {
+    char pc = p[pi];
+    if (ti == t.size() && pc != '*')
+      return wild_abort_all;
+    char tc = ti < t.size() ? t[ti] : '\0';
+    switch (pc) {
+    case '\\':
+      if (pi + 1 < p.size())
+        pc = p[++pi];
+      if (pc != tc)
+        return wild_no_match;
+      break;
+    case '?':
+      if (pathname && tc == '/')
+        return wild_no_match;
+      break;
+    case '*': {
+      bool match_slash = !pathname;
+      size_t first_star = pi;
+      while (pi + 1 < p.size() && p[pi + 1] == '*')
+        ++pi;
+      if (pathname && pi > first_star) {
+        size_t next = pi + 1;
+        bool at_start = first_star == 0 || p[first_star - 1] == '/';
+        bool at_end = next == p.size() || p[next] == '/' ||
+                      (p[next] == '\\' && next + 1 < p.size() &&
+                       p[next + 1] == '/');
+        if (at_start && at_end) {
+          // "**/" also matches no directory at all
+          if (next < p.size() && p[next] == '/' &&
+              wild(p, next + 1, t, ti, pathname) == wild_match)
+            return wild_match;
+          match_slash = true;
+        }
+      }
+      ++pi;
+      if (pi == p.size()) {
+        if (!match_slash && t.substr(ti).find('/') != string_view::npos)
+          return wild_no_match;
+        return wild_match;
+      }
+      if (!match_slash && p[pi] == '/') {
+        while (ti < t.size() && t[ti] != '/')
+          ++ti;
+        if (ti == t.size())
+          return wild_no_match;
+        break;
+      }
+      for (; ti < t.size(); ++ti) {
+        int result = wild(p, pi, t, ti, pathname);
+        if (result != wild_no_match) {
+          if (!match_slash || result != wild_abort_to_starstar)
+            return result;
+        } else if (!match_slash && t[ti] == '/') {
+          return wild_abort_to_starstar;
+        }
+      }
+      return wild_abort_all;
+    }
+    case '[': {
+      if (++pi == p.size())
+        return wild_abort_all;
+      bool negated = p[pi] == '!' || p[pi] == '^';
+      if (negated)
+        ++pi;
+      bool matched = false;
+      char previous = '\0';
+      for (bool first = true;; ++pi, first = false) {
+        if (pi == p.size())
+          return wild_abort_all;
+        char c = p[pi];
+        if (c == ']' && !first)
+          break;
+        if (c == '\\') {
+          if (++pi == p.size())
+            return wild_abort_all;
+          c = p[pi];
+          if (c == tc)
+            matched = true;
+        } else if (c == '-' && previous && pi + 1 < p.size() &&
+                   p[pi + 1] != ']') {
+          c = p[++pi];
+          if (c == '\\') {
+            if (++pi == p.size())
+              return wild_abort_all;
+            c = p[pi];
+          }
+          if (tc >= previous && tc <= c)
+            matched = true;
+          c = '\0';
+        } else if (c == '[' && pi + 1 < p.size() && p[pi + 1] == ':') {
+          size_t close = pi + 2;
+          while (close + 1 < p.size() &&
+                 !(p[close] == ':' && p[close + 1] == ']'))
+            ++close;
+          if (close + 1 >= p.size()) {
+            if (tc == '[')
+              matched = true;
+          } else {
+            auto name = p.substr(pi + 2, close - pi - 2);
+            if (!is_class_name(name))
+              return wild_abort_all;
+            if (in_class(name, static_cast<unsigned char>(tc)))
+              matched = true;
+            pi = close + 1;
+            c = '\0';
+          }
+        } else if (c == tc) {
+          matched = true;
+        }
+        previous = c;
+      }
+      if (matched == negated || (pathname && tc == '/'))
+        return wild_no_match;
+      break;
+    }
+    default:
+      if (pc != tc)
+        return wild_no_match;
+      break;
+    }
+  }
+  return ti == t.size() ? wild_match : wild_no_match;
+}
+
+} // namespace
+
+// A port of git's dowild(): a '*' that fails to match gives up on the
+// whole pattern (abort_all) or, in pathname mode, back to the last "**"
+// (abort_to_starstar), which keeps the backtracking linear per star
+bool wildmatch(string_view pattern, string_view text, bool pathname) {
+  return wild(pattern, 0, text, 0, pathname) == wild_match;
+}
+
+} // namespace cppgit2
@@ -0,0 +1,238 @@
+#include <cppgit2/workdir_watcher.hpp>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cppgit2 {
+
+#ifdef __linux__
+
+namespace {
+
+const uint32_t workdir_events = IN_CREATE | IN_DELETE | IN_MODIFY |
+                                IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+// Git replaces the index by renaming index.lock
+const uint32_t git_dir_events = IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR;
+
+std::string join(const std::string &dir, const char *name) {
+  return dir.empty() ? std::string(name) : dir + "/" + name;
+}
+
+} // namespace
+
+workdir_watcher::workdir_watcher(const repository &repo, bool watch_ignored)
+    : repo_(repo), workdir_(repo.workdir()), watch_ignored_(watch_ignored),
+      fd_(-1), git_dir_watch_(-1), needs_full_scan_(true) {
+  if (workdir_.empty())
+    throw git_exception("cannot watch a bare repository",
+                        git_exception::error_class::repository,
+                        git_exception::error_code::barerepo);
+
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0)
+    throw git_exception(std::string("inotify_init1 failed: ") +
+                            strerror(errno),
+                        git_exception::error_class::os);
+
+  // Without it a new index (and so a staged change) would go unnoticed
+  git_dir_watch_ = inotify_add_watch(fd_, repo_.path().c_str(), git_dir_events);
+  if (git_dir_watch_ < 0) {
+    auto error = errno;
+    close(fd_);
+    throw git_exception("inotify_add_watch failed for " + repo_.path() + ": " +
+                            strerror(error),
+                        git_exception::error_class::os);
+  }
+  try {
+    add_watches("");
+  } catch (...) {
+    close(fd_);
+    throw;
+  }
+}
+
+workdir_watcher::~workdir_watcher() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool workdir_watcher::is_ignored_directory(const std::string &dir) const {
+  if (watch_ignored_ || dir.empty())
+    return false;
+  int ignored = 0;
+  git_ignore_path_is_ignored(&ignored,
+                             const_cast<git_repository *>(repo_.c_ptr()),
+                             (dir + "/").c_str());
+  return ignored != 0;
+}
+
+void workdir_watcher::add_watches(const std::string &dir) {
+  if (is_ignored_directory(dir))
+    return;
+
+  auto absolute = workdir_ + dir;
+  int wd = inotify_add_watch(fd_, absolute.c_str(), workdir_events);
+  if (wd < 0) {
+    // Gone already, or not a directory: the parent's event covers it
+    if (errno == ENOENT || errno == ENOTDIR)
+      return;
+    throw git_exception("inotify_add_watch failed for " + absolute + ": " +
+                            strerror(errno),
+                        git_exception::error_class::os);
+  }
+  watches_[wd] = dir;
+
+  // Subdirectories are listed after the watch exists, so that directories
+  // created meanwhile are seen one way or the other
+  auto handle = opendir(absolute.c_str());
+  if (!handle)
+    return;
+  std::vector<std::string> subdirectories;
+  while (auto entry = readdir(handle)) {
+    const char *name = entry->d_name;
+    if (!strcmp(name, ".") || !strcmp(name, "..") ||
+        (dir.empty() && !strcmp(name, ".git")))
+      continue;
+    bool is_directory = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat st;
+      is_directory = fstatat(dirfd(handle), name, &st, AT_SYMLINK_NOFOLLOW) ==
+                         0 &&
+                     S_ISDIR(st.st_mode);
+    }
+    if (is_directory)
+      subdirectories.push_back(join(dir, name));
+  }
+  closedir(handle);
+  for (auto &subdirectory : subdirectories)
+    add_watches(subdirectory);
+}
+
+bool workdir_watcher::poll(int timeout_ms) {
+  if (timeout_ms) {
+    struct pollfd descriptor = {fd_, POLLIN, 0};
+    if (::poll(&descriptor, 1, timeout_ms) <= 0)
+      return false;
+  }
+
+  bool any = false;
+  alignas(struct inotify_event) char buffer[64 * 1024];
+  for (;;) {
+    auto length = read(fd_, buffer, sizeof(buffer));
+    if (length < 0 && errno == EINTR)
+      continue;
+    if (length <= 0)
+      break;
+    any = true;
+
+    for (char *p = buffer; p < buffer + length;) {
+      auto event = reinterpret_cast<struct inotify_event *>(p);
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        needs_full_scan_ = true;
+        continue;
+      }
+      if (event->wd == git_dir_watch_) {
+        if (event->len && !strcmp(event->name, "index"))
+          needs_full_scan_ = true;
+        continue;
+      }
+      auto watch = watches_.find(event->wd);
+      if (watch == watches_.end())
+        continue;
+      if (event->mask & IN_IGNORED) {
+        watches_.erase(watch);
+        continue;
+      }
+
+      auto dir = watch->second;
+      if (!event->len) {
+        // Event on the watched directory itself (deleted or moved)
+        if (!dir.empty())
+          dirty_.insert(dir);
+        continue;
+      }
+      if (dir.empty() && !strcmp(event->name, ".git"))
+        continue;
+
+      auto path = join(dir, event->name);
+      dirty_.insert(path);
+      if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+        add_watches(path);
+    }
+  }
+  return any;
+}
+
+#else
+
+workdir_watcher::workdir_watcher(const repository &repo, bool watch_ignored)
+    : repo_(repo), watch_ignored_(watch_ignored), fd_(-1), git_dir_watch_(-1),
+      needs_full_scan_(true) {
+  throw git_exception("workdir_watcher requires inotify (Linux)",
+                      git_exception::error_class::os);
+}
+
+workdir_watcher::~workdir_watcher() {}
+
+bool workdir_watcher::is_ignored_directory(const std::string &) const {
+  return false;
+}
+
+void workdir_watcher::add_watches(const std::string &) {}
+
+bool workdir_watcher::poll(int) { return false; }
+
+#endif
+
+std::vector<std::string> workdir_watcher::dirty_paths() const {
+  return std::vector<std::string>(dirty_.begin(), dirty_.end());
+}
+
+std::vector<std::string> workdir_watcher::take_dirty_paths() {
+  std::vector<std::string> result(dirty_.begin(), dirty_.end());
+  dirty_.clear();
+  needs_full_scan_ = false;
+  return result;
+}
+
+strarray workdir_watcher::pathspec() const { return strarray(dirty_paths()); }
+
+void workdir_watcher::for_each_status(
+    status_engine &engine,
+    std::function<void(const std::string &, status::status_type)> visitor) {
+  poll();
+  bool full_scan = needs_full_scan_;
+  auto paths = dirty_paths();
+
+  // Paths that are not current stay dirty until a later run finds them
+  // current; everything else is current until an event says otherwise
+  std::set<std::string> not_current;
+  auto collect = [&](const std::string &path, status::status_type flags) {
+    auto key = path;
+    if (!key.empty() && key.back() == '/')
+      key.pop_back();
+    not_current.insert(key);
+    visitor(path, flags);
+  };
+  if (full_scan)
+    engine.for_each_status(collect);
+  else
+    engine.for_each_status(paths, collect);
+  dirty_.swap(not_current);
+  needs_full_scan_ = false;
+}
+
+} // namespace cppgit2
@@ -0,0 +1,163 @@
+#include <cppgit2/attribute_matcher.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <sys/stat.h>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_repository *raw(const repository &repo) {
+  return const_cast<git_repository *>(repo.c_ptr());
+}
+
+const std::vector<std::string> names{"text", "diff",   "merge", "foo",
+                                     "binary", "doc",  "lang",  "rooted",
+                                     "wild", "eol",    "mymacro"};
+
+const std::vector<std::string> paths{
+    "a.txt",         "x.bin",           "y.m",
+    "docs/read.txt", "docs/sub/f.c",    "docs/deep/sub/f.c",
+    "root.only",     "sub/root.only",   "abc.dat",
+    "abbc.dat",      "special.txt",     "docs/special.txt",
+    "none"};
+
+// Top-level and nested .gitattributes (staged), and info/attributes
+void write_attributes(const repository &repo, const std::string &workdir) {
+  mkdir((workdir + "docs").c_str(), 0777);
+  mkdir((repo.path() + "info").c_str(), 0777);
+  write_file(workdir + ".gitattributes", "*.txt text\n"
+                                         "*.bin binary\n"
+                                         "[attr]mymacro -diff foo=bar\n"
+                                         "*.m mymacro\n"
+                                         "docs/** doc\n"
+                                         "/root.only rooted\n"
+                                         "a?c.dat wild=yes\n");
+  write_file(workdir + "docs/.gitattributes", "*.txt -text eol=lf\n"
+                                              "sub/*.c lang=c\n");
+  write_file(repo.path() + "info/attributes", "special.txt !text foo=info\n");
+  git_index *index = nullptr;
+  REQUIRE(git_repository_index(&index, raw(repo)) == 0);
+  REQUIRE(git_index_add_bypath(index, ".gitattributes") == 0);
+  REQUIRE(git_index_add_bypath(index, "docs/.gitattributes") == 0);
+  REQUIRE(git_index_write(index) == 0);
+  git_index_free(index);
+}
+
+// "unspecified", "true", "false" or the string, as libgit2 has it
+std::string libgit2_value(const repository &repo, uint32_t flags,
+                          const std::string &path, const std::string &name) {
+  const char *value = nullptr;
+  REQUIRE(git_attr_get(&value, raw(repo), flags, path.c_str(),
+                       name.c_str()) == 0);
+  switch (git_attr_value(value)) {
+  case GIT_ATTR_VALUE_UNSPECIFIED:
+    return "unspecified";
+  case GIT_ATTR_VALUE_TRUE:
+    return "true";
+  case GIT_ATTR_VALUE_FALSE:
+    return "false";
+  default:
+    return value;
+  }
+}
+
+std::string describe(const attribute_matcher::value &v) {
+  switch (v.state) {
+  case attribute::attribute_value::unspecified:
+    return "unspecified";
+  case attribute::attribute_value::true_:
+    return "true";
+  case attribute::attribute_value::false_:
+    return "false";
+  default:
+    return v.text.to_string();
+  }
+}
+
+} // namespace
+
+TEST_CASE("Answer as lookup_attribute does" *
+          test_suite("attribute_matcher")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  write_attributes(repo, dir.path());
+
+  for (auto flags : {attribute::flag::file_then_index,
+                     attribute::flag::index_only}) {
+    attribute_matcher matcher(repo, flags, 2);
+    auto batch = matcher.lookup(paths, names);
+    REQUIRE(batch.size() == paths.size() * names.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+      auto single = matcher.lookup(paths[i], names);
+      for (size_t j = 0; j < names.size(); ++j) {
+        CAPTURE(paths[i]);
+        CAPTURE(names[j]);
+        auto expected = libgit2_value(repo, static_cast<uint32_t>(flags),
+                                      paths[i], names[j]);
+        REQUIRE(describe(single[j]) == expected);
+        REQUIRE(describe(batch[i * names.size() + j]) == expected);
+      }
+    }
+  }
+
+  // A few answers spelled out: macros, nested files and info/attributes
+  attribute_matcher matcher(repo);
+  auto values = matcher.lookup("x.bin", {"binary", "diff", "merge", "text"});
+  REQUIRE(describe(values[0]) == "true");
+  REQUIRE(describe(values[1]) == "false");
+  REQUIRE(describe(values[2]) == "false");
+  REQUIRE(describe(values[3]) == "false");
+  values = matcher.lookup("y.m", {"mymacro", "diff", "foo"});
+  REQUIRE(describe(values[0]) == "true");
+  REQUIRE(describe(values[1]) == "false");
+  REQUIRE(describe(values[2]) == "bar");
+  values = matcher.lookup("docs/read.txt", {"text", "eol", "doc"});
+  REQUIRE(describe(values[0]) == "false");
+  REQUIRE(describe(values[1]) == "lf");
+  REQUIRE(describe(values[2]) == "true");
+  values = matcher.lookup("special.txt", {"text", "foo"});
+  REQUIRE(describe(values[0]) == "unspecified");
+  REQUIRE(describe(values[1]) == "info");
+}
+
+TEST_CASE("Expand only macros that are set" *
+          test_suite("attribute_matcher")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  write_attributes(repo, dir.path());
+  write_file(dir.path() + "docs/.gitattributes", "*.bin -binary diff\n");
+  git_index *index = nullptr;
+  REQUIRE(git_repository_index(&index, raw(repo)) == 0);
+  REQUIRE(git_index_add_bypath(index, "docs/.gitattributes") == 0);
+  REQUIRE(git_index_write(index) == 0);
+  git_index_free(index);
+
+  // As `git check-attr`: -binary decides binary without expanding, and
+  // hides the top-level "*.bin binary" (libgit2 expands it to -text)
+  attribute_matcher matcher(repo);
+  auto values =
+      matcher.lookup("docs/x.bin", {"binary", "diff", "merge", "text"});
+  REQUIRE(describe(values[0]) == "false");
+  REQUIRE(describe(values[1]) == "true");
+  REQUIRE(describe(values[2]) == "unspecified");
+  REQUIRE(describe(values[3]) == "unspecified");
+}
+
+TEST_CASE("Read the attributes of a tree" * test_suite("attribute_matcher")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  write_attributes(repo, dir.path());
+  auto commit = commit_files(
+      repo, {{".gitattributes", "*.txt text\n*.dat -text\n"}});
+
+  // The work tree's files are not read, only those of the commit
+  attribute_matcher matcher(repo, commit);
+  auto values = matcher.lookup("a.dat", {"text"});
+  REQUIRE(describe(values[0]) == "false");
+  values = matcher.lookup("y.m", {"mymacro"});
+  REQUIRE(describe(values[0]) == "unspecified");
+  values = matcher.lookup("docs/read.txt", {"text"});
+  REQUIRE(describe(values[0]) == "true");
+}
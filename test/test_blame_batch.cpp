@@ -0,0 +1,62 @@
+#include <cppgit2/blame_batch.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+// Every line is attributed the same way in both lists
+void require_same_lines(const blame::hunk_list &actual,
+                        const blame::hunk_list &expected) {
+  REQUIRE(actual.line_count() == expected.line_count());
+  for (size_t line = 1; line <= expected.line_count(); ++line) {
+    auto a = actual.hunk_by_line(line);
+    auto e = expected.hunk_by_line(line);
+    CAPTURE(line);
+    REQUIRE(a.final_commit_id() == e.final_commit_id());
+    REQUIRE(a.orig_commit_id() == e.orig_commit_id());
+    REQUIRE(a.orig_path() == e.orig_path());
+    REQUIRE(a.orig_start_line_number() + line - a.final_start_line_number() ==
+            e.orig_start_line_number() + line - e.final_start_line_number());
+  }
+}
+
+} // namespace
+
+TEST_CASE("Blame many files as repository::blame_file does" *
+          test_suite("blame_batch")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  commit_files(repo, {{"a", "1\n2\n3\n"}, {"b", "x\ny\n"}, {"c", "c\n"}});
+  commit_files(repo, {{"a", "1\n2b\n3\n4\n"}});
+  auto middle = commit_files(repo, {{"b", "w\nx\ny\n"}, {"c", "c\nd\n"}});
+  commit_files(repo, {{"a", "0\n1\n2b\n3\n4\n"}, {"d", "new\n"}});
+  commit_files(repo, {{"b", "w\nx\nY\n"}});
+
+  std::vector<std::string> paths{"a", "b", "c", "d"};
+  blame_batch batch(repo);
+  batch.add_paths(paths);
+  auto blames = batch.run(2);
+  REQUIRE(blames.size() == paths.size());
+  for (auto &path : paths) {
+    CAPTURE(path);
+    require_same_lines(blames.at(path),
+                       blame::hunk_list(repo.blame_file(path)));
+  }
+
+  // As of an older commit
+  blame::options options;
+  options.set_newest_commit(middle);
+  blame_batch older(repo, options);
+  older.add_paths({"a", "b"});
+  blames = older.run(1);
+  for (auto path : {"a", "b"})
+    require_same_lines(blames.at(path),
+                       blame::hunk_list(repo.blame_file(path, options)));
+
+  blame_batch missing(repo, options);
+  missing.add_path("d");
+  REQUIRE_THROWS_AS(missing.run(1), git_exception);
+}
@@ -0,0 +1,86 @@
+#include <cppgit2/blame_cache.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+// Every line is attributed the same way in both lists
+void require_same_lines(const blame::hunk_list &actual,
+                        const blame::hunk_list &expected) {
+  REQUIRE(actual.line_count() == expected.line_count());
+  for (size_t line = 1; line <= expected.line_count(); ++line) {
+    auto a = actual.hunk_by_line(line);
+    auto e = expected.hunk_by_line(line);
+    CAPTURE(line);
+    REQUIRE(a.final_commit_id() == e.final_commit_id());
+    REQUIRE(a.orig_commit_id() == e.orig_commit_id());
+    REQUIRE(a.orig_path() == e.orig_path());
+    REQUIRE(a.orig_start_line_number() + line - a.final_start_line_number() ==
+            e.orig_start_line_number() + line - e.final_start_line_number());
+    REQUIRE(a.boundary() == e.boundary());
+  }
+}
+
+} // namespace
+
+TEST_CASE("Blame incrementally as a full blame would" *
+          test_suite("blame_cache")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  commit_files(repo, {{"f", "a\nb\nc\n"}});
+  auto second = commit_files(repo, {{"f", "a\nB\nc\nd\n"}});
+  commit_files(repo, {{"f", "x\na\nB\nc\nd\n"}, {"g", "1\n"}});
+  commit_files(repo, {{"g", "2\n"}});
+  auto head = commit_files(repo, {{"f", "x\na\nB\nC\nd\ne\n"}});
+
+  blame_cache cache(repo);
+  blame::options options;
+  options.set_newest_commit(second);
+  require_same_lines(cache.blame_file("f", second),
+                     blame::hunk_list(repo.blame_file("f", options)));
+  REQUIRE(cache.stats().full == 1);
+
+  // HEAD descends from the cached commit: only the newer commits are walked
+  blame::hunk_list expected(repo.blame_file("f"));
+  require_same_lines(cache.blame_file("f"), expected);
+  REQUIRE(cache.stats().incremental == 1);
+  REQUIRE(cache.contains("f", head));
+  require_same_lines(cache.blame_file("f", head), expected);
+  REQUIRE(cache.stats().hits == 1);
+  REQUIRE(cache.size() == 2);
+
+  // A saved cache answers from disk
+  cache.save(dir.path() + "blame.cache");
+  blame_cache loaded(repo);
+  loaded.load(dir.path() + "blame.cache");
+  REQUIRE(loaded.size() == 2);
+  require_same_lines(loaded.blame_file("f"), expected);
+  REQUIRE(loaded.stats().hits == 1);
+
+  loaded.evict("f");
+  REQUIRE(!loaded.contains("f", head));
+  require_same_lines(loaded.blame_file("f"), expected);
+  REQUIRE(loaded.stats().full == 1);
+}
+
+TEST_CASE("Keep a bounded number of blames per path" *
+          test_suite("blame_cache")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  std::vector<oid> commits;
+  std::string content;
+  for (int i = 0; i < 4; ++i) {
+    content += std::to_string(i) + "\n";
+    commits.push_back(commit_files(repo, {{"f", content}}));
+  }
+  blame_cache cache(repo, blame::options(), 2);
+  for (auto &id : commits)
+    cache.blame_file("f", id);
+  REQUIRE(cache.size() == 2);
+  REQUIRE(!cache.contains("f", commits[1]));
+  REQUIRE(cache.contains("f", commits[3]));
+  REQUIRE(cache.stats().incremental == 3);
+}
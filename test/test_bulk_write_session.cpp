@@ -0,0 +1,109 @@
+#include <cppgit2/bulk_write_session.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <sys/stat.h>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_odb *odb_of(const repository &repo) {
+  git_odb *odb = nullptr;
+  git_repository_odb(&odb, const_cast<git_repository *>(repo.c_ptr()));
+  return odb;
+}
+
+bool is_loose(const std::string &gitdir, const oid &id) {
+  auto hex = id.to_hex_string();
+  struct stat st;
+  return stat((gitdir + "objects/" + hex.substr(0, 2) + "/" + hex.substr(2))
+                  .c_str(),
+              &st) == 0;
+}
+
+std::string content_of(git_odb_object *object) {
+  return std::string(static_cast<const char *>(git_odb_object_data(object)),
+                     git_odb_object_size(object));
+}
+
+} // namespace
+
+TEST_CASE("Write objects into a pack" * test_suite("bulk_write_session")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  oid blob, pack_name;
+  {
+    bulk_write_session session(repo);
+    blob = repo.create_blob_from_buffer("bulk content\n");
+    auto again = session.write("bulk content\n", 13, object::object_type::blob);
+    REQUIRE(again == blob);
+    REQUIRE(session.size() == 1);
+    REQUIRE(!is_loose(dir.path(), blob));
+
+    // Readable in the session, by full and abbreviated id
+    REQUIRE(repo.lookup_blob(blob).raw_size() == 13);
+    auto odb = odb_of(repo);
+    git_odb_object *object = nullptr;
+    REQUIRE(git_odb_read_prefix(&object, odb, blob.c_ptr(), 7) == 0);
+    REQUIRE(oid(git_odb_object_id(object)) == blob);
+    REQUIRE(content_of(object) == "bulk content\n");
+    git_odb_object_free(object);
+    git_oid full;
+    REQUIRE(git_odb_exists_prefix(&full, odb, blob.c_ptr(), 10) == 0);
+    REQUIRE(oid(&full) == blob);
+    git_odb_free(odb);
+
+    pack_name = session.close();
+    REQUIRE(!session.is_open());
+  }
+  REQUIRE(!read_file(dir.path() + "objects/pack/pack-" +
+                     pack_name.to_hex_string() + ".idx")
+               .empty());
+
+  // From the pack, in a fresh handle
+  auto reopened = repository::open(dir.path());
+  auto odb = odb_of(reopened);
+  git_odb_object *object = nullptr;
+  REQUIRE(git_odb_read(&object, odb, blob.c_ptr()) == 0);
+  REQUIRE(content_of(object) == "bulk content\n");
+  git_odb_object_free(object);
+  git_odb_free(odb);
+}
+
+TEST_CASE("Reuse the backend across sessions" *
+          test_suite("bulk_write_session")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  auto odb = odb_of(repo);
+  auto backends = git_odb_num_backends(odb);
+  oid discarded;
+  {
+    bulk_write_session session(repo);
+    REQUIRE(git_odb_num_backends(odb) == backends + 1);
+    REQUIRE_THROWS(bulk_write_session{repo});
+    discarded = repo.create_blob_from_buffer("discarded");
+  }
+  REQUIRE(!git_odb_exists(odb, discarded.c_ptr()));
+
+  // Between sessions, writes are loose objects again
+  auto loose = repo.create_blob_from_buffer("loose");
+  REQUIRE(is_loose(dir.path(), loose));
+  git_odb_object *object = nullptr;
+  REQUIRE(git_odb_read_prefix(&object, odb, loose.c_ptr(), 8) == 0);
+  git_odb_object_free(object);
+
+  {
+    bulk_write_session first(repo);
+    first.close();
+    bulk_write_session second(repo);
+    // Closing or destroying the first session leaves the second alone
+    REQUIRE_THROWS(first.close());
+    REQUIRE(second.is_open());
+    auto packed = repo.create_blob_from_buffer("packed");
+    REQUIRE(!is_loose(dir.path(), packed));
+    REQUIRE(second.size() == 1);
+  }
+  REQUIRE(git_odb_num_backends(odb) == backends + 1);
+  git_odb_free(odb);
+}
@@ -0,0 +1,143 @@
+#include <cppgit2/config.hpp>
+#include <cppgit2/config_view.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+#include <thread>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+const char local_config[] = "[core]\n"
+                            "\tbare = false\n"
+                            "\trepositoryformatversion = 0\n"
+                            "[Section]\n"
+                            "\tYes = yes\n"
+                            "\tOn = on\n"
+                            "\tOne = 1\n"
+                            "\tOff = off\n"
+                            "\tImplicit\n"
+                            "\tEmpty =\n"
+                            "\tKilo = 2k\n"
+                            "\tMega = 3m\n"
+                            "\tGiga = 3g\n"
+                            "\tNegative = -42\n"
+                            "\tText = \"quoted value \" # comment\n"
+                            "[remote \"Origin\"]\n"
+                            "\turl = upper\n"
+                            "[remote \"origin\"]\n"
+                            "\turl = lower\n"
+                            "\tfetch = +refs/heads/a:refs/remotes/origin/a\n"
+                            "\tfetch = +refs/heads/b:refs/remotes/origin/b\n"
+                            "[section]\n"
+                            "\ttext = last wins\n";
+
+std::vector<std::string> libgit2_values(const repository &repo,
+                                        const std::string &name) {
+  std::vector<std::string> values;
+  git_config *cfg = nullptr;
+  REQUIRE(git_repository_config_snapshot(
+              &cfg, const_cast<git_repository *>(repo.c_ptr())) == 0);
+  git_config_iterator *iter = nullptr;
+  REQUIRE(git_config_multivar_iterator_new(&iter, cfg, name.c_str(),
+                                           nullptr) == 0);
+  git_config_entry *entry = nullptr;
+  while (git_config_next(&entry, iter) == 0)
+    values.push_back(entry->value ? entry->value : "");
+  git_config_iterator_free(iter);
+  git_config_free(cfg);
+  return values;
+}
+
+std::vector<std::string> strings(const std::vector<string_view> &views) {
+  std::vector<std::string> result;
+  for (auto &view : views)
+    result.push_back(view.to_string());
+  return result;
+}
+
+} // namespace
+
+TEST_CASE("Read what config reads" * test_suite("config_view")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  write_file(repo.path() + "config", local_config);
+  auto cfg = repo.config();
+  auto view = cfg.frozen_snapshot();
+  config_view watched(repo);
+
+  // Integers are booleans too, as in git
+  for (auto name : {"section.yes", "section.on", "section.one",
+                    "section.off", "section.implicit", "section.kilo",
+                    "core.bare"}) {
+    CAPTURE(name);
+    REQUIRE(view.value_as_bool(name) == cfg.value_as_bool(name));
+    REQUIRE(watched.value_as_bool(name) == cfg.value_as_bool(name));
+  }
+  for (auto name : {"section.kilo", "section.mega", "section.one",
+                    "section.negative"}) {
+    CAPTURE(name);
+    REQUIRE(view.value_as_int32(name) == cfg.value_as_int32(name));
+    REQUIRE(view.value_as_int64(name) == cfg.value_as_int64(name));
+  }
+  REQUIRE(view.value_as_int64("section.giga") ==
+          cfg.value_as_int64("section.giga"));
+  REQUIRE_THROWS_AS(cfg.value_as_int32("section.giga"), git_exception);
+  REQUIRE(view.value_as_string("section.empty") == string_view(""));
+  // The last value read wins, whatever the case of the section
+  REQUIRE(view.value_as_string("section.text").to_string() ==
+          libgit2_values(repo, "section.text").back());
+  REQUIRE(view.value_as_string("section.text") == string_view("last wins"));
+
+  // Sections and keys fold case, subsections do not
+  REQUIRE(view.value_as_bool("SECTION.YES"));
+  REQUIRE(view.value_as_string("Remote.Origin.URL") == string_view("upper"));
+  REQUIRE(view.value_as_string("remote.origin.url") == string_view("lower"));
+  REQUIRE(!view.contains("remote.ORIGIN.url"));
+  REQUIRE(strings(view.values("remote.origin.fetch")) ==
+          libgit2_values(repo, "remote.origin.fetch"));
+  REQUIRE(strings(view.values("section.text")) ==
+          libgit2_values(repo, "section.text"));
+  REQUIRE(view.values("missing.key").empty());
+
+  // Missing and unparsable values
+  REQUIRE_THROWS_AS(view.value_as_string("missing.key"), git_exception);
+  REQUIRE(view.value_as_string("missing.key", "fallback") ==
+          string_view("fallback"));
+  REQUIRE(view.value_as_int32("missing.key", 7) == 7);
+  REQUIRE(!view.value_as_bool("missing.key", false));
+  REQUIRE_THROWS_AS(view.value_as_bool("section.text"), git_exception);
+  REQUIRE_THROWS_AS(view.value_as_int32("section.giga"), git_exception);
+  REQUIRE_THROWS_AS(view.value_as_int64("section.text", 1), git_exception);
+}
+
+TEST_CASE("Notice changed configuration files" * test_suite("config_view")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  write_file(repo.path() + "config", local_config);
+  config_view view(repo);
+  REQUIRE(view.is_current());
+  REQUIRE(!view.contains("added.key"));
+  // A frozen snapshot watches nothing
+  auto frozen = repo.config().frozen_snapshot();
+
+  config_view_cache cache(repo, std::chrono::milliseconds(0));
+  auto before = cache.get();
+  REQUIRE(!before->contains("added.key"));
+
+  write_file(repo.path() + "config",
+             std::string(local_config) + "[added]\n\tkey = 1\n");
+  REQUIRE(!view.is_current());
+  REQUIRE(frozen.is_current());
+  auto reloaded = view.reload();
+  REQUIRE(reloaded.is_current());
+  REQUIRE(reloaded.value_as_int32("added.key") == 1);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  auto after = cache.get();
+  REQUIRE(after->value_as_int32("added.key") == 1);
+  // Views handed out earlier stay as they were
+  REQUIRE(!before->contains("added.key"));
+  REQUIRE(cache.get() == after);
+}
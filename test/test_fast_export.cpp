@@ -0,0 +1,178 @@
+#include <cppgit2/fast_export.hpp>
+#include <cppgit2/fast_import.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <sstream>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_repository *raw(const repository &repo) {
+  return const_cast<git_repository *>(repo.c_ptr());
+}
+
+typedef std::vector<std::tuple<std::string, std::string, uint32_t>> files;
+
+// Commit `content` (path, content, mode) on `ref` with `parents`
+oid commit_on(const repository &repo, const std::string &ref,
+              const files &content, const std::vector<oid> &parents,
+              const std::string &message) {
+  git_index *index = nullptr;
+  REQUIRE(git_index_new(&index) == 0);
+  for (auto &file : content) {
+    git_index_entry entry = {};
+    entry.path = std::get<0>(file).c_str();
+    entry.mode = std::get<2>(file);
+    entry.id = *repo.create_blob_from_buffer(std::get<1>(file)).c_ptr();
+    REQUIRE(git_index_add(index, &entry) == 0);
+  }
+  oid tree;
+  REQUIRE(git_index_write_tree_to(tree.c_ptr(), index, raw(repo)) == 0);
+  git_index_free(index);
+  std::vector<commit> parent_commits;
+  for (auto &parent : parents)
+    parent_commits.push_back(repo.lookup_commit(parent));
+  signature author("A U Thor", "author@example.com",
+                   1500000000 + 100 * static_cast<long>(message.size()), 60);
+  signature committer("C O Mitter", "c@example.com", 1500000000, -120);
+  return repo.create_commit(ref, author, committer, "UTF-8", message,
+                            repo.lookup_tree(tree), parent_commits);
+}
+
+oid target_of(const repository &repo, const std::string &name) {
+  oid id;
+  REQUIRE(git_reference_name_to_id(id.c_ptr(), raw(repo), name.c_str()) == 0);
+  return id;
+}
+
+std::string export_stream(fast_export &exporter,
+                          fast_export::statistics *stats = nullptr) {
+  std::ostringstream out;
+  auto result = exporter.run(out);
+  if (stats)
+    *stats = result;
+  return out.str();
+}
+
+void import_stream(repository &repo, const std::string &stream,
+                   const std::string &marks = std::string()) {
+  fast_import importer(repo);
+  if (!marks.empty())
+    importer.import_marks(marks);
+  std::istringstream in(stream);
+  importer.run(in);
+}
+
+} // namespace
+
+TEST_CASE("Round-trip a history through fast_import" *
+          test_suite("fast_export")) {
+  temporary_directory dir;
+  auto source = repository::init(dir.path() + "source", true);
+  const uint32_t blob = GIT_FILEMODE_BLOB;
+  auto base = commit_on(source, "refs/heads/master",
+                        {std::make_tuple("a.txt", "a\n", blob),
+                         std::make_tuple("dir/sub/b", "b\n", blob),
+                         std::make_tuple("run.sh", "#!/bin/sh\n",
+                                         GIT_FILEMODE_BLOB_EXECUTABLE)},
+                        {}, "base");
+  auto main = commit_on(source, "refs/heads/master",
+                        {std::make_tuple("a.txt", "a\nmore\n", blob),
+                         std::make_tuple("dir/sub/b", "b\n", blob),
+                         std::make_tuple("link", "a.txt", GIT_FILEMODE_LINK),
+                         std::make_tuple("run.sh", "#!/bin/sh\n", blob)},
+                        {base}, "main line");
+  auto side = commit_on(source, "refs/heads/topic",
+                        {std::make_tuple("a.txt", "a\n", blob),
+                         std::make_tuple("moved/b", "b\n", blob),
+                         std::make_tuple("run.sh", "#!/bin/sh\n",
+                                         GIT_FILEMODE_BLOB_EXECUTABLE)},
+                        {base}, "side");
+  auto merge = commit_on(source, "refs/heads/master",
+                         {std::make_tuple("a.txt", "a\nmore\n", blob),
+                          std::make_tuple("link", "a.txt", GIT_FILEMODE_LINK),
+                          std::make_tuple("moved/b", "b\n", blob)},
+                         {main, side}, "merge both\n\nwith a body\n");
+  signature tagger("T A Gger", "t@example.com", 1500000500, 0);
+  git_oid tag;
+  REQUIRE(git_tag_create(&tag, raw(source), "v1",
+                         source.lookup_object(base, object::object_type::commit)
+                             .c_ptr(),
+                         tagger.c_ptr(), "version 1\n", 0) == 0);
+  git_reference *light = nullptr;
+  REQUIRE(git_reference_create(&light, raw(source), "refs/tags/light",
+                               side.c_ptr(), 0, "tag") == 0);
+  git_reference_free(light);
+
+  fast_export exporter(source);
+  exporter.push_glob("refs/heads/*");
+  exporter.push_glob("refs/tags/*");
+  fast_export::statistics stats;
+  auto stream = export_stream(exporter, &stats);
+  REQUIRE(stats.commits == 4);
+  REQUIRE(stats.blobs == 5);
+  REQUIRE(stats.tags == 1);
+  REQUIRE(stats.refs_skipped.empty());
+
+  // Unsigned commits come back with the same ids
+  auto target = repository::init(dir.path() + "target", true);
+  import_stream(target, stream);
+  REQUIRE(target_of(target, "refs/heads/master") == merge);
+  REQUIRE(target_of(target, "refs/heads/topic") == side);
+  REQUIRE(target_of(target, "refs/tags/light") == side);
+  REQUIRE(target_of(target, "refs/tags/v1") == oid(&tag));
+}
+
+TEST_CASE("Export only what is new since the last marks" *
+          test_suite("fast_export")) {
+  temporary_directory dir;
+  auto source = repository::init(dir.path() + "source", true);
+  auto target = repository::init(dir.path() + "target", true);
+  const uint32_t blob = GIT_FILEMODE_BLOB;
+  auto first = commit_on(source, "refs/heads/master",
+                         {std::make_tuple("a", "1\n", blob)}, {}, "first");
+
+  fast_export exporter(source);
+  exporter.push_reference("refs/heads/master");
+  import_stream(target, export_stream(exporter));
+  exporter.export_marks(dir.path() + "marks");
+  REQUIRE(read_file(dir.path() + "marks") ==
+          ":1 " + source.lookup_commit(first).tree().lookup_entry_by_name("a")
+                      .id()
+                      .to_hex_string() +
+              "\n:2 " + first.to_hex_string() + "\n");
+
+  auto second = commit_on(source, "refs/heads/master",
+                          {std::make_tuple("a", "1\n", blob),
+                           std::make_tuple("b", "2\n", blob)},
+                          {first}, "second");
+  fast_export next(source);
+  next.import_marks(dir.path() + "marks");
+  next.push_reference("refs/heads/master");
+  fast_export::statistics stats;
+  auto stream = export_stream(next, &stats);
+  REQUIRE(stats.commits == 1);
+  REQUIRE(stats.blobs == 1);
+  REQUIRE(stream.find("from :2\n") != std::string::npos);
+  import_stream(target, stream, dir.path() + "marks");
+  REQUIRE(target_of(target, "refs/heads/master") == second);
+  next.export_marks(dir.path() + "marks");
+
+  // Hidden commits are named by id
+  fast_export hidden(source);
+  hidden.hide(first);
+  hidden.push_reference("refs/heads/master");
+  stream = export_stream(hidden, &stats);
+  REQUIRE(stats.commits == 1);
+  REQUIRE(stream.find("from " + first.to_hex_string() + "\n") !=
+          std::string::npos);
+
+  // Nothing new: the reference becomes a reset
+  fast_export again(source);
+  again.import_marks(dir.path() + "marks");
+  again.push_reference("refs/heads/master");
+  REQUIRE(export_stream(again, &stats).find("commit ") == std::string::npos);
+  REQUIRE(stats.commits == 0);
+}
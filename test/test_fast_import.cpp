@@ -0,0 +1,145 @@
+#include <cppgit2/fast_import.hpp>
+#include <cppgit2/repository.hpp>
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <doctest.hpp>
+#include <sstream>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+// Commit ids are those git fast-import gives for the same streams
+const char first_stream[] = "blob\n"
+                            "mark :1\n"
+                            "data 6\n"
+                            "hello\n"
+                            "\n"
+                            "commit refs/heads/master\n"
+                            "mark :2\n"
+                            "committer C O Mitter <c@example.com> "
+                            "1500000000 +0000\n"
+                            "data 6\n"
+                            "first\n"
+                            "\n"
+                            "M 100644 :1 a.txt\n"
+                            "\n"
+                            "checkpoint\n"
+                            "\n"
+                            "blob\n"
+                            "mark :3\n"
+                            "data 4\n"
+                            "new\n"
+                            "\n"
+                            "commit refs/heads/master\n"
+                            "mark :4\n"
+                            "committer C O Mitter <c@example.com> "
+                            "1500000100 +0000\n"
+                            "data 7\n"
+                            "second\n"
+                            "\n"
+                            "from :2\n"
+                            "M 100644 :3 dir/b.txt\n"
+                            "D a.txt\n"
+                            "\n";
+
+const char first_commit[] = "d22757493951db71ef7e98648e3d5108387f361a";
+const char second_commit[] = "0058e1b4310a941b00f3a63b04940da762974471";
+const char second_tree[] = "ab0c02891d40e27b828bcf227d56f0dde8a7be4d";
+
+// A commit on an existing branch without `from`, then one continuing it
+const char second_stream[] = "commit refs/heads/master\n"
+                             "mark :5\n"
+                             "committer C O Mitter <c@example.com> "
+                             "1500000200 +0000\n"
+                             "data 5\n"
+                             "root\n"
+                             "\n"
+                             "M 100644 inline c.txt\n"
+                             "data 2\n"
+                             "c\n"
+                             "\n"
+                             "commit refs/heads/topic\n"
+                             "committer C O Mitter <c@example.com> "
+                             "1500000300 +0000\n"
+                             "data 5\n"
+                             "cont\n"
+                             "\n"
+                             "from refs/heads/master^0\n"
+                             "M 100644 inline d.txt\n"
+                             "data 2\n"
+                             "d\n"
+                             "\n";
+
+const char topic_commit[] = "71d68b27b8b1cbc18f47cc57233f52121f3b1bc0";
+
+std::vector<std::string> list_directory(const std::string &path) {
+  std::vector<std::string> names;
+  if (auto dir = opendir(path.c_str())) {
+    while (auto entry = readdir(dir))
+      if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+        names.push_back(entry->d_name);
+    closedir(dir);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+fast_import::statistics import(repository &repo, const char *stream) {
+  fast_import importer(repo);
+  std::istringstream in(stream);
+  return importer.run(in);
+}
+
+} // namespace
+
+TEST_CASE("Import a stream" * test_suite("fast_import")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  fast_import importer(repo);
+  std::istringstream in(first_stream);
+  auto stats = importer.run(in);
+  REQUIRE(stats.blobs == 2);
+  REQUIRE(stats.commits == 2);
+  REQUIRE(stats.refs_skipped.empty());
+  REQUIRE(importer.mark(2).to_hex_string() == first_commit);
+  REQUIRE(importer.mark(4).to_hex_string() == second_commit);
+
+  auto head = repo.lookup_reference("refs/heads/master").target();
+  REQUIRE(head.to_hex_string() == second_commit);
+  auto commit = repo.lookup_commit(head);
+  REQUIRE(commit.parent_count() == 1);
+  REQUIRE(commit.parent_id(0).to_hex_string() == first_commit);
+  REQUIRE(commit.tree_id().to_hex_string() == second_tree);
+
+  // One pack per checkpoint, no loose objects
+  auto objects = list_directory(dir.path() + "objects");
+  REQUIRE(objects == std::vector<std::string>{"info", "pack"});
+  size_t packs = 0;
+  for (auto &name : list_directory(dir.path() + "objects/pack"))
+    if (name.size() > 5 && name.compare(name.size() - 5, 5, ".pack") == 0)
+      ++packs;
+  REQUIRE(packs == 2);
+}
+
+TEST_CASE("Start branches as root commits" * test_suite("fast_import")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  import(repo, first_stream);
+  auto stats = import(repo, second_stream);
+
+  // The root commit does not contain master's commit, so master stays
+  REQUIRE(stats.commits == 2);
+  REQUIRE(stats.refs_skipped == std::vector<std::string>{"refs/heads/master"});
+  REQUIRE(repo.lookup_reference("refs/heads/master")
+              .target()
+              .to_hex_string() == second_commit);
+
+  auto topic = repo.lookup_reference("refs/heads/topic").target();
+  REQUIRE(topic.to_hex_string() == topic_commit);
+  auto commit = repo.lookup_commit(topic);
+  REQUIRE(commit.parent_count() == 1);
+  REQUIRE(commit.parent_id(0).to_hex_string() == second_commit);
+}
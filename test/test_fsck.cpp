@@ -0,0 +1,118 @@
+#include <cppgit2/fsck.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_repository *raw(const repository &repo) {
+  return const_cast<git_repository *>(repo.c_ptr());
+}
+
+std::string loose_path(const repository &repo, const oid &id) {
+  auto hex = id.to_hex_string();
+  return repo.path() + "objects/" + hex.substr(0, 2) + "/" + hex.substr(2);
+}
+
+// Replace the loose object file of `id`
+void overwrite(const repository &repo, const oid &id,
+               const std::string &content) {
+  auto path = loose_path(repo, id);
+  REQUIRE(remove(path.c_str()) == 0);
+  write_file(path, content);
+}
+
+std::vector<fsck::problem> check(const repository &repo,
+                                 fsck::statistics *stats = nullptr) {
+  std::vector<fsck::problem> problems;
+  auto result = fsck(repo, 2).check(
+      [&](const fsck::problem &p) { problems.push_back(p); });
+  if (stats)
+    *stats = result;
+  REQUIRE(result.problems == problems.size());
+  return problems;
+}
+
+bool has_problem(const std::vector<fsck::problem> &problems,
+                 fsck::problem_type type, const oid &id,
+                 const std::string &path = std::string()) {
+  for (auto &p : problems)
+    if (p.type == type && p.id == id && (path.empty() || p.path == path))
+      return true;
+  return false;
+}
+
+} // namespace
+
+TEST_CASE("Find nothing wrong with a sound repository" * test_suite("fsck")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  commit_files(repo, {{"a", "1"}});
+  commit_files(repo, {{"a", "2"}, {"b", "3"}});
+  fsck::statistics stats;
+  REQUIRE(check(repo, &stats).empty());
+  REQUIRE(stats.objects == 7);
+  REQUIRE(stats.commits == 2);
+  REQUIRE(stats.trees == 2);
+  REQUIRE(stats.blobs == 3);
+  REQUIRE(stats.tags == 0);
+}
+
+TEST_CASE("Report corrupted and missing objects" * test_suite("fsck")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  auto blob = repo.create_blob_from_buffer("1");
+  auto other = repo.create_blob_from_buffer("other");
+  auto commit = commit_files(repo, {{"a", "1"}, {"b", "2"}});
+  auto missing = repo.create_blob_from_buffer("2");
+  auto hex = commit.to_hex_string();
+
+  // A valid object stored under the wrong id, and one deleted
+  overwrite(repo, blob, read_file(loose_path(repo, other)));
+  REQUIRE(remove(loose_path(repo, missing).c_str()) == 0);
+  auto problems = check(repo);
+  REQUIRE(has_problem(problems, fsck::problem_type::hash_mismatch, blob));
+  REQUIRE(has_problem(problems, fsck::problem_type::broken_link, blob,
+                      hex + ":a"));
+  REQUIRE(has_problem(problems, fsck::problem_type::missing, missing,
+                      hex + ":b"));
+  REQUIRE(problems.size() == 3);
+
+  // Bytes that do not inflate
+  overwrite(repo, blob, "not zlib");
+  problems = check(repo);
+  REQUIRE(has_problem(problems, fsck::problem_type::unreadable, blob));
+}
+
+TEST_CASE("Report links to objects of the wrong type" * test_suite("fsck")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  auto commit = commit_files(repo, {{"a", "1"}});
+  auto tree = repo.lookup_commit(commit).tree_id();
+
+  // A tree that calls a tree a blob, which strict creation would refuse
+  git_libgit2_opts(GIT_OPT_ENABLE_STRICT_OBJECT_CREATION, 0);
+  git_treebuilder *builder = nullptr;
+  REQUIRE(git_treebuilder_new(&builder, raw(repo), nullptr) == 0);
+  REQUIRE(git_treebuilder_insert(nullptr, builder, "file", tree.c_ptr(),
+                                 GIT_FILEMODE_BLOB) == 0);
+  oid bad;
+  REQUIRE(git_treebuilder_write(bad.c_ptr(), builder) == 0);
+  git_treebuilder_free(builder);
+  git_libgit2_opts(GIT_OPT_ENABLE_STRICT_OBJECT_CREATION, 1);
+  signature who("A U Thor", "author@example.com", 1500000000, 0);
+  oid wrong = repo.create_commit("refs/heads/wrong", who, who, "UTF-8",
+                                 "wrong", repo.lookup_tree(bad), {});
+
+  auto problems = check(repo);
+  REQUIRE(problems.size() == 1);
+  REQUIRE(has_problem(problems, fsck::problem_type::wrong_type, tree,
+                      wrong.to_hex_string() + ":file"));
+
+  // Without the connectivity walk only the objects themselves are checked
+  size_t reported = 0;
+  fsck(repo, 2).check([&](const fsck::problem &) { ++reported; }, false);
+  REQUIRE(reported == 0);
+}
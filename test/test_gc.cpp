@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cppgit2/gc.hpp>
+#include <cppgit2/repository.hpp>
+#include <ctime>
+#include <doctest.hpp>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_repository *raw(const repository &repo) {
+  return const_cast<git_repository *>(repo.c_ptr());
+}
+
+// Looked up through a new handle, which has not mapped any deleted pack
+bool has_object(const repository &repo, const oid &id) {
+  auto fresh = repository::open(repo.path());
+  git_odb *odb = nullptr;
+  REQUIRE(git_repository_odb(&odb, raw(fresh)) == 0);
+  bool found = git_odb_exists(odb, id.c_ptr()) != 0;
+  git_odb_free(odb);
+  return found;
+}
+
+bool contains(const std::vector<oid> &ids, const oid &id) {
+  return std::find(ids.begin(), ids.end(), id) != ids.end();
+}
+
+size_t count_files(const std::string &directory, const std::string &suffix) {
+  size_t count = 0;
+  if (DIR *dir = opendir(directory.c_str())) {
+    while (auto found = readdir(dir)) {
+      std::string name(found->d_name);
+      count += name.size() > suffix.size() &&
+               name.compare(name.size() - suffix.size(), suffix.size(),
+                            suffix) == 0;
+    }
+    closedir(dir);
+  }
+  return count;
+}
+
+void force_update(const repository &repo, const std::string &name,
+                  const oid &id) {
+  git_reference *ref = nullptr;
+  REQUIRE(git_reference_create(&ref, raw(repo), name.c_str(), id.c_ptr(), 1,
+                               "reset") == 0);
+  git_reference_free(ref);
+}
+
+} // namespace
+
+TEST_CASE("Mark through references, reflogs and the index" *
+          test_suite("gc")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  commit_files(repo, {{"a", "1"}});
+  auto second = commit_files(repo, {{"a", "2"}});
+  auto third = commit_files(repo, {{"a", "3"}, {"b", "third"}});
+  auto third_blob = repo.create_blob_from_buffer("third");
+  force_update(repo, "refs/heads/master", second);
+  auto loose_blob = repo.create_blob_from_buffer("unreferenced");
+
+  // A blob that only the index refers to
+  git_index *index = nullptr;
+  REQUIRE(git_repository_index(&index, raw(repo)) == 0);
+  git_index_entry entry = {};
+  entry.path = "staged";
+  entry.mode = GIT_FILEMODE_BLOB;
+  auto staged = repo.create_blob_from_buffer("staged");
+  entry.id = *staged.c_ptr();
+  REQUIRE(git_index_add(index, &entry) == 0);
+  REQUIRE(git_index_write(index) == 0);
+  git_index_free(index);
+
+  gc collector(repo, 2);
+  auto report = collector.mark();
+  // Three commits, three trees, four blobs ("1", "2", "3", "third"),
+  // "staged" and the unreferenced blob
+  REQUIRE(report.objects == 12);
+  REQUIRE(report.reachable == 11);
+  REQUIRE(report.unreachable_loose == std::vector<oid>{loose_blob});
+  REQUIRE(report.unreachable_packed.empty());
+  // The third commit is only in the reflogs now
+  REQUIRE(collector.is_reachable(third));
+  REQUIRE(collector.is_reachable(third_blob));
+  REQUIRE(collector.is_reachable(staged));
+
+  // Without the reflogs, it is gone after a prune
+  remove((dir.path() + ".git/logs/refs/heads/master").c_str());
+  remove((dir.path() + ".git/logs/HEAD").c_str());
+  report = collector.mark();
+  REQUIRE(report.reachable == 7);
+  REQUIRE(!collector.is_reachable(third));
+  REQUIRE(contains(report.unreachable_loose, third_blob));
+  REQUIRE(collector.prune(std::time(nullptr) - 3600) == 0);
+  REQUIRE(collector.prune(std::time(nullptr) + 3600) == 5);
+  REQUIRE(!has_object(repo, third));
+  REQUIRE(!has_object(repo, third_blob));
+  REQUIRE(!has_object(repo, loose_blob));
+  REQUIRE(has_object(repo, second));
+  REQUIRE(has_object(repo, staged));
+}
+
+TEST_CASE("Repack the reachable objects" * test_suite("gc")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto first = commit_files(repo, {{"a", "1"}});
+  auto second = commit_files(repo, {{"a", "2"}});
+  auto loose_blob = repo.create_blob_from_buffer("unreferenced");
+  auto pack_dir = dir.path() + ".git/objects/pack/";
+
+  gc collector(repo, 2);
+  collector.mark();
+  auto pack = collector.repack(std::time(nullptr) + 3600);
+  REQUIRE(count_files(pack_dir, ".pack") == 1);
+  REQUIRE(count_files(pack_dir, ".idx") == 1);
+  REQUIRE(read_file(pack_dir + "pack-" + pack.to_hex_string() + ".pack")
+              .size() > 0);
+  // Packed objects are no longer loose
+  auto hex = second.to_hex_string();
+  struct stat st;
+  REQUIRE(stat((dir.path() + ".git/objects/" + hex.substr(0, 2) + "/" +
+                hex.substr(2))
+                   .c_str(),
+               &st) != 0);
+  // The unreachable object stays loose until it is pruned
+  REQUIRE(has_object(repo, loose_blob));
+  REQUIRE(has_object(repo, second));
+
+  // Once master moves back, the second commit is unreachable and packed
+  force_update(repo, "refs/heads/master", first);
+  remove((dir.path() + ".git/logs/refs/heads/master").c_str());
+  remove((dir.path() + ".git/logs/HEAD").c_str());
+  auto report = collector.mark();
+  REQUIRE(report.reachable == 3);
+  REQUIRE(contains(report.unreachable_packed, second));
+  auto repacked = collector.repack(std::time(nullptr) + 3600);
+  REQUIRE(!(repacked == pack));
+  REQUIRE(count_files(pack_dir, ".pack") == 1);
+  REQUIRE(!has_object(repo, second));
+  REQUIRE(has_object(repo, first));
+
+  // A pack newer than the expiry time keeps its objects
+  auto recent = commit_files(repo, {{"a", "recent"}});
+  collector.mark();
+  collector.repack(std::time(nullptr) + 3600);
+  force_update(repo, "refs/heads/master", first);
+  remove((dir.path() + ".git/logs/refs/heads/master").c_str());
+  remove((dir.path() + ".git/logs/HEAD").c_str());
+  collector.mark();
+  collector.repack(std::time(nullptr) - 3600);
+  REQUIRE(has_object(repo, recent));
+}
@@ -0,0 +1,121 @@
+#include <cppgit2/ignore_matcher.hpp>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/status_engine.hpp>
+#include <doctest.hpp>
+#include <sys/stat.h>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+// Whether libgit2 agrees with the matcher about `path`
+bool libgit2_ignores(const repository &repo, const std::string &path) {
+  int ignored = 0;
+  REQUIRE(git_ignore_path_is_ignored(
+              &ignored, const_cast<git_repository *>(repo.c_ptr()),
+              path.c_str()) == 0);
+  return ignored != 0;
+}
+
+void make_tree(const std::string &workdir) {
+  mkdir((workdir + "sub").c_str(), 0777);
+  mkdir((workdir + "build").c_str(), 0777);
+  write_file(workdir + ".gitignore", "*.log\n"
+                                     "!keep.log\n"
+                                     "build/\n"
+                                     "!build/wanted.txt\n"
+                                     "/root-only\n"
+                                     "!wanted.tmp\n");
+  write_file(workdir + "sub/.gitignore", "!sub.log\n"
+                                         "keep.log\n");
+  write_file(workdir + ".git/info/exclude", "*.tmp\n");
+}
+
+} // namespace
+
+TEST_CASE("Apply ignore rules in git's order" * test_suite("ignore_matcher")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  make_tree(dir.path());
+  ignore_matcher matcher(repo, 2);
+
+  // As git check-ignore answers. libgit2 drops a '!' rule that does not
+  // follow a rule it negates in the same file, so it ignores sub/sub.log
+  // and wanted.tmp
+  std::vector<std::pair<std::string, bool>> expected{
+      {"a.log", true},
+      {"keep.log", false},        // '!' re-includes
+      {"sub/a.log", true},        // the root .gitignore applies below
+      {"sub/sub.log", false},     // a deeper file overrides it
+      {"sub/keep.log", true},     // in both directions
+      {"build/", true},           // directory-only rule
+      {"build", false},           // ...which a file does not match
+      {"build/wanted.txt", true}, // no re-include below an ignored directory
+      {"root-only", true},
+      {"sub/root-only", false},   // anchored at its .gitignore
+      {"other.tmp", true},        // info/exclude
+      {"wanted.tmp", false},      // .gitignore before info/exclude
+      {"a.txt", false},
+      {".git", true}};
+  std::vector<std::string> paths;
+  for (auto &e : expected) {
+    CHECK_MESSAGE(matcher.is_ignored(e.first) == e.second, e.first);
+    paths.push_back(e.first);
+  }
+  auto classified = matcher.classify(paths);
+  for (size_t i = 0; i < paths.size(); ++i)
+    CHECK_MESSAGE(classified[i] == expected[i].second, paths[i]);
+  REQUIRE(matcher.is_directory_ignored("build"));
+  REQUIRE(!matcher.is_directory_ignored("sub/"));
+}
+
+TEST_CASE("Check extra ignore rules first" * test_suite("ignore_matcher")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  make_tree(dir.path());
+  // The same rules given to libgit2, for comparison
+  const std::string rules = "*.gen\nkeep.log\n!x.gen";
+  repo.add_ignore_rules(rules);
+  ignore_matcher matcher(repo, 0, rules);
+  std::vector<std::pair<std::string, bool>> expected{
+      {"y.gen", true},
+      {"sub/y.gen", true},
+      {"keep.log", true}, // although .gitignore re-includes it
+      {"sub/keep.log", true},
+      {"x.gen", false},
+      {"sub/x.gen", false},
+      {"a.log", true},
+      {"a.txt", false}};
+  for (auto &e : expected) {
+    CHECK_MESSAGE(matcher.is_ignored(e.first) == e.second, e.first);
+    CHECK_MESSAGE(libgit2_ignores(repo, e.first) == e.second, e.first);
+  }
+
+  ignore_matcher plain(repo);
+  REQUIRE(!plain.is_ignored("y.gen"));
+  REQUIRE(!plain.is_ignored("keep.log"));
+  REQUIRE(plain.is_ignored("a.log"));
+}
+
+TEST_CASE("Report files ignored by extra rules" *
+          test_suite("ignore_matcher")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  write_file(dir.path() + "x.gen", "generated");
+
+  status::options options;
+  options.set_flags(status::options::flag::include_untracked |
+                    status::options::flag::include_ignored);
+  for (auto rules : {"", "*.gen"}) {
+    status_engine engine(repo, options, 2, rules);
+    std::vector<std::pair<std::string, status::status_type>> result;
+    engine.for_each_status(
+        [&](const std::string &path, status::status_type type) {
+          result.emplace_back(path, type);
+        });
+    auto type = *rules ? status::status_type::ignored
+                       : status::status_type::wt_new;
+    REQUIRE(result == decltype(result){{"x.gen", type}});
+  }
+}
@@ -0,0 +1,154 @@
+#include <cppgit2/index_view.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <sys/stat.h>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_repository *raw(const repository &repo) {
+  return const_cast<git_repository *>(repo.c_ptr());
+}
+
+// A work tree with nested directories, staged in the index with a
+// conflict and a skip-worktree entry, written as index version `version`
+// and read back
+git_index *stage_files(const repository &repo, const std::string &root,
+                       unsigned int version) {
+  mkdir((root + "dir").c_str(), 0777);
+  mkdir((root + "dir/sub").c_str(), 0777);
+  mkdir((root + "dir2").c_str(), 0777);
+  const char *files[] = {"a", "dir/b", "dir/sub/c", "dir/sub/d", "dir2/e",
+                         "dir.txt", "z"};
+  git_index *index = nullptr;
+  REQUIRE(git_repository_index(&index, raw(repo)) == 0);
+  for (auto file : files) {
+    write_file(root + file, std::string(file) + "\n");
+    REQUIRE(git_index_add_bypath(index, file) == 0);
+  }
+  git_oid tree;
+  REQUIRE(git_index_write_tree(&tree, index) == 0);
+
+  git_index_entry ours = *git_index_get_bypath(index, "a", 0);
+  git_index_entry theirs = ours;
+  ours.path = theirs.path = "conflict";
+  REQUIRE(git_index_conflict_add(index, nullptr, &ours, &theirs) == 0);
+  git_index_entry sparse = *git_index_get_bypath(index, "z", 0);
+  sparse.flags_extended |= GIT_INDEX_ENTRY_SKIP_WORKTREE;
+  REQUIRE(git_index_add(index, &sparse) == 0);
+  REQUIRE(git_index_set_version(index, version) == 0);
+  REQUIRE(git_index_write(index) == 0);
+  git_index_free(index);
+
+  // What was written, read back (libgit2 drops extended flags from
+  // version 4 entries)
+  REQUIRE(git_index_open(&index, (root + ".git/index").c_str()) == 0);
+  return index;
+}
+
+// Every entry of the view reads as libgit2 reads it
+void require_same_entries(const index_view &view, git_index *index) {
+  REQUIRE(view.size() == git_index_entrycount(index));
+  size_t position = 0;
+  for (auto entry : view) {
+    auto expected = git_index_get_byindex(index, position++);
+    CAPTURE(expected->path);
+    REQUIRE(entry.path() == string_view(expected->path));
+    REQUIRE(entry.id() == oid(&expected->id));
+    REQUIRE(entry.mode() == expected->mode);
+    REQUIRE(entry.stage() == git_index_entry_stage(expected));
+    REQUIRE(entry.file_size() == expected->file_size);
+    REQUIRE(entry.mtime().seconds == expected->mtime.seconds);
+    REQUIRE(entry.ino() == expected->ino);
+    REQUIRE(entry.skip_worktree() ==
+            ((expected->flags_extended & GIT_INDEX_ENTRY_SKIP_WORKTREE) != 0));
+  }
+  REQUIRE(position == view.size());
+}
+
+} // namespace
+
+TEST_CASE("Read the entries libgit2 reads" * test_suite("index_view")) {
+  for (unsigned int version : {2u, 3u, 4u}) {
+    CAPTURE(version);
+    temporary_directory dir;
+    auto repo = repository::init(dir.path(), false);
+    auto index = stage_files(repo, dir.path(), version);
+    index_view view(repo, 2);
+    // A skip-worktree entry needs extended flags, so version 2 becomes 3
+    REQUIRE(view.version() == (version == 2 ? 3 : version));
+    require_same_entries(view, index);
+    git_index_free(index);
+  }
+}
+
+TEST_CASE("Look up paths and directories" * test_suite("index_view")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto index = stage_files(repo, dir.path(), 4);
+  index_view view(dir.path() + ".git/index");
+
+  size_t position = 0;
+  REQUIRE(git_index_find(&position, index, "dir/sub/c") == 0);
+  REQUIRE(view.find("dir/sub/c") == position);
+  REQUIRE(view.find("dir/sub") == index_view::npos);
+  REQUIRE(view.find("a", 1) == index_view::npos);
+  REQUIRE(view.find("conflict", 2) != index_view::npos);
+  REQUIRE(view.entry_at(view.find("conflict", 3)).is_conflict());
+  REQUIRE(view.find("conflict", 0) == index_view::npos);
+
+  // "dir.txt" sorts between "dir" and "dir/", and is not under dir
+  auto range = view.directory_range("dir");
+  REQUIRE(range.second - range.first == 3);
+  REQUIRE(view.entry_at(range.first).path() == string_view("dir/b"));
+  REQUIRE(view.entry_at(range.second - 1).path() == string_view("dir/sub/d"));
+  range = view.directory_range("dir/sub");
+  REQUIRE(range.second - range.first == 2);
+  range = view.directory_range("");
+  REQUIRE(range.first == 0);
+  REQUIRE(range.second == view.size());
+  REQUIRE(view.directory_range("none").first ==
+          view.directory_range("none").second);
+  REQUIRE(view.entry_at(view.lower_bound("dir/s")).path() ==
+          string_view("dir/sub/c"));
+  REQUIRE(view.lower_bound("zz") == view.size());
+  git_index_free(index);
+}
+
+TEST_CASE("Read the cached trees" * test_suite("index_view")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  mkdir((dir.path() + "dir").c_str(), 0777);
+  write_file(dir.path() + "a", "a\n");
+  write_file(dir.path() + "dir/b", "b\n");
+  git_index *index = nullptr;
+  REQUIRE(git_repository_index(&index, raw(repo)) == 0);
+  REQUIRE(git_index_add_bypath(index, "a") == 0);
+  REQUIRE(git_index_add_bypath(index, "dir/b") == 0);
+  git_oid root;
+  REQUIRE(git_index_write_tree(&root, index) == 0);
+  REQUIRE(git_index_write(index) == 0);
+
+  index_view view(repo);
+  REQUIRE(view.has_extension("TREE"));
+  REQUIRE(!view.has_extension("IEOT"));
+  oid id;
+  REQUIRE(view.cached_tree("", id));
+  REQUIRE(id == oid(&root));
+  git_tree *tree = nullptr;
+  REQUIRE(git_tree_lookup(&tree, raw(repo), &root) == 0);
+  REQUIRE(view.cached_tree("dir", id));
+  REQUIRE(id == oid(git_tree_entry_id(git_tree_entry_byname(tree, "dir"))));
+  git_tree_free(tree);
+
+  // Changing a file invalidates its directories
+  write_file(dir.path() + "dir/b", "changed\n");
+  REQUIRE(git_index_add_bypath(index, "dir/b") == 0);
+  REQUIRE(git_index_write(index) == 0);
+  git_index_free(index);
+  index_view changed(repo);
+  REQUIRE(!changed.cached_tree("dir", id));
+  REQUIRE(!changed.cached_tree("", id));
+}
@@ -0,0 +1,55 @@
+#include <cppgit2/git_exception.hpp>
+#include <cppgit2/mapped_file.hpp>
+#include <cstring>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+TEST_CASE("Map a file" * test_suite("mapped_file")) {
+  temporary_directory dir;
+  write_file(dir.path() + "file", "hello, world\n");
+  mapped_file file(dir.path() + "file");
+  REQUIRE(file.size() == 13);
+  REQUIRE(memcmp(file.data(), "hello, world\n", 13) == 0);
+  REQUIRE(file.path() == dir.path() + "file");
+}
+
+TEST_CASE("Map an empty file" * test_suite("mapped_file")) {
+  temporary_directory dir;
+  write_file(dir.path() + "empty", "");
+  mapped_file file(dir.path() + "empty");
+  REQUIRE(file.size() == 0);
+
+  mapped_file none;
+  REQUIRE(none.size() == 0);
+}
+
+TEST_CASE("Map a missing file" * test_suite("mapped_file")) {
+  temporary_directory dir;
+  bool exception_thrown = false;
+  try {
+    mapped_file file(dir.path() + "missing");
+  } catch (git_exception &) {
+    exception_thrown = true;
+  }
+  REQUIRE(exception_thrown);
+}
+
+TEST_CASE("Move a mapped file" * test_suite("mapped_file")) {
+  temporary_directory dir;
+  write_file(dir.path() + "file", "content");
+  mapped_file first(dir.path() + "file");
+  auto data = first.data();
+
+  mapped_file second(std::move(first));
+  REQUIRE(second.data() == data);
+  REQUIRE(second.size() == 7);
+  REQUIRE(first.size() == 0);
+
+  mapped_file third;
+  third = std::move(second);
+  REQUIRE(third.data() == data);
+  REQUIRE(memcmp(third.data(), "content", 7) == 0);
+  REQUIRE(second.size() == 0);
+}
@@ -1,5 +1,7 @@
 #include <cppgit2/oid.hpp>
 #include <doctest.hpp>
+#include <unordered_map>
+#include <unordered_set>
 using doctest::test_suite;
 using namespace cppgit2;
 
@@ -97,4 +99,36 @@ TEST_CASE("Interoperatbility with libgit2" * test_suite("oid")) {
 
   // Results are the same
   REQUIRE(oid1.to_hex_string(8) == std::string(oid1_formatted)); // f9de917
-}
\ No newline at end of file
+}
+
+TEST_CASE("Hash and compare oids" * test_suite("oid")) {
+  oid oid1("f9de917ac729414151fdce077d4098cfec9a45a5");
+  oid oid2("f9de917ac729414151fdce077d4098cfec9a45a5");
+  oid oid3("0123456789abcdef0123456789abcdef01234567");
+
+  // Equal ids hash alike, whether wrapped or raw
+  REQUIRE(oid_hash()(oid1) == oid_hash()(oid2));
+  REQUIRE(oid_hash()(oid1) == oid_hash()(*oid1.c_ptr()));
+  REQUIRE(oid_equal()(oid1, oid2));
+  REQUIRE(oid_equal()(*oid1.c_ptr(), *oid2.c_ptr()));
+  REQUIRE(!oid_equal()(oid1, oid3));
+  REQUIRE(!oid_equal()(*oid1.c_ptr(), *oid3.c_ptr()));
+}
+
+TEST_CASE("Use oids as hash keys" * test_suite("oid")) {
+  std::unordered_set<oid, oid_hash, oid_equal> ids;
+  ids.insert(oid("f9de917ac729414151fdce077d4098cfec9a45a5"));
+  ids.insert(oid("f9de917ac729414151fdce077d4098cfec9a45a5"));
+  ids.insert(oid("0123456789abcdef0123456789abcdef01234567"));
+  REQUIRE(ids.size() == 2);
+  REQUIRE(ids.count(oid("0123456789abcdef0123456789abcdef01234567")) == 1);
+  REQUIRE(ids.count(oid("1123456789abcdef0123456789abcdef01234567")) == 0);
+
+  // Ids differing only past the bytes that are hashed still differ
+  std::unordered_map<git_oid, int, oid_hash, oid_equal> raw;
+  raw[*oid("f9de917ac729414151fdce077d4098cfec9a45a5").c_ptr()] = 1;
+  raw[*oid("f9de917ac729414151fdce077d4098cfec9a45a6").c_ptr()] = 2;
+  REQUIRE(raw.size() == 2);
+  REQUIRE(raw[*oid("f9de917ac729414151fdce077d4098cfec9a45a5").c_ptr()] == 1);
+  REQUIRE(raw[*oid("f9de917ac729414151fdce077d4098cfec9a45a6").c_ptr()] == 2);
+}
@@ -0,0 +1,113 @@
+#include <cppgit2/pack_writer.hpp>
+#include <cppgit2/repository.hpp>
+#include <cstring>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_oid append_blob(pack_writer &writer, const std::string &content) {
+  git_oid id;
+  git_odb_hash(&id, content.data(), content.size(), GIT_OBJECT_BLOB);
+  std::vector<unsigned char> compressed;
+  pack_writer::compress(content.data(), content.size(), compressed);
+  writer.append(id, GIT_OBJECT_BLOB, content.size(), compressed.data(),
+                compressed.size());
+  return id;
+}
+
+} // namespace
+
+TEST_CASE("Write a pack readable by libgit2" * test_suite("pack_writer")) {
+  temporary_directory dir;
+  oid pack_name;
+  git_oid first, second;
+  {
+    auto repo = repository::init(dir.path(), true);
+    pack_writer writer(repo);
+    first = append_blob(writer, "first blob\n");
+    second = append_blob(writer, std::string(100000, 'x'));
+    REQUIRE(writer.size() == 2);
+    pack_name = writer.finish();
+  }
+  auto base = dir.path() + "objects/pack/pack-" + pack_name.to_hex_string();
+  REQUIRE(!read_file(base + ".pack").empty());
+  REQUIRE(!read_file(base + ".idx").empty());
+
+  // Through the .idx, in a fresh handle
+  auto repo = repository::open(dir.path());
+  git_odb *odb = nullptr;
+  REQUIRE(git_repository_odb(&odb, const_cast<git_repository *>(repo.c_ptr())) ==
+          0);
+  git_odb_object *object = nullptr;
+  REQUIRE(git_odb_read(&object, odb, &first) == 0);
+  REQUIRE(std::string(static_cast<const char *>(git_odb_object_data(object)),
+                      git_odb_object_size(object)) == "first blob\n");
+  git_odb_object_free(object);
+  REQUIRE(git_odb_read(&object, odb, &second) == 0);
+  REQUIRE(git_odb_object_size(object) == 100000);
+  git_odb_object_free(object);
+  git_odb_free(odb);
+}
+
+TEST_CASE("Read objects back before finishing" * test_suite("pack_writer")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  pack_writer writer(repo);
+  auto id = append_blob(writer, "content");
+
+  // A second copy is not written
+  std::vector<unsigned char> compressed;
+  pack_writer::compress("content", 7, compressed);
+  REQUIRE(!writer.append(id, GIT_OBJECT_BLOB, 7, compressed.data(),
+                         compressed.size()));
+  REQUIRE(writer.size() == 1);
+
+  REQUIRE(writer.contains(id));
+  git_object_t type;
+  size_t size;
+  REQUIRE(writer.read_header(id, type, size));
+  REQUIRE(type == GIT_OBJECT_BLOB);
+  REQUIRE(size == 7);
+  std::string data(size, '\0');
+  REQUIRE(writer.read(id, &data[0]));
+  REQUIRE(data == "content");
+
+  git_oid other;
+  git_odb_hash(&other, "other", 5, GIT_OBJECT_BLOB);
+  REQUIRE(!writer.contains(other));
+  REQUIRE(!writer.read_header(other, type, size));
+}
+
+TEST_CASE("Finish an empty pack" * test_suite("pack_writer")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  pack_writer writer(repo);
+  REQUIRE(writer.finish().is_zero());
+}
+
+TEST_CASE("Create blobs from paths" * test_suite("pack_writer")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path() + "repo", false);
+  std::vector<std::string> paths, contents{"one\n", "", std::string(70000, 'y'),
+                                           "one\n"};
+  for (size_t i = 0; i < contents.size(); ++i) {
+    paths.push_back(dir.path() + "file" + std::to_string(i));
+    write_file(paths.back(), contents[i]);
+  }
+
+  for (auto storage : {repository::blob_storage::loose,
+                       repository::blob_storage::pack}) {
+    auto ids = repo.create_blobs_from_paths(paths, storage, 2);
+    REQUIRE(ids.size() == paths.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+      git_oid expected;
+      git_odb_hash(&expected, contents[i].data(), contents[i].size(),
+                   GIT_OBJECT_BLOB);
+      REQUIRE(git_oid_equal(ids[i].c_ptr(), &expected));
+      REQUIRE(repo.lookup_blob(ids[i]).raw_size() == contents[i].size());
+    }
+  }
+}
@@ -0,0 +1,103 @@
+#include <cppgit2/packed_refs_view.hpp>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+const char commit_a[] = "1111111111111111111111111111111111111111";
+const char commit_b[] = "2222222222222222222222222222222222222222";
+const char tag_object[] = "3333333333333333333333333333333333333333";
+
+std::string sorted_file() {
+  return std::string("# pack-refs with: peeled fully-peeled sorted \n") +
+         commit_a + " refs/heads/main\n" + commit_b + " refs/heads/topic\n" +
+         tag_object + " refs/tags/v1.0\n" + "^" + commit_a + "\n" + commit_b +
+         " refs/tags/v1.1\n";
+}
+
+} // namespace
+
+TEST_CASE("Look up packed references" * test_suite("packed_refs_view")) {
+  temporary_directory dir;
+  write_file(dir.path() + "packed-refs", sorted_file());
+  packed_refs_view view(dir.path() + "packed-refs");
+  REQUIRE(view.is_sorted());
+  REQUIRE(view.is_peeled());
+  REQUIRE(view.is_fully_peeled());
+
+  auto main = view.find("refs/heads/main");
+  REQUIRE(main != view.end());
+  REQUIRE((*main).name() == "refs/heads/main");
+  REQUIRE((*main).target().to_hex_string() == commit_a);
+  REQUIRE(!(*main).has_peeled());
+
+  // The "^" line belongs to the tag before it
+  auto annotated = view.find("refs/tags/v1.0");
+  REQUIRE(annotated != view.end());
+  REQUIRE((*annotated).target_hex() == tag_object);
+  REQUIRE((*annotated).has_peeled());
+  REQUIRE((*annotated).peeled().to_hex_string() == commit_a);
+
+  auto last = view.find("refs/tags/v1.1");
+  REQUIRE(last != view.end());
+  REQUIRE((*last).target().to_hex_string() == commit_b);
+  REQUIRE(!(*last).has_peeled());
+
+  REQUIRE(view.find("refs/heads/mai") == view.end());
+  REQUIRE(view.find("refs/heads/other") == view.end());
+  REQUIRE(view.find("refs/tags/v2") == view.end());
+}
+
+TEST_CASE("Iterate packed references" * test_suite("packed_refs_view")) {
+  temporary_directory dir;
+  write_file(dir.path() + "packed-refs", sorted_file());
+  packed_refs_view view(dir.path() + "packed-refs");
+
+  std::vector<std::string> names;
+  for (auto entry : view)
+    names.push_back(entry.name().to_string());
+  REQUIRE(names == std::vector<std::string>{"refs/heads/main",
+                                            "refs/heads/topic",
+                                            "refs/tags/v1.0",
+                                            "refs/tags/v1.1"});
+
+  names.clear();
+  for (auto entry : view.with_prefix("refs/tags/"))
+    names.push_back(entry.name().to_string());
+  REQUIRE(names ==
+          std::vector<std::string>{"refs/tags/v1.0", "refs/tags/v1.1"});
+
+  auto bound = view.lower_bound("refs/heads/n");
+  REQUIRE((*bound).name() == "refs/heads/topic");
+}
+
+TEST_CASE("Read an unsorted packed-refs file" *
+          test_suite("packed_refs_view")) {
+  temporary_directory dir;
+  write_file(dir.path() + "packed-refs",
+             std::string("# pack-refs with: peeled \n") + commit_b +
+                 " refs/tags/v1.1\n" + tag_object + " refs/tags/v1.0\n" + "^" +
+                 commit_a + "\n" + commit_a + " refs/heads/main\n");
+  packed_refs_view view(dir.path() + "packed-refs");
+  REQUIRE(!view.is_sorted());
+
+  std::vector<std::string> names;
+  for (auto entry : view)
+    names.push_back(entry.name().to_string());
+  REQUIRE(names == std::vector<std::string>{"refs/heads/main",
+                                            "refs/tags/v1.0",
+                                            "refs/tags/v1.1"});
+  auto annotated = view.find("refs/tags/v1.0");
+  REQUIRE(annotated != view.end());
+  REQUIRE((*annotated).peeled().to_hex_string() == commit_a);
+}
+
+TEST_CASE("Read a missing packed-refs file" *
+          test_suite("packed_refs_view")) {
+  temporary_directory dir;
+  packed_refs_view view(dir.path() + "packed-refs");
+  REQUIRE(view.empty());
+  REQUIRE(view.find("refs/heads/main") == view.end());
+}
@@ -0,0 +1,103 @@
+#include <cppgit2/reference_batch.hpp>
+#include <cppgit2/repository.hpp>
+#include <algorithm>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+TEST_CASE("Apply a reference batch" * test_suite("reference_batch")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto first = commit_files(repo, {{"a", "1"}});
+  auto second = commit_files(repo, {{"a", "2"}});
+
+  reference_batch batch(repo);
+  batch.create("refs/heads/one", first);
+  batch.create("refs/heads/two", second);
+  batch.update("refs/heads/master", second, first);
+  REQUIRE(batch.size() == 3);
+  REQUIRE(batch.commit().empty());
+  REQUIRE(batch.size() == 0);
+
+  REQUIRE(repo.reference_name_to_id("refs/heads/one") == first);
+  REQUIRE(repo.reference_name_to_id("refs/heads/two") == second);
+  REQUIRE(repo.reference_name_to_id("refs/heads/master") == first);
+
+  reference_batch removal(repo);
+  removal.remove("refs/heads/one", first);
+  REQUIRE(removal.commit().empty());
+  bool exception_thrown = false;
+  try {
+    repo.reference_name_to_id("refs/heads/one");
+  } catch (git_exception &) {
+    exception_thrown = true;
+  }
+  REQUIRE(exception_thrown);
+}
+
+TEST_CASE("Reject a reference batch whose expectations fail" *
+          test_suite("reference_batch")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto first = commit_files(repo, {{"a", "1"}});
+  auto second = commit_files(repo, {{"a", "2"}});
+  reference_batch setup(repo);
+  setup.create("refs/heads/stable", first);
+  REQUIRE(setup.commit().empty());
+
+  reference_batch batch(repo);
+  batch.create("refs/heads/new", first);
+  // master is at `second`
+  batch.update("refs/heads/master", first, second);
+  // Exists already
+  batch.create("refs/heads/stable", second);
+  auto rejected = batch.commit();
+  std::sort(rejected.begin(), rejected.end());
+  REQUIRE(rejected == std::vector<std::string>{"refs/heads/master",
+                                               "refs/heads/stable"});
+
+  // Nothing was applied
+  REQUIRE(repo.reference_name_to_id("refs/heads/master") == second);
+  REQUIRE(repo.reference_name_to_id("refs/heads/stable") == first);
+  bool exception_thrown = false;
+  try {
+    repo.reference_name_to_id("refs/heads/new");
+  } catch (git_exception &) {
+    exception_thrown = true;
+  }
+  REQUIRE(exception_thrown);
+}
+
+TEST_CASE("Lock packed and new references" * test_suite("reference_batch")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto first = commit_files(repo, {{"a", "1"}});
+  reference_batch setup(repo);
+  setup.create("refs/heads/stable", first);
+  REQUIRE(setup.commit().empty());
+
+  // stable is only in packed-refs, and someone else holds its lock
+  write_file(dir.path() + ".git/refs/heads/stable.lock", "");
+  reference_batch batch(repo);
+  batch.remove("refs/heads/stable");
+  batch.create("refs/heads/topic/new", first);
+  bool locked = false;
+  try {
+    batch.commit();
+  } catch (git_exception &e) {
+    locked = e.code() == git_exception::error_code::locked;
+  }
+  REQUIRE(locked);
+  REQUIRE(repo.reference_name_to_id("refs/heads/stable") == first);
+
+  // No lock file or directory is left behind
+  ::remove((dir.path() + ".git/refs/heads/stable.lock").c_str());
+  batch.create("refs/heads/topic/new", first);
+  REQUIRE(batch.commit().empty());
+  REQUIRE(repo.reference_name_to_id("refs/heads/topic/new") == first);
+  struct stat st;
+  REQUIRE(stat((dir.path() + ".git/refs/heads/topic").c_str(), &st) != 0);
+  REQUIRE(stat((dir.path() + ".git/refs/heads/topic/new.lock").c_str(), &st) !=
+          0);
+}
@@ -0,0 +1,44 @@
+#include <cppgit2/reference_batch.hpp>
+#include <cppgit2/reference_iterator.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+std::vector<std::string> names_under(const repository &repo,
+                                     const std::string &prefix) {
+  std::vector<std::string> names;
+  reference_iterator refs(repo, prefix);
+  for (auto &ref : refs)
+    names.push_back(ref.name().to_string());
+  return names;
+}
+
+} // namespace
+
+TEST_CASE("List loose and packed references" *
+          test_suite("reference_iterator")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto id = commit_files(repo, {{"a", "1"}});
+  reference_batch packed(repo);
+  packed.create("refs/tags/v1", id);
+  REQUIRE(packed.commit().empty());
+  // Files elsewhere in the git directory are not references
+  write_file(dir.path() + ".git/logs/refs/heads/stale", "");
+  write_file(dir.path() + ".git/ORIG_HEAD", id.to_hex_string() + "\n");
+
+  std::vector<std::string> all{"refs/heads/master", "refs/tags/v1"};
+  REQUIRE(names_under(repo, "refs/") == all);
+  REQUIRE(names_under(repo, "") == all);
+  REQUIRE(names_under(repo, "re") == all);
+  REQUIRE(names_under(repo, "refs/tags/") ==
+          std::vector<std::string>{"refs/tags/v1"});
+  REQUIRE(names_under(repo, "refs/heads/m") ==
+          std::vector<std::string>{"refs/heads/master"});
+  REQUIRE(names_under(repo, "HEAD").empty());
+  REQUIRE(names_under(repo, "logs/").empty());
+}
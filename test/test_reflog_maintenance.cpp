@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cppgit2/reflog_maintenance.hpp>
+#include <cppgit2/reftable.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <sys/stat.h>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_repository *raw(const repository &repo) {
+  return const_cast<git_repository *>(repo.c_ptr());
+}
+
+std::string line(const std::string &old_id, const std::string &new_id,
+                 long time, const std::string &message) {
+  return old_id + " " + new_id + " C O <c@o> " + std::to_string(time) +
+         " +0000\t" + message + "\n";
+}
+
+// A -> B on master, and C (child of A) reachable from no reference; the
+// log of master is left to the test and HEAD has none
+struct history {
+  std::string zero = std::string(40, '0');
+  std::string a, b, c;
+
+  explicit history(repository &repo) {
+    auto first = commit_files(repo, {{"a", "1"}});
+    c = commit_files(repo, {{"a", "3"}}).to_hex_string();
+    git_reference *ref = nullptr;
+    REQUIRE(git_reference_create(&ref, raw(repo), "refs/heads/master",
+                                 first.c_ptr(), 1, "reset") == 0);
+    git_reference_free(ref);
+    b = commit_files(repo, {{"a", "2"}}).to_hex_string();
+    a = first.to_hex_string();
+    std::remove((repo.path() + "logs/HEAD").c_str());
+  }
+
+  // zero -> A -> C -> B, then B again much later
+  std::string log() const {
+    return line(zero, a, 100, "one") + line(a, c, 200, "two") +
+           line(c, b, 300, "three") + line(b, b, 5000, "four");
+  }
+};
+
+} // namespace
+
+TEST_CASE("Expire unreachable entries as git does" *
+          test_suite("reflog_maintenance")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  history h(repo);
+  auto path = dir.path() + ".git/logs/refs/heads/master";
+  reflog_maintenance maintenance(repo, 2);
+  reflog_maintenance::policy p;
+  p.expire_unreachable = 1000;
+
+  // Expected logs from `git reflog expire --expire=never
+  // --expire-unreachable=1000 [--rewrite] refs/heads/master`
+  write_file(path, h.log());
+  p.dry_run = true;
+  auto counted = maintenance.expire(p);
+  REQUIRE(read_file(path) == h.log());
+  p.dry_run = false;
+  auto report = maintenance.expire(p);
+  REQUIRE(report.expired == 2);
+  REQUIRE(counted.expired == report.expired);
+  REQUIRE(report.rewritten == 1);
+  REQUIRE(report.locked.empty());
+  REQUIRE(read_file(path) ==
+          line(h.zero, h.a, 100, "one") + line(h.b, h.b, 5000, "four"));
+
+  write_file(path, h.log());
+  p.rewrite = true;
+  report = maintenance.expire(p);
+  REQUIRE(report.expired == 1);
+  REQUIRE(read_file(path) == line(h.zero, h.a, 100, "one") +
+                                 line(h.a, h.b, 300, "three") +
+                                 line(h.b, h.b, 5000, "four"));
+}
+
+TEST_CASE("Expire entries by age" * test_suite("reflog_maintenance")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  history h(repo);
+  auto path = dir.path() + ".git/logs/refs/heads/master";
+  write_file(path, h.log() + "not an entry\n");
+
+  reflog_maintenance::policy p;
+  p.expire = 250;
+  auto report = reflog_maintenance(repo, 2).expire(p);
+  REQUIRE(report.entries == 4);
+  REQUIRE(report.expired == 2);
+  // Lines that do not parse are kept as they are
+  REQUIRE(read_file(path) == line(h.c, h.b, 300, "three") +
+                                 line(h.b, h.b, 5000, "four") +
+                                 "not an entry\n");
+}
+
+TEST_CASE("Skip logs whose reference is locked" *
+          test_suite("reflog_maintenance")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  history h(repo);
+  auto path = dir.path() + ".git/logs/refs/heads/master";
+  write_file(path, h.log());
+  write_file(dir.path() + ".git/refs/heads/master.lock", "");
+
+  reflog_maintenance::policy p;
+  p.expire = 1000000;
+  auto report = reflog_maintenance(repo, 2).expire(p);
+  REQUIRE(report.locked == std::vector<std::string>{"refs/heads/master"});
+  REQUIRE(read_file(path) == h.log());
+}
+
+TEST_CASE("Expire the logs of a reftable repository" *
+          test_suite("reflog_maintenance")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  history h(repo);
+  reftable::migrate(repo);
+  auto path = dir.path() + ".git/logs/refs/heads/master";
+  write_file(path, h.log());
+
+  // refs/heads is a file now; the reference lock is the stack's
+  reflog_maintenance maintenance(repo, 2);
+  reflog_maintenance::policy p;
+  p.expire = 250;
+  {
+    auto other = repository::open(dir.path());
+    auto held = other.create_transaction();
+    held.lock_reference("refs/heads/master");
+    auto report = maintenance.expire(p);
+    REQUIRE(report.locked == std::vector<std::string>{"refs/heads/master"});
+    REQUIRE(read_file(path) == h.log());
+  }
+  auto report = maintenance.expire(p);
+  REQUIRE(report.locked.empty());
+  REQUIRE(report.expired == 2);
+  REQUIRE(read_file(path) ==
+          line(h.c, h.b, 300, "three") + line(h.b, h.b, 5000, "four"));
+
+  // The stack is unlocked again
+  auto later = commit_files(repo, {{"b", "1"}});
+  oid head;
+  REQUIRE(git_reference_name_to_id(head.c_ptr(), raw(repo), "HEAD") == 0);
+  REQUIRE(head == later);
+}
+
+TEST_CASE("Read the entries of every log" *
+          test_suite("reflog_maintenance")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  history h(repo);
+  write_file(dir.path() + ".git/logs/refs/heads/master", h.log());
+  mkdir((dir.path() + ".git/logs/refs/heads/nested").c_str(), 0777);
+  write_file(dir.path() + ".git/logs/refs/heads/nested/topic",
+             line(h.zero, h.c, 400, "topic") + "garbage\n");
+  write_file(dir.path() + ".git/logs/refs/heads/nested/topic.lock", "");
+
+  reflog_maintenance maintenance(repo, 2);
+  REQUIRE(maintenance.names() ==
+          (std::vector<std::string>{"refs/heads/master",
+                                    "refs/heads/nested/topic"}));
+  std::vector<std::string> seen;
+  maintenance.for_each_entry(
+      [&](string_view name, const reflog_maintenance::entry &e) {
+        seen.push_back(name.to_string() + " " + e.new_id.to_hex_string() +
+                       " " + e.committer.to_string() + " " +
+                       std::to_string(e.time) + " " + e.message.to_string());
+      });
+  REQUIRE(seen == (std::vector<std::string>{
+                      "refs/heads/master " + h.a + " C O <c@o> 100 one",
+                      "refs/heads/master " + h.c + " C O <c@o> 200 two",
+                      "refs/heads/master " + h.b + " C O <c@o> 300 three",
+                      "refs/heads/master " + h.b + " C O <c@o> 5000 four",
+                      "refs/heads/nested/topic " + h.c +
+                          " C O <c@o> 400 topic"}));
+
+  // Every id but zero, once
+  auto tips = maintenance.build_tip_index();
+  REQUIRE(tips.size() == 3);
+  REQUIRE(tips.contains(oid(h.a)));
+  REQUIRE(!tips.contains(oid(h.zero)));
+  REQUIRE(std::is_sorted(tips.ids().begin(), tips.ids().end(),
+                         [](const git_oid &x, const git_oid &y) {
+                           return git_oid_cmp(&x, &y) < 0;
+                         }));
+}
@@ -0,0 +1,264 @@
+#include <cppgit2/reference_batch.hpp>
+#include <cppgit2/reftable.hpp>
+#include <cppgit2/repository.hpp>
+#include <doctest.hpp>
+#include <sys/stat.h>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_repository *raw(const repository &repo) {
+  return const_cast<git_repository *>(repo.c_ptr());
+}
+
+bool exists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+size_t table_count(const std::string &git_dir) {
+  auto list = read_file(git_dir + "reftable/tables.list");
+  size_t count = 0;
+  for (char c : list)
+    count += c == '\n';
+  return count;
+}
+
+oid target_of(const repository &repo, const std::string &name) {
+  oid id;
+  REQUIRE(git_reference_name_to_id(id.c_ptr(), raw(repo), name.c_str()) == 0);
+  return id;
+}
+
+std::string symbolic_target(const repository &repo, const std::string &name) {
+  git_reference *ref = nullptr;
+  REQUIRE(git_reference_lookup(&ref, raw(repo), name.c_str()) == 0);
+  std::string target = git_reference_symbolic_target(ref);
+  git_reference_free(ref);
+  return target;
+}
+
+void create(const repository &repo, const std::string &name, const oid &id) {
+  git_reference *ref = nullptr;
+  REQUIRE(git_reference_create(&ref, raw(repo), name.c_str(), id.c_ptr(), 0,
+                               "create") == 0);
+  git_reference_free(ref);
+}
+
+size_t reflog_size(const repository &repo, const std::string &name) {
+  git_reflog *log = nullptr;
+  REQUIRE(git_reflog_read(&log, raw(repo), name.c_str()) == 0);
+  auto size = git_reflog_entrycount(log);
+  git_reflog_free(log);
+  return size;
+}
+
+uint32_t crc32_of(const std::string &data) {
+  uint32_t crc = 0xffffffff;
+  for (unsigned char c : data) {
+    crc ^= c;
+    for (int bit = 0; bit < 8; ++bit)
+      crc = (crc >> 1) ^ (0xedb88320 & (0u - (crc & 1)));
+  }
+  return ~crc;
+}
+
+} // namespace
+
+TEST_CASE("Switch a repository to reftable" * test_suite("reftable")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto first = commit_files(repo, {{"a", "1"}});
+  auto second = commit_files(repo, {{"a", "2"}});
+  reference_batch packed(repo);
+  packed.create("refs/tags/v1", first);
+  REQUIRE(packed.commit().empty());
+  create(repo, "refs/heads/topic", first);
+
+  // Attaching is for repositories that already use reftable
+  REQUIRE_THROWS(reftable::attach(repo));
+  REQUIRE(exists(dir.path() + ".git/packed-refs"));
+
+  reftable::migrate(repo);
+  REQUIRE(reftable::is_enabled(repo));
+  REQUIRE(exists(dir.path() + ".git/reftable/tables.list"));
+  REQUIRE(!exists(dir.path() + ".git/packed-refs"));
+  REQUIRE(read_file(dir.path() + ".git/HEAD") ==
+          "ref: refs/heads/.invalid\n");
+  struct stat st;
+  REQUIRE(stat((dir.path() + ".git/refs/heads").c_str(), &st) == 0);
+  REQUIRE(S_ISREG(st.st_mode));
+  REQUIRE(symbolic_target(repo, "HEAD") == "refs/heads/master");
+  REQUIRE(target_of(repo, "refs/heads/master") == second);
+  REQUIRE(target_of(repo, "refs/tags/v1") == first);
+
+  // Fresh and reopened handles read the stack without further calls
+  auto reopened = repository::open(dir.path());
+  REQUIRE(reftable::is_enabled(reopened));
+  REQUIRE(target_of(reopened, "refs/heads/topic") == first);
+  REQUIRE(target_of(reopened, "HEAD") == second);
+  auto again = reopened.reopen();
+  REQUIRE(target_of(again, "refs/tags/v1") == first);
+  REQUIRE(symbolic_target(again, "HEAD") == "refs/heads/master");
+
+  // There is no packed-refs for a batch to rewrite
+  reference_batch refused(reopened);
+  refused.create("refs/heads/batch", first);
+  REQUIRE_THROWS(refused.commit());
+}
+
+TEST_CASE("Write, read and compact references" * test_suite("reftable")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  auto git_dir = dir.path();
+  reftable::options opts;
+  opts.block_size = 256;
+  reftable::migrate(repo, opts);
+  auto id = commit_files(repo, {{"a", "1"}});
+
+  for (int i = 0; i < 64; ++i)
+    create(repo, "refs/heads/b" + std::to_string(i), id);
+  // Geometric compaction keeps O(log n) tables
+  REQUIRE(table_count(git_dir) <= 7);
+
+  git_reference *ref = nullptr;
+  REQUIRE(git_reference_lookup(&ref, raw(repo), "refs/heads/b3") == 0);
+  git_reference *renamed = nullptr;
+  REQUIRE(git_reference_rename(&renamed, ref, "refs/heads/renamed/b3", 0,
+                               "rename") == 0);
+  git_reference_free(ref);
+  git_reference_free(renamed);
+  REQUIRE(git_reference_lookup(&ref, raw(repo), "refs/heads/b4") == 0);
+  REQUIRE(git_reference_delete(ref) == 0);
+  git_reference_free(ref);
+
+  git_refdb *refdb = nullptr;
+  REQUIRE(git_repository_refdb(&refdb, raw(repo)) == 0);
+  REQUIRE(git_refdb_compress(refdb) == 0);
+  git_refdb_free(refdb);
+  REQUIRE(table_count(git_dir) == 1);
+
+  // Everything reads back, from the compacted stack and in a fresh handle
+  auto reopened = repository::open(git_dir);
+  size_t count = 0;
+  git_reference_iterator *iter = nullptr;
+  REQUIRE(git_reference_iterator_glob_new(&iter, raw(reopened),
+                                          "refs/heads/*") == 0);
+  const char *name = nullptr;
+  while (git_reference_next_name(&name, iter) == 0)
+    ++count;
+  git_reference_iterator_free(iter);
+  REQUIRE(count == 64); // b0..b63 and master, less b3 and b4, plus renamed/b3
+  REQUIRE(target_of(reopened, "refs/heads/renamed/b3") == id);
+  REQUIRE(git_reference_lookup(&ref, raw(reopened), "refs/heads/b4") ==
+          GIT_ENOTFOUND);
+  REQUIRE(git_reference_lookup(&ref, raw(reopened), "refs/heads/b3") ==
+          GIT_ENOTFOUND);
+}
+
+TEST_CASE("Keep reflogs next to the stack" * test_suite("reftable")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto first = commit_files(repo, {{"a", "1"}});
+  reftable::migrate(repo);
+  auto second = commit_files(repo, {{"a", "2"}});
+
+  // Branch updates log to the branch and to HEAD, which points to it
+  REQUIRE(reflog_size(repo, "refs/heads/master") == 2);
+  REQUIRE(reflog_size(repo, "HEAD") == 2);
+  git_object *object = nullptr;
+  REQUIRE(git_revparse_single(&object, raw(repo), "master@{1}") == 0);
+  REQUIRE(oid(git_object_id(object)) == first);
+  git_object_free(object);
+  (void)second;
+
+  // A reference without a log has an empty one, and reading it leaves
+  // no file behind
+  create(repo, "refs/tags/v1", first);
+  REQUIRE(reflog_size(repo, "refs/tags/v1") == 0);
+  REQUIRE(!exists(dir.path() + ".git/logs/refs/tags/v1"));
+
+  // refs/stash is logged through ensure_log, as git_stash_save does
+  write_file(dir.path() + "a", "changed");
+  git_index *index = nullptr;
+  REQUIRE(git_repository_index(&index, raw(repo)) == 0);
+  REQUIRE(git_index_add_bypath(index, "a") == 0);
+  REQUIRE(git_index_write(index) == 0);
+  git_index_free(index);
+  signature who("A U Thor", "author@example.com", 1500000000, 0);
+  git_oid stash;
+  REQUIRE(git_stash_save(&stash, raw(repo), who.c_ptr(), "saved", 0) == 0);
+  REQUIRE(reflog_size(repo, "refs/stash") == 1);
+  REQUIRE(git_revparse_single(&object, raw(repo), "stash@{0}") == 0);
+  REQUIRE(oid(git_object_id(object)) == oid(&stash));
+  git_object_free(object);
+}
+
+TEST_CASE("Give each worktree its own HEAD" * test_suite("reftable")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path() + "main", false);
+  auto first = commit_files(repo, {{"a", "1"}});
+  git_worktree *worktree = nullptr;
+  REQUIRE(git_worktree_add(&worktree, raw(repo), "wt",
+                           (dir.path() + "wt").c_str(), nullptr) == 0);
+  git_repository *handle = nullptr;
+  REQUIRE(git_repository_open_from_worktree(&handle, worktree) == 0);
+  git_worktree_free(worktree);
+  repository linked(handle);
+
+  // Migrating fills the linked worktree's stack too; the handle opened
+  // before the switch still needs the backend
+  reftable::migrate(repo);
+  reftable::attach(linked);
+  auto linked_dir = linked.path();
+  REQUIRE(exists(linked_dir + "reftable/tables.list"));
+  REQUIRE(read_file(linked_dir + "HEAD") == "ref: refs/heads/.invalid\n");
+  REQUIRE(symbolic_target(repo, "HEAD") == "refs/heads/master");
+  REQUIRE(symbolic_target(linked, "HEAD") == "refs/heads/wt");
+
+  // Moving one worktree's HEAD leaves the other's alone
+  auto second = commit_files(linked, {{"b", "2"}});
+  REQUIRE(target_of(linked, "HEAD") == second);
+  REQUIRE(target_of(repo, "HEAD") == first);
+  REQUIRE(target_of(repo, "refs/heads/wt") == second);
+  REQUIRE(git_repository_set_head_detached(raw(linked), first.c_ptr()) == 0);
+  REQUIRE(symbolic_target(repo, "HEAD") == "refs/heads/master");
+
+  // Per-worktree references stay in their worktree
+  create(linked, "refs/bisect/bad", second);
+  REQUIRE(target_of(linked, "refs/bisect/bad") == second);
+  git_reference *ref = nullptr;
+  REQUIRE(git_reference_lookup(&ref, raw(repo), "refs/bisect/bad") ==
+          GIT_ENOTFOUND);
+}
+
+TEST_CASE("Refuse tables that hold reflogs" * test_suite("reftable")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  reftable::migrate(repo);
+  auto id = commit_files(repo, {{"a", "1"}});
+  REQUIRE(target_of(repository::open(dir.path()), "refs/heads/master") == id);
+
+  // Point the newest table's log section at its first block, as a table
+  // written by git with reflogs would, and fix up the footer checksum
+  auto list = read_file(dir.path() + "reftable/tables.list");
+  auto newest = list.substr(0, list.size() - 1);
+  newest = newest.substr(newest.rfind('\n') + 1);
+  auto path = dir.path() + "reftable/" + newest;
+  auto table = read_file(path);
+  auto footer = table.size() - 68;
+  for (int i = 0; i < 8; ++i)
+    table[footer + 48 + i] = i == 7 ? 24 : 0;
+  auto crc = crc32_of(table.substr(footer, 64));
+  for (int i = 0; i < 4; ++i)
+    table[footer + 64 + i] = static_cast<char>(crc >> (24 - 8 * i));
+  write_file(path, table);
+
+  auto reopened = repository::open(dir.path());
+  git_reference *ref = nullptr;
+  REQUIRE(git_reference_lookup(&ref, raw(reopened), "refs/heads/master") < 0);
+  REQUIRE(std::string(git_error_last()->message).find("reflog blocks") !=
+          std::string::npos);
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cppgit2/repository.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <ftw.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+// Scratch directories and repositories for the tests
+
+// A new empty directory, deleted with everything in it on destruction
+class temporary_directory {
+public:
+  temporary_directory() {
+    const char *tmp = getenv("TMPDIR");
+    std::string pattern = std::string(tmp && *tmp ? tmp : "/tmp") +
+                          "/cppgit2_test_XXXXXX";
+    if (!mkdtemp(&pattern[0]))
+      throw std::runtime_error("failed to create a temporary directory");
+    path_ = pattern + "/";
+  }
+
+  ~temporary_directory() {
+    nftw(path_.c_str(),
+         [](const char *path, const struct stat *, int, struct FTW *) {
+           return ::remove(path);
+         },
+         16, FTW_DEPTH | FTW_PHYS);
+  }
+
+  temporary_directory(const temporary_directory &) = delete;
+  temporary_directory &operator=(const temporary_directory &) = delete;
+
+  // Ends with '/'
+  const std::string &path() const { return path_; }
+
+private:
+  std::string path_;
+};
+
+inline void write_file(const std::string &path, const std::string &content) {
+  std::ofstream out(path, std::ios::binary);
+  out << content;
+}
+
+inline std::string read_file(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream content;
+  content << in.rdbuf();
+  return content.str();
+}
+
+// Commit `files` (name -> content, at the top level) on top of HEAD and
+// move HEAD's branch to the new commit
+inline cppgit2::oid commit_files(cppgit2::repository &repo,
+                                 const std::map<std::string, std::string> &files,
+                                 const std::string &message = "commit") {
+  using namespace cppgit2;
+  std::vector<commit> parents;
+  oid head;
+  if (git_reference_name_to_id(head.c_ptr(),
+                               const_cast<git_repository *>(repo.c_ptr()),
+                               "HEAD") == 0)
+    parents.push_back(repo.lookup_commit(head));
+  tree_builder builder = parents.empty()
+                             ? tree_builder(repo)
+                             : tree_builder(repo, parents.back().tree());
+  for (auto &file : files)
+    builder.insert(file.first, repo.create_blob_from_buffer(file.second),
+                   file_mode::blob);
+  auto tree_id = builder.write();
+  signature author("A U Thor", "author@example.com", 1500000000, 0);
+  return repo.create_commit("HEAD", author, author, "UTF-8", message,
+                            repo.lookup_tree(tree_id), parents);
+}
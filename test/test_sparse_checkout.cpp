@@ -0,0 +1,122 @@
+#include <cppgit2/repository.hpp>
+#include <cppgit2/sparse_checkout.hpp>
+#include <doctest.hpp>
+#include <sys/stat.h>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+bool exists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+bool skipped(const cppgit2::index &index, const std::string &path) {
+  auto entry = git_index_get_bypath(const_cast<git_index *>(index.c_ptr()),
+                                    path.c_str(), 0);
+  REQUIRE(entry);
+  return (entry->flags_extended & GIT_INDEX_ENTRY_SKIP_WORKTREE) != 0;
+}
+
+const char *const files[] = {"top", "a/f", "a/b/x/y", "a/x/f", "c/z", "d/f"};
+
+// The files above, staged
+cppgit2::index make_work_tree(repository &repo, const std::string &workdir) {
+  for (auto directory : {"a", "a/b", "a/b/x", "a/x", "c", "d"})
+    mkdir((workdir + directory).c_str(), 0777);
+  auto index = repo.index();
+  auto raw = const_cast<git_index *>(index.c_ptr());
+  for (auto file : files) {
+    write_file(workdir + file, std::string(file) + "\n");
+    REQUIRE(git_index_add_bypath(raw, file) == 0);
+  }
+  REQUIRE(git_index_write(raw) == 0);
+  return index;
+}
+
+} // namespace
+
+TEST_CASE("Write and read cone patterns as git does" *
+          test_suite("sparse_checkout")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  sparse_checkout none(repo);
+  REQUIRE(!none.enabled());
+  REQUIRE(none.includes("d/f"));
+
+  // `git sparse-checkout set a/b c`
+  sparse_checkout cone(repo);
+  cone.set_directories({"c", "a/b"});
+  cone.write();
+  REQUIRE(read_file(dir.path() + ".git/info/sparse-checkout") ==
+          "/*\n!/*/\n/a/\n!/a/*/\n/a/b/\n/c/\n");
+  auto config = repo.config();
+  REQUIRE(config.value_as_bool("core.sparseCheckout"));
+  REQUIRE(config.value_as_bool("core.sparseCheckoutCone"));
+
+  sparse_checkout loaded(repo);
+  REQUIRE(loaded.enabled());
+  REQUIRE(loaded.directories() == std::vector<std::string>{"a/b", "c"});
+  // Files in the root and in parents of the cone, and everything in it
+  REQUIRE(loaded.includes("top"));
+  REQUIRE(loaded.includes("a/f"));
+  REQUIRE(loaded.includes("a/b/x/y"));
+  REQUIRE(loaded.includes("c/z"));
+  REQUIRE(!loaded.includes("a/x/f"));
+  REQUIRE(!loaded.includes("d/f"));
+  REQUIRE(!loaded.includes("ab/f"));
+  REQUIRE(loaded.includes_directory("a"));
+  REQUIRE(loaded.includes_directory("a/b/x"));
+  REQUIRE(!loaded.includes_directory("a/x"));
+  REQUIRE(!loaded.includes_directory("d"));
+
+  loaded.add_directory("d");
+  loaded.write();
+  REQUIRE(read_file(dir.path() + ".git/info/sparse-checkout") ==
+          "/*\n!/*/\n/a/\n!/a/*/\n/a/b/\n/c/\n/d/\n");
+
+  write_file(dir.path() + ".git/info/sparse-checkout", "*.txt\n");
+  REQUIRE_THROWS_AS(sparse_checkout{repo}, git_exception);
+}
+
+TEST_CASE("Apply the cone to the index and work tree" *
+          test_suite("sparse_checkout")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto workdir = dir.path();
+  auto index = make_work_tree(repo, workdir);
+
+  sparse_checkout cone(repo);
+  cone.set_directories({"a/b", "c"});
+  cone.write();
+  // As `git sparse-checkout set a/b c` leaves them (`git ls-files -t`)
+  REQUIRE(cone.apply(index) == 2);
+  for (auto file : files) {
+    CAPTURE(file);
+    bool outside = std::string(file) == "a/x/f" || std::string(file) == "d/f";
+    REQUIRE(skipped(index, file) == outside);
+    REQUIRE(exists(workdir + file) == !outside);
+  }
+  REQUIRE(cone.apply(index) == 0);
+
+  // Diffs against the work tree leave out what is outside the cone
+  write_file(workdir + "a/f", "changed\n");
+  mkdir((workdir + "d").c_str(), 0777);
+  write_file(workdir + "d/new", "new\n");
+  diff::options options;
+  options.set_flags(diff::options::flag::include_untracked |
+                    diff::options::flag::recurse_untracked_dirs);
+  cone.restrict(options);
+  auto changes = repo.create_diff_index_to_workdir(index, options);
+  REQUIRE(changes.size() == 1);
+  REQUIRE(changes[0].new_file().path() == "a/f");
+
+  // Widening the cone checks the files out again
+  cone.add_directory("d");
+  REQUIRE(cone.apply(index) == 1);
+  REQUIRE(!skipped(index, "d/f"));
+  REQUIRE(read_file(workdir + "d/f") == "d/f\n");
+  REQUIRE(skipped(index, "a/x/f"));
+}
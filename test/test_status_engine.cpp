@@ -0,0 +1,93 @@
+#include <cppgit2/repository.hpp>
+#include <cppgit2/status_engine.hpp>
+#include <doctest.hpp>
+#include <sys/stat.h>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+typedef std::vector<std::pair<std::string, status::status_type>> statuses;
+
+status::options untracked_options() {
+  status::options options;
+  options.set_flags(status::options::flag::include_untracked |
+                    status::options::flag::recurse_untracked_dirs);
+  return options;
+}
+
+statuses engine_status(const repository &repo,
+                       const status::options &options) {
+  statuses result;
+  status_engine engine(repo, options, 2);
+  engine.for_each_status(
+      [&](const std::string &path, status::status_type type) {
+        result.emplace_back(path, type);
+      });
+  return result;
+}
+
+statuses libgit2_status(const repository &repo,
+                        const status::options &options) {
+  statuses result;
+  repo.for_each_status(options,
+                       [&](const std::string &path, status::status_type type) {
+                         result.emplace_back(path, type);
+                       });
+  return result;
+}
+
+void stage(repository &repo, const std::vector<std::string> &paths) {
+  git_index *index = nullptr;
+  REQUIRE(git_repository_index(&index, const_cast<git_repository *>(
+                                           repo.c_ptr())) == 0);
+  for (auto &path : paths)
+    REQUIRE(git_index_add_bypath(index, path.c_str()) == 0);
+  REQUIRE(git_index_write(index) == 0);
+  git_index_free(index);
+}
+
+} // namespace
+
+TEST_CASE("Match for_each_status" * test_suite("status_engine")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto workdir = dir.path();
+  mkdir((workdir + "dir").c_str(), 0777);
+  write_file(workdir + "kept", "kept\n");
+  write_file(workdir + "modified", "before\n");
+  write_file(workdir + "deleted", "deleted\n");
+  write_file(workdir + "dir/nested", "nested\n");
+  stage(repo, {"kept", "modified", "deleted", "dir/nested"});
+  commit_files(repo, {{"kept", "kept\n"},
+                      {"modified", "before\n"},
+                      {"deleted", "deleted\n"}});
+
+  write_file(workdir + "modified", "after, and longer\n");
+  remove((workdir + "deleted").c_str());
+  write_file(workdir + "staged", "staged\n");
+  stage(repo, {"staged"});
+  mkdir((workdir + "new").c_str(), 0777);
+  write_file(workdir + "new/untracked", "untracked\n");
+  write_file(workdir + ".gitignore", "*.o\n");
+  write_file(workdir + "ignored.o", "");
+
+  auto options = untracked_options();
+  auto expected = libgit2_status(repo, options);
+  REQUIRE(expected.size() == 6);
+  REQUIRE(engine_status(repo, options) == expected);
+}
+
+TEST_CASE("Treat a missing index as empty" * test_suite("status_engine")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  write_file(dir.path() + "untracked", "untracked\n");
+  struct stat st;
+  REQUIRE(stat((dir.path() + ".git/index").c_str(), &st) != 0);
+
+  auto options = untracked_options();
+  auto result = engine_status(repo, options);
+  REQUIRE(result == statuses{{"untracked", status::status_type::wt_new}});
+  REQUIRE(result == libgit2_status(repo, options));
+}
@@ -0,0 +1,64 @@
+#include <cppgit2/string_view.hpp>
+#include <doctest.hpp>
+#include <unordered_set>
+using doctest::test_suite;
+using namespace cppgit2;
+
+TEST_CASE("Construct string_view" * test_suite("string_view")) {
+  string_view empty;
+  REQUIRE(empty.empty());
+  REQUIRE(empty.size() == 0);
+
+  std::string text = "refs/heads/main";
+  string_view from_string(text);
+  REQUIRE(from_string.data() == text.data());
+  REQUIRE(from_string.size() == text.size());
+  REQUIRE(string_view("abc").size() == 3);
+  REQUIRE(string_view("abcdef", 2).to_string() == "ab");
+}
+
+TEST_CASE("Compare string_views" * test_suite("string_view")) {
+  REQUIRE(string_view("abc") == string_view("abc"));
+  REQUIRE(string_view("abc") != string_view("abd"));
+  REQUIRE(string_view("ab") < string_view("abc"));
+  REQUIRE(string_view("abc") > string_view("ab"));
+  REQUIRE(string_view("abc") <= string_view("abc"));
+  REQUIRE(string_view("b") >= string_view("abc"));
+  REQUIRE(string_view().compare(string_view()) == 0);
+  // Bytes compare unsigned, as memcmp does
+  REQUIRE(string_view("\xff") > string_view("a"));
+}
+
+TEST_CASE("Search string_views" * test_suite("string_view")) {
+  string_view path("refs/heads/topic/one");
+  REQUIRE(path.starts_with("refs/"));
+  REQUIRE(!path.starts_with("refs/tags/"));
+  REQUIRE(path.ends_with("/one"));
+  REQUIRE(!path.ends_with("refs/heads/topic/one/"));
+  REQUIRE(path.find('/') == 4);
+  REQUIRE(path.find('/', 5) == 10);
+  REQUIRE(path.find('x') == string_view::npos);
+  REQUIRE(path.rfind('/') == 16);
+  REQUIRE(string_view("abc").rfind('/') == string_view::npos);
+}
+
+TEST_CASE("Take substrings of string_views" * test_suite("string_view")) {
+  string_view path("refs/heads/main");
+  REQUIRE(path.substr(5) == "heads/main");
+  REQUIRE(path.substr(5, 5) == "heads");
+  REQUIRE(path.substr(5, 100) == "heads/main");
+  REQUIRE(path.substr(100).empty());
+}
+
+TEST_CASE("Hash string_views" * test_suite("string_view")) {
+  std::string first = "refs/heads/main", second = "refs/heads/main";
+  REQUIRE(string_view_hash()(first) == string_view_hash()(second));
+
+  std::unordered_set<string_view, string_view_hash> names;
+  names.insert(string_view(first));
+  names.insert(string_view(second));
+  names.insert(string_view("refs/heads/topic"));
+  REQUIRE(names.size() == 2);
+  REQUIRE(names.count("refs/heads/topic") == 1);
+  REQUIRE(names.count("refs/heads/other") == 0);
+}
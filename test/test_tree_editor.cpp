@@ -0,0 +1,98 @@
+#include <cppgit2/repository.hpp>
+#include <cppgit2/tree_editor.hpp>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_repository *raw(const repository &repo) {
+  return const_cast<git_repository *>(repo.c_ptr());
+}
+
+// A baseline tree and the same files in an index, which the expected
+// results are computed with
+struct baseline {
+  git_index *index = nullptr;
+  oid root;
+
+  explicit baseline(const repository &repo) {
+    REQUIRE(git_index_new(&index) == 0);
+    for (auto path : {"a/b/c", "a/b/d", "a/e", "f", "g/h", "i/j/k", "z"})
+      upsert(repo, path, path);
+    root = write(repo);
+  }
+
+  ~baseline() { git_index_free(index); }
+
+  void upsert(const repository &repo, const std::string &path,
+              const std::string &content) {
+    git_index_entry entry = {};
+    entry.path = path.c_str();
+    entry.mode = GIT_FILEMODE_BLOB;
+    entry.id = *repo.create_blob_from_buffer(content).c_ptr();
+    REQUIRE(git_index_add(index, &entry) == 0);
+  }
+
+  oid write(const repository &repo) {
+    oid id;
+    REQUIRE(git_index_write_tree_to(id.c_ptr(), index, raw(repo)) == 0);
+    return id;
+  }
+};
+
+} // namespace
+
+TEST_CASE("Edit a tree as an index would" * test_suite("tree_editor")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  for (size_t threads : {1, 3}) {
+    CAPTURE(threads);
+    baseline expected(repo);
+    tree_editor editor(repo, threads);
+
+    // Replace, add below new and existing directories, remove a file, a
+    // directory and the only file of a directory
+    editor.upsert("a/b/c", repo.create_blob_from_buffer("old"),
+                  file_mode::blob);
+    editor.upsert("a/b/c", repo.create_blob_from_buffer("new"),
+                  file_mode::blob);
+    expected.upsert(repo, "a/b/c", "new");
+    editor.upsert("a/n/o/p", repo.create_blob_from_buffer("p"),
+                  file_mode::blob);
+    expected.upsert(repo, "a/n/o/p", "p");
+    editor.upsert("y", repo.create_blob_from_buffer("y"), file_mode::blob);
+    expected.upsert(repo, "y", "y");
+    editor.remove("f");
+    REQUIRE(git_index_remove_bypath(expected.index, "f") == 0);
+    editor.remove("i");
+    REQUIRE(git_index_remove_directory(expected.index, "i", 0) == 0);
+    tree::update update;
+    update.set_action(tree::update_type::remove);
+    update.set_path("g/h");
+    editor.add(update);
+    REQUIRE(git_index_remove_bypath(expected.index, "g/h") == 0);
+    REQUIRE(editor.size() == 7);
+
+    auto root = editor.apply(repo.lookup_tree(expected.root));
+    REQUIRE(root == expected.write(repo));
+    // The root, a, a/b, a/n and a/n/o; "e" and "z" are untouched
+    REQUIRE(editor.trees_written() == 5);
+  }
+}
+
+TEST_CASE("Build a tree from nothing" * test_suite("tree_editor")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  baseline expected(repo);
+  tree_editor editor(repo);
+  for (auto path : {"z", "i/j/k", "a/e", "a/b/d", "a/b/c", "g/h", "f"})
+    editor.upsert(path, repo.create_blob_from_buffer(path), file_mode::blob);
+  REQUIRE(editor.apply(tree()) == expected.root);
+
+  editor.clear();
+  editor.remove("a/missing");
+  REQUIRE_THROWS_AS(editor.apply(repo.lookup_tree(expected.root)),
+                    git_exception);
+}
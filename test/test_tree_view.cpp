@@ -0,0 +1,81 @@
+#include <cppgit2/repository.hpp>
+#include <cppgit2/tree_view.hpp>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_repository *raw(const repository &repo) {
+  return const_cast<git_repository *>(repo.c_ptr());
+}
+
+// A tree with every kind of entry and names that sort around "a/"
+oid make_tree(const repository &repo) {
+  git_index *index = nullptr;
+  REQUIRE(git_index_new(&index) == 0);
+  auto add = [&](const char *path, uint32_t mode) {
+    git_index_entry entry = {};
+    entry.path = path;
+    entry.mode = mode;
+    entry.id = *repo.create_blob_from_buffer(path).c_ptr();
+    REQUIRE(git_index_add(index, &entry) == 0);
+  };
+  add("a-b", GIT_FILEMODE_BLOB);
+  add("a.c", GIT_FILEMODE_BLOB_EXECUTABLE);
+  add("a/x", GIT_FILEMODE_BLOB);
+  add("a0", GIT_FILEMODE_LINK);
+  add("module", GIT_FILEMODE_COMMIT);
+  add("z", GIT_FILEMODE_BLOB);
+  oid id;
+  REQUIRE(git_index_write_tree_to(id.c_ptr(), index, raw(repo)) == 0);
+  git_index_free(index);
+  return id;
+}
+
+void require_same_entries(const tree_view &view, const tree &expected) {
+  REQUIRE(view.size() == expected.size());
+  auto c_tree = expected.c_ptr();
+  for (size_t i = 0; i < view.size(); ++i) {
+    auto e = git_tree_entry_byindex(c_tree, i);
+    CAPTURE(git_tree_entry_name(e));
+    REQUIRE(view[i].name == string_view(git_tree_entry_name(e)));
+    REQUIRE(view[i].id() == oid(git_tree_entry_id(e)));
+    REQUIRE(view[i].mode == static_cast<uint32_t>(git_tree_entry_filemode(e)));
+    REQUIRE(view.find(view[i].name) == &view[i]);
+  }
+}
+
+} // namespace
+
+TEST_CASE("View the entries of a tree" * test_suite("tree_view")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  auto id = make_tree(repo);
+  auto source = repo.lookup_tree(id);
+
+  tree_view view(source);
+  require_same_entries(view, source);
+  tree_view read(repo, id);
+  require_same_entries(read, source);
+
+  // "a" is a directory, ordered as "a/"
+  REQUIRE(view[2].name == string_view("a"));
+  REQUIRE(view[2].is_tree());
+  REQUIRE(view.find("a.c")->mode == GIT_FILEMODE_BLOB_EXECUTABLE);
+  REQUIRE(view.find("a0")->is_link());
+  REQUIRE(view.find("module")->is_submodule());
+  REQUIRE(view.find("z")->is_blob());
+  REQUIRE(view.find("a/") == nullptr);
+  REQUIRE(view.find("b") == nullptr);
+  REQUIRE(view.find("") == nullptr);
+
+  // Moving keeps the entries
+  tree_view moved(std::move(read));
+  require_same_entries(moved, source);
+
+  tree_view empty(repo, tree_builder(repo).write());
+  REQUIRE(empty.empty());
+  REQUIRE(empty.find("a") == nullptr);
+}
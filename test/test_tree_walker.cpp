@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/tree_walker.hpp>
+#include <doctest.hpp>
+#include <mutex>
+#include <set>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+git_repository *raw(const repository &repo) {
+  return const_cast<git_repository *>(repo.c_ptr());
+}
+
+// Nested trees in which "copy" and "nested/copy" hold the same subtree
+oid make_tree(const repository &repo) {
+  git_index *index = nullptr;
+  REQUIRE(git_index_new(&index) == 0);
+  std::vector<std::string> paths{"top", "skip/a", "skip/deep/b"};
+  for (auto prefix : {"copy/", "nested/copy/"})
+    for (auto file : {"1", "2", "sub/3"})
+      paths.push_back(prefix + std::string(file));
+  for (int i = 0; i < 40; ++i)
+    paths.push_back("wide/d" + std::to_string(i % 8) + "/f" +
+                    std::to_string(i));
+  for (auto &path : paths) {
+    git_index_entry entry = {};
+    entry.path = path.c_str();
+    entry.mode = GIT_FILEMODE_BLOB;
+    // Same content at the same place below "copy"
+    auto slash = path.find("copy/");
+    entry.id = *repo.create_blob_from_buffer(
+                        slash == std::string::npos ? path
+                                                   : path.substr(slash))
+                    .c_ptr();
+    REQUIRE(git_index_add(index, &entry) == 0);
+  }
+  oid id;
+  REQUIRE(git_index_write_tree_to(id.c_ptr(), index, raw(repo)) == 0);
+  git_index_free(index);
+  return id;
+}
+
+// Every path below `root` (directories too), as git_tree_walk sees them
+std::multiset<std::string> libgit2_paths(const repository &repo,
+                                         const oid &root) {
+  std::multiset<std::string> paths;
+  git_tree *tree = nullptr;
+  REQUIRE(git_tree_lookup(&tree, raw(repo), root.c_ptr()) == 0);
+  REQUIRE(git_tree_walk(tree, GIT_TREEWALK_PRE,
+                        [](const char *prefix, const git_tree_entry *entry,
+                           void *payload) {
+                          static_cast<std::multiset<std::string> *>(payload)
+                              ->insert(std::string(prefix) +
+                                       git_tree_entry_name(entry));
+                          return 0;
+                        },
+                        &paths) == 0);
+  git_tree_free(tree);
+  return paths;
+}
+
+} // namespace
+
+TEST_CASE("Visit what git_tree_walk visits" * test_suite("tree_walker")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  auto root = make_tree(repo);
+  auto expected = libgit2_paths(repo, root);
+
+  for (size_t threads : {1, 4}) {
+    CAPTURE(threads);
+    tree_walker walker(repo, threads);
+    std::mutex mutex;
+    std::multiset<std::string> paths;
+    size_t workers = 0;
+    walker.walk(root, [&](const string_view &prefix,
+                          const tree_view::entry &entry, size_t worker) {
+      std::lock_guard<std::mutex> lock(mutex);
+      paths.insert(prefix.to_string() + entry.name.to_string());
+      workers = std::max(workers, worker + 1);
+      return 0;
+    });
+    REQUIRE(paths == expected);
+    REQUIRE(workers <= threads);
+
+    // Skipped subtrees are not entered
+    paths.clear();
+    walker.walk(root, [&](const string_view &prefix,
+                          const tree_view::entry &entry, size_t) {
+      std::lock_guard<std::mutex> lock(mutex);
+      paths.insert(prefix.to_string() + entry.name.to_string());
+      return entry.name == string_view("skip") ? 1 : 0;
+    });
+    REQUIRE(paths.count("skip") == 1);
+    REQUIRE(paths.count("skip/a") == 0);
+    REQUIRE(paths.size() == expected.size() - 3);
+
+    // The repeated subtree is entered once
+    paths.clear();
+    walker.walk(root,
+                [&](const string_view &prefix, const tree_view::entry &entry,
+                    size_t) {
+                  std::lock_guard<std::mutex> lock(mutex);
+                  paths.insert(prefix.to_string() + entry.name.to_string());
+                  return 0;
+                },
+                true);
+    REQUIRE(paths.count("copy") == 1);
+    REQUIRE(paths.count("nested/copy") == 1);
+    REQUIRE(paths.size() == expected.size() - 4);
+
+    // Stopping ends the walk early
+    size_t visited = 0;
+    walker.walk(root, [&](const string_view &, const tree_view::entry &,
+                          size_t) {
+      std::lock_guard<std::mutex> lock(mutex);
+      return ++visited == 3 ? -1 : 0;
+    });
+    REQUIRE(visited < expected.size());
+  }
+}
+
+TEST_CASE("Visit and aggregate distinct trees" * test_suite("tree_walker")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  auto root = make_tree(repo);
+  tree_walker walker(repo, 3);
+
+  // root, skip, skip/deep, copy and copy/sub (each at two paths), nested,
+  // wide and its 8 directories
+  std::mutex mutex;
+  std::set<std::string> trees;
+  size_t visits = 0, empty = 0;
+  walker.for_each_tree(root, [&](const git_oid &id, const tree_view &entries,
+                                 size_t) {
+    std::lock_guard<std::mutex> lock(mutex);
+    empty += entries.empty();
+    trees.insert(oid(&id).to_hex_string());
+    ++visits;
+  });
+  REQUIRE(visits == 15);
+  REQUIRE(empty == 0);
+  REQUIRE(trees.size() == 15);
+  REQUIRE(walker.trees_read() == 15);
+
+  // Files below each tree, counting each occurrence of a repeated one
+  auto files = walker.aggregate<size_t>(
+      root, [](const tree_view::entry &) { return size_t(1); },
+      [](size_t &total, const size_t &value) { total += value; });
+  REQUIRE(files.size() == 15);
+  tree_view top(repo, root);
+  // top, skip/a, skip/deep/b, 3 in each copy and 40 in wide
+  REQUIRE(files.at(*root.c_ptr()) == 49);
+  REQUIRE(files.at(*top.find("copy")->raw_id) == 3);
+  REQUIRE(files.at(*top.find("wide")->raw_id) == 40);
+}
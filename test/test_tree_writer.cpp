@@ -0,0 +1,87 @@
+#include <cppgit2/repository.hpp>
+#include <cppgit2/tree_writer.hpp>
+#include <doctest.hpp>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+typedef std::vector<std::pair<std::string, file_mode>> listing;
+
+// The root tree libgit2 writes for an index holding `files`, each with the
+// blob of its own path
+oid index_tree(const repository &repo, const listing &files) {
+  git_index *index = nullptr;
+  REQUIRE(git_index_new(&index) == 0);
+  for (auto &file : files) {
+    git_index_entry entry = {};
+    entry.path = file.first.c_str();
+    entry.mode = static_cast<uint32_t>(file.second);
+    entry.id = *repo.create_blob_from_buffer(file.first).c_ptr();
+    REQUIRE(git_index_add(index, &entry) == 0);
+  }
+  oid id;
+  REQUIRE(git_index_write_tree_to(
+              id.c_ptr(), index, const_cast<git_repository *>(repo.c_ptr())) ==
+          0);
+  git_index_free(index);
+  return id;
+}
+
+} // namespace
+
+TEST_CASE("Write the trees libgit2 writes" * test_suite("tree_writer")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  // Byte order; "a/" sorts after "a.c" and before "ab" in tree order too
+  listing files{{"a-b", file_mode::blob},
+                {"a.c", file_mode::blob_executable},
+                {"a/x", file_mode::blob},
+                {"a/y/deep/z", file_mode::link},
+                {"a/y/w", file_mode::blob},
+                {"ab", file_mode::blob},
+                {"b/c/d", file_mode::blob},
+                {"top", file_mode::blob}};
+
+  tree_writer writer(repo);
+  for (auto &file : files)
+    writer.append(file.first, repo.create_blob_from_buffer(file.first),
+                  file.second);
+  auto root = writer.finish();
+  REQUIRE(root == index_tree(repo, files));
+  // The root, a, a/y, a/y/deep, b and b/c
+  REQUIRE(writer.trees_written() == 6);
+
+  // The writer starts over after finish()
+  writer.append("only", repo.create_blob_from_buffer("only"), file_mode::blob);
+  REQUIRE(writer.finish() == index_tree(repo, {{"only", file_mode::blob}}));
+  oid empty;
+  REQUIRE(git_oid_fromstr(empty.c_ptr(),
+                          "4b825dc642cb6eb9a060e54bf8d69288fbee4904") == 0);
+  REQUIRE(writer.finish() == empty);
+}
+
+TEST_CASE("Refuse paths out of order" * test_suite("tree_writer")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), true);
+  auto blob = repo.create_blob_from_buffer("x");
+
+  tree_writer unsorted(repo);
+  unsorted.append("b", blob, file_mode::blob);
+  REQUIRE_THROWS_AS(unsorted.append("a", blob, file_mode::blob),
+                    git_exception);
+
+  tree_writer duplicate(repo);
+  duplicate.append("a/b", blob, file_mode::blob);
+  REQUIRE_THROWS_AS(duplicate.append("a/b", blob, file_mode::blob),
+                    git_exception);
+
+  // "a" is a file, and "a/c" would make it a directory, though "a-b" came
+  // in between
+  tree_writer collision(repo);
+  collision.append("a", blob, file_mode::blob);
+  collision.append("a-b", blob, file_mode::blob);
+  REQUIRE_THROWS_AS(collision.append("a/c", blob, file_mode::blob),
+                    git_exception);
+}
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cppgit2/repository.hpp>
+#include <cppgit2/workdir_watcher.hpp>
+#include <doctest.hpp>
+#include <sys/stat.h>
+#include <test_repository.hpp>
+using doctest::test_suite;
+using namespace cppgit2;
+
+namespace {
+
+typedef std::vector<std::pair<std::string, status::status_type>> statuses;
+
+void stage(repository &repo, const std::vector<std::string> &paths) {
+  git_index *index = nullptr;
+  REQUIRE(git_repository_index(&index, const_cast<git_repository *>(
+                                           repo.c_ptr())) == 0);
+  for (auto &path : paths)
+    REQUIRE(git_index_add_bypath(index, path.c_str()) == 0);
+  REQUIRE(git_index_write(index) == 0);
+  git_index_free(index);
+}
+
+bool contains(const std::vector<std::string> &paths, const std::string &path) {
+  return std::find(paths.begin(), paths.end(), path) != paths.end();
+}
+
+// Poll until no more events arrive
+void drain(workdir_watcher &watcher) {
+  while (watcher.poll(200))
+    ;
+}
+
+// A clean work tree with a.txt, dir/b.txt and an ignored build directory
+void make_work_tree(repository &repo, const std::string &workdir) {
+  mkdir((workdir + "dir").c_str(), 0777);
+  mkdir((workdir + "build").c_str(), 0777);
+  write_file(workdir + "a.txt", "a\n");
+  write_file(workdir + "dir/b.txt", "b\n");
+  write_file(workdir + ".gitignore", "build/\n");
+  write_file(workdir + "build/out", "");
+  stage(repo, {"a.txt", "dir/b.txt", ".gitignore"});
+  commit_files(repo, {{"a.txt", "a\n"}, {".gitignore", "build/\n"}});
+}
+
+} // namespace
+
+TEST_CASE("Collect changed paths" * test_suite("workdir_watcher")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto workdir = dir.path();
+  make_work_tree(repo, workdir);
+
+  workdir_watcher watcher(repo);
+  // The root and dir; .git and the ignored build directory are not watched
+  REQUIRE(watcher.watch_count() == 2);
+  REQUIRE(watcher.needs_full_scan());
+  REQUIRE(watcher.take_dirty_paths().empty());
+  REQUIRE(!watcher.needs_full_scan());
+
+  write_file(workdir + "dir/b.txt", "changed\n");
+  write_file(workdir + "build/out", "changed\n");
+  mkdir((workdir + "new").c_str(), 0777);
+  drain(watcher);
+  write_file(workdir + "new/c.txt", "c\n");
+  drain(watcher);
+  auto dirty = watcher.take_dirty_paths();
+  REQUIRE(contains(dirty, "dir/b.txt"));
+  REQUIRE(contains(dirty, "new"));
+  REQUIRE(contains(dirty, "new/c.txt"));
+  REQUIRE(!contains(dirty, "build/out"));
+  REQUIRE(watcher.watch_count() == 3);
+  REQUIRE(!watcher.needs_full_scan());
+
+  // A new index invalidates what is known
+  stage(repo, {"dir/b.txt"});
+  drain(watcher);
+  REQUIRE(watcher.needs_full_scan());
+  REQUIRE(watcher.dirty_paths().empty());
+}
+
+TEST_CASE("Report the status of changed paths" *
+          test_suite("workdir_watcher")) {
+  temporary_directory dir;
+  auto repo = repository::init(dir.path(), false);
+  auto workdir = dir.path();
+  make_work_tree(repo, workdir);
+  status::options options;
+  options.set_flags(status::options::flag::include_untracked |
+                    status::options::flag::recurse_untracked_dirs);
+  status_engine engine(repo, options, 2);
+  workdir_watcher watcher(repo);
+
+  // The first run is a full scan: dir/b.txt is staged but not committed
+  statuses seen;
+  auto collect = [&](const std::string &path, status::status_type type) {
+    seen.emplace_back(path, type);
+  };
+  watcher.for_each_status(engine, collect);
+  REQUIRE(seen == statuses{{"dir/b.txt", status::status_type::index_new}});
+  REQUIRE(watcher.dirty_paths() == std::vector<std::string>{"dir/b.txt"});
+
+  // Later runs look at what changed, plus what was not current
+  write_file(workdir + "a.txt", "changed\n");
+  write_file(workdir + "untracked", "");
+  drain(watcher);
+  seen.clear();
+  watcher.for_each_status(engine, collect);
+  std::sort(seen.begin(), seen.end());
+  REQUIRE(seen == statuses{{"a.txt", status::status_type::wt_modified},
+                           {"dir/b.txt", status::status_type::index_new},
+                           {"untracked", status::status_type::wt_new}});
+
+  // Putting a file back makes it current again
+  write_file(workdir + "a.txt", "a\n");
+  remove((workdir + "untracked").c_str());
+  drain(watcher);
+  seen.clear();
+  watcher.for_each_status(engine, collect);
+  REQUIRE(seen == statuses{{"dir/b.txt", status::status_type::index_new}});
+  REQUIRE(watcher.dirty_paths() == std::vector<std::string>{"dir/b.txt"});
+}